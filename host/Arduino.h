@@ -0,0 +1,345 @@
+#ifndef ARDUINO_H
+#define ARDUINO_H
+
+/**
+ * Host (Linux) stand-in for the Arduino core.
+ *
+ * Only the subset of the core used by the firmware modules is provided. Every
+ * call is routed through the host HAL (hal_host.cpp), which keeps pin levels,
+ * a virtual clock and a per-call cost model so that timing measured on the
+ * host tracks what the ATmega328 would spend on the same call.
+ *
+ * This header is only on the include path of the `native` environment; AVR
+ * builds keep using the real core.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <type_traits>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 0x1
+#define LOW  0x0
+
+#define INPUT        0x0
+#define OUTPUT       0x1
+#define INPUT_PULLUP 0x2
+
+#define LSBFIRST 0
+#define MSBFIRST 1
+
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+
+// Uno/Nano analog pins used as digital I/O
+const uint8_t A0 = 14;
+const uint8_t A1 = 15;
+const uint8_t A2 = 16;
+const uint8_t A3 = 17;
+const uint8_t A4 = 18;
+const uint8_t A5 = 19;
+
+// Arduino's min/max are macros taking mixed types; templates keep that
+// without clashing with <algorithm> on the host
+template <typename T, typename U>
+inline typename std::common_type<T, U>::type max(T a, U b) { return (a > b) ? a : b; }
+template <typename T, typename U>
+inline typename std::common_type<T, U>::type min(T a, U b) { return (a < b) ? a : b; }
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+void shiftOut(uint8_t dataPin, uint8_t clockPin, uint8_t bitOrder, uint8_t val);
+
+#define _BV(bit) (1 << (bit))
+
+// ===== Program memory =====
+// avr/pgmspace.h (pulled in by the real Arduino.h). Flash and RAM share one
+// address space on the host, so PROGMEM data is read directly, charged the
+// lpm loads of the real thing.
+#define PROGMEM
+uint8_t pgm_read_byte(const void* address);
+void* memcpy_P(void* dest, const void* src, size_t n);
+
+// ===== Interrupts =====
+// Pin-change interrupt vectors. The host HAL calls PCINTn_vect when a pin
+// enabled in PCICR/PCMSKn changes level, preempting whatever is running.
+#define ISR(vector) extern "C" void vector()
+extern "C" void PCINT0_vect();
+extern "C" void PCINT1_vect();
+extern "C" void PCINT2_vect();
+
+void noInterrupts();
+void interrupts();
+
+// ATmega328 registers emulated by the HAL
+extern volatile uint8_t PCICR;
+extern volatile uint8_t PCMSK0;
+extern volatile uint8_t PCMSK1;
+extern volatile uint8_t PCMSK2;
+extern volatile uint8_t PINB;
+extern volatile uint8_t PINC;
+extern volatile uint8_t PIND;
+
+// Uno/Nano pin mapping, as in the core's pins_arduino.h
+#define NOT_A_PORT 0
+#define PB 2
+#define PC 3
+#define PD 4
+
+#define digitalPinToPort(p) (((p) <= 7) ? PD : (((p) <= 13) ? PB : PC))
+#define digitalPinToBitMask(p) _BV(((p) <= 7) ? (p) : (((p) <= 13) ? ((p) - 8) : ((p) - 14)))
+#define portInputRegister(port) (((port) == PB) ? &PINB : (((port) == PC) ? &PINC : &PIND))
+
+/**
+ * Output port register (PORTB/PORTC/PORTD). Reads return the port's output
+ * latch; a write drives all of the port's output pins in the same instant,
+ * as a single `out` instruction does.
+ */
+class HostPortRegister {
+public:
+  explicit HostPortRegister(uint8_t port) : port(port) {}
+  operator uint8_t() const;
+  HostPortRegister& operator=(uint8_t value);
+  HostPortRegister& operator|=(uint8_t value) { return *this = (uint8_t)(*this | value); }
+  HostPortRegister& operator&=(uint8_t value) { return *this = (uint8_t)(*this & value); }
+
+private:
+  uint8_t port;
+};
+
+extern HostPortRegister PORTB;
+extern HostPortRegister PORTC;
+extern HostPortRegister PORTD;
+
+// ===== SPI =====
+// Hardware SPI pins and registers. A write to SPDR in master mode clocks the
+// byte out on MOSI/SCK and sets SPIF when done; the HAL models the transfer
+// as blocking, since the firmware polls SPIF straight after.
+const uint8_t SS = 10;
+const uint8_t MOSI = 11;
+const uint8_t MISO = 12;
+const uint8_t SCK = 13;
+
+#define SPR0 0
+#define SPR1 1
+#define CPHA 2
+#define CPOL 3
+#define MSTR 4
+#define DORD 5
+#define SPE 6
+#define SPIE 7
+#define SPI2X 0
+#define WCOL 6
+#define SPIF 7
+
+class HostSpiDataRegister {
+public:
+  operator uint8_t() const { return received; }
+  HostSpiDataRegister& operator=(uint8_t value);
+
+private:
+  uint8_t received;
+};
+
+extern volatile uint8_t SPCR;
+extern volatile uint8_t SPSR;
+extern HostSpiDataRegister SPDR;
+
+// ===== USART0 =====
+// MIDI UART registers. The HAL keeps UCSR0A's flags up to date: a byte
+// written to UDR0 goes straight to the shift register when the transmitter
+// is idle, otherwise it waits in the one-byte buffer (UDRE0 clear) until the
+// shift register frees up. USART_UDRE_vect runs for as long as UDRE0 and
+// UDRIE0 are both set, as on the MCU. Received bytes set RXC0 and run
+// USART_RX_vect until UDR0 is read.
+#define F_CPU 16000000UL
+
+// UCSR0A
+#define MPCM0 0
+#define U2X0 1
+#define UPE0 2
+#define DOR0 3
+#define FE0 4
+#define UDRE0 5
+#define TXC0 6
+#define RXC0 7
+// UCSR0B
+#define TXB80 0
+#define RXB80 1
+#define UCSZ02 2
+#define TXEN0 3
+#define RXEN0 4
+#define UDRIE0 5
+#define TXCIE0 6
+#define RXCIE0 7
+// UCSR0C
+#define UCPOL0 0
+#define UCSZ00 1
+#define UCSZ01 2
+
+extern "C" void USART_RX_vect();
+extern "C" void USART_UDRE_vect();
+
+// UCSR0B: enabling UDRIE0 with the buffer empty runs the vector at once
+class HostUartControlRegister {
+public:
+  operator uint8_t() const { return value; }
+  HostUartControlRegister& operator=(uint8_t newValue);
+  HostUartControlRegister& operator|=(uint8_t bits) { return *this = (uint8_t)(value | bits); }
+  HostUartControlRegister& operator&=(uint8_t bits) { return *this = (uint8_t)(value & bits); }
+
+private:
+  uint8_t value;
+};
+
+class HostUartDataRegister {
+public:
+  operator uint8_t() const;
+  HostUartDataRegister& operator=(uint8_t value);
+};
+
+extern volatile uint8_t UCSR0A;
+extern HostUartControlRegister UCSR0B;
+extern volatile uint8_t UCSR0C;
+extern volatile uint16_t UBRR0;
+extern HostUartDataRegister UDR0;
+
+// ===== Timer2 =====
+// Timer2 in CTC mode (WGM21): TCNT2 counts F_CPU / prescaler from 0 to
+// OCR2A, then starts over and sets OCF2A. TIMER2_COMPA_vect runs while
+// OCF2A and OCIE2A are both set; entering it clears OCF2A, as does writing
+// a 1 to it in TIFR2. Writing TCCR2B starts or stops the count, so set
+// TCCR2A and OCR2A first; other waveform modes leave the timer stopped.
+// TCCR2A
+#define WGM20 0
+#define WGM21 1
+// TCCR2B
+#define CS20 0
+#define CS21 1
+#define CS22 2
+// TIMSK2 / TIFR2
+#define OCIE2A 1
+#define OCF2A 1
+
+extern "C" void TIMER2_COMPA_vect();
+
+class HostTimer2ControlRegister {
+public:
+  operator uint8_t() const { return value; }
+  HostTimer2ControlRegister& operator=(uint8_t newValue);
+
+private:
+  uint8_t value;
+};
+
+// TCNT2: reads the running count; a write restarts the count from 0
+class HostTimer2CounterRegister {
+public:
+  operator uint8_t() const;
+  HostTimer2CounterRegister& operator=(uint8_t value);
+};
+
+// TIFRn: flags are cleared by writing a 1 to them
+class HostTimerFlagRegister {
+public:
+  operator uint8_t() const { return value; }
+  HostTimerFlagRegister& operator=(uint8_t clear) {
+    value &= (uint8_t)~clear;
+    return *this;
+  }
+  void set(uint8_t flags) { value |= flags; }
+
+private:
+  uint8_t value;
+};
+
+extern volatile uint8_t TCCR2A;
+extern HostTimer2ControlRegister TCCR2B;
+extern volatile uint8_t OCR2A;
+extern volatile uint8_t TIMSK2;
+extern HostTimerFlagRegister TIFR2;
+extern HostTimer2CounterRegister TCNT2;
+
+// ===== Timer1 =====
+// 16-bit Timer1 in normal mode: TCNT1 counts F_CPU / prescaler and wraps
+// from 0xFFFF to 0, setting TOV1. TIMER1_OVF_vect runs while TOV1 and
+// TOIE1 are both set; entering it clears TOV1, as does writing a 1 to it
+// in TIFR1. Writing TCCR1B starts or stops the count, so set TCCR1A first;
+// other waveform modes leave the timer stopped.
+// TCCR1B
+#define CS10 0
+#define CS11 1
+#define CS12 2
+// TIMSK1 / TIFR1
+#define TOIE1 0
+#define TOV1 0
+
+extern "C" void TIMER1_OVF_vect();
+
+class HostTimer1ControlRegister {
+public:
+  operator uint8_t() const { return value; }
+  HostTimer1ControlRegister& operator=(uint8_t newValue);
+
+private:
+  uint8_t value;
+};
+
+// TCNT1: reads the running count; a write sets it
+class HostTimer1CounterRegister {
+public:
+  operator uint16_t() const;
+  HostTimer1CounterRegister& operator=(uint16_t value);
+};
+
+extern volatile uint8_t TCCR1A;
+extern HostTimer1ControlRegister TCCR1B;
+extern volatile uint8_t TIMSK1;
+extern HostTimerFlagRegister TIFR1;
+extern HostTimer1CounterRegister TCNT1;
+
+#define digitalPinToPCICR(p) (((p) <= 21) ? (&PCICR) : ((volatile uint8_t*)0))
+#define digitalPinToPCICRbit(p) (((p) <= 7) ? 2 : (((p) <= 13) ? 0 : 1))
+#define digitalPinToPCMSK(p) (((p) <= 7) ? (&PCMSK2) : (((p) <= 13) ? (&PCMSK0) : (((p) <= 21) ? (&PCMSK1) : ((volatile uint8_t*)0))))
+#define digitalPinToPCMSKbit(p) (((p) <= 7) ? (p) : (((p) <= 13) ? ((p) - 8) : ((p) - 14)))
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+class HardwareSerial {
+public:
+  void begin(unsigned long baud);
+  void end();
+  size_t write(uint8_t b);
+  size_t write(const uint8_t* buffer, size_t size);
+  int availableForWrite();
+  void flush();
+
+  size_t print(const char* s);
+  size_t print(char c);
+  size_t print(unsigned char n, int base = DEC);
+  size_t print(int n, int base = DEC);
+  size_t print(unsigned int n, int base = DEC);
+  size_t print(long n, int base = DEC);
+  size_t print(unsigned long n, int base = DEC);
+  size_t println();
+  template <typename T>
+  size_t println(T value) { return print(value) + println(); }
+  template <typename T>
+  size_t println(T value, int base) { return print(value, base) + println(); }
+
+private:
+  size_t printNumber(unsigned long n, int base);
+};
+
+extern HardwareSerial Serial;
+
+#endif
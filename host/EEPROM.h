@@ -0,0 +1,28 @@
+#ifndef EEPROM_H
+#define EEPROM_H
+
+#include <Arduino.h>
+
+// ATmega328 EEPROM size
+#define HOST_EEPROM_SIZE 1024
+
+/**
+ * Host stand-in for the AVR EEPROM library, backed by a RAM array.
+ * Cells start erased (0xFF) like a fresh chip. As with avr-libc, a write
+ * starts programming and returns; the next read or write waits (on EEPE)
+ * until the datasheet programming time has passed on the virtual clock.
+ */
+class EEPROMClass {
+public:
+  uint8_t read(int idx);
+  void write(int idx, uint8_t val);
+  void update(int idx, uint8_t val);
+  uint16_t length() { return HOST_EEPROM_SIZE; }
+};
+
+extern EEPROMClass EEPROM;
+
+// avr/eeprom.h: no write in progress, so the next access will not wait
+bool eeprom_is_ready();
+
+#endif
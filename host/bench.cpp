@@ -0,0 +1,587 @@
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <vector>
+
+#include "hal_host.h"
+#include "simulator.h"
+
+/*
+ * Each trial powers up a fresh firmware, puts it in the gesture's starting
+ * state, plays the gesture with random contact bounce at a random phase
+ * against the 10 ms main-loop tick, and reads the latencies off the timeline.
+ *
+ * Latency is measured from the first switch's stable edge (its last bounce)
+ * to the first matching output:
+ *   relay    first relay pin edge
+ *   midi     Program Change data byte starting on the wire
+ *   display  first 7-segment frame that shows the gesture's result
+ *
+ * When one update moves several relays, skew is the time from the first to
+ * the last relay edge of that update, in nanoseconds.
+ *
+ * Trials where the firmware did not perform the gesture (e.g. a combo read
+ * as a single press) are counted as misfires and excluded from latencies.
+ */
+
+enum Gesture {
+  GESTURE_MANUAL_TOGGLE,
+  GESTURE_PRESET_RECALL,
+  GESTURE_BANK_UP,
+  GESTURE_BANK_DOWN,
+  GESTURE_EDIT_ENTER,
+  GESTURE_EDIT_EXIT,
+  GESTURE_LEAVE_BANK,
+  NUM_GESTURES
+};
+
+enum Metric {
+  METRIC_RELAY,
+  METRIC_MIDI,
+  METRIC_DISPLAY,
+  METRIC_RELAY_SKEW,
+  NUM_METRICS
+};
+
+static const char* const GESTURE_NAMES[NUM_GESTURES] = {
+  "manual toggle", "preset recall", "bank up", "bank down", "edit enter", "edit exit", "bank->manual"
+};
+
+static const char* const METRIC_NAMES[NUM_METRICS] = {"relay", "midi", "display", "skew ns"};
+
+/**
+ * Regression thresholds. Budgets apply to the p99 (latency in microseconds,
+ * relay skew in nanoseconds), 0 = output not produced by the gesture.
+ *
+ * Single gestures are dominated by debounce (> 30 ms stable, timed from the
+ * captured edge) plus up to one 10 ms tick. Combos are timed from the first finger, so they also carry the
+ * 0-20 ms spread before the partner is debounced. Edit enter/exit wait for
+ * the 2 s hold; edit exit leaves the relays where edit mode had them.
+ *
+ * Relays are written with one masked port write per port; loops on PORTD
+ * and PORTB land one port write (~250 ns) apart.
+ *
+ * A single press that could start a combo is applied at once and rolled back
+ * if the partner arrives, so no combo may be read as a single press.
+ * Bank->manual is SW2+SW3 from bank mode with SW3 landing 60-150 ms late:
+ * SW2 has selected a preset by then, and the pair must still leave bank
+ * mode rather than start the edit hold. Its display carries that spread.
+ */
+struct Budget {
+  uint32_t limit[NUM_METRICS];   // relay, midi, display (us), relay skew (ns)
+  uint8_t misfirePercent;
+};
+
+static const Budget BUDGETS[NUM_GESTURES] = {
+  {{  42000,      0,   42000,    0},   0},   // manual toggle
+  {{  42000,  42000,   42000, 1000},   0},   // preset recall
+  {{      0,      0,   64000,    0},   0},   // bank up
+  {{      0,      0,   64000,    0},   0},   // bank down
+  {{      0,      0, 2034000,    0},   0},   // edit enter
+  {{      0,      0, 2038000,    0},   0},   // edit exit
+  {{      0,      0,  200000,    0},   0},   // bank->manual
+};
+
+// Switch pairs for combos, 0xFF = single switch gesture
+static const uint8_t NO_SWITCH = 0xFF;
+static const uint32_t HOLD_MS = 150;
+static const uint32_t LONG_HOLD_MS = EDIT_MODE_LONG_PRESS_MS + 500;
+// A second finger lands this long after the first at most
+static const uint32_t MAX_COMBO_SPREAD_US = 20000;
+// A late second finger, after the first has been debounced and applied
+static const uint32_t MIN_STAGGER_US = 60000;
+static const uint32_t MAX_STAGGER_US = 150000;
+// Relay edges this close to the first one belong to the same update
+static const uint64_t RELAY_UPDATE_SPAN_NS = 1000000ULL;
+// Time allowed after release for trailing outputs
+static const uint64_t SETTLE_NS = 1500ULL * 1000000ULL;
+
+struct Trial {
+  uint8_t switchA;
+  uint8_t switchB;
+  uint32_t holdMs;
+  uint32_t minSpreadUs;
+  uint32_t maxSpreadUs;
+  StateManager before;
+};
+
+/**
+ * Put a freshly booted firmware into the gesture's starting state.
+ */
+static Trial prepareTrial(Gesture gesture, Simulator& sim, Rng& rng) {
+  StateManager& state = sim.firmware().state;
+  Trial trial;
+  trial.switchA = rng.between(0, NUM_SWITCHES - 1);
+  trial.switchB = NO_SWITCH;
+  trial.holdMs = HOLD_MS;
+  trial.minSpreadUs = 0;
+  trial.maxSpreadUs = MAX_COMBO_SPREAD_US;
+
+  // Stored presets light loops 1 and 3 so recalls and saves move relays
+  uint8_t* eeprom = hostEepromData();
+  for (uint8_t i = 0; i < TOTAL_PRESETS; i++) eeprom[EEPROM_PRESETS_START_ADDR + i] = 0x05;
+  eeprom[EEPROM_INIT_FLAG_ADDR] = EEPROM_INIT_MAGIC;   // Base table only: loading adds the rest
+  state.loadPresets();
+
+  switch (gesture) {
+    case GESTURE_MANUAL_TOGGLE:
+      break;
+
+    case GESTURE_PRESET_RECALL:
+      state.currentMode = BANK_MODE;
+      state.displayState = SHOWING_BANK;
+      state.currentBank = rng.between(1, NUM_BANKS);
+      break;
+
+    case GESTURE_BANK_UP:
+    case GESTURE_BANK_DOWN:
+      state.currentMode = BANK_MODE;
+      state.displayState = SHOWING_BANK;
+      state.currentBank = rng.between(1, NUM_BANKS);
+      trial.switchA = (gesture == GESTURE_BANK_UP) ? 2 : 0;
+      trial.switchB = trial.switchA + 1;
+      break;
+
+    case GESTURE_EDIT_ENTER:
+      state.currentMode = BANK_MODE;
+      state.displayState = SHOWING_BANK;
+      state.activePreset = rng.between(0, PRESETS_PER_BANK - 1);
+      trial.switchA = 1;
+      trial.switchB = 2;
+      trial.holdMs = LONG_HOLD_MS;
+      break;
+
+    case GESTURE_EDIT_EXIT:
+      state.currentMode = EDIT_MODE;
+      state.displayState = EDIT_MODE_ANIMATED;
+      state.activePreset = rng.between(0, PRESETS_PER_BANK - 1);
+      state.editModeLoops |= loopBit(1);
+      trial.switchA = 1;
+      trial.switchB = 2;
+      trial.holdMs = LONG_HOLD_MS;
+      break;
+
+    case GESTURE_LEAVE_BANK:
+      state.currentMode = BANK_MODE;
+      state.displayState = SHOWING_BANK;
+      state.currentBank = rng.between(1, NUM_BANKS);
+      trial.switchA = 1;
+      trial.switchB = 2;
+      trial.minSpreadUs = MIN_STAGGER_US;
+      trial.maxSpreadUs = MAX_STAGGER_US;
+      break;
+
+    default:
+      break;
+  }
+
+  // Settle the prepared state for one pass so the baseline frame is on screen
+  sim.runUntilNs(hostNowNs() + 20ULL * 1000000ULL);
+  trial.before = state;
+  return trial;
+}
+
+/**
+ * @return true if the firmware ended up where the gesture should have taken it
+ */
+static bool gestureSucceeded(Gesture gesture, const Trial& trial, const StateManager& after) {
+  const StateManager& before = trial.before;
+  switch (gesture) {
+    case GESTURE_MANUAL_TOGGLE:
+      return after.currentMode == MANUAL_MODE &&
+             (after.loops ^ before.loops) == loopBit(trial.switchA);
+
+    case GESTURE_PRESET_RECALL:
+      return after.currentMode == BANK_MODE && after.activePreset == trial.switchA &&
+             !after.globalPresetActive;
+
+    case GESTURE_BANK_UP:
+      return after.currentMode == BANK_MODE &&
+             after.currentBank == ((before.currentBank == NUM_BANKS) ? 1 : before.currentBank + 1);
+
+    case GESTURE_BANK_DOWN:
+      return after.currentMode == BANK_MODE &&
+             after.currentBank == ((before.currentBank == 1) ? NUM_BANKS : before.currentBank - 1);
+
+    case GESTURE_EDIT_ENTER:
+      return after.currentMode == EDIT_MODE && after.activePreset == before.activePreset;
+
+    case GESTURE_EDIT_EXIT:
+      return after.currentMode == BANK_MODE && after.loops == before.editModeLoops;
+
+    case GESTURE_LEAVE_BANK:
+      // SW2's preset rolled back: no preset, the loops as they were
+      return after.currentMode == MANUAL_MODE && after.activePreset == -1 && after.loops == before.loops;
+
+    default:
+      return false;
+  }
+}
+
+/**
+ * @return true if a display frame shows the result of the gesture
+ */
+static bool frameShowsResult(Gesture gesture, const uint8_t* frame) {
+  switch (gesture) {
+    case GESTURE_MANUAL_TOGGLE:
+      return true;  // Any redraw after the press is the new loop status
+    case GESTURE_PRESET_RECALL:
+      return frame[7] != 0x1F;  // PC flash replaces "bAn"
+    case GESTURE_BANK_UP:
+    case GESTURE_BANK_DOWN:
+      return frame[7] == 0x1F;  // "bAn" with the new number
+    case GESTURE_EDIT_ENTER:
+      return (frame[5] & 0x7F) == 0b01001111;  // 'E' of "Ed1t"
+    case GESTURE_EDIT_EXIT:
+      return frame[0] == 0x80 && frame[7] == 0x80;  // Saved: all decimal points
+    case GESTURE_LEAVE_BANK:
+      return frame[7] != 0x1F && frame[6] != 0x00;  // Loop status, not "bAn" or the PC flash
+    default:
+      return false;
+  }
+}
+
+/**
+ * Run one trial.
+ * @param latencyUs Filled per metric (skew in ns), UINT32_MAX if the output never appeared
+ * @return false on misfire
+ */
+static bool runTrial(Gesture gesture, Rng& rng, uint32_t latencyUs[NUM_METRICS]) {
+  Simulator sim;
+  sim.begin(true);
+  const Trial trial = prepareTrial(gesture, sim, rng);
+
+  // Random phase against the 100 Hz loop, in microseconds
+  const uint64_t startUs = hostNowNs() / 1000 + rng.between(0, MAIN_LOOP_INTERVAL_MS * 1000);
+  std::vector<TraceEvent> trace;
+  const uint64_t stableUs = appendBouncedEdge(trace, rng, startUs, trial.switchA, LOW);
+  uint64_t releaseUs = stableUs + trial.holdMs * 1000ULL;
+
+  if (trial.switchB != NO_SWITCH) {
+    const uint64_t secondUs = appendBouncedEdge(trace, rng, startUs + rng.between(trial.minSpreadUs, trial.maxSpreadUs),
+                                                trial.switchB, LOW);
+    releaseUs = std::max<uint64_t>(releaseUs, secondUs + trial.holdMs * 1000ULL);
+    std::stable_sort(trace.begin(), trace.end(),
+                     [](const TraceEvent& a, const TraceEvent& b) { return a.timeUs < b.timeUs; });
+  }
+
+  appendBouncedEdge(trace, rng, releaseUs, trial.switchA, HIGH);
+  if (trial.switchB != NO_SWITCH) appendBouncedEdge(trace, rng, releaseUs + 5000, trial.switchB, HIGH);
+
+  sim.play(trace.data(), trace.size());
+  sim.runUntilNs(hostNowNs() + SETTLE_NS);
+
+  if (!gestureSucceeded(gesture, trial, sim.firmware().state)) return false;
+
+  const uint64_t stableNs = stableUs * 1000ULL;
+  uint64_t firstNs[NUM_METRICS] = {UINT64_MAX, UINT64_MAX, UINT64_MAX, UINT64_MAX};
+  bool afterStatus = false;
+
+  const std::vector<TimelineEntry>& timeline = sim.timeline();
+  for (size_t i = 0; i < timeline.size(); i++) {
+    const TimelineEntry& e = timeline[i];
+    if (e.timeNs < stableNs) continue;
+
+    if (e.kind == TL_RELAY) {
+      firstNs[METRIC_RELAY] = std::min(firstNs[METRIC_RELAY], e.timeNs);
+    } else if (e.kind == TL_MIDI) {
+      if ((e.value & 0xF0) == 0xC0) afterStatus = true;
+      else if (afterStatus && e.value < 0x80) firstNs[METRIC_MIDI] = std::min(firstNs[METRIC_MIDI], e.extraNs);
+    } else if (e.kind == TL_DISPLAY && frameShowsResult(gesture, e.frame)) {
+      firstNs[METRIC_DISPLAY] = std::min(firstNs[METRIC_DISPLAY], e.timeNs);
+    }
+  }
+
+  for (uint8_t m = 0; m < METRIC_RELAY_SKEW; m++) {
+    latencyUs[m] = (firstNs[m] == UINT64_MAX) ? UINT32_MAX : (uint32_t)((firstNs[m] - stableNs) / 1000);
+  }
+
+  // Relay edges from the same update all fall well inside one pass
+  latencyUs[METRIC_RELAY_SKEW] = UINT32_MAX;
+  if (firstNs[METRIC_RELAY] != UINT64_MAX) {
+    uint64_t lastNs = firstNs[METRIC_RELAY];
+    uint8_t relaysMoved = 0;
+    for (size_t i = 0; i < timeline.size(); i++) {
+      const TimelineEntry& e = timeline[i];
+      if (e.kind != TL_RELAY || e.timeNs < firstNs[METRIC_RELAY] || e.timeNs >= firstNs[METRIC_RELAY] + RELAY_UPDATE_SPAN_NS) continue;
+      lastNs = std::max(lastNs, e.timeNs);
+      relaysMoved++;
+    }
+    if (relaysMoved > 1) latencyUs[METRIC_RELAY_SKEW] = (uint32_t)(lastNs - firstNs[METRIC_RELAY]);
+  }
+  return true;
+}
+
+/*
+ * Frame render cost: virtual time to compose one frame into Display's
+ * buffer, without sending it, under the ATmega328 cost model. The charged
+ * part is the flash reads of digit glyphs and frame images (memcpy_P,
+ * pgm_read_byte); the logic around them is free on the virtual clock, so
+ * the figures compare the states' PROGMEM traffic, not their whole cost.
+ * Values, loop states and animation frames cycle so every variant is drawn.
+ */
+static const uint32_t RENDER_ITERATIONS = 10000;
+
+static const char* const DISPLAY_STATE_NAMES[] = {"manual", "bank", "pc flash", "saved", "edit"};
+
+static void benchRender() {
+  hostReset();
+  g_hostCost = HOST_COST_ATMEGA328;
+  Display display;
+
+  printf("frame render cost, %u frames per state (virtual us per frame)\n", RENDER_ITERATIONS);
+  printf("%-14s %9s %9s\n", "", "mean", "worst");
+  for (uint8_t s = SHOWING_MANUAL; s <= EDIT_MODE_ANIMATED; s++) {
+    uint64_t totalNs = 0;
+    uint64_t worstNs = 0;
+    for (uint32_t i = 0; i < RENDER_ITERATIONS; i++) {
+      const uint64_t startNs = hostNowNs();
+      display.render((DisplayState)s, (uint8_t)(i % 128), (LoopMask)(i & ALL_LOOPS), (i & 0x10) != 0, (uint8_t)(i % 6));
+      const uint64_t renderNs = hostNowNs() - startNs;
+      totalNs += renderNs;
+      worstNs = std::max(worstNs, renderNs);
+    }
+    printf("%-14s %9.2f %9.2f\n", DISPLAY_STATE_NAMES[s], totalNs / 1000.0 / RENDER_ITERATIONS, worstNs / 1000.0);
+  }
+}
+
+/*
+ * LED update cost: virtual time per LedController::update() under the
+ * ATmega328 cost model, on a HAL with no firmware running so no interrupt
+ * lands inside. Every pass makes one update; nearly all of them find the
+ * LEDs as they are, and the rest shift and latch the chain.
+ */
+static const uint32_t LED_UPDATES = 1000;
+static const uint32_t LED_UNCHANGED_BUDGET_NS = 1000;
+static const uint32_t LED_CHANGED_BUDGET_NS = LED_SHIFT_REGISTERS * 10000;
+
+// Worst virtual time of one update() over LED_UPDATES, ns
+static uint64_t worstLedUpdateNs(LedController& leds, Rng& rng, bool change) {
+  uint64_t worstNs = 0;
+  LoopMask loops = 0;
+  for (uint32_t i = 0; i < LED_UPDATES; i++) {
+    // Different loops every time, or the same ones again
+    if (change) loops = (LoopMask)(loops ^ (1 + rng.between(0, ALL_LOOPS - 1)));
+    const uint64_t startNs = hostNowNs();
+    leds.update(loops, BANK_MODE, 0, false);
+    worstNs = std::max(worstNs, hostNowNs() - startNs);
+  }
+  return worstNs;
+}
+
+static bool benchLeds(Rng& rng) {
+  hostReset();
+  LedController leds;
+  leds.begin();
+
+  const uint64_t changedNs = worstLedUpdateNs(leds, rng, true);
+  leds.update(0, BANK_MODE, 0, false);
+  const uint64_t unchangedNs = worstLedUpdateNs(leds, rng, false);
+
+  const bool changedOk = changedNs <= LED_CHANGED_BUDGET_NS;
+  const bool unchangedOk = unchangedNs <= LED_UNCHANGED_BUDGET_NS;
+  printf("LED update cost, worst of %u updates (virtual us, %u-chip chain)\n", LED_UPDATES, LED_SHIFT_REGISTERS);
+  printf("%-14s %9.2f %9.2f%s\n", "unchanged", unchangedNs / 1000.0, LED_UNCHANGED_BUDGET_NS / 1000.0,
+         unchangedOk ? "" : "  FAIL");
+  printf("%-14s %9.2f %9.2f%s\n", "changed", changedNs / 1000.0, LED_CHANGED_BUDGET_NS / 1000.0,
+         changedOk ? "" : "  FAIL");
+  printf("\n");
+  return changedOk && unchangedOk;
+}
+
+/*
+ * Preset recall burst: a footswitch recalls a preset that moves the relays
+ * and carries MIDI messages for the rest of the rig. Recall time runs from
+ * the first relay edge to the last byte of the messages leaving the wire,
+ * with the switcher's own Program Change ahead of them. Each mix grows one
+ * message at a time up to PRESET_MAX_MESSAGES; the table shows the most
+ * that fit in the budget. Every burst has to reach the wire back to back,
+ * with the status bytes running status saves left out, or the run fails.
+ */
+static const uint32_t RECALL_BUDGET_US = 5000;
+
+enum MessageMix {
+  MIX_PROGRAM_CHANGES,   // A Program Change for each unit on its own channel
+  MIX_CONTROL_CHANGES,   // Control Changes to one unit: running status
+  MIX_CHANNEL_CCS,       // A Control Change for each unit on its own channel
+  MIX_RIG,               // Program Changes for two units, then Control Changes to an amp
+  NUM_MIXES
+};
+
+static const char* const MIX_NAMES[NUM_MIXES] = {"PC per channel", "CC one channel", "CC per channel", "rig mix"};
+
+// The first count messages of the mix, each with its status byte
+static std::vector<uint8_t> mixMessages(MessageMix mix, uint8_t count) {
+  std::vector<uint8_t> bytes;
+  for (uint8_t m = 0; m < count; m++) {
+    const bool programChange = mix == MIX_PROGRAM_CHANGES || (mix == MIX_RIG && m < 2);
+    const uint8_t channel = (mix == MIX_CONTROL_CHANGES) ? 1 : (mix == MIX_RIG) ? 1 + std::min<uint8_t>(m, 2) : 1 + m;
+    if (programChange) {
+      bytes.push_back(0xC0 | channel);
+      bytes.push_back(m);
+    } else {
+      bytes.push_back(0xB0 | channel);
+      bytes.push_back(20 + m);
+      bytes.push_back(127);
+    }
+  }
+  return bytes;
+}
+
+// Bytes as they should leave the wire: a status byte only where it changes
+static void appendRunningStatus(std::vector<uint8_t>& wire, uint8_t& status, const uint8_t* bytes, size_t length) {
+  for (size_t i = 0; i < length; i++) {
+    if (bytes[i] & 0x80) {
+      if (bytes[i] == status) continue;
+      status = bytes[i];
+    }
+    wire.push_back(bytes[i]);
+  }
+}
+
+/**
+ * Recall preset 1 from bank mode with messages stored for it.
+ * @param recallUs Set to the recall time
+ * @return false if the burst was not on the wire back to back as expected
+ */
+static bool recallBurst(const std::vector<uint8_t>& messages, uint32_t& recallUs) {
+  Simulator sim;
+  sim.begin(true);
+  StateManager& state = sim.firmware().state;
+
+  // Presets light loops 1 and 3 so the recall moves relays
+  uint8_t* eeprom = hostEepromData();
+  for (uint8_t i = 0; i < TOTAL_PRESETS; i++) eeprom[EEPROM_PRESETS_START_ADDR + i] = 0x05;
+  eeprom[EEPROM_INIT_FLAG_ADDR] = EEPROM_INIT_MAGIC;
+  state.loadPresets();
+  state.currentMode = BANK_MODE;
+  state.displayState = SHOWING_BANK;
+  state.currentBank = 1;
+  if (!state.presetMessages.set(0, messages.data(), messages.size())) return false;
+  while (!state.presetMessages.isIdle()) sim.runUntilNs(hostNowNs() + MAIN_LOOP_INTERVAL_MS * 1000000ULL);
+
+  const uint64_t pressUs = hostNowNs() / 1000 + 1000;
+  const TraceEvent press[] = {{pressUs, 0, LOW}, {pressUs + HOLD_MS * 1000ULL, 0, HIGH}};
+  const size_t from = sim.timeline().size();
+  sim.play(press, 2);
+  sim.runUntilNs(hostNowNs() + SETTLE_NS);
+
+  const uint8_t programChange[] = {(uint8_t)(0xC0 | state.midiChannel), 0};
+  std::vector<uint8_t> expected;
+  uint8_t status = 0;
+  appendRunningStatus(expected, status, programChange, sizeof(programChange));
+  appendRunningStatus(expected, status, messages.data(), messages.size());
+
+  uint64_t relayNs = UINT64_MAX;
+  uint64_t nextWireNs = 0;
+  std::vector<uint8_t> wire;
+  bool backToBack = true;
+  const std::vector<TimelineEntry>& timeline = sim.timeline();
+  for (size_t i = from; i < timeline.size(); i++) {
+    const TimelineEntry& e = timeline[i];
+    if (e.kind == TL_RELAY) relayNs = std::min(relayNs, e.timeNs);
+    if (e.kind != TL_MIDI) continue;
+    if (!wire.empty() && e.extraNs != nextWireNs) backToBack = false;
+    wire.push_back(e.value);
+    nextWireNs = e.extraNs + HOST_MIDI_BYTE_NS;
+  }
+
+  recallUs = (relayNs == UINT64_MAX || nextWireNs < relayNs) ? UINT32_MAX : (uint32_t)((nextWireNs - relayNs) / 1000);
+  return backToBack && wire == expected && relayNs != UINT64_MAX;
+}
+
+static bool benchRecallBurst() {
+  bool ok = true;
+  printf("preset recall burst, first relay edge to last message byte off the wire (virtual us, budget %u)\n",
+         RECALL_BUDGET_US);
+  printf("%-14s %9s %9s %9s\n", "mix", "fit", "bytes", "recall");
+  for (uint8_t mix = 0; mix < NUM_MIXES; mix++) {
+    uint8_t fit = 0;
+    uint32_t fitUs = 0;
+    size_t fitBytes = 0;
+    bool burstsOk = true;
+    for (uint8_t count = 1; count <= PRESET_MAX_MESSAGES; count++) {
+      const std::vector<uint8_t> messages = mixMessages((MessageMix)mix, count);
+      uint32_t recallUs = UINT32_MAX;
+      if (!recallBurst(messages, recallUs)) burstsOk = false;
+      if (recallUs > RECALL_BUDGET_US) break;
+      std::vector<uint8_t> stored;
+      uint8_t status = 0;
+      appendRunningStatus(stored, status, messages.data(), messages.size());
+      fit = count;
+      fitUs = recallUs;
+      fitBytes = stored.size();
+    }
+    printf("%-14s %9u %9zu %9u%s\n", MIX_NAMES[mix], fit, fitBytes, fitUs, burstsOk ? "" : "  FAIL");
+    if (!burstsOk) ok = false;
+  }
+  printf("\n");
+  return ok;
+}
+
+static uint32_t percentile(const std::vector<uint32_t>& sorted, uint32_t pct) {
+  const size_t index = (sorted.size() * pct + 99) / 100;
+  return sorted[index == 0 ? 0 : index - 1];
+}
+
+int commandBench(int argc, char** argv) {
+  const uint32_t trials = (argc > 0) ? strtoul(argv[0], nullptr, 10) : 500;
+  Rng rng((argc > 1) ? strtoul(argv[1], nullptr, 10) : 1);
+  bool withinBudget = true;
+
+  printf("press-to-action latency, %u trials per gesture (us, from first stable edge; skew in ns)\n", trials);
+  printf("%-14s %-8s %9s %9s %9s %9s\n", "gesture", "output", "min", "median", "p99", "budget");
+
+  for (uint8_t g = 0; g < NUM_GESTURES; g++) {
+    const Gesture gesture = (Gesture)g;
+    const Budget& budget = BUDGETS[g];
+    std::vector<uint32_t> samples[NUM_METRICS];
+    uint32_t misfires = 0;
+    uint32_t missing[NUM_METRICS] = {0, 0, 0, 0};
+
+    for (uint32_t t = 0; t < trials; t++) {
+      uint32_t latencyUs[NUM_METRICS];
+      if (!runTrial(gesture, rng, latencyUs)) {
+        misfires++;
+        continue;
+      }
+      for (uint8_t m = 0; m < NUM_METRICS; m++) {
+        if (budget.limit[m] == 0) continue;
+        if (latencyUs[m] == UINT32_MAX) missing[m]++;
+        else samples[m].push_back(latencyUs[m]);
+      }
+    }
+
+    for (uint8_t m = 0; m < NUM_METRICS; m++) {
+      if (budget.limit[m] == 0) continue;
+      std::vector<uint32_t>& s = samples[m];
+      if (s.empty()) {
+        printf("%-14s %-8s %9s %9s %9s %9u\n", GESTURE_NAMES[g], METRIC_NAMES[m], "-", "-", "-", budget.limit[m]);
+        continue;
+      }
+      std::sort(s.begin(), s.end());
+      const uint32_t p99 = percentile(s, 99);
+      const bool ok = p99 <= budget.limit[m] && missing[m] == 0;
+      printf("%-14s %-8s %9u %9u %9u %9u%s\n", GESTURE_NAMES[g], METRIC_NAMES[m], s.front(), percentile(s, 50), p99,
+             budget.limit[m], ok ? "" : "  FAIL");
+      if (missing[m] > 0) printf("  %u trials produced no %s output\n", missing[m], METRIC_NAMES[m]);
+      if (!ok) withinBudget = false;
+    }
+
+    const uint32_t misfirePercent = (trials > 0) ? (misfires * 100 + trials - 1) / trials : 0;
+    const bool misfiresOk = misfirePercent <= budget.misfirePercent;
+    printf("%-14s %-8s %u/%u (%u%%, budget %u%%)%s\n", GESTURE_NAMES[g], "misfire", misfires, trials, misfirePercent,
+           budget.misfirePercent, misfiresOk ? "" : "  FAIL");
+    if (!misfiresOk) withinBudget = false;
+  }
+
+  printf("\n");
+  if (!benchLeds(rng)) withinBudget = false;
+  if (!benchRecallBurst()) withinBudget = false;
+  benchRender();
+
+  printf("%s\n", withinBudget ? "all gestures within budget" : "budget exceeded");
+  return withinBudget ? 0 : 1;
+}
@@ -0,0 +1,16 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+/**
+ * Press-to-action latency benchmark.
+ *
+ * Usage: bench [trials] [seed]
+ * Prints min/median/p99 per gesture and returns non-zero if any p99 exceeds
+ * its budget. Then the virtual time of an LED update, with the LEDs
+ * unchanged and with a new image to latch, against budgets; how many
+ * messages of each mix a preset can send on recall within 5 ms of the
+ * relays moving; and the host time to render one frame per display state.
+ */
+int commandBench(int argc, char** argv);
+
+#endif
@@ -0,0 +1,172 @@
+#include "debounce_check.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <vector>
+
+#include "hal_host.h"
+#include "simulator.h"
+
+/*
+ * The reference is the time-based debounce the firmware used before the
+ * vertical counters: an edge restarts a per-switch timer and the level is
+ * accepted on the first pass more than DEBOUNCE_MS after the last edge. It
+ * sees the same edges at the same times as the firmware's ISR capture.
+ *
+ * Presses are held at least twice DEBOUNCE_MS and glitches last less than
+ * DEBOUNCE_MS minus one pass, so both debouncers must accept every press
+ * and reject every glitch. Only the pass that accepts a change may differ,
+ * by one pass, where an edge lands right at a pass boundary.
+ */
+
+static const uint8_t CHECK_SWITCH_PINS[NUM_SWITCHES] = {SW1_PIN, SW2_PIN, SW3_PIN, SW4_PIN};
+
+// Time simulated after the last edge so the final releases are accepted
+static const uint64_t CHECK_TAIL_NS = 200ULL * 1000000ULL;
+
+struct ReferenceSwitch {
+  uint8_t rawLevel;
+  uint8_t debouncedLevel;
+  uint64_t lastEdgeUs;
+};
+
+struct Transition {
+  uint32_t pass;
+  uint8_t level;
+};
+
+/**
+ * Build a trace where every switch runs its own press/glitch sequence, so
+ * edges on different switches overlap freely.
+ */
+static void buildTrace(std::vector<TraceEvent>& trace, Rng& rng, uint32_t presses, uint64_t startUs) {
+  const uint32_t maxGlitchUs = (DEBOUNCE_MS - MAIN_LOOP_INTERVAL_MS) * 1000UL;
+
+  for (uint8_t sw = 0; sw < NUM_SWITCHES; sw++) {
+    uint64_t timeUs = startUs + rng.between(0, 50000);
+    for (uint32_t i = sw; i < presses; i += NUM_SWITCHES) {
+      if (rng.between(0, 3) == 0) {
+        // Contact glitch: too short to count as a press
+        const TraceEvent down = {timeUs, sw, LOW};
+        const TraceEvent up = {timeUs + rng.between(50, maxGlitchUs), sw, HIGH};
+        trace.push_back(down);
+        trace.push_back(up);
+        timeUs = up.timeUs + rng.between(2 * DEBOUNCE_MS, 300) * 1000ULL;
+      }
+      timeUs = appendBouncedEdge(trace, rng, timeUs, sw, LOW) + rng.between(2 * DEBOUNCE_MS, 400) * 1000ULL;
+      timeUs = appendBouncedEdge(trace, rng, timeUs, sw, HIGH) + rng.between(2 * DEBOUNCE_MS, 400) * 1000ULL;
+    }
+  }
+
+  std::stable_sort(trace.begin(), trace.end(),
+                   [](const TraceEvent& a, const TraceEvent& b) { return a.timeUs < b.timeUs; });
+}
+
+int commandDebounce(int argc, char** argv) {
+  const uint32_t presses = (argc > 0) ? strtoul(argv[0], nullptr, 10) : 20000;
+  Rng rng((argc > 1) ? strtoul(argv[1], nullptr, 10) : 1);
+
+  Simulator sim;
+  sim.begin(false);
+  Firmware& fw = sim.firmware();
+
+  std::vector<TraceEvent> trace;
+  buildTrace(trace, rng, presses, sim.bootNs() / 1000 + 1000);
+  for (size_t i = 0; i < trace.size(); i++) {
+    hostScheduleInputLevel(CHECK_SWITCH_PINS[trace[i].switchIndex], trace[i].level, trace[i].timeUs * 1000ULL);
+  }
+
+  ReferenceSwitch reference[NUM_SWITCHES];
+  std::vector<Transition> expected[NUM_SWITCHES];
+  std::vector<Transition> actual[NUM_SWITCHES];
+  uint8_t firmwareLevel[NUM_SWITCHES];
+  for (uint8_t i = 0; i < NUM_SWITCHES; i++) {
+    reference[i].rawLevel = HIGH;
+    reference[i].debouncedLevel = HIGH;
+    reference[i].lastEdgeUs = 0;
+    firmwareLevel[i] = HIGH;
+  }
+
+  const uint64_t endNs = (trace.empty() ? hostNowNs() : trace.back().timeUs * 1000ULL) + CHECK_TAIL_NS;
+  size_t nextEdge = 0;
+  uint32_t pass = 0;
+
+  while (hostNowNs() < endNs) {
+    // Idle up to the next pass, then run it here so it can be observed
+    sim.runUntilNs(sim.nextReleaseNs());
+    const uint64_t passNs = hostNowNs();
+    // Storage runs between passes; a pass is a run of the control task
+    const uint32_t controlRuns = fw.scheduler.stats(Firmware::CONTROL_TASK).runs;
+    fw.loop();
+    if (fw.scheduler.stats(Firmware::CONTROL_TASK).runs == controlRuns) continue;
+    pass++;
+
+    // Reference: edges up to the start of the pass, then the timer check
+    for (; nextEdge < trace.size() && trace[nextEdge].timeUs * 1000ULL <= passNs; nextEdge++) {
+      ReferenceSwitch& ref = reference[trace[nextEdge].switchIndex];
+      // A repeated level is not an edge; the pin-change interrupt never fires for it
+      if (trace[nextEdge].level == ref.rawLevel) continue;
+      ref.rawLevel = trace[nextEdge].level;
+      ref.lastEdgeUs = trace[nextEdge].timeUs;
+    }
+
+    for (uint8_t i = 0; i < NUM_SWITCHES; i++) {
+      ReferenceSwitch& ref = reference[i];
+      if (ref.rawLevel != ref.debouncedLevel && passNs / 1000 - ref.lastEdgeUs > DEBOUNCE_MS * 1000UL) {
+        ref.debouncedLevel = ref.rawLevel;
+        const Transition t = {pass, ref.debouncedLevel};
+        expected[i].push_back(t);
+      }
+
+      const uint8_t level = fw.switches.isPressed(i) ? LOW : HIGH;
+      if (level != firmwareLevel[i]) {
+        firmwareLevel[i] = level;
+        const Transition t = {pass, level};
+        actual[i].push_back(t);
+      }
+    }
+  }
+
+  uint32_t transitions = 0;
+  uint32_t samePass = 0;
+  uint32_t onePassLate = 0;
+  uint32_t onePassEarly = 0;
+  uint32_t mismatches = 0;
+
+  for (uint8_t i = 0; i < NUM_SWITCHES; i++) {
+    const size_t count = std::max(expected[i].size(), actual[i].size());
+    for (size_t n = 0; n < count; n++) {
+      transitions++;
+      if (n >= expected[i].size() || n >= actual[i].size() || expected[i][n].level != actual[i][n].level) {
+        if (mismatches == 0) {
+          fprintf(stderr, "SW%u transition %zu: reference %s, vertical counter %s\n", i + 1, n,
+                  (n < expected[i].size()) ? (expected[i][n].level ? "release" : "press") : "none",
+                  (n < actual[i].size()) ? (actual[i][n].level ? "release" : "press") : "none");
+        }
+        mismatches++;
+        continue;
+      }
+
+      const int32_t delta = (int32_t)actual[i][n].pass - (int32_t)expected[i][n].pass;
+      if (delta == 0) samePass++;
+      else if (delta == 1) onePassLate++;
+      else if (delta == -1) onePassEarly++;
+      else {
+        if (mismatches == 0) {
+          fprintf(stderr, "SW%u transition %zu: accepted %d passes apart\n", i + 1, n, delta);
+        }
+        mismatches++;
+      }
+    }
+  }
+
+  printf("debounce: %u presses, %zu switch edges, %u passes\n", presses, trace.size(), pass);
+  printf("  transitions      %u\n", transitions);
+  printf("  same pass        %u\n", samePass);
+  printf("  one pass later   %u\n", onePassLate);
+  printf("  one pass earlier %u\n", onePassEarly);
+  printf("  mismatched       %u\n", mismatches);
+  printf("%s\n", (mismatches == 0) ? "vertical counters match the reference" : "vertical counters DIFFER from the reference");
+  return (mismatches == 0) ? 0 : 1;
+}
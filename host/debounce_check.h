@@ -0,0 +1,15 @@
+#ifndef DEBOUNCE_CHECK_H
+#define DEBOUNCE_CHECK_H
+
+/**
+ * Debouncer equivalence check.
+ *
+ * Usage: debounce [presses] [seed]
+ * Plays random bouncy presses and sub-debounce glitches on all switches and
+ * compares the firmware's debounced levels, pass by pass, against the
+ * time-based reference debouncer. Returns non-zero if the two disagree on
+ * any press or release, or accept one more than a pass apart.
+ */
+int commandDebounce(int argc, char** argv);
+
+#endif
@@ -0,0 +1,331 @@
+#include "event_log_check.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <vector>
+
+#include "hal_host.h"
+#include "rng.h"
+#include "simulator.h"
+#include "midi_parser.h"
+#include "sysex.h"
+
+/*
+ * The decoder works on MIDI bytes as a host on the other end of the cable
+ * gets them, so it reads a monitor's .syx capture as well as the bytes the
+ * simulator saw the switcher send. Record times come back from the header:
+ * the newest record is `age` ms before the header's uptime, and each
+ * record's delta steps back to the one before.
+ */
+
+static const uint64_t BYTE_NS = HOST_MIDI_BYTE_NS;
+static const uint64_t DUMP_WAIT_NS = 500ULL * 1000000ULL;
+static const uint32_t LONG_HOLD_MS = EDIT_MODE_LONG_PRESS_MS + 500;
+// A message the switcher sends is on the wire within this of being logged
+static const uint64_t SEND_SLACK_NS = 20ULL * 1000000ULL;
+
+static const uint8_t HEADER_BYTES = 1 + 1 + 3 + 5 + 5;
+static const uint8_t RECORD_BYTES = 3 + 1 + 2 + 3;
+
+struct DecodedRecord {
+  uint32_t timeMs;      // From power-up
+  bool gapSaturated;    // More than 65535 ms after the record before
+  uint8_t event;
+  uint8_t a;
+  uint16_t b;
+  uint16_t deltaMs;
+};
+
+struct LogDump {
+  bool headerSeen;
+  uint8_t count;
+  uint8_t size;
+  uint16_t lost;
+  uint32_t ageMs;
+  uint32_t uptimeMs;
+  std::vector<DecodedRecord> records;
+};
+
+/**
+ * Pull the event log out of a MIDI byte stream; other traffic is skipped.
+ * @return false if it is missing, garbled or incomplete (reason printed)
+ */
+static bool decodeLog(const std::vector<uint8_t>& bytes, LogDump& dump) {
+  dump.headerSeen = false;
+  dump.records.clear();
+
+  std::vector<uint8_t> message;
+  bool inSysEx = false;
+  for (size_t i = 0; i < bytes.size(); i++) {
+    const uint8_t data = bytes[i];
+    if (data >= 0xF8) continue;
+    if (data == MIDI_SYSEX_START) {
+      message.clear();
+      inSysEx = true;
+      continue;
+    }
+    if (!inSysEx) continue;
+    if (data != MIDI_SYSEX_END) {
+      message.push_back(data);
+      continue;
+    }
+    inSysEx = false;
+
+    if (message.size() < 3 || message[0] != MIDI_SYSEX_ID || message[1] != MIDI_SYSEX_DEVICE) continue;
+    const uint8_t* in = &message[3];
+    const size_t body = message.size() - 3;
+
+    if (message[2] == SYSEX_LOG_HEADER) {
+      if (body != HEADER_BYTES) {
+        fprintf(stderr, "garbled log header (%zu bytes)\n", body);
+        return false;
+      }
+      dump.headerSeen = true;
+      dump.records.clear();
+      dump.count = *in++;
+      dump.size = *in++;
+      dump.lost = getSeptets(in, 3);
+      dump.ageMs = getSeptets(in, 5);
+      dump.uptimeMs = getSeptets(in, 5);
+    } else if (message[2] == SYSEX_LOG_RECORDS && dump.headerSeen) {
+      if (body < 1 || (body - 1) % RECORD_BYTES != 0 || *in != dump.records.size()) {
+        fprintf(stderr, "garbled or out-of-order log records (%zu bytes, first %u)\n", body, body ? *in : 0);
+        return false;
+      }
+      in++;
+      for (size_t n = (body - 1) / RECORD_BYTES; n > 0; n--) {
+        DecodedRecord record;
+        record.deltaMs = getSeptets(in, 3);
+        record.event = *in++;
+        record.a = getSeptets(in, 2);
+        record.b = getSeptets(in, 3);
+        dump.records.push_back(record);
+      }
+    }
+  }
+
+  if (!dump.headerSeen) {
+    fprintf(stderr, "no event log in the stream\n");
+    return false;
+  }
+  if (dump.records.size() != dump.count || dump.count > dump.size) {
+    fprintf(stderr, "event log incomplete: %zu of %u records\n", dump.records.size(), dump.count);
+    return false;
+  }
+
+  // Newest first, back through the deltas
+  uint32_t timeMs = dump.uptimeMs - dump.ageMs;
+  for (size_t i = dump.records.size(); i > 0; i--) {
+    DecodedRecord& record = dump.records[i - 1];
+    record.timeMs = timeMs;
+    record.gapSaturated = record.deltaMs == 0xFFFF;
+    timeMs -= record.deltaMs;
+  }
+  return true;
+}
+
+static void printLoops(uint16_t loops) {
+  printf("0x%04X", loops);
+}
+
+static void printRecord(const DecodedRecord& record) {
+  static const char* const MODES[] = {"manual", "bank", "edit"};
+  static const char* const COMBOS[] = {"", "SW2+SW3 mode", "SW1+SW2 bank down", "SW3+SW4 bank up",
+                                       "SW2+SW3 hold edit"};
+
+  printf("  %10.3f s  ", record.timeMs / 1000.0);
+  switch (record.event) {
+    case LOG_MODE:
+      printf("mode     %s", (record.a < 3) ? MODES[record.a] : "?");
+      break;
+    case LOG_BANK:
+      printf("bank     %u", record.a);
+      break;
+    case LOG_GESTURE:
+      if (record.a == PRESS_SINGLE) printf("press    SW%u", record.b + 1);
+      else printf("combo    %s", (record.a <= PRESS_EDIT_HOLD) ? COMBOS[record.a] : "?");
+      break;
+    case LOG_PRESET_LOAD:
+    case LOG_PRESET_SAVE:
+      printf("preset   %s %u, loops ", (record.event == LOG_PRESET_LOAD) ? "load" : "save", record.a);
+      printLoops(record.b);
+      break;
+    case LOG_RELAYS:
+      printf("relays   ");
+      printLoops(record.b);
+      break;
+    case LOG_MIDI_SEND:
+      printf("midi out %02X", record.a);
+      if (midiMessageLength(record.a) > 1) printf(" %02X", record.b & 0x7F);
+      if (midiMessageLength(record.a) > 2) printf(" %02X", record.b >> 8);
+      break;
+    default:
+      printf("event %u (%u, %u)", record.event, record.a, record.b);
+      break;
+  }
+  if (record.gapSaturated) printf("   (65.5 s or more after the one before)");
+  printf("\n");
+}
+
+static void printLog(const LogDump& dump) {
+  printf("event log: %u of %u records, %u lost, read %.3f s after power-up\n", dump.count, dump.size, dump.lost,
+         dump.uptimeMs / 1000.0);
+  for (size_t i = 0; i < dump.records.size(); i++) {
+    printRecord(dump.records[i]);
+  }
+}
+
+int commandSyxLog(int argc, char** argv) {
+  if (argc < 1) {
+    fprintf(stderr, "usage: syxlog <file.syx>\n");
+    return 2;
+  }
+  FILE* file = fopen(argv[0], "rb");
+  if (!file) {
+    fprintf(stderr, "cannot open %s\n", argv[0]);
+    return 2;
+  }
+  std::vector<uint8_t> bytes;
+  int c;
+  while ((c = fgetc(file)) != EOF) bytes.push_back(c);
+  fclose(file);
+
+  LogDump dump;
+  if (!decodeLog(bytes, dump)) return 1;
+  printLog(dump);
+  return 0;
+}
+
+/**
+ * Append one gesture starting at timeUs: mostly single presses, some bank
+ * and mode combos, and now and then SW2+SW3 held for edit mode.
+ * @return Time the last switch is released
+ */
+static uint64_t appendGesture(std::vector<TraceEvent>& trace, Rng& rng, uint64_t timeUs) {
+  const uint32_t kind = rng.between(0, 9);
+  if (kind < 6) {
+    const uint8_t sw = rng.between(0, NUM_SWITCHES - 1);
+    const uint64_t pressedUs = appendBouncedEdge(trace, rng, timeUs, sw, LOW);
+    return appendBouncedEdge(trace, rng, pressedUs + rng.between(60, 400) * 1000ULL, sw, HIGH);
+  }
+  const uint8_t a = (kind < 9) ? rng.between(0, 2) : 1;
+  const uint32_t holdMs = (kind < 9) ? rng.between(80, 300) : LONG_HOLD_MS;
+  const uint64_t aUs = appendBouncedEdge(trace, rng, timeUs, a, LOW);
+  const uint64_t bUs = appendBouncedEdge(trace, rng, timeUs + rng.between(0, 20000), a + 1, LOW);
+  const uint64_t releaseUs = std::max(aUs, bUs) + holdMs * 1000ULL;
+  appendBouncedEdge(trace, rng, releaseUs, a, HIGH);
+  return appendBouncedEdge(trace, rng, releaseUs + rng.between(0, 20000), a + 1, HIGH);
+}
+
+static void scheduleBytes(Simulator& sim, uint64_t timeNs, const uint8_t* bytes, uint8_t length) {
+  for (uint8_t i = 0; i < length; i++) {
+    sim.scheduleMidiIn(bytes[i], timeNs + (i + 1) * BYTE_NS);
+  }
+}
+
+// Relays as the simulator saw them just before timeNs
+static uint16_t relaysAt(const std::vector<TimelineEntry>& entries, uint64_t timeNs) {
+  uint16_t loops = 0;
+  // Relay entries are in time order, though other entries may be out of it
+  for (size_t i = 0; i < entries.size(); i++) {
+    if (entries[i].kind != TL_RELAY || entries[i].timeNs >= timeNs) continue;
+    if (entries[i].value == HIGH) loops |= 1 << entries[i].index;
+    else loops &= ~(1 << entries[i].index);
+  }
+  return loops;
+}
+
+// A byte sent within [fromNs, fromNs + SEND_SLACK_NS)
+static bool sentAround(const std::vector<TimelineEntry>& entries, uint64_t fromNs, uint8_t data) {
+  for (size_t i = 0; i < entries.size(); i++) {
+    if (entries[i].kind != TL_MIDI || entries[i].value != data) continue;
+    if (entries[i].timeNs >= fromNs && entries[i].timeNs < fromNs + SEND_SLACK_NS) return true;
+  }
+  return false;
+}
+
+/**
+ * Check each relay change and MIDI message in the log against the simulator.
+ * @return Records that do not match
+ */
+static uint32_t checkAgainstTimeline(const LogDump& dump, const std::vector<TimelineEntry>& entries) {
+  uint32_t mismatches = 0;
+  for (size_t i = 0; i < dump.records.size(); i++) {
+    const DecodedRecord& record = dump.records[i];
+    const uint64_t msNs = record.timeMs * 1000000ULL;
+    bool ok = true;
+    if (record.event == LOG_RELAYS) {
+      // Logged right after the relays were written, in the same millisecond
+      const bool sameMsFollows = i + 1 < dump.records.size() && dump.records[i + 1].deltaMs == 0 &&
+                                 dump.records[i + 1].event == LOG_RELAYS;
+      ok = sameMsFollows || relaysAt(entries, msNs + 1000000ULL) == record.b;
+    } else if (record.event == LOG_MIDI_SEND) {
+      ok = sentAround(entries, msNs, record.a);
+    }
+    if (!ok) {
+      printf("  does not match the simulator:");
+      printRecord(record);
+      mismatches++;
+    }
+  }
+  return mismatches;
+}
+
+int commandEventLog(int argc, char** argv) {
+  const uint32_t seconds = (argc > 0) ? strtoul(argv[0], nullptr, 10) : 30;
+  Rng rng((argc > 1) ? strtoul(argv[1], nullptr, 10) : 1);
+
+  Simulator sim;
+  sim.begin(true);
+  const uint64_t startNs = hostNowNs();
+  uint64_t endNs = startNs + seconds * 1000000000ULL;
+
+  // Each gesture logs at least itself, so a run of EVENT_LOG_SIZE or more
+  // wraps the log however short it was asked to be
+  std::vector<TraceEvent> trace;
+  uint32_t gestures = 0;
+  uint64_t timeUs = startNs / 1000;
+  for (; timeUs < endNs / 1000 || gestures < EVENT_LOG_SIZE; gestures++) {
+    timeUs = appendGesture(trace, rng, timeUs) + rng.between(200, 1500) * 1000ULL;
+  }
+  endNs = std::max<uint64_t>(endNs, timeUs * 1000ULL);
+  std::stable_sort(trace.begin(), trace.end(),
+                   [](const TraceEvent& a, const TraceEvent& b) { return a.timeUs < b.timeUs; });
+
+  // A Program Change recall every few seconds
+  uint32_t recalls = 0;
+  for (uint64_t timeNs = startNs + rng.between(1, 5) * 1000000000ULL; timeNs < endNs;
+       timeNs += rng.between(2000, 6000) * 1000000ULL, recalls++) {
+    const uint8_t pc[] = {0xC0, (uint8_t)rng.between(0, TOTAL_PRESETS - 1)};
+    scheduleBytes(sim, timeNs, pc, sizeof(pc));
+  }
+
+  sim.play(trace.data(), trace.size());
+  sim.runUntilNs(endNs);
+
+  const size_t from = sim.timeline().size();
+  const uint8_t request[] = {MIDI_SYSEX_START, MIDI_SYSEX_ID, MIDI_SYSEX_DEVICE, SYSEX_LOG_REQUEST, MIDI_SYSEX_END};
+  scheduleBytes(sim, hostNowNs(), request, sizeof(request));
+  sim.runUntilNs(hostNowNs() + DUMP_WAIT_NS);
+
+  std::vector<uint8_t> bytes;
+  const std::vector<TimelineEntry>& entries = sim.timeline();
+  for (size_t i = from; i < entries.size(); i++) {
+    if (entries[i].kind == TL_MIDI) bytes.push_back(entries[i].value);
+  }
+
+  printf("eventlog: %.1f s, %u gestures, %u MIDI recalls\n", (endNs - startNs) / 1e9, gestures, recalls);
+  LogDump dump;
+  if (!decodeLog(bytes, dump)) {
+    printf("event log check FAILED\n");
+    return 1;
+  }
+  printLog(dump);
+
+  const uint32_t mismatches = checkAgainstTimeline(dump, entries);
+  const bool ok = mismatches == 0 && dump.count == dump.size && dump.lost > 0;
+  if (dump.count < dump.size || dump.lost == 0) printf("  the run did not fill the log\n");
+  printf("%s\n", ok ? "event log read back and matches the simulator" : "event log check FAILED");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,29 @@
+#ifndef EVENT_LOG_CHECK_H
+#define EVENT_LOG_CHECK_H
+
+/**
+ * Event log readout check.
+ *
+ * Usage: eventlog [seconds] [seed]
+ * Plays random presses, bank/mode combos, edit-mode saves and MIDI
+ * recalls into the firmware, asks for the event log over MIDI IN and
+ * decodes what comes back on MIDI OUT into a timeline. Checks the log
+ * against the timeline the simulator recorded: every relay change and MIDI
+ * message logged has to have happened, at the logged millisecond. A run
+ * goes on past the seconds asked for until it has made EVENT_LOG_SIZE
+ * gestures, so the log always wraps. Returns non-zero if the readout is
+ * garbled, disagrees or did not wrap.
+ */
+int commandEventLog(int argc, char** argv);
+
+/**
+ * Event log decoder.
+ *
+ * Usage: syxlog <file.syx>
+ * Reads raw MIDI bytes as saved by a MIDI monitor after sending the
+ * switcher F0 7D 4C 03 F7, and prints the event log they carry as a
+ * timeline from power-up. Other traffic in the file is skipped.
+ */
+int commandSyxLog(int argc, char** argv);
+
+#endif
@@ -0,0 +1,334 @@
+#include "gesture_check.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <vector>
+
+#include "hal_host.h"
+#include "rng.h"
+#include "simulator.h"
+#include "gestures.h"
+
+/*
+ * The recognizer runs on a SwitchHandler of its own, with the caller's
+ * side done here the way ModeController does it: a tap that could start a
+ * chord is taken at once but stays pending, a chord drops the pending taps
+ * it was made of, and pending taps stand once a switch outside every chord
+ * with them is pressed or the window runs out. Taps are cleared once taken
+ * and chords clear every recent press.
+ *
+ * A tap of SW2 moves the check from IN_MANUAL to IN_BANK, the way SW2
+ * selecting a preset moves the switcher onto one, and a chord that drops
+ * the tap moves it back. SW1+SW2 is the pair in IN_MANUAL and nothing in
+ * IN_BANK, so it only comes out as the pair if chords are matched in the
+ * context from before the pending taps, as ModeController does.
+ *
+ * Gestures are played one per trial from power-up, so each starts with no
+ * taps or holds in progress. Double taps land within their 300 ms, slow
+ * taps well outside it; chords are spread over at most a quarter of the
+ * simultaneous window, but for the late pair, whose SW1 lands after SW2
+ * has been taken.
+ */
+
+static const uint8_t CHECK_SWITCH_PINS[NUM_SWITCHES] = {SW1_PIN, SW2_PIN, SW3_PIN, SW4_PIN};
+
+enum CheckAction {
+  CHECK_NONE,
+  CHECK_TAP,
+  CHECK_JUMP,      // SW1 double tap
+  CHECK_MUTE,      // SW2+SW3+SW4
+  CHECK_PAIR,      // SW1+SW2
+  CHECK_HOLD,      // SW2+SW3 held
+  CHECK_RELEASE,   // SW4 let go
+  NUM_CHECK_ACTIONS
+};
+
+static const char* const ACTION_NAMES[NUM_CHECK_ACTIONS] = {
+  "none", "tap", "jump", "mute", "pair", "hold", "release"
+};
+
+static const uint16_t DOUBLE_TAP_MS = 300;
+static const uint16_t HOLD_MS = 1000;
+
+constexpr GestureRule CHECK_GESTURES[] PROGMEM = {
+  {SW2 | SW3, TRIGGER_HOLD, IN_ANY, CHECK_HOLD, HOLD_MS},
+  {SW2 | SW3 | SW4, TRIGGER_CHORD, IN_ANY, CHECK_MUTE, 0},
+  {SW1 | SW2, TRIGGER_CHORD, IN_MANUAL, CHECK_PAIR, 0},
+  // After an SW2 tap the pair would be swallowed, if its tap were not undone first
+  {SW1 | SW2, TRIGGER_CHORD, IN_BANK, CHECK_NONE, 0},
+  {SW4, TRIGGER_RELEASE, IN_ANY, CHECK_RELEASE, 0},
+  {SW1, TRIGGER_DOUBLE_TAP, IN_ANY, CHECK_JUMP, DOUBLE_TAP_MS},
+  {SW1 | SW2 | SW3 | SW4, TRIGGER_TAP, IN_ANY, CHECK_TAP, 0}
+};
+static const uint8_t CHECK_GESTURE_COUNT = sizeof(CHECK_GESTURES) / sizeof(CHECK_GESTURES[0]);
+
+enum Scenario {
+  SCENARIO_TAP_RELEASE,   // SW4: tap, release
+  SCENARIO_DOUBLE_TAP,    // SW1 twice: tap, jump
+  SCENARIO_SLOW_TAPS,     // SW1 twice, slowly: tap, tap
+  SCENARIO_MUTE,          // SW2+SW3+SW4 in any order: mute
+  SCENARIO_PAIR,          // SW1+SW2: pair
+  SCENARIO_HOLD,          // SW2+SW3 held: tap, tap, hold
+  SCENARIO_LATE_PAIR,     // SW2, SW1 60-150 ms later: pair
+  NUM_SCENARIOS
+};
+
+static const char* const SCENARIO_NAMES[NUM_SCENARIOS] = {
+  "tap+release", "double tap", "slow taps", "3-chord", "2-chord", "hold", "late 2-chord"
+};
+
+struct Recognized {
+  uint8_t action;
+  uint8_t switchIndex;
+  bool pending;
+};
+
+// Time run after the last edge so pending taps and the release are settled
+static const uint64_t CHECK_TAIL_US = 1000000ULL;
+
+static uint64_t appendTap(std::vector<TraceEvent>& trace, Rng& rng, uint64_t timeUs, uint8_t sw, uint32_t minMs,
+                          uint32_t maxMs) {
+  const uint64_t pressedUs = appendBouncedEdge(trace, rng, timeUs, sw, LOW);
+  return appendBouncedEdge(trace, rng, pressedUs + rng.between(minMs, maxMs) * 1000ULL, sw, HIGH);
+}
+
+/**
+ * Lay out one gesture and what it has to be recognized as.
+ * @return Time of the last edge
+ */
+static uint64_t buildScenario(Scenario scenario, Rng& rng, uint64_t startUs, std::vector<TraceEvent>& trace,
+                              std::vector<Recognized>& expected) {
+  const Recognized tap1 = {CHECK_TAP, 0, false};
+  uint64_t endUs = startUs;
+
+  switch (scenario) {
+    case SCENARIO_TAP_RELEASE: {
+      endUs = appendTap(trace, rng, startUs, 3, 60, 300);
+      expected.push_back({CHECK_TAP, 3, false});
+      expected.push_back({CHECK_RELEASE, 0, false});
+      break;
+    }
+    case SCENARIO_DOUBLE_TAP:
+    case SCENARIO_SLOW_TAPS: {
+      const bool slow = scenario == SCENARIO_SLOW_TAPS;
+      // Press to press, bounce included: under 250 ms fast, over 400 ms slow
+      const uint64_t firstUpUs = appendTap(trace, rng, startUs, 0, 60, slow ? 200 : 100);
+      const uint64_t secondUs = firstUpUs + rng.between(60, 100) * 1000ULL + (slow ? 300000ULL : 0);
+      endUs = appendTap(trace, rng, secondUs, 0, 60, 200);
+      expected.push_back(tap1);
+      expected.push_back({(uint8_t)(slow ? CHECK_TAP : CHECK_JUMP), 0, false});
+      break;
+    }
+    case SCENARIO_MUTE:
+    case SCENARIO_PAIR:
+    case SCENARIO_HOLD: {
+      uint8_t sws[3] = {1, 2, 3};
+      uint8_t count = 3;
+      if (scenario == SCENARIO_PAIR) {
+        sws[0] = 0;
+        sws[1] = 1;
+        count = 2;
+      } else if (scenario == SCENARIO_HOLD) {
+        count = 2;
+      }
+      for (uint8_t i = count - 1; i > 0; i--) std::swap(sws[i], sws[rng.between(0, i)]);
+
+      const uint32_t holdMs = (scenario == SCENARIO_HOLD) ? HOLD_MS + 500 : rng.between(150, 300);
+      uint64_t downUs = startUs;
+      for (uint8_t i = 0; i < count; i++) {
+        const uint64_t pressUs = startUs + rng.between(0, SIMULTANEOUS_WINDOW_MS / 4) * 1000ULL;
+        downUs = std::max(downUs, appendBouncedEdge(trace, rng, pressUs, sws[i], LOW));
+      }
+      for (uint8_t i = 0; i < count; i++) {
+        const uint64_t releaseUs = downUs + holdMs * 1000ULL + rng.between(0, 20000);
+        endUs = std::max(endUs, appendBouncedEdge(trace, rng, releaseUs, sws[i], HIGH));
+      }
+
+      if (scenario == SCENARIO_MUTE) {
+        expected.push_back({CHECK_MUTE, 0, false});
+      } else if (scenario == SCENARIO_PAIR) {
+        expected.push_back({CHECK_PAIR, 0, false});
+      } else {
+        // No chord is just SW2+SW3, so the pair goes out as taps once the window runs out
+        expected.push_back({CHECK_TAP, 1, false});
+        expected.push_back({CHECK_TAP, 2, false});
+        expected.push_back({CHECK_HOLD, 0, false});
+      }
+      break;
+    }
+    case SCENARIO_LATE_PAIR: {
+      // SW2 is debounced and taken, moving the context, before SW1 lands
+      const uint64_t secondUs = startUs + rng.between(60, 150) * 1000ULL;
+      const uint64_t downUs = std::max(appendBouncedEdge(trace, rng, startUs, 1, LOW),
+                                       appendBouncedEdge(trace, rng, secondUs, 0, LOW));
+      const uint64_t releaseUs = downUs + rng.between(150, 300) * 1000ULL;
+      endUs = std::max(appendBouncedEdge(trace, rng, releaseUs, 1, HIGH),
+                       appendBouncedEdge(trace, rng, releaseUs + rng.between(0, 20000), 0, HIGH));
+      expected.push_back({CHECK_PAIR, 0, false});
+      break;
+    }
+    default:
+      break;
+  }
+
+  std::stable_sort(trace.begin(), trace.end(),
+                   [](const TraceEvent& a, const TraceEvent& b) { return a.timeUs < b.timeUs; });
+  return endUs;
+}
+
+static void dropPending(std::vector<Recognized>& out) {
+  out.erase(std::remove_if(out.begin(), out.end(), [](const Recognized& r) { return r.pending; }), out.end());
+}
+
+static void settlePending(std::vector<Recognized>& out) {
+  for (size_t i = 0; i < out.size(); i++) out[i].pending = false;
+}
+
+static bool sameOutcome(std::vector<Recognized> actual, std::vector<Recognized> expected) {
+  // Taps landing within a pass of each other may come out in either order
+  const auto byTap = [](const Recognized& a, const Recognized& b) {
+    return a.action == CHECK_TAP && b.action == CHECK_TAP && a.switchIndex < b.switchIndex;
+  };
+  if (actual.size() != expected.size()) return false;
+  for (size_t i = 1; i < actual.size(); i++) {
+    if (byTap(actual[i], actual[i - 1])) std::swap(actual[i], actual[i - 1]);
+  }
+  for (size_t i = 0; i < actual.size(); i++) {
+    if (actual[i].action != expected[i].action) return false;
+    if (actual[i].action == CHECK_TAP && actual[i].switchIndex != expected[i].switchIndex) return false;
+  }
+  return true;
+}
+
+static void printOutcome(const char* label, const std::vector<Recognized>& out) {
+  printf("    %-9s", label);
+  for (size_t i = 0; i < out.size(); i++) {
+    printf(" %s", ACTION_NAMES[out[i].action]);
+    if (out[i].action == CHECK_TAP) printf(" SW%u", out[i].switchIndex + 1);
+  }
+  printf("\n");
+}
+
+int commandGestures(int argc, char** argv) {
+  const uint32_t trials = (argc > 0) ? strtoul(argv[0], nullptr, 10) : 600;
+  Rng rng((argc > 1) ? strtoul(argv[1], nullptr, 10) : 1);
+
+  uint32_t runs[NUM_SCENARIOS] = {0};
+  uint32_t misses[NUM_SCENARIOS] = {0};
+  uint64_t passes = 0;
+  uint64_t minPassNs = UINT64_MAX;
+  uint64_t maxPassNs = 0;
+  bool reported = false;
+
+  for (uint32_t trial = 0; trial < trials; trial++) {
+    const Scenario scenario = (Scenario)(trial % NUM_SCENARIOS);
+    hostReset();
+    SwitchHandler switches(CHECK_SWITCH_PINS, DEBOUNCE_MS, SIMULTANEOUS_WINDOW_MS, LONG_PRESS_MS);
+    GestureRecognizer recognizer(CHECK_GESTURES, CHECK_GESTURE_COUNT);
+    switches.begin();
+
+    // A random phase against the passes
+    const uint64_t startUs = hostNowNs() / 1000 + 100000 + rng.between(0, MAIN_LOOP_INTERVAL_MS * 1000);
+    std::vector<TraceEvent> trace;
+    std::vector<Recognized> expected;
+    const uint64_t endUs = buildScenario(scenario, rng, startUs, trace, expected) + CHECK_TAIL_US;
+    for (size_t i = 0; i < trace.size(); i++) {
+      hostScheduleInputLevel(CHECK_SWITCH_PINS[trace[i].switchIndex], trace[i].level, trace[i].timeUs * 1000ULL);
+    }
+
+    std::vector<Recognized> actual;
+    uint8_t pending = 0;
+    unsigned long pendingTime[NUM_SWITCHES] = {0};
+    uint8_t context = IN_MANUAL;          // As the taps taken so far left it
+    uint8_t pendingContext = IN_MANUAL;   // Before the pending taps
+    // Chords are matched as if the pending taps had not been taken
+    const auto chordContext = [&]() { return pending ? pendingContext : context; };
+    uint64_t passNs = hostNowNs();
+    while (passNs / 1000 < endUs) {
+      passNs += MAIN_LOOP_INTERVAL_MS * 1000000ULL;
+      hostAdvanceToNs(passNs);
+      switches.readAndDebounce();
+
+      uint8_t stillPending = 0;
+      for (uint8_t i = 0; i < NUM_SWITCHES; i++) {
+        if ((pending & (1 << i)) && pendingTime[i] == switches.getPressStartTime(i)) stillPending |= 1 << i;
+      }
+
+      GestureMatch gesture;
+      const uint64_t beforeNs = hostNowNs();
+      const bool found = recognizer.recognize(switches, chordContext(), stillPending, gesture);
+      const uint64_t costNs = hostNowNs() - beforeNs;
+      passes++;
+      minPassNs = std::min(minPassNs, costNs);
+      maxPassNs = std::max(maxPassNs, costNs);
+
+      if (found && gesture.trigger == TRIGGER_CHORD) {
+        dropPending(actual);
+        if (pending) context = pendingContext;
+        pending = 0;
+        actual.push_back({gesture.action, 0, false});
+        switches.clearRecentPresses();
+        continue;
+      }
+      if (found && (gesture.trigger == TRIGGER_TAP || gesture.trigger == TRIGGER_DOUBLE_TAP)) {
+        const uint8_t bit = 1 << gesture.switchIndex;
+        if ((pending & bit) || !recognizer.canStartChord(pending | bit, chordContext())) {
+          settlePending(actual);
+          for (uint8_t i = 0; i < NUM_SWITCHES; i++) {
+            if (pending & (1 << i)) switches.clearRecentPress(i);
+          }
+          pending = 0;
+        }
+        if (gesture.action == CHECK_TAP && recognizer.canStartChord(pending | bit, chordContext())) {
+          if (!pending) pendingContext = context;
+          pending |= bit;
+          pendingTime[gesture.switchIndex] = switches.getPressStartTime(gesture.switchIndex);
+          actual.push_back({gesture.action, gesture.switchIndex, true});
+        } else {
+          actual.push_back({gesture.action, gesture.switchIndex, false});
+          switches.clearRecentPresses();
+        }
+        if (gesture.action == CHECK_TAP && gesture.switchIndex == 1) context = IN_BANK;
+      } else if (found) {
+        actual.push_back({gesture.action, 0, false});
+      }
+
+      if (pending & ~switches.getRecentPresses()) {
+        settlePending(actual);
+        for (uint8_t i = 0; i < NUM_SWITCHES; i++) {
+          if (pending & (1 << i)) switches.clearRecentPress(i);
+        }
+        pending = 0;
+      }
+    }
+
+    runs[scenario]++;
+    if (!sameOutcome(actual, expected)) {
+      misses[scenario]++;
+      if (!reported) {
+        printf("  trial %u (%s) recognized differently:\n", trial, SCENARIO_NAMES[scenario]);
+        printOutcome("expected", expected);
+        printOutcome("actual", actual);
+        reported = true;
+      }
+    }
+  }
+
+  printf("gestures: %u trials on a %u-entry table\n", trials, CHECK_GESTURE_COUNT);
+  printf("  %-12s %8s %8s\n", "gesture", "trials", "misses");
+  uint32_t totalMisses = 0;
+  for (uint8_t s = 0; s < NUM_SCENARIOS; s++) {
+    printf("  %-12s %8u %8u\n", SCENARIO_NAMES[s], runs[s], misses[s]);
+    totalMisses += misses[s];
+  }
+  printf("  recognizer pass: %.2f-%.2f virtual us over %llu passes\n", minPassNs / 1000.0, maxPassNs / 1000.0,
+         (unsigned long long)passes);
+
+  if (totalMisses) {
+    printf("%u gestures misrecognized\n", totalMisses);
+    return 1;
+  }
+  printf("every gesture recognized\n");
+  return 0;
+}
@@ -0,0 +1,21 @@
+#ifndef GESTURE_CHECK_H
+#define GESTURE_CHECK_H
+
+/**
+ * Gesture recognizer check.
+ *
+ * Usage: gestures [trials] [seed]
+ * Runs the recognizer on a table with a 3-switch chord, a 2-switch chord
+ * that depends on the context, a double tap, a hold, a release and plain
+ * taps, none of which the switcher's own table has. Each trial plays one
+ * gesture with random bounce, spread and timing into the switch handler
+ * and checks what comes out, with chords rolling back the taps they start
+ * as the mode controller does. One gesture is the 2-switch chord with its
+ * first tap taken, and changing the context, before the second lands; it
+ * must still be matched in the context from before. Prints the misses per
+ * gesture and the cost of a recognizer pass on the virtual clock,
+ * pin-change interrupts included. Returns non-zero on any miss.
+ */
+int commandGestures(int argc, char** argv);
+
+#endif
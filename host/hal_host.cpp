@@ -0,0 +1,793 @@
+#include "hal_host.h"
+#include <EEPROM.h>
+#include <util/crc16.h>
+#include <algorithm>
+#include <deque>
+
+// Arduino HardwareSerial TX ring is 64 bytes, one slot is kept free
+#define HOST_SERIAL_TX_CAPACITY 63
+
+const HostCostModel HOST_COST_ATMEGA328 = {
+  3500,     // digitalWrite
+  3000,     // digitalRead
+  4000,     // pinMode
+  500,      // millis / micros
+  5000,     // Serial.write into TX ring
+  1000,     // EEPROM.read
+  3400000,  // EEPROM.write (3.3 ms typical, datasheet table 8-2)
+  4000,     // ISR entry/exit with a call out of the vector (~64 cycles)
+  250,      // PORTx RMW: in, andi, ori, out
+  2800,     // CRC-8 update: 8 rounds of lsl, brcc, eor, dec, brne (~45 cycles)
+  250,      // pgm_read_byte: movw, lpm (4 cycles)
+  560       // memcpy_P per byte: lpm Z+, st X+, subi, sbci, brne (9 cycles)
+};
+
+const HostCostModel HOST_COST_NONE = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+
+HostCostModel g_hostCost = HOST_COST_ATMEGA328;
+
+HardwareSerial Serial;
+EEPROMClass EEPROM;
+
+volatile uint8_t PCICR;
+volatile uint8_t PCMSK0;
+volatile uint8_t PCMSK1;
+volatile uint8_t PCMSK2;
+volatile uint8_t PINB;
+volatile uint8_t PINC;
+volatile uint8_t PIND;
+
+HostPortRegister PORTB(PB);
+HostPortRegister PORTC(PC);
+HostPortRegister PORTD(PD);
+
+volatile uint8_t SPCR;
+volatile uint8_t SPSR;
+HostSpiDataRegister SPDR;
+static uint32_t g_spiBytesTransferred = 0;
+
+volatile uint8_t UCSR0A;
+HostUartControlRegister UCSR0B;
+volatile uint8_t UCSR0C;
+volatile uint16_t UBRR0;
+HostUartDataRegister UDR0;
+
+volatile uint8_t TCCR2A;
+HostTimer2ControlRegister TCCR2B;
+volatile uint8_t OCR2A;
+volatile uint8_t TIMSK2;
+HostTimerFlagRegister TIFR2;
+HostTimer2CounterRegister TCNT2;
+
+volatile uint8_t TCCR1A;
+HostTimer1ControlRegister TCCR1B;
+volatile uint8_t TIMSK1;
+HostTimerFlagRegister TIFR1;
+HostTimer1CounterRegister TCNT1;
+
+// Default vectors for firmware builds that do not use these interrupts
+extern "C" __attribute__((weak)) void PCINT0_vect() {}
+extern "C" __attribute__((weak)) void PCINT1_vect() {}
+extern "C" __attribute__((weak)) void PCINT2_vect() {}
+extern "C" __attribute__((weak)) void USART_RX_vect() {}
+extern "C" __attribute__((weak)) void USART_UDRE_vect() {}
+extern "C" __attribute__((weak)) void TIMER2_COMPA_vect() {}
+extern "C" __attribute__((weak)) void TIMER1_OVF_vect() {}
+
+static uint64_t g_nowNs = 0;
+
+static uint8_t g_pinMode[HOST_NUM_PINS];
+static uint8_t g_outputLevel[HOST_NUM_PINS];
+static uint8_t g_inputLevel[HOST_NUM_PINS];
+static HostPinWriteHook g_pinWriteHook = nullptr;
+
+struct ScheduledInput {
+  uint64_t timeNs;
+  uint8_t pin;
+  uint8_t level;
+};
+
+static std::deque<ScheduledInput> g_scheduledInputs;
+static bool g_interruptsEnabled = true;
+static bool g_inInterrupt = false;
+static uint8_t g_pendingInterrupts = 0;   // PCIFR: bit per PCICR group
+static uint32_t g_interruptCount = 0;
+
+static uint64_t g_serialByteNs = 0;
+static uint64_t g_serialTxEndNs = 0;
+static uint32_t g_serialBytesWritten = 0;
+static HostSerialTxHook g_serialTxHook = nullptr;
+
+// USART0 transmitter: shift register plus the one-byte UDR0 buffer
+static uint64_t g_uartByteNs = 0;
+static uint64_t g_uartShiftEndNs = 0;
+static bool g_uartBufferFull = false;
+static uint8_t g_uartBufferByte = 0;
+static uint64_t g_uartBufferQueuedNs = 0;
+
+// USART0 receiver: bytes arriving from outside, and the one waiting in UDR0
+struct ScheduledRx {
+  uint64_t timeNs;
+  uint8_t data;
+};
+
+static std::deque<ScheduledRx> g_scheduledRx;
+static uint8_t g_uartRxByte = 0;
+
+// Timer2: time from one compare match to the next (0 = stopped) and the next match
+static uint64_t g_timer2PeriodNs = 0;
+static uint64_t g_timer2MatchNs = 0;
+
+// Timer1: clocks per count (0 = stopped), when the count was 0 and the next
+// overflow while it runs, the count it holds while stopped
+static uint16_t g_timer1Prescaler = 0;
+static uint64_t g_timer1ZeroNs = 0;
+static uint64_t g_timer1OverflowNs = 0;
+static uint16_t g_timer1HeldCount = 0;
+
+static uint8_t g_eeprom[HOST_EEPROM_SIZE];
+static uint32_t g_eepromWriteCounts[HOST_EEPROM_SIZE];
+static HostEepromWriteHook g_eepromWriteHook = nullptr;
+static uint64_t g_eepromReadyNs = 0;   // End of the write in progress
+
+void hostReset() {
+  g_nowNs = 0;
+  for (uint8_t i = 0; i < HOST_NUM_PINS; i++) {
+    g_pinMode[i] = INPUT;
+    g_outputLevel[i] = LOW;
+    g_inputLevel[i] = HIGH;
+  }
+  g_pinWriteHook = nullptr;
+  PCICR = 0;
+  PCMSK0 = 0;
+  PCMSK1 = 0;
+  PCMSK2 = 0;
+  PINB = 0xFF;
+  PINC = 0xFF;
+  PIND = 0xFF;
+  SPCR = 0;
+  SPSR = 0;
+  g_spiBytesTransferred = 0;
+  g_scheduledInputs.clear();
+  g_interruptsEnabled = true;
+  g_inInterrupt = false;
+  g_pendingInterrupts = 0;
+  g_interruptCount = 0;
+  g_serialByteNs = 0;
+  g_serialTxEndNs = 0;
+  g_serialBytesWritten = 0;
+  g_serialTxHook = nullptr;
+  UCSR0A = _BV(UDRE0);
+  UCSR0B = 0;
+  UCSR0C = _BV(UCSZ01) | _BV(UCSZ00);
+  UBRR0 = 0;
+  g_uartByteNs = 0;
+  g_uartShiftEndNs = 0;
+  g_uartBufferFull = false;
+  g_scheduledRx.clear();
+  g_uartRxByte = 0;
+  TCCR2A = 0;
+  TCCR2B = 0;
+  OCR2A = 0;
+  TIMSK2 = 0;
+  TIFR2 = 0xFF;
+  g_timer1Prescaler = 0;
+  g_timer1HeldCount = 0;
+  TCCR1A = 0;
+  TCCR1B = 0;
+  TIMSK1 = 0;
+  TIFR1 = 0xFF;
+  memset(g_eeprom, 0xFF, sizeof(g_eeprom));
+  memset(g_eepromWriteCounts, 0, sizeof(g_eepromWriteCounts));
+  g_eepromWriteHook = nullptr;
+  g_eepromReadyNs = 0;
+}
+
+// ===== Virtual clock =====
+
+static void applyInputLevel(uint8_t pin, uint8_t level);
+static void uartShiftComplete();
+static void uartReceive(uint8_t data);
+static void timer2Match();
+static void timer1Overflow();
+
+/**
+ * Move the clock to endNs, applying scheduled inputs and peripheral events
+ * on the way.
+ * @param busy The CPU is executing (a HAL call's cost): time spent in ISRs
+ *             delays the end. Otherwise it is waiting on a timer or
+ *             peripheral and ISRs run inside the wait.
+ */
+static void runClockTo(uint64_t endNs, bool busy) {
+  while (!g_inInterrupt) {
+    const uint64_t inputNs = g_scheduledInputs.empty() ? UINT64_MAX : g_scheduledInputs.front().timeNs;
+    const uint64_t uartNs = g_uartBufferFull ? g_uartShiftEndNs : UINT64_MAX;
+    const uint64_t rxNs = g_scheduledRx.empty() ? UINT64_MAX : g_scheduledRx.front().timeNs;
+    const uint64_t timerNs = g_timer2PeriodNs ? g_timer2MatchNs : UINT64_MAX;
+    const uint64_t timer1Ns = g_timer1Prescaler ? g_timer1OverflowNs : UINT64_MAX;
+    const uint64_t eventNs = std::min(std::min(std::min(inputNs, uartNs), std::min(rxNs, timerNs)), timer1Ns);
+    if (eventNs > endNs) break;
+    if (eventNs > g_nowNs) g_nowNs = eventNs;
+
+    const uint64_t startNs = g_nowNs;
+    if (inputNs == eventNs) {
+      const ScheduledInput input = g_scheduledInputs.front();
+      g_scheduledInputs.pop_front();
+      applyInputLevel(input.pin, input.level);
+    } else if (rxNs == eventNs) {
+      const uint8_t data = g_scheduledRx.front().data;
+      g_scheduledRx.pop_front();
+      uartReceive(data);
+    } else if (timerNs == eventNs) {
+      timer2Match();
+    } else if (timer1Ns == eventNs) {
+      timer1Overflow();
+    } else {
+      uartShiftComplete();
+    }
+    if (busy) endNs += g_nowNs - startNs;
+  }
+  if (endNs > g_nowNs) g_nowNs = endNs;
+}
+
+// CPU time for one HAL call
+static void spendNs(uint64_t ns) {
+  runClockTo(g_nowNs + ns, true);
+}
+
+uint64_t hostNowNs() {
+  return g_nowNs;
+}
+
+void hostAdvanceNs(uint64_t ns) {
+  runClockTo(g_nowNs + ns, false);
+}
+
+void hostAdvanceToNs(uint64_t timeNs) {
+  runClockTo(timeNs, false);
+}
+
+unsigned long millis() {
+  spendNs(g_hostCost.millisNs);
+  return (unsigned long)(g_nowNs / 1000000ULL);
+}
+
+unsigned long micros() {
+  spendNs(g_hostCost.millisNs);
+  return (unsigned long)(g_nowNs / 1000ULL);
+}
+
+void delay(unsigned long ms) {
+  // delay() polls micros(), so interrupts do not stretch it
+  runClockTo(g_nowNs + (uint64_t)ms * 1000000ULL, false);
+}
+
+void delayMicroseconds(unsigned int us) {
+  // Cycle-counted busy loop
+  spendNs((uint64_t)us * 1000ULL);
+}
+
+// ===== Interrupts =====
+
+static bool uartRxInterruptPending() {
+  return (UCSR0A & _BV(RXC0)) && (UCSR0B & _BV(RXCIE0));
+}
+
+static bool uartTxInterruptPending() {
+  return (UCSR0A & _BV(UDRE0)) && (UCSR0B & _BV(UDRIE0));
+}
+
+static bool timer2InterruptPending() {
+  return (TIFR2 & _BV(OCF2A)) && (TIMSK2 & _BV(OCIE2A));
+}
+
+static bool timer1InterruptPending() {
+  return (TIFR1 & _BV(TOV1)) && (TIMSK1 & _BV(TOIE1));
+}
+
+static void serviceInterrupts() {
+  while (g_interruptsEnabled && !g_inInterrupt &&
+         (g_pendingInterrupts || timer2InterruptPending() || timer1InterruptPending() || uartRxInterruptPending() ||
+          uartTxInterruptPending())) {
+    g_inInterrupt = true;
+    g_interruptCount++;
+    spendNs(g_hostCost.interruptNs);
+
+    // Lowest vector number first, as the AVR prioritises them: PCINT0-2, TIMER2 COMPA, TIMER1 OVF,
+    // USART RX, UDRE
+    if (g_pendingInterrupts) {
+      const uint8_t group = (g_pendingInterrupts & 0x01) ? 0 : ((g_pendingInterrupts & 0x02) ? 1 : 2);
+      g_pendingInterrupts &= ~(1 << group);
+      if (group == 0) PCINT0_vect();
+      else if (group == 1) PCINT1_vect();
+      else PCINT2_vect();
+    } else if (timer2InterruptPending()) {
+      TIFR2 = _BV(OCF2A);
+      TIMER2_COMPA_vect();
+    } else if (timer1InterruptPending()) {
+      TIFR1 = _BV(TOV1);
+      TIMER1_OVF_vect();
+    } else if (uartRxInterruptPending()) {
+      // Level triggered: runs again until the vector reads UDR0
+      USART_RX_vect();
+    } else {
+      // Level triggered: runs again until the vector fills UDR0 or clears UDRIE0
+      USART_UDRE_vect();
+    }
+    g_inInterrupt = false;
+  }
+}
+
+void noInterrupts() {
+  g_interruptsEnabled = false;
+}
+
+void interrupts() {
+  g_interruptsEnabled = true;
+  serviceInterrupts();
+}
+
+uint32_t hostInterruptCount() {
+  return g_interruptCount;
+}
+
+// ===== Pins =====
+
+// Mirror the level seen on a pin into its PINx register
+static void syncPortRegister(uint8_t pin) {
+  const uint8_t level = (g_pinMode[pin] == OUTPUT) ? g_outputLevel[pin] : g_inputLevel[pin];
+  volatile uint8_t* reg = portInputRegister(digitalPinToPort(pin));
+  if (level) *reg |= digitalPinToBitMask(pin);
+  else *reg &= ~digitalPinToBitMask(pin);
+}
+
+void pinMode(uint8_t pin, uint8_t mode) {
+  spendNs(g_hostCost.pinModeNs);
+  if (pin >= HOST_NUM_PINS) return;
+  const uint8_t previousMode = g_pinMode[pin];
+  g_pinMode[pin] = mode;
+
+  // The core sets the PORT latch to enable/disable the pullup
+  if (mode == INPUT_PULLUP) g_outputLevel[pin] = HIGH;
+  else if (mode == INPUT) g_outputLevel[pin] = LOW;
+  syncPortRegister(pin);
+
+  // A latch set HIGH beforehand is driven out as soon as the pin becomes an output
+  if (mode == OUTPUT && previousMode != OUTPUT && g_outputLevel[pin] == HIGH && g_pinWriteHook) {
+    g_pinWriteHook(pin, HIGH, g_nowNs);
+  }
+}
+
+// Set a pin's PORT latch; only output pins drive the change out
+static void driveOutput(uint8_t pin, uint8_t level) {
+  if (g_outputLevel[pin] == level) return;
+  g_outputLevel[pin] = level;
+  syncPortRegister(pin);
+  if (g_pinWriteHook && g_pinMode[pin] == OUTPUT) g_pinWriteHook(pin, level, g_nowNs);
+}
+
+void digitalWrite(uint8_t pin, uint8_t val) {
+  spendNs(g_hostCost.digitalWriteNs);
+  if (pin >= HOST_NUM_PINS) return;
+  driveOutput(pin, val ? HIGH : LOW);
+}
+
+HostPortRegister::operator uint8_t() const {
+  uint8_t value = 0;
+  for (uint8_t pin = 0; pin < HOST_NUM_PINS; pin++) {
+    if (digitalPinToPort(pin) != port) continue;
+    // On input pins the latch is the pullup enable
+    if (g_outputLevel[pin]) value |= digitalPinToBitMask(pin);
+  }
+  return value;
+}
+
+HostPortRegister& HostPortRegister::operator=(uint8_t value) {
+  spendNs(g_hostCost.portWriteNs);
+  for (uint8_t pin = 0; pin < HOST_NUM_PINS; pin++) {
+    if (digitalPinToPort(pin) != port) continue;
+    driveOutput(pin, (value & digitalPinToBitMask(pin)) ? HIGH : LOW);
+  }
+  return *this;
+}
+
+int digitalRead(uint8_t pin) {
+  spendNs(g_hostCost.digitalReadNs);
+  if (pin >= HOST_NUM_PINS) return LOW;
+  if (g_pinMode[pin] == OUTPUT) return g_outputLevel[pin];
+  return g_inputLevel[pin];
+}
+
+void shiftOut(uint8_t dataPin, uint8_t clockPin, uint8_t bitOrder, uint8_t val) {
+  // Same sequence as wiring_shift.c
+  for (uint8_t i = 0; i < 8; i++) {
+    if (bitOrder == LSBFIRST) digitalWrite(dataPin, !!(val & (1 << i)));
+    else digitalWrite(dataPin, !!(val & (1 << (7 - i))));
+    digitalWrite(clockPin, HIGH);
+    digitalWrite(clockPin, LOW);
+  }
+}
+
+static void applyInputLevel(uint8_t pin, uint8_t level) {
+  if (pin >= HOST_NUM_PINS) return;
+  level = level ? HIGH : LOW;
+  if (g_inputLevel[pin] == level) return;
+  g_inputLevel[pin] = level;
+  if (g_pinMode[pin] == OUTPUT) return;
+  syncPortRegister(pin);
+
+  // Pin-change interrupts fire on either edge of an enabled pin
+  const uint8_t group = digitalPinToPCICRbit(pin);
+  const bool enabled = (PCICR & _BV(group)) && (*digitalPinToPCMSK(pin) & _BV(digitalPinToPCMSKbit(pin)));
+  if (!enabled) return;
+  g_pendingInterrupts |= _BV(group);
+  serviceInterrupts();
+}
+
+void hostSetInputLevel(uint8_t pin, uint8_t level) {
+  applyInputLevel(pin, level);
+}
+
+void hostScheduleInputLevel(uint8_t pin, uint8_t level, uint64_t timeNs) {
+  const ScheduledInput input = {timeNs, pin, level};
+  // Keep time order; equal times stay in the order they were scheduled
+  std::deque<ScheduledInput>::iterator it = g_scheduledInputs.end();
+  while (it != g_scheduledInputs.begin() && (it - 1)->timeNs > timeNs) --it;
+  g_scheduledInputs.insert(it, input);
+}
+
+uint8_t hostGetOutputLevel(uint8_t pin) {
+  return (pin < HOST_NUM_PINS) ? g_outputLevel[pin] : LOW;
+}
+
+uint8_t hostGetPinMode(uint8_t pin) {
+  return (pin < HOST_NUM_PINS) ? g_pinMode[pin] : INPUT;
+}
+
+void hostSetPinWriteHook(HostPinWriteHook hook) {
+  g_pinWriteHook = hook;
+}
+
+// ===== SPI =====
+
+HostSpiDataRegister& HostSpiDataRegister::operator=(uint8_t value) {
+  SPSR &= ~_BV(SPIF);
+  received = 0xFF;  // MISO idles high, nothing listens
+  if ((SPCR & (_BV(SPE) | _BV(MSTR))) != (_BV(SPE) | _BV(MSTR))) return *this;
+
+  // fosc / 4, 16, 64, 128, halved by SPI2X; 62.5 ns per fosc cycle at 16 MHz
+  static const uint8_t DIVIDERS[4] = {4, 16, 64, 128};
+  const uint32_t divider = DIVIDERS[SPCR & 0x03] >> ((SPSR & _BV(SPI2X)) ? 1 : 0);
+  const uint64_t halfBitNs = divider * 125 / 4;
+  const bool lsbFirst = SPCR & _BV(DORD);
+
+  // Mode 0 only (CPOL = CPHA = 0): data set up while SCK is low, sampled on the rising edge
+  for (uint8_t i = 0; i < 8; i++) {
+    const uint8_t bit = lsbFirst ? i : 7 - i;
+    if (g_pinMode[MOSI] == OUTPUT) driveOutput(MOSI, (value >> bit) & 1);
+    spendNs(halfBitNs);
+    if (g_pinMode[SCK] == OUTPUT) driveOutput(SCK, HIGH);
+    spendNs(halfBitNs);
+    if (g_pinMode[SCK] == OUTPUT) driveOutput(SCK, LOW);
+  }
+
+  g_spiBytesTransferred++;
+  SPSR |= _BV(SPIF);
+  return *this;
+}
+
+uint32_t hostSpiBytesTransferred() {
+  return g_spiBytesTransferred;
+}
+
+// ===== Serial =====
+
+void HardwareSerial::begin(unsigned long baud) {
+  // 8N1: 10 bit times per byte
+  g_serialByteNs = (baud > 0) ? (10ULL * 1000000000ULL) / baud : 0;
+  g_serialTxEndNs = g_nowNs;
+}
+
+void HardwareSerial::end() {
+  flush();
+}
+
+size_t HardwareSerial::write(uint8_t b) {
+  spendNs(g_hostCost.serialWriteNs);
+
+  // Block like HardwareSerial::write() does while the TX ring is full
+  const uint64_t ringSpanNs = (uint64_t)HOST_SERIAL_TX_CAPACITY * g_serialByteNs;
+  if (g_serialTxEndNs > g_nowNs + ringSpanNs) {
+    runClockTo(g_serialTxEndNs - ringSpanNs, false);
+  }
+
+  const uint64_t wireStartNs = (g_serialTxEndNs > g_nowNs) ? g_serialTxEndNs : g_nowNs;
+  g_serialTxEndNs = wireStartNs + g_serialByteNs;
+  g_serialBytesWritten++;
+  if (g_serialTxHook) g_serialTxHook(b, g_nowNs, wireStartNs);
+  return 1;
+}
+
+size_t HardwareSerial::write(const uint8_t* buffer, size_t size) {
+  for (size_t i = 0; i < size; i++) write(buffer[i]);
+  return size;
+}
+
+int HardwareSerial::availableForWrite() {
+  if (g_serialByteNs == 0 || g_serialTxEndNs <= g_nowNs) return HOST_SERIAL_TX_CAPACITY;
+  // Bytes still waiting in the ring (the one in the shift register is not counted)
+  const uint64_t pending = (g_serialTxEndNs - g_nowNs + g_serialByteNs - 1) / g_serialByteNs - 1;
+  return (pending >= HOST_SERIAL_TX_CAPACITY) ? 0 : (int)(HOST_SERIAL_TX_CAPACITY - pending);
+}
+
+void HardwareSerial::flush() {
+  hostAdvanceToNs(g_serialTxEndNs);
+}
+
+size_t HardwareSerial::printNumber(unsigned long n, int base) {
+  char buf[8 * sizeof(long) + 1];
+  char* str = &buf[sizeof(buf) - 1];
+  *str = '\0';
+  if (base < 2) base = 10;
+  do {
+    const char c = n % base;
+    n /= base;
+    *--str = c < 10 ? c + '0' : c + 'A' - 10;
+  } while (n);
+  return print(str);
+}
+
+size_t HardwareSerial::print(const char* s) {
+  return write((const uint8_t*)s, strlen(s));
+}
+
+size_t HardwareSerial::print(char c) {
+  return write((uint8_t)c);
+}
+
+size_t HardwareSerial::print(unsigned char n, int base) {
+  return printNumber(n, base);
+}
+
+size_t HardwareSerial::print(int n, int base) {
+  return print((long)n, base);
+}
+
+size_t HardwareSerial::print(unsigned int n, int base) {
+  return printNumber(n, base);
+}
+
+size_t HardwareSerial::print(long n, int base) {
+  if (base == 10 && n < 0) {
+    return print('-') + printNumber((unsigned long)(-n), 10);
+  }
+  return printNumber((unsigned long)n, base);
+}
+
+size_t HardwareSerial::print(unsigned long n, int base) {
+  return printNumber(n, base);
+}
+
+size_t HardwareSerial::println() {
+  return print("\r\n");
+}
+
+// ===== Timer2 =====
+
+HostTimer2ControlRegister& HostTimer2ControlRegister::operator=(uint8_t newValue) {
+  static const uint16_t PRESCALERS[8] = {0, 1, 8, 32, 64, 128, 256, 1024};
+  value = newValue;
+  const uint16_t prescaler = PRESCALERS[value & 0x07];
+  const bool ctc = (TCCR2A & (_BV(WGM21) | _BV(WGM20))) == _BV(WGM21);
+  g_timer2PeriodNs = (prescaler && ctc) ? (OCR2A + 1ULL) * prescaler * 1000000000ULL / F_CPU : 0;
+  g_timer2MatchNs = g_nowNs + g_timer2PeriodNs;
+  return *this;
+}
+
+HostTimer2CounterRegister::operator uint8_t() const {
+  if (!g_timer2PeriodNs) return 0;
+  const uint64_t sinceMatchNs = g_nowNs + g_timer2PeriodNs - g_timer2MatchNs;
+  return (uint8_t)(sinceMatchNs * (OCR2A + 1ULL) / g_timer2PeriodNs);
+}
+
+HostTimer2CounterRegister& HostTimer2CounterRegister::operator=(uint8_t) {
+  g_timer2MatchNs = g_nowNs + g_timer2PeriodNs;
+  return *this;
+}
+
+static void timer2Match() {
+  g_timer2MatchNs += g_timer2PeriodNs;
+  TIFR2.set(_BV(OCF2A));
+  serviceInterrupts();
+}
+
+uint64_t hostTimer2NextMatchNs() {
+  return g_timer2PeriodNs ? g_timer2MatchNs : UINT64_MAX;
+}
+
+// ===== Timer1 =====
+
+// Time from 0 round to 0 again
+static uint64_t timer1WrapNs() {
+  return 0x10000ULL * g_timer1Prescaler * 1000000000ULL / F_CPU;
+}
+
+HostTimer1ControlRegister& HostTimer1ControlRegister::operator=(uint8_t newValue) {
+  static const uint16_t PRESCALERS[8] = {0, 1, 8, 64, 256, 1024, 0, 0};
+  // The count carries on from where it stopped
+  const uint16_t count = TCNT1;
+  value = newValue;
+  const uint16_t prescaler = PRESCALERS[value & 0x07];
+  const bool normal = !(TCCR1A & 0x03) && !(value & 0x18);
+  g_timer1Prescaler = normal ? prescaler : 0;
+  TCNT1 = count;
+  return *this;
+}
+
+HostTimer1CounterRegister::operator uint16_t() const {
+  if (!g_timer1Prescaler) return g_timer1HeldCount;
+  // A count can be shorter than a nanosecond's fraction allows: work in clocks
+  return (uint16_t)((g_nowNs - g_timer1ZeroNs) * F_CPU / (g_timer1Prescaler * 1000000000ULL));
+}
+
+HostTimer1CounterRegister& HostTimer1CounterRegister::operator=(uint16_t value) {
+  if (!g_timer1Prescaler) {
+    g_timer1HeldCount = value;
+    return *this;
+  }
+  g_timer1ZeroNs = g_nowNs - value * g_timer1Prescaler * 1000000000ULL / F_CPU;
+  g_timer1OverflowNs = g_timer1ZeroNs + timer1WrapNs();
+  return *this;
+}
+
+static void timer1Overflow() {
+  g_timer1ZeroNs = g_timer1OverflowNs;
+  g_timer1OverflowNs += timer1WrapNs();
+  TIFR1.set(_BV(TOV1));
+  serviceInterrupts();
+}
+
+// ===== USART0 =====
+
+HostUartControlRegister& HostUartControlRegister::operator=(uint8_t newValue) {
+  const bool enablingTx = (newValue & _BV(TXEN0)) && !(value & _BV(TXEN0));
+  value = newValue;
+  if (enablingTx) {
+    // 8N1, 10 bit times per byte; baud = F_CPU / (16 or 8 with U2X0) / (UBRR0 + 1)
+    const uint64_t divider = ((UCSR0A & _BV(U2X0)) ? 8ULL : 16ULL) * (UBRR0 + 1ULL);
+    g_uartByteNs = 10ULL * divider * 1000000000ULL / F_CPU;
+  }
+  serviceInterrupts();
+  return *this;
+}
+
+HostUartDataRegister::operator uint8_t() const {
+  // Reading takes the byte and its error flags out of the receive buffer
+  UCSR0A &= ~(_BV(RXC0) | _BV(FE0) | _BV(DOR0));
+  return g_uartRxByte;
+}
+
+HostUartDataRegister& HostUartDataRegister::operator=(uint8_t value) {
+  // Writes with the buffer full, or with the transmitter off, are lost
+  if (!(UCSR0B & _BV(TXEN0)) || g_uartBufferFull) return *this;
+
+  if (g_uartShiftEndNs <= g_nowNs) {
+    // Transmitter idle: straight into the shift register, buffer stays empty
+    g_uartShiftEndNs = g_nowNs + g_uartByteNs;
+    g_serialBytesWritten++;
+    if (g_serialTxHook) g_serialTxHook(value, g_nowNs, g_nowNs);
+  } else {
+    g_uartBufferFull = true;
+    g_uartBufferByte = value;
+    g_uartBufferQueuedNs = g_nowNs;
+    UCSR0A &= ~_BV(UDRE0);
+  }
+  return *this;
+}
+
+// Shift register done with a byte while another waits in UDR0
+static void uartShiftComplete() {
+  g_uartBufferFull = false;
+  const uint64_t wireStartNs = g_uartShiftEndNs;
+  g_uartShiftEndNs = wireStartNs + g_uartByteNs;
+  g_serialBytesWritten++;
+  if (g_serialTxHook) g_serialTxHook(g_uartBufferByte, g_uartBufferQueuedNs, wireStartNs);
+
+  UCSR0A |= _BV(UDRE0);
+  serviceInterrupts();
+}
+
+// Stop bit of an incoming byte sampled
+static void uartReceive(uint8_t data) {
+  if (!(UCSR0B & _BV(RXEN0))) return;
+  if (UCSR0A & _BV(RXC0)) {
+    // Previous byte never read: this one is lost (the MCU's second FIFO slot is not modelled)
+    UCSR0A |= _BV(DOR0);
+    return;
+  }
+  g_uartRxByte = data;
+  UCSR0A |= _BV(RXC0);
+  serviceInterrupts();
+}
+
+void hostScheduleSerialRx(uint8_t data, uint64_t timeNs) {
+  const ScheduledRx rx = {timeNs, data};
+  std::deque<ScheduledRx>::iterator it = g_scheduledRx.end();
+  while (it != g_scheduledRx.begin() && (it - 1)->timeNs > timeNs) --it;
+  g_scheduledRx.insert(it, rx);
+}
+
+void hostSetSerialTxHook(HostSerialTxHook hook) {
+  g_serialTxHook = hook;
+}
+
+uint32_t hostSerialBytesWritten() {
+  return g_serialBytesWritten;
+}
+
+// ===== EEPROM =====
+
+// avr-libc polls EEPE before every access; interrupts are still serviced
+static void eepromWaitReady() {
+  if (g_nowNs < g_eepromReadyNs) runClockTo(g_eepromReadyNs, false);
+}
+
+bool eeprom_is_ready() {
+  return g_nowNs >= g_eepromReadyNs;
+}
+
+uint8_t EEPROMClass::read(int idx) {
+  eepromWaitReady();
+  spendNs(g_hostCost.eepromReadNs);
+  if (idx < 0 || idx >= HOST_EEPROM_SIZE) return 0xFF;
+  return g_eeprom[idx];
+}
+
+void EEPROMClass::write(int idx, uint8_t val) {
+  eepromWaitReady();
+  spendNs(g_hostCost.eepromReadNs);
+  if (idx < 0 || idx >= HOST_EEPROM_SIZE) return;
+  g_eeprom[idx] = val;
+  g_eepromWriteCounts[idx]++;
+  g_eepromReadyNs = g_nowNs + g_hostCost.eepromWriteNs;
+  if (g_eepromWriteHook) g_eepromWriteHook((uint16_t)idx, val, g_nowNs);
+}
+
+void EEPROMClass::update(int idx, uint8_t val) {
+  if (read(idx) != val) write(idx, val);
+}
+
+uint8_t* hostEepromData() {
+  return g_eeprom;
+}
+
+const uint32_t* hostEepromWriteCounts() {
+  return g_eepromWriteCounts;
+}
+
+void hostSetEepromWriteHook(HostEepromWriteHook hook) {
+  g_eepromWriteHook = hook;
+}
+
+// ===== Program memory =====
+
+uint8_t pgm_read_byte(const void* address) {
+  spendNs(g_hostCost.progmemReadNs);
+  return *(const uint8_t*)address;
+}
+
+void* memcpy_P(void* dest, const void* src, size_t n) {
+  spendNs((uint64_t)n * g_hostCost.progmemCopyNs);
+  return memcpy(dest, src, n);
+}
+
+// ===== CRC (util/crc16.h) =====
+
+uint8_t _crc8_ccitt_update(uint8_t crc, uint8_t data) {
+  spendNs(g_hostCost.crc8Ns);
+  crc ^= data;
+  for (uint8_t i = 0; i < 8; i++) {
+    crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x07) : (uint8_t)(crc << 1);
+  }
+  return crc;
+}
@@ -0,0 +1,128 @@
+#ifndef HAL_HOST_H
+#define HAL_HOST_H
+
+#include <Arduino.h>
+
+/**
+ * Host HAL control surface.
+ *
+ * The firmware only sees the Arduino API (Arduino.h, EEPROM.h), the AVR
+ * registers Arduino.h emulates and avr-libc's util/crc16.h.
+ * Host tools use the functions below to drive inputs, move the virtual clock
+ * and observe outputs.
+ *
+ * Virtual time is kept in nanoseconds. It only moves when a host tool
+ * advances it or when the firmware calls into the HAL, which charges the
+ * ATmega328 cost of that call (see HostCostModel). A busy firmware pass
+ * therefore takes virtual time just like it would on the board.
+ *
+ * Input changes can be scheduled ahead of time. They are applied the moment
+ * the clock reaches them, even in the middle of a firmware call, and any
+ * enabled pin-change interrupt runs right there, as it would on the MCU.
+ */
+
+// Uno/Nano digital pins D0-D13 plus A0-A5
+#define HOST_NUM_PINS 20
+
+/**
+ * Approximate ATmega328 @ 16 MHz cost of each HAL call, in nanoseconds.
+ * Figures are from the Arduino AVR core (digitalWrite/digitalRead do a
+ * pin-table lookup, timer check and SREG save/restore) and the datasheet
+ * (EEPROM programming time), or counted from the instructions avr-libc
+ * emits (CRC-8, flash reads). Set all fields to zero to measure pure logic.
+ */
+struct HostCostModel {
+  uint32_t digitalWriteNs;
+  uint32_t digitalReadNs;
+  uint32_t pinModeNs;
+  uint32_t millisNs;
+  uint32_t serialWriteNs;     // Putting one byte into the TX ring
+  uint32_t eepromReadNs;      // One EEPROM access: a read, or starting a write
+  uint32_t eepromWriteNs;     // Erase + write; the next access waits until done
+  uint32_t interruptNs;       // ISR entry/exit: vector jump, register save/restore, reti
+  uint32_t portWriteNs;       // Read-modify-write of a PORTx register
+  uint32_t crc8Ns;            // One byte through _crc8_ccitt_update
+  uint32_t progmemReadNs;     // pgm_read_byte: Z set up, then lpm
+  uint32_t progmemCopyNs;     // One byte of memcpy_P: lpm, st and the loop around them
+};
+
+extern HostCostModel g_hostCost;
+
+// Default (realistic) and zero cost models
+extern const HostCostModel HOST_COST_ATMEGA328;
+extern const HostCostModel HOST_COST_NONE;
+
+// Observers, called after the HAL applies the change. Timestamps are virtual ns.
+typedef void (*HostPinWriteHook)(uint8_t pin, uint8_t level, uint64_t timeNs);
+typedef void (*HostSerialTxHook)(uint8_t data, uint64_t queuedNs, uint64_t wireStartNs);
+typedef void (*HostEepromWriteHook)(uint16_t address, uint8_t value, uint64_t timeNs);
+
+/**
+ * Reset pins, clock, EEPROM (erased), serial state and hooks.
+ * The cost model is left untouched.
+ */
+void hostReset();
+
+// ===== Virtual clock =====
+uint64_t hostNowNs();
+void hostAdvanceNs(uint64_t ns);
+void hostAdvanceToNs(uint64_t timeNs);
+
+// ===== Pins =====
+/**
+ * Drive an input pin from outside the MCU (e.g. a footswitch contact).
+ * @param pin Arduino pin number
+ * @param level HIGH or LOW as seen on the pin
+ */
+void hostSetInputLevel(uint8_t pin, uint8_t level);
+uint8_t hostGetOutputLevel(uint8_t pin);
+uint8_t hostGetPinMode(uint8_t pin);
+void hostSetPinWriteHook(HostPinWriteHook hook);
+
+/**
+ * Queue an input change for a future time. The change is applied (and its
+ * pin-change interrupt run) when the virtual clock reaches timeNs; a time
+ * already in the past applies at the next clock movement.
+ */
+void hostScheduleInputLevel(uint8_t pin, uint8_t level, uint64_t timeNs);
+
+/**
+ * @return Number of bytes clocked out by the SPI peripheral since hostReset()
+ */
+uint32_t hostSpiBytesTransferred();
+
+/**
+ * @return Number of pin-change ISRs run since hostReset()
+ */
+uint32_t hostInterruptCount();
+
+// ===== Serial (MIDI TX) =====
+// Bytes sent through Serial and through the USART0 registers (UDR0) both
+// reach the hook and the count; wireStartNs is when the start bit goes out
+void hostSetSerialTxHook(HostSerialTxHook hook);
+uint32_t hostSerialBytesWritten();
+
+// ===== USART0 receive (MIDI IN) =====
+// 8N1 at 31250 baud: a byte takes 320 us on the wire
+#define HOST_MIDI_BYTE_NS 320000ULL
+
+/**
+ * Queue a byte arriving on RX. At timeNs its stop bit is sampled: the byte
+ * lands in UDR0 and USART_RX_vect runs if enabled. A byte that arrives
+ * before the previous one was read is lost and sets DOR0.
+ */
+void hostScheduleSerialRx(uint8_t data, uint64_t timeNs);
+
+// ===== Timer2 =====
+/**
+ * @return Virtual time of Timer2's next compare match, UINT64_MAX while it
+ *         is stopped
+ */
+uint64_t hostTimer2NextMatchNs();
+
+// ===== EEPROM =====
+uint8_t* hostEepromData();
+const uint32_t* hostEepromWriteCounts();
+void hostSetEepromWriteHook(HostEepromWriteHook hook);
+
+#endif
@@ -0,0 +1,199 @@
+/**
+ * Host runner for the native environment.
+ *
+ * Builds the firmware modules from src_archive/ against the host HAL and
+ * drives them on the virtual clock.
+ *
+ * Usage: program [command] [options]
+ *   soak [presses] [seed]       Random footswitch presses with contact bounce,
+ *                               reports simulated edges per wall-clock second
+ *   sim <trace> [golden]        Replay a trace and print the relay/MIDI/display
+ *                               timeline, or compare it against a golden file
+ *   bench [trials] [seed]       Press-to-action latency per gesture against budgets
+ *   debounce [presses] [seed]   Check the vertical-counter debouncer against the
+ *                               time-based reference
+ *   miditx [bursts] [seed]      Push 128-message bursts through the MIDI transmit
+ *                               queue and check it never blocks or corrupts
+ *   midirx [messages] [seed]    Check the MIDI input parser and the delay from a
+ *                               received PC/CC to the relays
+ *   midithru [messages] [seed]  Forward MIDI IN to OUT merged with the switcher's
+ *                               own messages; reports per-byte delay and jitter
+ *   store [saves] [seed]        Save presets with random power cuts; checks every
+ *                               boot recovers them and reports EEPROM wear
+ *   storeboot [seed]            Time preset loading and boot to ready by EEPROM contents
+ *   restore [cycles] [seed]     Power-cycle mid-session; checks each power-up restores
+ *                               the last saved session and times reset to relays set
+ *   sched [seconds] [seed]      Gestures and MIDI traffic under load; checks every
+ *                               main-loop task meets its deadline
+ *   eventlog [seconds] [seed]   Read the event log back over MIDI SysEx and check it
+ *                               against the simulated run
+ *   syxlog <file.syx>           Decode an event log dump captured from MIDI OUT
+ *   presetdump [seed]           Dump the presets over MIDI SysEx and restore them
+ *                               into another unit; times both against the wire
+ *   syxpresets <dump.syx> [out] Print a preset dump captured from MIDI OUT, or
+ *                               write the restore that sends it back
+ *   gestures [trials] [seed]    Check chord, hold, double-tap and release recognition
+ *                               on a table of gestures the switcher does not use
+ *   modes [depth]               Explore every reachable mode state, or to depth events, and
+ *                               check it is legal; reports mode transitions per second
+ *   profile [seconds] [seed]    Read the hot-path profile back over MIDI SysEx
+ *                               (PROFILE_MODE builds)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "hal_host.h"
+#include "simulator.h"
+#include "bench.h"
+#include "debounce_check.h"
+#include "midi_tx_check.h"
+#include "midi_rx_check.h"
+#include "midi_thru_check.h"
+#include "preset_store_check.h"
+#include "session_check.h"
+#include "scheduler_check.h"
+#include "event_log_check.h"
+#include "preset_transfer_check.h"
+#include "gesture_check.h"
+#include "mode_check.h"
+#include "profiler_check.h"
+
+// Time simulated after the last trace event so trailing timeouts show up
+static const uint64_t SIM_TAIL_NS = 3000ULL * 1000000ULL;
+
+static double wallSeconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int commandSoak(int argc, char** argv) {
+  const uint32_t presses = (argc > 0) ? strtoul(argv[0], nullptr, 10) : 100000;
+  Rng rng((argc > 1) ? strtoul(argv[1], nullptr, 10) : 1);
+
+  Simulator sim;
+  sim.begin(false);
+
+  std::vector<TraceEvent> trace;
+  uint64_t timeUs = sim.bootNs() / 1000;
+  for (uint32_t i = 0; i < presses; i++) {
+    const uint8_t sw = rng.between(0, NUM_SWITCHES - 1);
+    timeUs = appendBouncedEdge(trace, rng, timeUs, sw, LOW) + rng.between(40, 400) * 1000ULL;
+    timeUs = appendBouncedEdge(trace, rng, timeUs, sw, HIGH) + rng.between(40, 600) * 1000ULL;
+  }
+
+  const double wallStart = wallSeconds();
+  sim.play(trace.data(), trace.size());
+  const double wallElapsed = wallSeconds() - wallStart;
+  const double virtualSeconds = hostNowNs() / 1e9;
+
+  printf("soak: %u presses, %zu switch edges\n", presses, trace.size());
+  printf("  virtual time   %.1f s (%.1f h)\n", virtualSeconds, virtualSeconds / 3600.0);
+  printf("  wall time      %.3f s\n", wallElapsed);
+  printf("  edges/s        %.0f\n", trace.size() / wallElapsed);
+  printf("  speedup        %.0fx real time\n", virtualSeconds / wallElapsed);
+  printf("  MIDI bytes     %u\n", hostSerialBytesWritten());
+  return 0;
+}
+
+/**
+ * Compare two timelines line by line.
+ * @return true if identical; otherwise prints the first difference
+ */
+static bool compareTimelines(const char* actual, const char* goldenPath) {
+  FILE* golden = fopen(goldenPath, "r");
+  if (!golden) {
+    fprintf(stderr, "cannot open golden %s\n", goldenPath);
+    return false;
+  }
+
+  const char* cursor = actual;
+  char expected[256];
+  unsigned lineNumber = 0;
+  bool same = true;
+
+  while (same) {
+    const bool haveExpected = fgets(expected, sizeof(expected), golden) != nullptr;
+    const bool haveActual = *cursor != '\0';
+    if (!haveExpected && !haveActual) break;
+    lineNumber++;
+
+    const char* eol = strchr(cursor, '\n');
+    const size_t actualLen = eol ? (size_t)(eol - cursor + 1) : strlen(cursor);
+
+    if (!haveExpected || !haveActual || strlen(expected) != actualLen || strncmp(expected, cursor, actualLen) != 0) {
+      fprintf(stderr, "timeline differs from %s at line %u\n", goldenPath, lineNumber);
+      fprintf(stderr, "  golden: %s", haveExpected ? expected : "<end>\n");
+      fprintf(stderr, "  actual: %.*s", (int)actualLen, haveActual ? cursor : "<end>\n");
+      if (haveActual && !eol) fputc('\n', stderr);
+      same = false;
+    }
+    cursor += actualLen;
+  }
+
+  fclose(golden);
+  return same;
+}
+
+static int commandSim(int argc, char** argv) {
+  if (argc < 1) {
+    fprintf(stderr, "usage: sim <trace> [golden]\n");
+    return 2;
+  }
+
+  std::vector<TraceEvent> trace;
+  if (!Simulator::loadTrace(argv[0], trace)) return 2;
+
+  Simulator sim;
+  sim.begin(true);
+  sim.play(trace.data(), trace.size());
+  sim.runUntilNs(hostNowNs() + SIM_TAIL_NS);
+
+  if (argc < 2) {
+    sim.writeTimeline(stdout);
+    return 0;
+  }
+
+  char* text = nullptr;
+  size_t textLen = 0;
+  FILE* buffer = open_memstream(&text, &textLen);
+  sim.writeTimeline(buffer);
+  fclose(buffer);
+
+  const bool same = compareTimelines(text, argv[1]);
+  free(text);
+  if (same) printf("timeline matches %s (%zu entries)\n", argv[1], sim.timeline().size());
+  return same ? 0 : 1;
+}
+
+int main(int argc, char** argv) {
+  const char* command = (argc > 1) ? argv[1] : "soak";
+  const int subArgc = (argc > 2) ? argc - 2 : 0;
+  char** subArgv = argv + 2;
+
+  if (strcmp(command, "soak") == 0) return commandSoak(subArgc, subArgv);
+  if (strcmp(command, "sim") == 0) return commandSim(subArgc, subArgv);
+  if (strcmp(command, "bench") == 0) return commandBench(subArgc, subArgv);
+  if (strcmp(command, "debounce") == 0) return commandDebounce(subArgc, subArgv);
+  if (strcmp(command, "miditx") == 0) return commandMidiTx(subArgc, subArgv);
+  if (strcmp(command, "midirx") == 0) return commandMidiRx(subArgc, subArgv);
+  if (strcmp(command, "midithru") == 0) return commandMidiThru(subArgc, subArgv);
+  if (strcmp(command, "store") == 0) return commandStore(subArgc, subArgv);
+  if (strcmp(command, "storeboot") == 0) return commandStoreBoot(subArgc, subArgv);
+  if (strcmp(command, "restore") == 0) return commandRestore(subArgc, subArgv);
+  if (strcmp(command, "sched") == 0) return commandSched(subArgc, subArgv);
+  if (strcmp(command, "eventlog") == 0) return commandEventLog(subArgc, subArgv);
+  if (strcmp(command, "syxlog") == 0) return commandSyxLog(subArgc, subArgv);
+  if (strcmp(command, "presetdump") == 0) return commandPresetDump(subArgc, subArgv);
+  if (strcmp(command, "syxpresets") == 0) return commandSyxPresets(subArgc, subArgv);
+  if (strcmp(command, "gestures") == 0) return commandGestures(subArgc, subArgv);
+  if (strcmp(command, "modes") == 0) return commandModes(subArgc, subArgv);
+  if (strcmp(command, "profile") == 0) return commandProfile(subArgc, subArgv);
+
+  fprintf(stderr, "unknown command: %s\n", command);
+  fprintf(stderr, "usage: %s [soak|sim|bench|debounce|miditx|midirx|midithru|store|storeboot|restore|sched|eventlog|syxlog|presetdump|syxpresets|gestures|modes|profile]\n", argv[0]);
+  return 2;
+}
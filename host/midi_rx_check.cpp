@@ -0,0 +1,324 @@
+#include "midi_rx_check.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+#include "hal_host.h"
+#include "rng.h"
+#include "simulator.h"
+#include "midi_parser.h"
+
+/*
+ * Parser check: the generator writes a byte stream and, alongside it, the
+ * events a correct parser reports for it, in order. Realtime bytes are
+ * reported as they arrive, so one inserted mid-message comes out ahead of
+ * the message around it.
+ *
+ * Response check: the wire is cut into 320 us byte slots. A 0xF8 clock
+ * takes every CLOCK_SLOTS-th slot (24 ppqn at ~120 BPM) and pushes any
+ * message byte due in that slot to the next one, as a sender merging clock
+ * into its output does.
+ */
+
+static const uint8_t CAPTURE_SIZE = 16;
+// A SysEx body this long or longer saturates the reported length
+static const uint16_t SYSEX_LONG = 300;
+
+static const uint64_t BYTE_NS = HOST_MIDI_BYTE_NS;
+static const uint32_t CLOCK_SLOTS = 65;
+// Quiet time after each message while its response is collected
+static const uint32_t RESPONSE_SLOTS = 125;
+static const uint32_t RESPONSE_BUDGET_US = MAIN_LOOP_INTERVAL_MS * 1000UL + 2000;
+
+struct ExpectedEvent {
+  MidiEvent event;
+  std::vector<uint8_t> body;   // SysEx only
+};
+
+struct Stream {
+  std::vector<uint8_t> bytes;
+  std::vector<ExpectedEvent> events;
+};
+
+static void expect(Stream& stream, uint8_t status, uint8_t data1, uint8_t data2, uint8_t length) {
+  ExpectedEvent e;
+  e.event.status = status;
+  e.event.data1 = data1;
+  e.event.data2 = data2;
+  e.event.length = length;
+  stream.events.push_back(e);
+}
+
+// Sometimes slip a realtime byte in after the byte just written
+static void maybeRealtime(Stream& stream, Rng& rng) {
+  if (rng.between(0, 9) != 0) return;
+  static const uint8_t REALTIME[] = {0xF8, 0xFA, 0xFB, 0xFC, 0xFE, 0xFF};
+  const uint8_t data = REALTIME[rng.between(0, sizeof(REALTIME) - 1)];
+  stream.bytes.push_back(data);
+  expect(stream, data, 0, 0, 1);
+}
+
+/**
+ * Write one message per iteration: channel messages (with running status
+ * where the previous one allows it), system common, SysEx, or a stray data
+ * byte where no status is in force.
+ */
+static void buildStream(Stream& stream, Rng& rng, uint32_t messages) {
+  uint8_t runningStatus = 0;
+  bool statusRequired = false;  // Previous SysEx was cut short by this message's status
+
+  for (uint32_t m = 0; m < messages; m++) {
+    const uint32_t kind = statusRequired ? 0 : rng.between(0, 19);
+    statusRequired = false;
+
+    if (kind < 14) {
+      const uint8_t status = (uint8_t)(((8 + rng.between(0, 6)) << 4) | rng.between(0, 15));
+      const uint8_t dataBytes = midiMessageLength(status) - 1;
+      const uint8_t data[2] = {(uint8_t)rng.between(0, 127), (uint8_t)rng.between(0, 127)};
+      if (status != runningStatus || rng.between(0, 1) == 0) {
+        stream.bytes.push_back(status);
+        maybeRealtime(stream, rng);
+      }
+      runningStatus = status;
+      for (uint8_t i = 0; i < dataBytes; i++) {
+        stream.bytes.push_back(data[i]);
+        if (i + 1 < dataBytes) maybeRealtime(stream, rng);
+      }
+      expect(stream, status, data[0], (dataBytes > 1) ? data[1] : 0, dataBytes + 1);
+    } else if (kind < 16) {
+      // System common: MTC quarter frame, song position, song select, tune request
+      static const uint8_t COMMON[] = {0xF1, 0xF2, 0xF3, 0xF6};
+      const uint8_t status = COMMON[rng.between(0, sizeof(COMMON) - 1)];
+      const uint8_t dataBytes = midiMessageLength(status) - 1;
+      const uint8_t data[2] = {(uint8_t)rng.between(0, 127), (uint8_t)rng.between(0, 127)};
+      stream.bytes.push_back(status);
+      for (uint8_t i = 0; i < dataBytes; i++) {
+        maybeRealtime(stream, rng);
+        stream.bytes.push_back(data[i]);
+      }
+      expect(stream, status, (dataBytes > 0) ? data[0] : 0, (dataBytes > 1) ? data[1] : 0, dataBytes + 1);
+      runningStatus = 0;
+    } else if (kind < 19) {
+      const uint16_t length = (rng.between(0, 19) == 0) ? (uint16_t)rng.between(240, SYSEX_LONG)
+                                                        : (uint16_t)rng.between(0, 40);
+      ExpectedEvent e;
+      stream.bytes.push_back(MIDI_SYSEX_START);
+      for (uint16_t i = 0; i < length; i++) {
+        maybeRealtime(stream, rng);
+        const uint8_t data = rng.between(0, 127);
+        stream.bytes.push_back(data);
+        e.body.push_back(data);
+      }
+      maybeRealtime(stream, rng);
+      runningStatus = 0;
+      if (rng.between(0, 9) == 0) {
+        // Cut short: the next message's status ends it and nothing is reported
+        statusRequired = true;
+        continue;
+      }
+      stream.bytes.push_back(MIDI_SYSEX_END);
+      e.event.status = MIDI_SYSEX_START;
+      e.event.data1 = 0;
+      e.event.data2 = 0;
+      e.event.length = (uint8_t)std::min<uint16_t>(length, 0xFF);
+      stream.events.push_back(e);
+    } else if (runningStatus == 0) {
+      stream.bytes.push_back(rng.between(0, 127));  // Stray data byte, ignored
+    }
+    maybeRealtime(stream, rng);
+  }
+}
+
+/**
+ * Run the stream through a parser.
+ * @return Number of events that differ from the expected ones
+ */
+static uint32_t checkParser(const Stream& stream, bool capture) {
+  MidiParser parser;
+  uint8_t buffer[CAPTURE_SIZE];
+  parser.setSysExBuffer(capture ? buffer : nullptr, CAPTURE_SIZE);
+
+  uint32_t mismatches = 0;
+  size_t next = 0;
+  for (size_t i = 0; i < stream.bytes.size(); i++) {
+    MidiEvent event;
+    if (!parser.parse(stream.bytes[i], event)) continue;
+
+    if (next >= stream.events.size()) {
+      if (mismatches++ == 0) fprintf(stderr, "byte %zu: unexpected event %02X\n", i, event.status);
+      continue;
+    }
+    const ExpectedEvent& e = stream.events[next++];
+    bool same = event.status == e.event.status && event.data1 == e.event.data1 &&
+                event.data2 == e.event.data2 && event.length == e.event.length;
+    if (same && event.status == MIDI_SYSEX_START) {
+      const size_t size = capture ? CAPTURE_SIZE : 0;
+      const size_t stored = std::min(e.body.size(), size);
+      same = parser.sysExOverflowed() == (e.body.size() > size) &&
+             std::equal(e.body.begin(), e.body.begin() + stored, buffer);
+    }
+    if (!same) {
+      if (mismatches == 0) {
+        fprintf(stderr, "byte %zu (%s capture): got %02X %02X %02X len %u, expected %02X %02X %02X len %u\n", i,
+                capture ? "with" : "without", event.status, event.data1, event.data2, event.length,
+                e.event.status, e.event.data1, e.event.data2, e.event.length);
+      }
+      mismatches++;
+    }
+  }
+  mismatches += stream.events.size() - next;
+  return mismatches;
+}
+
+static uint32_t percentile(const std::vector<uint32_t>& sorted, uint32_t pct) {
+  const size_t index = (sorted.size() * pct + 99) / 100;
+  return sorted[index == 0 ? 0 : index - 1];
+}
+
+static void printLatency(const char* name, std::vector<uint32_t>& samples) {
+  if (samples.empty()) {
+    printf("  %-16s %9s %9s %9s %9s %9u\n", name, "-", "-", "-", "-", RESPONSE_BUDGET_US);
+    return;
+  }
+  std::sort(samples.begin(), samples.end());
+  printf("  %-16s %9u %9u %9u %9u %9u\n", name, samples.front(), percentile(samples, 50), percentile(samples, 99),
+         samples.back(), RESPONSE_BUDGET_US);
+}
+
+// Loops 1-4 lit by stored preset n (1-128); never zero, and neighbours differ
+static uint8_t presetPattern(uint8_t presetNumber) {
+  return (uint8_t)(presetNumber % 15) + 1;
+}
+
+int commandMidiRx(int argc, char** argv) {
+  const uint32_t messages = (argc > 0) ? strtoul(argv[0], nullptr, 10) : 2000;
+  Rng rng((argc > 1) ? strtoul(argv[1], nullptr, 10) : 1);
+  bool ok = true;
+
+  Stream stream;
+  buildStream(stream, rng, messages * 10);
+  const uint32_t parseWith = checkParser(stream, true);
+  const uint32_t parseWithout = checkParser(stream, false);
+  printf("midirx: parser, %zu bytes, %zu events\n", stream.bytes.size(), stream.events.size());
+  printf("  mismatched with capture    %u\n", parseWith);
+  printf("  mismatched without capture %u\n", parseWithout);
+  ok = ok && parseWith == 0 && parseWithout == 0;
+
+  Simulator sim;
+  sim.begin(true);
+  Firmware& fw = sim.firmware();
+  const uint8_t channel = fw.state.midiChannel;
+  uint8_t* eeprom = hostEepromData();
+  for (uint8_t i = 0; i < TOTAL_PRESETS; i++) eeprom[EEPROM_PRESETS_START_ADDR + i] = presetPattern(i + 1);
+  eeprom[EEPROM_INIT_FLAG_ADDR] = EEPROM_INIT_MAGIC;   // Base table only: loading adds the rest
+  // Loading upgrades the image in EEPROM, which takes virtual time
+  fw.state.loadPresets();
+
+  std::vector<uint32_t> relayUs;
+  std::vector<uint32_t> displayUs;
+  uint32_t wrong = 0;
+  uint32_t ignored = 0;
+  uint32_t runningStatusSent = 0;
+  uint8_t lastStatus = 0;
+  uint8_t lastProgram = 0xFF;
+  uint64_t slot = hostNowNs() / BYTE_NS + 1;
+
+  for (uint32_t m = 0; m < messages; m++) {
+    // Mostly PC on our channel, some loop CCs, some traffic for other devices
+    const uint32_t kind = rng.between(0, 9);
+    uint8_t bytes[3];
+    uint8_t length;
+    const bool forUs = kind < 9;
+    const uint8_t msgChannel = forUs ? channel : (uint8_t)((channel + rng.between(1, 15)) & 0x0F);
+    LoopMask loops = fw.state.loops;
+
+    if (kind < 6 || !forUs) {
+      // A new program whose loops differ from the current ones, so the relays
+      // and the flashed number must both change
+      uint8_t program;
+      uint8_t pattern;
+      do {
+        program = rng.between(0, TOTAL_PRESETS - 1);
+        pattern = presetPattern(program + 1);
+      } while (forUs && (program == lastProgram || pattern == loops));
+      if (forUs) lastProgram = program;
+      bytes[0] = 0xC0 | msgChannel;
+      bytes[1] = program;
+      length = 2;
+      if (forUs) loops = pattern;
+    } else {
+      const uint8_t loop = rng.between(0, NUM_LOOPS - 1);
+      loops ^= loopBit(loop);
+      bytes[0] = 0xB0 | msgChannel;
+      bytes[1] = MIDI_CC_LOOP_FIRST + loop;
+      bytes[2] = (loops & loopBit(loop)) ? 127 : 0;
+      length = 3;
+    }
+    const uint8_t expectedBank = fw.state.currentBank;
+    const uint8_t expectedPreset = (length == 2 && forUs) ? bytes[1] : 0xFF;
+
+    // Idle with the clock running, then the message at a random phase
+    const uint64_t start = slot + rng.between(0, 400);
+    for (; slot < start; slot++) {
+      if (slot % CLOCK_SLOTS == 0) sim.scheduleMidiIn(0xF8, (slot + 1) * BYTE_NS);
+    }
+    const uint8_t first = (bytes[0] == lastStatus && rng.between(0, 1) == 0) ? 1 : 0;
+    if (first == 1) runningStatusSent++;
+    lastStatus = bytes[0];
+    for (uint8_t i = first; i < length; slot++) {
+      sim.scheduleMidiIn((slot % CLOCK_SLOTS == 0) ? 0xF8 : bytes[i++], (slot + 1) * BYTE_NS);
+    }
+    const uint64_t arrivalNs = slot * BYTE_NS;
+    for (const uint64_t end = slot + RESPONSE_SLOTS; slot < end; slot++) {
+      if (slot % CLOCK_SLOTS == 0) sim.scheduleMidiIn(0xF8, (slot + 1) * BYTE_NS);
+    }
+
+    const size_t from = sim.timeline().size();
+    sim.runUntilNs(slot * BYTE_NS);
+
+    uint64_t relayNs = 0;
+    uint64_t displayNs = 0;
+    const std::vector<TimelineEntry>& tl = sim.timeline();
+    for (size_t i = from; i < tl.size(); i++) {
+      if (tl[i].timeNs < arrivalNs) continue;
+      if (tl[i].kind == TL_RELAY && relayNs == 0) relayNs = tl[i].timeNs;
+      if (tl[i].kind == TL_DISPLAY && displayNs == 0) displayNs = tl[i].timeNs;
+    }
+
+    if (!forUs) {
+      ignored++;
+      if (relayNs != 0) wrong++;
+      continue;
+    }
+    bool right = relayNs != 0 && loops == fw.state.loops;
+    if (expectedPreset != 0xFF) {
+      right = right && displayNs != 0 && fw.state.displayState == FLASHING_PC &&
+              fw.state.currentBank == expectedPreset / PRESETS_PER_BANK + 1 &&
+              fw.state.activePreset == expectedPreset % PRESETS_PER_BANK;
+      if (displayNs != 0) displayUs.push_back((displayNs - arrivalNs) / 1000);
+    } else {
+      right = right && fw.state.currentBank == expectedBank;
+    }
+    if (relayNs != 0) relayUs.push_back((relayNs - arrivalNs) / 1000);
+    if (!right) {
+      if (wrong == 0) fprintf(stderr, "message %u (%02X %02X): wrong response\n", m, bytes[0], bytes[1]);
+      wrong++;
+    }
+  }
+
+  printf("\nmidirx: firmware, %u messages (%u for other channels, %u in running status) over a running clock\n",
+         messages, ignored, runningStatusSent);
+  printf("  %-16s %9s %9s %9s %9s %9s\n", "stop bit to (us)", "min", "median", "p99", "max", "budget");
+  const uint32_t relayMax = relayUs.empty() ? 0 : *std::max_element(relayUs.begin(), relayUs.end());
+  const uint32_t displayMax = displayUs.empty() ? 0 : *std::max_element(displayUs.begin(), displayUs.end());
+  printLatency("relays", relayUs);
+  printLatency("display", displayUs);
+  printf("  wrong responses  %u\n", wrong);
+  ok = ok && wrong == 0 && relayMax <= RESPONSE_BUDGET_US && displayMax <= RESPONSE_BUDGET_US;
+
+  printf("%s\n", ok ? "MIDI input parsed and answered within budget" : "MIDI input check FAILED");
+  return ok ? 0 : 1;
+}
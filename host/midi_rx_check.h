@@ -0,0 +1,19 @@
+#ifndef MIDI_RX_CHECK_H
+#define MIDI_RX_CHECK_H
+
+/**
+ * MIDI receive parser and response check.
+ *
+ * Usage: midirx [messages] [seed]
+ * Feeds the parser random streams with running status, realtime bytes
+ * dropped into the middle of messages and SysEx, SysEx with and without a
+ * capture buffer, system common messages and stray data bytes, and checks
+ * every event against the stream's generator. Then sends Program Change and
+ * loop Control Change messages to the firmware over a running MIDI clock
+ * and reports the delay from the last byte's stop bit to the relays and
+ * the display. Returns non-zero on any parse mismatch, wrong response or a
+ * delay past MAIN_LOOP_INTERVAL_MS + 2 ms.
+ */
+int commandMidiRx(int argc, char** argv);
+
+#endif
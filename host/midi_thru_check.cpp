@@ -0,0 +1,339 @@
+#include "midi_thru_check.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <vector>
+
+#include "hal_host.h"
+#include "rng.h"
+#include "midi_handler.h"
+
+/*
+ * Input is laid out in 320 us byte slots as in the midirx check, with a
+ * clock byte every CLOCK_SLOTS slots. The sparse stream leaves idle slots
+ * between messages; the dense one sends bursts of back-to-back messages
+ * that fill the line, so anything the switcher adds has to queue.
+ *
+ * The switcher's own messages are Program Changes on channel 16, which the
+ * input never uses, so every output byte can be told apart: realtime,
+ * the switcher's, a forwarded input byte, or a status byte re-sent for a
+ * message the input sent in running status.
+ */
+
+static const uint64_t BYTE_NS = HOST_MIDI_BYTE_NS;
+static const uint32_t CLOCK_SLOTS = 65;
+static const uint8_t OWN_STATUS = 0xCF;
+// Time allowed after the input ends for the queues to drain
+static const uint64_t DRAIN_NS = 200ULL * 1000000ULL;
+static const uint64_t PASS_NS = MAIN_LOOP_INTERVAL_MS * 1000000ULL;
+
+// Realtime bytes wait behind at most the byte being shifted out and the one in UDR0
+static const uint64_t REALTIME_LIMIT_NS = 2 * BYTE_NS;
+// Thru bytes wait behind at most half the thru queue and one of the switcher's messages
+static const uint64_t THRU_LIMIT_NS = (MIDI_THRU_QUEUE_SIZE / 2 + 4) * BYTE_NS;
+
+struct InputByte {
+  uint8_t data;
+  uint64_t arrivalNs;   // Stop bit sampled
+};
+
+struct OwnSend {
+  uint64_t timeNs;
+  uint8_t program;
+};
+
+struct WireByte {
+  uint8_t data;
+  uint64_t startNs;
+};
+
+struct ScenarioResult {
+  uint32_t thruBytes;
+  uint32_t ownMessages;
+  uint32_t statusResent;
+  uint32_t corrupt;
+  uint32_t missing;
+  uint32_t eventMismatches;
+  uint32_t dropped;
+  std::vector<uint32_t> thruDelayUs;
+  std::vector<uint32_t> realtimeDelayUs;
+};
+
+static std::vector<WireByte> g_wire;
+
+static void onSerialTx(uint8_t data, uint64_t queuedNs, uint64_t wireStartNs) {
+  (void)queuedNs;
+  const WireByte b = {data, wireStartNs};
+  g_wire.push_back(b);
+}
+
+class InputWriter {
+public:
+  explicit InputWriter(std::vector<InputByte>& bytes) : bytes(bytes), slot(10ULL * 1000000ULL / BYTE_NS) {}
+
+  // Next free slot, after any clock byte due first
+  void write(uint8_t data) {
+    while (slot % CLOCK_SLOTS == 0) put(0xF8);
+    put(data);
+  }
+
+  void idle(uint32_t slots) {
+    for (; slots > 0; slots--) {
+      if (slot % CLOCK_SLOTS == 0) put(0xF8);
+      else slot++;
+    }
+  }
+
+private:
+  std::vector<InputByte>& bytes;
+  uint64_t slot;
+
+  void put(uint8_t data) {
+    const InputByte b = {data, (slot + 1) * BYTE_NS};
+    bytes.push_back(b);
+    slot++;
+  }
+};
+
+/**
+ * Channels 1-3 with a few message types, so running status comes up often.
+ * Dense streams send bursts of 20-80 messages with no gap, then rest.
+ */
+static void buildInput(std::vector<InputByte>& bytes, Rng& rng, uint32_t messages, bool dense) {
+  static const uint8_t TYPES[] = {0x80, 0x90, 0x90, 0xB0, 0xC0, 0xE0};
+  InputWriter writer(bytes);
+  uint8_t runningStatus = 0;
+  uint32_t burstLeft = 0;
+
+  for (uint32_t m = 0; m < messages; m++) {
+    const uint32_t kind = rng.between(0, 19);
+    if (kind < 18) {
+      const uint8_t status = TYPES[rng.between(0, sizeof(TYPES) - 1)] | rng.between(0, 2);
+      if (status != runningStatus || rng.between(0, 3) == 0) writer.write(status);
+      runningStatus = status;
+      for (uint8_t i = 1; i < midiMessageLength(status); i++) writer.write(rng.between(0, 127));
+    } else if (kind < 19) {
+      // Song position: system common, ends running status
+      writer.write(0xF2);
+      writer.write(rng.between(0, 127));
+      writer.write(rng.between(0, 127));
+      runningStatus = 0;
+    } else {
+      writer.write(MIDI_SYSEX_START);
+      for (uint32_t i = rng.between(0, 20); i > 0; i--) writer.write(rng.between(0, 127));
+      writer.write(MIDI_SYSEX_END);
+      runningStatus = 0;
+    }
+
+    if (!dense) {
+      writer.idle(rng.between(0, 60));
+    } else if (burstLeft == 0) {
+      writer.idle(rng.between(100, 300));
+      burstLeft = rng.between(20, 80);
+    } else {
+      burstLeft--;
+    }
+  }
+}
+
+// The switcher's Program Changes, 20-120 ms apart while the input lasts
+static void buildOwnSends(std::vector<OwnSend>& own, Rng& rng, uint64_t endNs) {
+  for (uint64_t t = 15ULL * 1000000ULL; t < endNs; t += rng.between(20, 120) * 1000000ULL) {
+    const OwnSend send = {t + rng.between(0, 999) * 1000ULL, (uint8_t)(own.size() & 0x7F)};
+    own.push_back(send);
+  }
+}
+
+static void runScenario(const std::vector<InputByte>& input, const std::vector<OwnSend>& own,
+                        ScenarioResult& result) {
+  hostReset();
+  g_hostCost = HOST_COST_ATMEGA328;
+  g_wire.clear();
+  hostSetSerialTxHook(onSerialTx);
+  initMIDI(MIDI_TX_OVERFLOW_POLICY, true);
+
+  for (size_t i = 0; i < input.size(); i++) hostScheduleSerialRx(input[i].data, input[i].arrivalNs);
+
+  // Main loop: a housekeeping pass every 10 ms, own messages sent in between
+  const uint64_t endNs = input.back().arrivalNs + DRAIN_NS;
+  uint64_t nextPassNs = PASS_NS;
+  size_t nextOwn = 0;
+  while (hostNowNs() < endNs) {
+    if (nextOwn < own.size() && own[nextOwn].timeNs < nextPassNs) {
+      hostAdvanceToNs(own[nextOwn].timeNs);
+      sendMIDIMessage(OWN_STATUS, own[nextOwn].program);
+      nextOwn++;
+    } else {
+      hostAdvanceToNs(nextPassNs);
+      updateMIDI();
+      nextPassNs += PASS_NS;
+    }
+  }
+
+  const MidiRxStats stats = getMIDIRxStats();
+  result.dropped = stats.thruDropped + stats.thruAbandoned + getMIDITxStats().messagesDropped;
+  result.thruBytes = 0;
+  result.ownMessages = 0;
+  result.statusResent = 0;
+  result.corrupt = 0;
+  result.eventMismatches = 0;
+  result.thruDelayUs.clear();
+  result.realtimeDelayUs.clear();
+
+  // Byte by byte: every wire byte is accounted for, in input order per lane
+  std::vector<InputByte> inMessages;
+  std::vector<InputByte> inRealtime;
+  for (size_t i = 0; i < input.size(); i++) {
+    (input[i].data >= 0xF8 ? inRealtime : inMessages).push_back(input[i]);
+  }
+  size_t nextMessage = 0;
+  size_t nextRealtime = 0;
+  uint8_t ownBytesLeft = 0;
+  for (size_t i = 0; i < g_wire.size(); i++) {
+    const WireByte& w = g_wire[i];
+    if (w.data >= 0xF8) {
+      if (nextRealtime < inRealtime.size()) {
+        result.realtimeDelayUs.push_back((w.startNs - inRealtime[nextRealtime++].arrivalNs) / 1000);
+      } else {
+        result.corrupt++;
+      }
+    } else if (ownBytesLeft > 0) {
+      ownBytesLeft--;
+    } else if (w.data == OWN_STATUS) {
+      ownBytesLeft = midiMessageLength(OWN_STATUS) - 1;
+    } else if (nextMessage < inMessages.size() && w.data == inMessages[nextMessage].data) {
+      result.thruDelayUs.push_back((w.startNs - inMessages[nextMessage++].arrivalNs) / 1000);
+      result.thruBytes++;
+    } else if ((w.data & 0x80) && nextMessage < inMessages.size() && !(inMessages[nextMessage].data & 0x80)) {
+      result.statusResent++;
+    } else {
+      result.corrupt++;
+    }
+  }
+  result.missing = (inMessages.size() - nextMessage) + (inRealtime.size() - nextRealtime);
+
+  // Message by message: what a receiver downstream makes of the output
+  MidiParser inParser;
+  MidiParser outParser;
+  std::vector<MidiEvent> expected[2];   // [0] messages, [1] realtime
+  std::vector<MidiEvent> received[2];
+  MidiEvent event;
+  for (size_t i = 0; i < input.size(); i++) {
+    if (inParser.parse(input[i].data, event)) expected[event.status >= 0xF8].push_back(event);
+  }
+  size_t ownIndex = 0;
+  for (size_t i = 0; i < g_wire.size(); i++) {
+    if (!outParser.parse(g_wire[i].data, event)) continue;
+    if (event.status == OWN_STATUS) {
+      if (ownIndex >= own.size() || event.data1 != own[ownIndex].program) result.eventMismatches++;
+      ownIndex++;
+      result.ownMessages++;
+      continue;
+    }
+    received[event.status >= 0xF8].push_back(event);
+  }
+  result.eventMismatches += own.size() - std::min(own.size(), ownIndex);
+  for (uint8_t lane = 0; lane < 2; lane++) {
+    const size_t count = std::max(expected[lane].size(), received[lane].size());
+    for (size_t i = 0; i < count; i++) {
+      if (i >= expected[lane].size() || i >= received[lane].size() ||
+          expected[lane][i].status != received[lane][i].status || expected[lane][i].data1 != received[lane][i].data1 ||
+          expected[lane][i].data2 != received[lane][i].data2 || expected[lane][i].length != received[lane][i].length) {
+        result.eventMismatches++;
+      }
+    }
+  }
+}
+
+static uint32_t percentile(const std::vector<uint32_t>& sorted, uint32_t pct) {
+  const size_t index = (sorted.size() * pct + 99) / 100;
+  return sorted[index == 0 ? 0 : index - 1];
+}
+
+static uint32_t spread(const std::vector<uint32_t>& sorted) {
+  return sorted.empty() ? 0 : sorted.back() - sorted.front();
+}
+
+int commandMidiThru(int argc, char** argv) {
+  const uint32_t messages = (argc > 0) ? strtoul(argv[0], nullptr, 10) : 5000;
+  Rng rng((argc > 1) ? strtoul(argv[1], nullptr, 10) : 1);
+
+  enum { SPARSE, SPARSE_MERGED, DENSE, DENSE_MERGED, NUM_SCENARIOS };
+  static const char* const NAMES[NUM_SCENARIOS] = {"sparse", "sparse+own", "dense", "dense+own"};
+
+  std::vector<InputByte> sparse;
+  std::vector<InputByte> dense;
+  buildInput(sparse, rng, messages, false);
+  buildInput(dense, rng, messages, true);
+
+  std::vector<OwnSend> sparseOwn;
+  std::vector<OwnSend> denseOwn;
+  buildOwnSends(sparseOwn, rng, sparse.back().arrivalNs);
+  buildOwnSends(denseOwn, rng, dense.back().arrivalNs);
+  const std::vector<OwnSend> none;
+
+  ScenarioResult results[NUM_SCENARIOS];
+  runScenario(sparse, none, results[SPARSE]);
+  runScenario(sparse, sparseOwn, results[SPARSE_MERGED]);
+  runScenario(dense, none, results[DENSE]);
+  runScenario(dense, denseOwn, results[DENSE_MERGED]);
+
+  printf("midithru: %u messages per stream (%zu sparse bytes, %zu dense bytes), own PC every 20-120 ms\n",
+         messages, sparse.size(), dense.size());
+  printf("%-22s", "");
+  for (uint8_t s = 0; s < NUM_SCENARIOS; s++) printf(" %11s", NAMES[s]);
+
+  struct Row {
+    const char* name;
+    uint32_t (*value)(ScenarioResult&);
+  };
+  static const Row ROWS[] = {
+    {"bytes forwarded", [](ScenarioResult& r) { return r.thruBytes; }},
+    {"own messages", [](ScenarioResult& r) { return r.ownMessages; }},
+    {"status re-sent", [](ScenarioResult& r) { return r.statusResent; }},
+    {"thru delay min (us)", [](ScenarioResult& r) { return r.thruDelayUs.front(); }},
+    {"thru delay median", [](ScenarioResult& r) { return percentile(r.thruDelayUs, 50); }},
+    {"thru delay p99", [](ScenarioResult& r) { return percentile(r.thruDelayUs, 99); }},
+    {"thru delay max", [](ScenarioResult& r) { return r.thruDelayUs.back(); }},
+    {"thru jitter", [](ScenarioResult& r) { return spread(r.thruDelayUs); }},
+    {"realtime delay max", [](ScenarioResult& r) { return r.realtimeDelayUs.back(); }},
+    {"realtime jitter", [](ScenarioResult& r) { return spread(r.realtimeDelayUs); }},
+    {"dropped", [](ScenarioResult& r) { return r.dropped; }},
+    {"corrupt", [](ScenarioResult& r) { return r.corrupt + r.missing; }},
+    {"event mismatches", [](ScenarioResult& r) { return r.eventMismatches; }},
+  };
+  for (uint8_t s = 0; s < NUM_SCENARIOS; s++) {
+    std::sort(results[s].thruDelayUs.begin(), results[s].thruDelayUs.end());
+    std::sort(results[s].realtimeDelayUs.begin(), results[s].realtimeDelayUs.end());
+  }
+  for (size_t row = 0; row < sizeof(ROWS) / sizeof(ROWS[0]); row++) {
+    printf("\n%-22s", ROWS[row].name);
+    for (uint8_t s = 0; s < NUM_SCENARIOS; s++) printf(" %11u", ROWS[row].value(results[s]));
+  }
+  printf("\n");
+  printf("jitter added by merging: sparse %u us, dense %u us\n",
+         spread(results[SPARSE_MERGED].thruDelayUs) - spread(results[SPARSE].thruDelayUs),
+         spread(results[DENSE_MERGED].thruDelayUs) - spread(results[DENSE].thruDelayUs));
+
+  bool ok = true;
+  for (uint8_t s = 0; s < NUM_SCENARIOS; s++) {
+    const ScenarioResult& r = results[s];
+    if (r.corrupt > 0 || r.missing > 0 || r.eventMismatches > 0 || r.dropped > 0) {
+      printf("%s: %u corrupt, %u missing, %u mismatched events, %u dropped\n", NAMES[s], r.corrupt, r.missing,
+             r.eventMismatches, r.dropped);
+      ok = false;
+    }
+    if (r.realtimeDelayUs.back() * 1000ULL > REALTIME_LIMIT_NS) {
+      printf("%s: realtime byte held %u us\n", NAMES[s], r.realtimeDelayUs.back());
+      ok = false;
+    }
+    if (r.thruDelayUs.back() * 1000ULL > THRU_LIMIT_NS) {
+      printf("%s: forwarded byte held %u us\n", NAMES[s], r.thruDelayUs.back());
+      ok = false;
+    }
+  }
+
+  printf("%s\n", ok ? "thru stream forwarded whole and merged within bounds" : "thru check FAILED");
+  return ok ? 0 : 1;
+}
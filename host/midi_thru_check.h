@@ -0,0 +1,18 @@
+#ifndef MIDI_THRU_CHECK_H
+#define MIDI_THRU_CHECK_H
+
+/**
+ * MIDI thru/merge check.
+ *
+ * Usage: midithru [messages] [seed]
+ * Plays a sparse and a dense MIDI IN stream (running status, MIDI clock,
+ * system common and SysEx), each once thru only and once merged with the
+ * switcher's own Program Changes. Reports the delay of every forwarded
+ * byte from its stop bit to its start on MIDI OUT and the jitter merging
+ * adds. Returns non-zero if the output does not carry exactly the input's
+ * messages and the switcher's own, if a byte is dropped, or if a realtime
+ * or message byte is held past its bound.
+ */
+int commandMidiThru(int argc, char** argv);
+
+#endif
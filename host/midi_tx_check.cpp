@@ -0,0 +1,385 @@
+#include "midi_tx_check.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <vector>
+
+#include "hal_host.h"
+#include "rng.h"
+#include "midi_handler.h"
+
+static const uint32_t BURST_MESSAGES = 128;
+// A realtime clock byte follows every this many messages
+static const uint32_t REALTIME_EVERY = 16;
+// 8N1 at 31250 baud
+static const uint64_t BYTE_NS = 320000;
+// Realtime bytes wait behind at most the byte being shifted out and the one in UDR0
+static const uint64_t REALTIME_LIMIT_NS = 2 * BYTE_NS;
+// Time allowed after the last burst for the queue to drain
+static const uint64_t DRAIN_NS = 2000ULL * 1000000ULL;
+
+enum TxPath {
+  PATH_SERIAL_WRITE,
+  PATH_DROP_NEWEST,
+  PATH_DROP_OLDEST,
+  NUM_PATHS
+};
+
+static const char* const PATH_NAMES[NUM_PATHS] = {"Serial.write", "drop newest", "drop oldest"};
+
+struct Message {
+  uint8_t bytes[3];
+  uint8_t length;
+  uint32_t burst;
+};
+
+struct Burst {
+  uint64_t startNs;
+  uint32_t firstMessage;
+};
+
+struct WireByte {
+  uint8_t data;
+  uint64_t startNs;
+};
+
+struct PathResult {
+  uint32_t delivered;
+  uint32_t dropped;
+  uint32_t droppedReported;
+  uint32_t corrupt;
+  uint32_t burstTailsLost;
+  uint64_t longestSendNs;
+  uint64_t longestBurstNs;
+  uint64_t realtimeWaitNs;
+  uint32_t realtimeDropped;
+  uint8_t highWater;
+};
+
+static std::vector<WireByte> g_wire;
+
+static void onSerialTx(uint8_t data, uint64_t queuedNs, uint64_t wireStartNs) {
+  (void)queuedNs;
+  const WireByte b = {data, wireStartNs};
+  g_wire.push_back(b);
+}
+
+static bool sendMessage(TxPath path, const Message& m) {
+  if (path == PATH_SERIAL_WRITE) {
+    Serial.write(m.bytes, m.length);
+    return true;
+  }
+  return sendMIDIMessage(m.bytes[0], m.bytes[1], m.bytes[2]);
+}
+
+static void runPath(TxPath path, const std::vector<Burst>& bursts, const std::vector<Message>& messages,
+                    PathResult& result) {
+  hostReset();
+  g_hostCost = HOST_COST_ATMEGA328;
+  g_wire.clear();
+  hostSetSerialTxHook(onSerialTx);
+  if (path == PATH_SERIAL_WRITE) Serial.begin(31250);
+  else initMIDI(path == PATH_DROP_NEWEST ? MIDI_TX_DROP_NEWEST : MIDI_TX_DROP_OLDEST);
+
+  memset(&result, 0, sizeof(result));
+  std::vector<uint64_t> realtimeSentNs;
+
+  for (size_t b = 0; b < bursts.size(); b++) {
+    hostAdvanceToNs(bursts[b].startNs);
+    const uint64_t burstStartNs = hostNowNs();
+
+    for (uint32_t i = 0; i < BURST_MESSAGES; i++) {
+      const uint64_t beforeNs = hostNowNs();
+      sendMessage(path, messages[bursts[b].firstMessage + i]);
+      result.longestSendNs = std::max(result.longestSendNs, hostNowNs() - beforeNs);
+
+      if (i % REALTIME_EVERY == REALTIME_EVERY - 1) {
+        const uint64_t sentNs = hostNowNs();
+        bool accepted = true;
+        if (path == PATH_SERIAL_WRITE) Serial.write((uint8_t)0xF8);
+        else accepted = sendMIDIRealtime(0xF8);
+        // Only bytes the lane took can be matched against the wire
+        if (accepted) realtimeSentNs.push_back(sentNs);
+      }
+    }
+    result.longestBurstNs = std::max(result.longestBurstNs, hostNowNs() - burstStartNs);
+  }
+  hostAdvanceNs(DRAIN_NS);
+
+  if (path != PATH_SERIAL_WRITE) {
+    const MidiTxStats stats = getMIDITxStats();
+    result.droppedReported = stats.messagesDropped;
+    result.realtimeDropped = stats.realtimeDropped;
+    result.highWater = stats.queueHighWater;
+  }
+
+  // Split the wire into realtime bytes and whole messages, running status
+  // included; anything else is corrupt
+  std::vector<Message> received;
+  size_t realtimeIndex = 0;
+  uint64_t realtimeFreeNs = 0;
+  Message current;
+  uint8_t have = 0;
+  uint8_t runningStatus = 0;
+  for (size_t i = 0; i < g_wire.size(); i++) {
+    const uint8_t data = g_wire[i].data;
+    if (data >= 0xF8) {
+      // Time spent behind other traffic; a burst's clock bytes also queue behind each other
+      if (realtimeIndex < realtimeSentNs.size()) {
+        const uint64_t readyNs = std::max(realtimeSentNs[realtimeIndex], realtimeFreeNs);
+        result.realtimeWaitNs = std::max(result.realtimeWaitNs, g_wire[i].startNs - readyNs);
+      }
+      realtimeFreeNs = g_wire[i].startNs + BYTE_NS;
+      realtimeIndex++;
+      continue;
+    }
+    if (data & 0x80) {
+      if (have != 0) result.corrupt++;  // Previous message cut short
+      current.length = midiMessageLength(data);
+      current.bytes[0] = data;
+      have = 1;
+      runningStatus = (data < 0xF0) ? data : 0;
+    } else if (have == 0 && runningStatus == 0) {
+      result.corrupt++;  // Data byte with no status
+      continue;
+    } else {
+      if (have == 0) {
+        current.length = midiMessageLength(runningStatus);
+        current.bytes[0] = runningStatus;
+        have = 1;
+      }
+      current.bytes[have++] = data;
+    }
+    if (have == current.length) {
+      received.push_back(current);
+      have = 0;
+    }
+  }
+  if (have != 0) result.corrupt++;
+
+  // Received messages must be the sent ones, in order, with some left out
+  std::vector<bool> delivered(messages.size(), false);
+  size_t next = 0;
+  for (size_t r = 0; r < received.size(); r++) {
+    while (next < messages.size() && (messages[next].length != received[r].length ||
+                                      memcmp(messages[next].bytes, received[r].bytes, received[r].length) != 0)) {
+      next++;
+    }
+    if (next == messages.size()) {
+      result.corrupt++;
+      continue;
+    }
+    delivered[next++] = true;
+    result.delivered++;
+  }
+  result.dropped = messages.size() - result.delivered;
+
+  // Whatever is queued at the end of a burst is on the wire within the queue's
+  // and the realtime lane's worth of byte times, unless a newer burst pushes it out first
+  const uint64_t queueDrainNs = (MIDI_TX_QUEUE_SIZE + MIDI_TX_REALTIME_QUEUE_SIZE + 1) * BYTE_NS;
+  for (size_t b = 0; b < bursts.size(); b++) {
+    const bool displaced = b + 1 < bursts.size() && bursts[b + 1].startNs - bursts[b].startNs < queueDrainNs;
+    if (!displaced && !delivered[bursts[b].firstMessage + BURST_MESSAGES - 1]) result.burstTailsLost++;
+  }
+}
+
+struct SysExResult {
+  uint32_t sent;
+  uint32_t accepted;
+  uint32_t arrived;
+  uint32_t cut;
+  uint32_t lost;
+};
+
+// SysEx bodies on the wire, between F0 and F7; one ended by any other status is cut
+static void readSysEx(std::vector<std::vector<uint8_t> >& bodies, uint32_t& cut) {
+  bool inSysEx = false;
+  std::vector<uint8_t> body;
+  for (size_t i = 0; i < g_wire.size(); i++) {
+    const uint8_t data = g_wire[i].data;
+    if (data >= 0xF8) continue;
+    if (inSysEx && data == MIDI_SYSEX_END) {
+      bodies.push_back(body);
+      inSysEx = false;
+    } else if (inSysEx && (data & 0x80)) {
+      cut++;
+      inSysEx = false;
+    } else if (inSysEx) {
+      body.push_back(data);
+    }
+    if (data == MIDI_SYSEX_START) {
+      inSysEx = true;
+      body.clear();
+    }
+  }
+  if (inSysEx) cut++;
+}
+
+// Try a SysEx of random length; one the queue takes must reach the wire whole
+static void trySysEx(Rng& rng, std::vector<std::vector<uint8_t> >& accepted, uint32_t& sent, uint8_t length = 0) {
+  if (length == 0) length = rng.between(0, MIDI_TX_QUEUE_SIZE - 6);
+  std::vector<uint8_t> data(length);
+  for (uint8_t i = 0; i < length; i++) data[i] = rng.between(0, 127);
+  const uint8_t command = sent & 0x7F;
+  sent++;
+  if (!sendMIDISysEx(command, data.data(), length)) return;
+  std::vector<uint8_t> body;
+  body.push_back(MIDI_SYSEX_ID);
+  body.push_back(MIDI_SYSEX_DEVICE);
+  body.push_back(command);
+  body.insert(body.end(), data.begin(), data.end());
+  accepted.push_back(body);
+}
+
+/**
+ * The bursts again under drop oldest, a SysEx at the start of each and one
+ * mid-burst. First a Program Change, a SysEx and a preset's burst of a
+ * Program Change and 8 Control Changes, which the SysEx must survive.
+ */
+static void runSysEx(const std::vector<Burst>& bursts, const std::vector<Message>& messages, Rng& rng,
+                     SysExResult& result) {
+  hostReset();
+  g_hostCost = HOST_COST_ATMEGA328;
+  g_wire.clear();
+  hostSetSerialTxHook(onSerialTx);
+  initMIDI(MIDI_TX_DROP_OLDEST);
+  memset(&result, 0, sizeof(result));
+  std::vector<std::vector<uint8_t> > accepted;
+
+  hostAdvanceToNs(bursts[0].startNs / 2);
+  sendMIDIMessage(0xC0, 1);
+  trySysEx(rng, accepted, result.sent, 33);
+  sendMIDIMessage(0xC0, 2);
+  for (uint8_t cc = 0; cc < 8; cc++) sendMIDIMessage(0xB0, MIDI_CC_LOOP_FIRST + cc, 127);
+
+  for (size_t b = 0; b < bursts.size(); b++) {
+    hostAdvanceToNs(bursts[b].startNs);
+    trySysEx(rng, accepted, result.sent);
+    const uint32_t midBurst = rng.between(1, BURST_MESSAGES - 1);
+    for (uint32_t i = 0; i < BURST_MESSAGES; i++) {
+      if (i == midBurst) trySysEx(rng, accepted, result.sent);
+      const Message& m = messages[bursts[b].firstMessage + i];
+      sendMIDIMessage(m.bytes[0], m.bytes[1], m.bytes[2]);
+    }
+  }
+  hostAdvanceNs(DRAIN_NS);
+
+  std::vector<std::vector<uint8_t> > received;
+  readSysEx(received, result.cut);
+  result.accepted = accepted.size();
+  // Every SysEx taken arrives, in order, and nothing else does
+  size_t next = 0;
+  for (size_t r = 0; r < received.size(); r++) {
+    size_t match = next;
+    while (match < accepted.size() && received[r] != accepted[match]) match++;
+    if (match == accepted.size()) {
+      result.cut++;
+      continue;
+    }
+    next = match + 1;
+    result.arrived++;
+  }
+  result.lost = accepted.size() - result.arrived;
+}
+
+int commandMidiTx(int argc, char** argv) {
+  const uint32_t burstCount = (argc > 0) ? strtoul(argv[0], nullptr, 10) : 50;
+  Rng rng((argc > 1) ? strtoul(argv[1], nullptr, 10) : 1);
+
+  // Bursts 20-200 ms apart: a burst takes ~100 ms on the wire, so some land on a busy queue
+  std::vector<Burst> bursts;
+  std::vector<Message> messages;
+  uint64_t timeNs = 10ULL * 1000000ULL;
+  uint32_t bytes = 0;
+  for (uint32_t b = 0; b < burstCount; b++) {
+    const Burst burst = {timeNs, (uint32_t)messages.size()};
+    bursts.push_back(burst);
+    for (uint32_t i = 0; i < BURST_MESSAGES; i++) {
+      const uint32_t seq = messages.size();
+      const uint8_t channel = rng.between(0, 15);
+      Message m;
+      m.burst = b;
+      if (rng.between(0, 1) == 0) {
+        m.bytes[0] = 0xC0 | channel;
+        m.bytes[1] = seq & 0x7F;
+        m.bytes[2] = 0;
+        m.length = 2;
+      } else {
+        m.bytes[0] = 0xB0 | channel;
+        m.bytes[1] = (seq >> 7) & 0x7F;
+        m.bytes[2] = seq & 0x7F;
+        m.length = 3;
+      }
+      bytes += m.length;
+      messages.push_back(m);
+    }
+    timeNs += rng.between(20, 200) * 1000000ULL;
+  }
+
+  PathResult results[NUM_PATHS];
+  for (uint8_t p = 0; p < NUM_PATHS; p++) runPath((TxPath)p, bursts, messages, results[p]);
+
+  printf("miditx: %u bursts of %u messages (%zu messages, %u bytes), realtime byte every %u messages\n",
+         burstCount, BURST_MESSAGES, messages.size(), bytes, REALTIME_EVERY);
+  printf("%-22s %14s %14s %14s\n", "", PATH_NAMES[0], PATH_NAMES[1], PATH_NAMES[2]);
+  printf("%-22s", "delivered");
+  for (uint8_t p = 0; p < NUM_PATHS; p++) printf(" %14u", results[p].delivered);
+  printf("\n%-22s", "dropped");
+  for (uint8_t p = 0; p < NUM_PATHS; p++) printf(" %14u", results[p].dropped);
+  printf("\n%-22s", "corrupt");
+  for (uint8_t p = 0; p < NUM_PATHS; p++) printf(" %14u", results[p].corrupt);
+  printf("\n%-22s", "burst tails lost");  // Not counting tails displaced by the next burst
+  for (uint8_t p = 0; p < NUM_PATHS; p++) printf(" %14u", results[p].burstTailsLost);
+  printf("\n%-22s", "longest send (us)");
+  for (uint8_t p = 0; p < NUM_PATHS; p++) printf(" %14.1f", results[p].longestSendNs / 1000.0);
+  printf("\n%-22s", "longest burst (us)");
+  for (uint8_t p = 0; p < NUM_PATHS; p++) printf(" %14.1f", results[p].longestBurstNs / 1000.0);
+  printf("\n%-22s", "realtime wait (us)");
+  for (uint8_t p = 0; p < NUM_PATHS; p++) printf(" %14.1f", results[p].realtimeWaitNs / 1000.0);
+  printf("\n%-22s %14s", "realtime dropped", "-");
+  for (uint8_t p = PATH_DROP_NEWEST; p < NUM_PATHS; p++) printf(" %14u", results[p].realtimeDropped);
+  printf("\n%-22s %14s", "queue high water", "-");
+  for (uint8_t p = PATH_DROP_NEWEST; p < NUM_PATHS; p++) printf(" %14u", results[p].highWater);
+  printf("\n");
+
+  bool ok = true;
+  for (uint8_t p = PATH_DROP_NEWEST; p < NUM_PATHS; p++) {
+    const PathResult& r = results[p];
+    const char* name = PATH_NAMES[p];
+    // Never blocking: a send costs at most the UDRE interrupts it triggers
+    if (r.longestSendNs >= BYTE_NS) {
+      printf("%s: a send blocked for %.1f us\n", name, r.longestSendNs / 1000.0);
+      ok = false;
+    }
+    if (r.corrupt > 0) {
+      printf("%s: %u corrupt or out-of-order messages\n", name, r.corrupt);
+      ok = false;
+    }
+    if (r.dropped != r.droppedReported) {
+      printf("%s: %u messages lost but %u reported dropped\n", name, r.dropped, r.droppedReported);
+      ok = false;
+    }
+    if (r.realtimeWaitNs > REALTIME_LIMIT_NS) {
+      printf("%s: realtime byte waited %.1f us\n", name, r.realtimeWaitNs / 1000.0);
+      ok = false;
+    }
+  }
+  if (results[PATH_DROP_OLDEST].burstTailsLost > 0) {
+    printf("%s: lost the last message of %u bursts\n", PATH_NAMES[PATH_DROP_OLDEST],
+           results[PATH_DROP_OLDEST].burstTailsLost);
+    ok = false;
+  }
+
+  SysExResult sysEx;
+  runSysEx(bursts, messages, rng, sysEx);
+  printf("SysEx under drop oldest: %u sent, %u taken, %u arrived whole, %u cut, %u lost\n", sysEx.sent,
+         sysEx.accepted, sysEx.arrived, sysEx.cut, sysEx.lost);
+  if (sysEx.accepted == 0 || sysEx.cut > 0 || sysEx.lost > 0) {
+    printf("%s: a SysEx the queue took did not arrive whole\n", PATH_NAMES[PATH_DROP_OLDEST]);
+    ok = false;
+  }
+
+  printf("%s\n", ok ? "transmit queue never blocked and kept every message whole" : "transmit queue check FAILED");
+  return ok ? 0 : 1;
+}
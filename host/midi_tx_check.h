@@ -0,0 +1,22 @@
+#ifndef MIDI_TX_CHECK_H
+#define MIDI_TX_CHECK_H
+
+/**
+ * MIDI transmit queue throughput check.
+ *
+ * Usage: miditx [bursts] [seed]
+ * Pushes bursts of 128 Program Change / Control Change messages, with
+ * realtime clock bytes mixed in, through the blocking Serial.write path and
+ * through the interrupt-driven queue under each overflow policy. Reports
+ * how long the sends hold up the caller, what reached the wire and how long
+ * realtime bytes waited behind other traffic. The wire is read back with
+ * running status, which back-to-back messages of one status go out in.
+ * Then sends the bursts under drop oldest with SysEx messages in between.
+ * Returns non-zero if the queue ever blocks, corrupts
+ * or reorders a message, loses count of drops, delays a realtime byte past
+ * two byte times, or (drop oldest) loses the last message of a burst that
+ * no newer burst displaced, or cuts or loses a SysEx it took.
+ */
+int commandMidiTx(int argc, char** argv);
+
+#endif
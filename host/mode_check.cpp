@@ -0,0 +1,220 @@
+#include "mode_check.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unordered_map>
+#include <vector>
+
+#include "mode_machine.h"
+#include "state_manager.h"
+
+/*
+ * The closure is a breadth-first walk keyed on the packed state, so each
+ * state is expanded once and the first path found to it is a shortest
+ * one. A power cycle is modelled as StateManager saves and restores the
+ * session: edit mode is saved as bank mode, and bank mode comes back
+ * showing the bank, manual mode the loops.
+ *
+ * A rollback is played with the argument of every legal preset selection
+ * from every state, not only the selection from before the last press, so
+ * the walk reaches at least every state the mode controller can.
+ */
+
+static const uint8_t POWER_CYCLE = MODE_EVENTS;
+
+struct EventArg {
+  uint8_t event;
+  uint8_t arg;
+};
+
+struct Visit {
+  uint64_t parent;
+  EventArg via;
+  uint16_t depth;
+};
+
+static const char* const EVENT_NAMES[MODE_EVENTS + 1] = {
+  "none", "switch", "mode pair", "bank up", "bank down", "edit hold", "program", "flash done", "saved done",
+  "loop set", "rollback", "power cycle"
+};
+
+static const char* const ROW_NAMES[MODE_ROWS] = {"manual", "bank", "preset", "edit"};
+
+static uint64_t packState(const ModeState& state) {
+  return (uint64_t)state.mode | (uint64_t)state.display << 8 | (uint64_t)state.bank << 16 |
+         (uint64_t)(uint8_t)(state.activePreset + 1) << 24 | (uint64_t)state.globalPreset << 32 |
+         (uint64_t)state.flashingPC << 40;
+}
+
+static ModeState unpackState(uint64_t key) {
+  ModeState state;
+  state.mode = key & 0xFF;
+  state.display = (key >> 8) & 0xFF;
+  state.bank = (key >> 16) & 0xFF;
+  state.activePreset = (int8_t)((key >> 24) & 0xFF) - 1;
+  state.globalPreset = (key >> 32) & 1;
+  state.flashingPC = (key >> 40) & 0xFF;
+  return state;
+}
+
+static ModeState powerUpState() {
+  const StateManager fresh;
+  ModeState state;
+  state.mode = fresh.currentMode;
+  state.display = fresh.displayState;
+  state.bank = fresh.currentBank;
+  state.activePreset = fresh.activePreset;
+  state.globalPreset = fresh.globalPresetActive;
+  state.flashingPC = fresh.flashingPC;
+  return state;
+}
+
+static ModeState powerCycled(const ModeState& state) {
+  ModeState restored = powerUpState();
+  restored.mode = (state.mode == MANUAL_MODE) ? MANUAL_MODE : BANK_MODE;
+  restored.display = (restored.mode == BANK_MODE) ? SHOWING_BANK : SHOWING_MANUAL;
+  restored.bank = state.bank;
+  restored.activePreset = state.activePreset;
+  restored.globalPreset = state.globalPreset;
+  return restored;
+}
+
+// Every event with every argument it takes
+static std::vector<EventArg> allEvents() {
+  std::vector<EventArg> events;
+  for (uint8_t event = 0; event < MODE_EVENTS; event++) {
+    if (event == EV_LOOP_SET) {
+      for (uint8_t loop = 0; loop < NUM_LOOPS; loop++) {
+        events.push_back({event, loop});
+        events.push_back({event, (uint8_t)(loop | LOOP_SET_ON)});
+      }
+    } else if (event == EV_ROLLBACK) {
+      // Back to no preset, any preset of the bank, or the global preset on one
+      ModeState before = powerUpState();
+      for (before.activePreset = -1; before.activePreset < PRESETS_PER_BANK; before.activePreset++) {
+        before.globalPreset = false;
+        events.push_back({event, rollbackArg(before)});
+        before.globalPreset = true;
+        if (before.activePreset != -1) events.push_back({event, rollbackArg(before)});
+      }
+    } else {
+      const uint8_t args = (event == EV_SWITCH) ? NUM_SWITCHES : (event == EV_PROGRAM) ? 128 : 1;
+      for (uint8_t arg = 0; arg < args; arg++) events.push_back({event, arg});
+    }
+  }
+  return events;
+}
+
+static void printState(const ModeState& state) {
+  printf("mode %u display %u bank %u preset %d global %u pc %u\n", state.mode, state.display, state.bank,
+         state.activePreset, state.globalPreset, state.flashingPC);
+}
+
+static void printPath(const std::unordered_map<uint64_t, Visit>& visits, uint64_t key) {
+  std::vector<EventArg> path;
+  for (auto it = visits.find(key); it != visits.end() && it->second.depth > 0; it = visits.find(it->second.parent)) {
+    path.push_back(it->second.via);
+  }
+  printf("    from power-up:");
+  for (size_t i = path.size(); i-- > 0;) {
+    printf(" %s", EVENT_NAMES[path[i].event]);
+    if (path[i].event == EV_SWITCH || path[i].event == EV_PROGRAM) printf(" %u", path[i].arg);
+    if (path[i].event == EV_LOOP_SET || path[i].event == EV_ROLLBACK) printf(" 0x%02X", path[i].arg);
+    printf(i ? "," : "\n");
+  }
+  if (path.empty()) printf(" (itself)\n");
+}
+
+int commandModes(int argc, char** argv) {
+  // 0 = until no new state turns up
+  const uint16_t depth = (argc > 0) ? strtoul(argv[0], nullptr, 10) : 0;
+  const std::vector<EventArg> events = allEvents();
+
+  const ModeState start = powerUpState();
+  std::unordered_map<uint64_t, Visit> visits;
+  std::vector<uint64_t> frontier(1, packState(start));
+  visits[frontier[0]] = {0, {EV_NONE, 0}, 0};
+  bool cellUsed[MODE_ROWS][MODE_EVENTS] = {};
+  uint16_t closedAt = 0;
+  bool legal = modeStateValid(start);
+  uint64_t illegalKey = frontier[0];
+  std::vector<ModeState> reached(events.size());
+  uint64_t transitions = 0;
+  double seconds = 0;
+
+  while (!frontier.empty() && legal && (depth == 0 || closedAt < depth)) {
+    std::vector<uint64_t> next;
+    for (size_t f = 0; f < frontier.size() && legal; f++) {
+      const ModeState state = unpackState(frontier[f]);
+      const uint16_t level = visits[frontier[f]].depth + 1;
+
+      // Only the reduceMode() calls are timed
+      struct timespec before, after;
+      clock_gettime(CLOCK_MONOTONIC, &before);
+      for (size_t i = 0; i < events.size(); i++) {
+        uint16_t effects;
+        reached[i] = reduceMode(state, events[i].event, events[i].arg, effects);
+      }
+      clock_gettime(CLOCK_MONOTONIC, &after);
+      seconds += (after.tv_sec - before.tv_sec) + (after.tv_nsec - before.tv_nsec) / 1e9;
+      transitions += events.size();
+
+      for (size_t i = 0; i <= events.size() && legal; i++) {
+        const EventArg via = (i < events.size()) ? events[i] : EventArg{POWER_CYCLE, 0};
+        ModeState result;
+        if (via.event == POWER_CYCLE) {
+          result = powerCycled(state);
+        } else {
+          result = reached[i];
+          if (modeAccepts(state, via.event)) cellUsed[modeRow(state)][via.event] = true;
+        }
+
+        const uint64_t key = packState(result);
+        if (visits.count(key)) continue;
+        visits[key] = {frontier[f], via, level};
+        next.push_back(key);
+        if (!modeStateValid(result)) {
+          legal = false;
+          illegalKey = key;
+        }
+      }
+    }
+    if (!next.empty()) closedAt++;
+    frontier.swap(next);
+  }
+
+  uint8_t cellsUsed = 0;
+  uint8_t cellsIgnoring = 0;
+  for (uint8_t row = 0; row < MODE_ROWS; row++) {
+    for (uint8_t event = 0; event < MODE_EVENTS; event++) {
+      cellsUsed += cellUsed[row][event];
+      ModeState probe = start;
+      probe.mode = (row == ROW_MANUAL) ? MANUAL_MODE : (row == ROW_EDIT) ? EDIT_MODE : BANK_MODE;
+      probe.activePreset = (row == ROW_BANK || row == ROW_MANUAL) ? -1 : 0;
+      if (!modeAccepts(probe, event)) cellsIgnoring++;
+    }
+  }
+
+  printf("modes: transition table of %u rows x %u events, %zu events with their arguments\n", MODE_ROWS, MODE_EVENTS,
+         events.size());
+  if (frontier.empty()) {
+    printf("  reachable states     %zu, no new ones after depth %u, power cycles included\n", visits.size(), closedAt);
+  } else {
+    printf("  states to depth %-4u %zu, new ones still turning up, power cycles included\n", closedAt, visits.size());
+  }
+  printf("  table cells used     %u of %u that take their event (%u ignore it)\n", cellsUsed,
+         MODE_ROWS * MODE_EVENTS - cellsIgnoring, cellsIgnoring);
+  printf("  transitions          %llu in %.3f s (%.1f M/s)\n", (unsigned long long)transitions, seconds,
+         (seconds > 0) ? transitions / seconds / 1e6 : 0.0);
+
+  if (!legal) {
+    const ModeState bad = unpackState(illegalKey);
+    printf("illegal state in row %s: ", ROW_NAMES[modeRow(bad)]);
+    printState(bad);
+    printPath(visits, illegalKey);
+    return 1;
+  }
+  printf("every reachable state is legal\n");
+  return 0;
+}
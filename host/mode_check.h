@@ -0,0 +1,20 @@
+#ifndef MODE_CHECK_H
+#define MODE_CHECK_H
+
+/**
+ * Mode state machine check.
+ *
+ * Usage: modes [depth]
+ * Explores reduceMode() from the power-up state with every event and
+ * argument: every footswitch gesture, all 128 Program Changes, the display
+ * timeouts, MIDI loop changes and the rollback of speculative presses,
+ * plus power cycles through the saved session. Walks the states it can
+ * reach until no new one turns up, or to depth events if given, and checks
+ * each with modeStateValid(). Each state is expanded once, so the walk
+ * runs in time linear in the states reached. Prints the states, the table
+ * cells they use and the reduceMode() calls per second. Returns non-zero,
+ * with the events that lead there, if any state is illegal.
+ */
+int commandModes(int argc, char** argv);
+
+#endif
@@ -0,0 +1,116 @@
+#include "peripherals.h"
+
+// MAX7219 register addresses
+#define OP_DIGIT0     1
+#define OP_DIGIT7     8
+#define OP_INTENSITY  10
+#define OP_SHUTDOWN   12
+
+Max7219Model::Max7219Model(uint8_t dinPin, uint8_t clkPin, uint8_t csPin)
+  : dinPin(dinPin), clkPin(clkPin), csPin(csPin) {
+  reset();
+}
+
+void Max7219Model::reset() {
+  memset(digits, 0, sizeof(digits));
+  shutdown = true;
+  intensity = 0;
+  registerWrites = 0;
+  clkLevel = LOW;
+  csLevel = HIGH;
+  dinLevel = LOW;
+  shift = 0;
+  dirty = false;
+}
+
+void Max7219Model::onPinWrite(uint8_t pin, uint8_t level) {
+  if (pin == dinPin) {
+    dinLevel = level;
+  } else if (pin == clkPin) {
+    // Data is clocked in on the rising edge while LOAD/CS is low
+    if (level == HIGH && clkLevel == LOW && csLevel == LOW) {
+      shift = (uint16_t)((shift << 1) | dinLevel);
+    }
+    clkLevel = level;
+  } else if (pin == csPin) {
+    // The last 16 bits are latched on the rising edge of LOAD/CS
+    if (level == HIGH && csLevel == LOW) {
+      const uint8_t opcode = (shift >> 8) & 0x0F;
+      const uint8_t data = shift & 0xFF;
+      if (opcode >= OP_DIGIT0 && opcode <= OP_DIGIT7) {
+        if (digits[opcode - OP_DIGIT0] != data) dirty = true;
+        digits[opcode - OP_DIGIT0] = data;
+      } else if (opcode == OP_INTENSITY) {
+        intensity = data & 0x0F;
+      } else if (opcode == OP_SHUTDOWN) {
+        shutdown = (data & 0x01) == 0;
+      }
+      registerWrites++;
+    }
+    csLevel = level;
+  }
+}
+
+bool Max7219Model::takeDirty() {
+  const bool wasDirty = dirty;
+  dirty = false;
+  return wasDirty;
+}
+
+ShiftRegisterModel::ShiftRegisterModel(uint8_t dataPin, uint8_t clockPin, uint8_t latchPin, uint8_t chainLength)
+  : dataPin(dataPin), clockPin(clockPin), latchPin(latchPin),
+    chainMask((chainLength >= 4) ? 0xFFFFFFFFUL : ((1UL << (chainLength * 8)) - 1)) {
+  reset();
+}
+
+void ShiftRegisterModel::reset() {
+  outputs = 0;
+  latches = 0;
+  clocks = 0;
+  dataLevel = LOW;
+  clockLevel = LOW;
+  latchLevel = LOW;
+  shift = 0;
+}
+
+void ShiftRegisterModel::onPinWrite(uint8_t pin, uint8_t level) {
+  if (pin == dataPin) {
+    dataLevel = level;
+  } else if (pin == clockPin) {
+    if (level == HIGH && clockLevel == LOW) {
+      // Bits shifted past the last chip fall off QH'
+      shift = ((shift << 1) | dataLevel) & chainMask;
+      clocks++;
+    }
+    clockLevel = level;
+  } else if (pin == latchPin) {
+    if (level == HIGH && latchLevel == LOW) {
+      outputs = shift;
+      latches++;
+    }
+    latchLevel = level;
+  }
+}
+
+struct GlyphName {
+  uint8_t segments;
+  char c;
+};
+
+// Everything the firmware draws: LedControl's table plus the custom 'n' and 't'
+static const GlyphName GLYPHS[] = {
+  {0b00000000, ' '}, {0b01111110, '0'}, {0b00110000, '1'}, {0b01101101, '2'},
+  {0b01111001, '3'}, {0b00110011, '4'}, {0b01011011, '5'}, {0b01011111, '6'},
+  {0b01110000, '7'}, {0b01111111, '8'}, {0b01111011, '9'}, {0b01110111, 'A'},
+  {0b00011111, 'b'}, {0b00001101, 'c'}, {0b00111101, 'd'}, {0b01001111, 'E'},
+  {0b01000111, 'F'}, {0b00110111, 'H'}, {0b00001110, 'L'}, {0b01100111, 'P'},
+  {0b00000001, '-'}, {0b00001000, '_'}, {0b00010101, 'n'}, {0b00001111, 't'},
+};
+
+char segmentToChar(uint8_t segments) {
+  segments &= 0x7F;
+  for (uint8_t i = 0; i < sizeof(GLYPHS) / sizeof(GLYPHS[0]); i++) {
+    if (GLYPHS[i].segments == segments) return GLYPHS[i].c;
+  }
+  return '?';
+}
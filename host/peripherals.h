@@ -0,0 +1,80 @@
+#ifndef PERIPHERALS_H
+#define PERIPHERALS_H
+
+#include <Arduino.h>
+
+/**
+ * Pin-level models of the board's peripheral chips.
+ *
+ * They decode the same pin edges the real parts see, so they stay correct
+ * whichever way the firmware drives the pins (library, bit-bang or port writes).
+ * Feed them from the HAL pin-write hook.
+ */
+
+/**
+ * Max7219Model - Single MAX7219 with 8 digit registers.
+ * Samples DIN on CLK rising edges and latches the 16-bit frame on CS rising edge.
+ */
+class Max7219Model {
+public:
+  Max7219Model(uint8_t dinPin, uint8_t clkPin, uint8_t csPin);
+
+  void reset();
+  void onPinWrite(uint8_t pin, uint8_t level);
+
+  /**
+   * Consume the "digits changed" flag.
+   * @return true if any digit register changed since the last call
+   */
+  bool takeDirty();
+
+  uint8_t digits[8];        // Segment byte per digit register, index 0 = rightmost
+  bool shutdown;
+  uint8_t intensity;
+  uint32_t registerWrites;  // Completed 16-bit frames
+
+private:
+  uint8_t dinPin;
+  uint8_t clkPin;
+  uint8_t csPin;
+  uint8_t clkLevel;
+  uint8_t csLevel;
+  uint8_t dinLevel;
+  uint16_t shift;
+  bool dirty;
+};
+
+/**
+ * ShiftRegisterModel - Chain of 74HC595s.
+ * Samples SER on SRCLK rising edges and copies the shift stage to the
+ * outputs on RCLK rising edge.
+ */
+class ShiftRegisterModel {
+public:
+  ShiftRegisterModel(uint8_t dataPin, uint8_t clockPin, uint8_t latchPin, uint8_t chainLength = 1);
+
+  void reset();
+  void onPinWrite(uint8_t pin, uint8_t level);
+
+  uint32_t outputs;     // Latched outputs, Q0 of the first chip = bit 0
+  uint32_t latches;     // RCLK rising edges seen
+  uint32_t clocks;      // SRCLK rising edges seen
+
+private:
+  uint8_t dataPin;
+  uint8_t clockPin;
+  uint8_t latchPin;
+  uint32_t chainMask;
+  uint8_t dataLevel;
+  uint8_t clockLevel;
+  uint8_t latchLevel;
+  uint32_t shift;
+};
+
+/**
+ * Render a MAX7219 segment byte as the character it shows ('?' if unknown).
+ * The decimal point (bit 7) is ignored.
+ */
+char segmentToChar(uint8_t segments);
+
+#endif
@@ -0,0 +1,658 @@
+#include "preset_store_check.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+#include "hal_host.h"
+#include <EEPROM.h>
+#include "rng.h"
+#include "preset_store.h"
+#include "preset_messages.h"
+#include "simulator.h"
+#include <util/crc16.h>
+
+/*
+ * The store is driven on its own, the way the main loop drives it: one
+ * update() per 10 ms pass, with a save landing in about one pass in three.
+ * Most saves go to one preset, like a player tweaking the same sound over
+ * and over.
+ *
+ * The EEPROM write hook tells which value of each preset EEPROM holds:
+ *   committed  - value of the preset's newest complete journal record
+ *   written    - value of the newest EEPROM write about the preset, a
+ *                record or a base table byte written back
+ *   saved      - value of the newest save
+ * A boot has to bring back one of the three for every preset: a save that
+ * never completed a record may be lost, an older value may not come back.
+ *
+ * Power is cut at a random point of a pass. Each pass starts at most one
+ * EEPROM write, so this covers every point a multi-byte update can be cut
+ * at. A cut while a byte is still programming leaves that cell torn: it
+ * holds a random value, and the write does not count as done.
+ */
+
+static const uint64_t PASS_NS = MAIN_LOOP_INTERVAL_MS * 1000000ULL;
+static const uint8_t HOT_PRESET = 5;
+static const uint8_t HOT_PERCENT = 60;
+// Blocking save of earlier firmware: one erase + write
+static const uint32_t BLOCKING_SAVE_US = 3400;
+// Longest a pass may spend on EEPROM: checking the base table during a write-back
+static const uint32_t PASS_LIMIT_US = 200;
+static const uint16_t JOURNAL_SLOTS = PresetStore::JOURNAL_SLOTS;
+static const uint8_t RECORD_SIZE = PresetStore::RECORD_SIZE;
+
+struct EepromWrite {
+  bool pending;
+  uint16_t address;
+  uint64_t timeNs;
+};
+
+static LoopMask g_committed[TOTAL_PRESETS];
+static LoopMask g_written[TOTAL_PRESETS];
+static LoopMask g_saved[TOTAL_PRESETS];
+static uint32_t g_records;
+static std::vector<uint64_t> g_commitNs;   // Per preset: when the newest record completed
+static EepromWrite g_lastWrite;            // Still programming until the next access
+
+// CRC-8 as the firmware computes it (poly 0x07, init 0xFF), without the HAL's cycle cost
+static uint8_t crc8(const uint8_t* bytes, uint8_t length) {
+  uint8_t crc = 0xFF;
+  for (uint8_t i = 0; i < length; i++) {
+    crc ^= bytes[i];
+    for (uint8_t bit = 0; bit < 8; bit++) {
+      crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x07) : (uint8_t)(crc << 1);
+    }
+  }
+  return crc;
+}
+
+static void finishWrite() {
+  if (!g_lastWrite.pending) return;
+  g_lastWrite.pending = false;
+
+  const uint16_t address = g_lastWrite.address;
+  const uint8_t value = hostEepromData()[address];
+  if (address >= EEPROM_PRESETS_START_ADDR && address < EEPROM_PRESETS_START_ADDR + TOTAL_PRESETS) {
+    LoopMask& written = g_written[address - EEPROM_PRESETS_START_ADDR];
+    written = (LoopMask)((written & ~0xFF) | value);
+    return;
+  }
+  if (PresetStore::LOOP_BYTES > 1 && address >= EEPROM_PRESETS_HIGH_ADDR &&
+      address < EEPROM_PRESETS_HIGH_ADDR + TOTAL_PRESETS) {
+    // Loops 9-16, kept inverted
+    LoopMask& written = g_written[address - EEPROM_PRESETS_HIGH_ADDR];
+    written = (LoopMask)((written & 0xFF) | ((uint8_t)~value << 8));
+    return;
+  }
+  // Byte 0 is written last and completes a record; a fence only flips its
+  // lap bit, which the CRC always catches
+  if (address < EEPROM_JOURNAL_START_ADDR || address >= EEPROM_MESSAGES_START_ADDR ||
+      (address - EEPROM_JOURNAL_START_ADDR) % RECORD_SIZE != 0) {
+    return;
+  }
+  const uint8_t* eeprom = hostEepromData();
+  if (crc8(eeprom + address, RECORD_SIZE - 1) != eeprom[address + RECORD_SIZE - 1]) return;
+  const uint8_t index = value & 0x7F;
+  LoopMask loops = 0;
+  for (uint8_t i = 0; i < PresetStore::LOOP_BYTES; i++) loops |= (LoopMask)(eeprom[address + 1 + i] << (8 * i));
+  loops &= ALL_LOOPS;
+  g_committed[index] = loops;
+  g_written[index] = loops;
+  g_commitNs[index] = g_lastWrite.timeNs;
+  g_records++;
+}
+
+static void onEepromWrite(uint16_t address, uint8_t value, uint64_t timeNs) {
+  (void)value;
+  // The HAL waited for the previous write before starting this one
+  finishWrite();
+  g_lastWrite.pending = true;
+  g_lastWrite.address = address;
+  g_lastWrite.timeNs = timeNs;
+}
+
+static void resetTracking() {
+  memset(g_committed, 0, sizeof(g_committed));
+  memset(g_written, 0, sizeof(g_written));
+  memset(g_saved, 0, sizeof(g_saved));
+  g_records = 0;
+  g_commitNs.assign(TOTAL_PRESETS, 0);
+  g_lastWrite.pending = false;
+  hostSetEepromWriteHook(onEepromWrite);
+}
+
+static uint32_t percentile(const std::vector<uint32_t>& sorted, uint32_t pct) {
+  const size_t index = (sorted.size() * pct + 99) / 100;
+  return sorted[index == 0 ? 0 : index - 1];
+}
+
+struct BootResult {
+  uint32_t wrong;
+  uint32_t repairedBanks;
+  uint32_t resetBanks;
+};
+
+/**
+ * Cut the power somewhere in the current pass, then boot a fresh store
+ * from the EEPROM image and compare it with what was committed.
+ * Afterwards the booted values are what EEPROM holds.
+ */
+static void powerCycle(PresetStore& store, Rng& rng, BootResult& result, uint32_t& torn) {
+  const uint64_t cutNs = hostNowNs() + rng.between(0, PASS_NS / 1000) * 1000ULL;
+  if (g_lastWrite.pending && cutNs < g_lastWrite.timeNs + g_hostCost.eepromWriteNs) {
+    hostEepromData()[g_lastWrite.address] = rng.next() & 0xFF;
+    g_lastWrite.pending = false;
+    torn++;
+  }
+  finishWrite();
+  hostAdvanceToNs(cutNs + PASS_NS);
+
+  store = PresetStore();
+  store.begin();
+  result.repairedBanks += store.repairedBanks();
+  result.resetBanks += store.resetBanks();
+
+  for (uint8_t i = 0; i < TOTAL_PRESETS; i++) {
+    const LoopMask loops = store.get(i);
+    if (loops != g_committed[i] && loops != g_written[i] && loops != g_saved[i]) {
+      if (result.wrong == 0) {
+        printf("  preset %u booted as %u, committed %u, last written %u, last saved %u\n", i + 1, loops,
+               g_committed[i], g_written[i], g_saved[i]);
+      }
+      result.wrong++;
+    }
+    g_committed[i] = loops;
+    g_written[i] = loops;
+    g_saved[i] = loops;
+  }
+}
+
+static void drain(PresetStore& store) {
+  while (!store.isIdle()) {
+    hostAdvanceNs(PASS_NS);
+    store.update();
+  }
+}
+
+/**
+ * Save presets one after the other until the journal holds the given
+ * number of records. Stops short of the write-back that follows a full ring.
+ */
+static void fillJournal(PresetStore& store, Rng& rng, uint16_t records) {
+  const uint32_t target = g_records + records;
+  while (g_records < target) {
+    const uint8_t index = rng.between(0, TOTAL_PRESETS - 1);
+    store.set(index, (LoopMask)((store.get(index) + rng.between(1, ALL_LOOPS)) & ALL_LOOPS));
+    while (g_records < target && !store.isIdle()) {
+      hostAdvanceNs(PASS_NS);
+      store.update();
+      finishWrite();
+    }
+  }
+  hostAdvanceNs(PASS_NS);
+}
+
+// Base table of earlier, 4-loop firmware
+static void randomBaseTable(Rng& rng, LoopMask* expected) {
+  uint8_t* eeprom = hostEepromData();
+  for (uint16_t a = EEPROM_PRESETS_START_ADDR + TOTAL_PRESETS; a < EEPROM_SIZE; a++) eeprom[a] = rng.next() & 0xFF;
+  for (uint8_t i = 0; i < TOTAL_PRESETS; i++) {
+    expected[i] = rng.between(0, 15);
+    eeprom[EEPROM_PRESETS_START_ADDR + i] = expected[i];
+  }
+}
+
+/**
+ * Images left by earlier firmware, and one from firmware with a layout
+ * version this one does not know: the presets have to survive the first
+ * boot, junk in the rest of EEPROM must not replay, and a save after it
+ * has to survive the next.
+ * @return Number of upgrades that lost a preset
+ */
+static uint32_t checkUpgrades(Rng& rng) {
+  static const char* const NAMES[] = {"base table (0x42)", "2-byte journal (0x43)", "layout version 1",
+                                      "layout version 2", "unknown version"};
+  uint32_t failed = 0;
+
+  for (uint8_t kind = 0; kind < 5; kind++) {
+    hostReset();
+    uint8_t* eeprom = hostEepromData();
+    LoopMask expected[TOTAL_PRESETS];
+    randomBaseTable(rng, expected);
+
+    if (kind == 0) {
+      eeprom[EEPROM_INIT_FLAG_ADDR] = EEPROM_INIT_MAGIC;
+    } else if (kind == 1) {
+      // 2-byte records (lap | index, lap | check | loops) after the base table, lap 1
+      eeprom[EEPROM_INIT_FLAG_ADDR] = EEPROM_JOURNAL_MAGIC;
+      const uint16_t start = EEPROM_PRESETS_START_ADDR + TOTAL_PRESETS;
+      const uint16_t records = rng.between(1, 400);
+      for (uint16_t slot = 0; slot <= records; slot++) {
+        const uint8_t index = rng.between(0, TOTAL_PRESETS - 1);
+        const uint8_t loops = rng.between(0, 15);
+        const uint8_t check = ~(index ^ (index >> 3) ^ (index >> 6) ^ loops) & 0x07;
+        // The slot after the last record is from the previous lap
+        const uint8_t lapBit = (slot < records) ? 0x80 : 0x00;
+        eeprom[start + slot * 2] = lapBit | index;
+        eeprom[start + slot * 2 + 1] = lapBit | (check << 4) | loops;
+        if (slot < records) expected[index] = loops;
+      }
+    } else if (kind == 2) {
+      // 3-byte records running to the end of EEPROM, over where the session ring is now.
+      // Only 4-loop units ran this layout: a larger unit keeps just the base table.
+      eeprom[EEPROM_INIT_FLAG_ADDR] = EEPROM_HEADER_MAGIC;
+      eeprom[EEPROM_HEADER_ADDR] = 1;
+      eeprom[EEPROM_HEADER_ADDR + 1] = (uint8_t)~1;
+      const uint16_t slots = (EEPROM_SIZE - EEPROM_JOURNAL_START_ADDR) / 3;
+      const uint16_t records = rng.between(JOURNAL_SLOTS, slots - 1);
+      for (uint16_t slot = 0; slot <= records; slot++) {
+        const uint8_t index = rng.between(0, TOTAL_PRESETS - 1);
+        const uint8_t lapBit = (slot < records) ? 0x80 : 0x00;
+        uint8_t* record = eeprom + EEPROM_JOURNAL_START_ADDR + slot * 3;
+        record[0] = lapBit | index;
+        record[1] = lapBit | rng.between(0, 15);
+        record[2] = _crc8_ccitt_update(_crc8_ccitt_update(0xFF, record[0]), record[1]);
+        if (slot < records && NUM_LOOPS <= 4) expected[index] = record[1] & 0x0F;
+      }
+    } else if (kind == 3) {
+      // This unit's tables and records, with the ring running to the session
+      // ring, over where the preset messages are now
+      eeprom[EEPROM_INIT_FLAG_ADDR] = EEPROM_HEADER_MAGIC;
+      eeprom[EEPROM_HEADER_ADDR] = (EEPROM_LAYOUT_ID & ~0x07) | 2;
+      eeprom[EEPROM_HEADER_ADDR + 1] = ~eeprom[EEPROM_HEADER_ADDR];
+      for (uint8_t i = 0; PresetStore::LOOP_BYTES > 1 && i < TOTAL_PRESETS; i++) {
+        const uint8_t high = rng.next() & (ALL_LOOPS >> 8);
+        eeprom[EEPROM_PRESETS_HIGH_ADDR + i] = ~high;
+        expected[i] |= (LoopMask)(high << 8);
+      }
+      const uint16_t slots = (EEPROM_SESSION_START_ADDR - EEPROM_JOURNAL_START_ADDR) / RECORD_SIZE;
+      const uint16_t records = rng.between(JOURNAL_SLOTS, slots - 1);
+      for (uint16_t slot = 0; slot <= records; slot++) {
+        const uint8_t index = rng.between(0, TOTAL_PRESETS - 1);
+        const LoopMask loops = (LoopMask)(rng.next() & ALL_LOOPS);
+        const uint8_t lap = (slot < records) ? 1 : 0;
+        // The lap rides in the top bit of the loop bytes when the loops leave it free
+        const uint32_t loopBytes = loops | ((lap && NUM_LOOPS < PresetStore::LOOP_BYTES * 8)
+                                                ? 1UL << (PresetStore::LOOP_BYTES * 8 - 1) : 0);
+        uint8_t* record = eeprom + EEPROM_JOURNAL_START_ADDR + slot * RECORD_SIZE;
+        record[0] = (lap << 7) | index;
+        for (uint8_t b = 0; b < PresetStore::LOOP_BYTES; b++) record[1 + b] = (uint8_t)(loopBytes >> (8 * b));
+        record[RECORD_SIZE - 1] = crc8(record, RECORD_SIZE - 1);
+        if (slot < records) expected[index] = loops;
+      }
+      // Its session ring is where this firmware keeps it
+      if (!PresetStore::sessionRingCurrent()) {
+        printf("  layout version 2 session ring not taken up\n");
+        failed++;
+      }
+    } else {
+      eeprom[EEPROM_INIT_FLAG_ADDR] = EEPROM_HEADER_MAGIC;
+      eeprom[EEPROM_HEADER_ADDR] = EEPROM_LAYOUT_VERSION + 1;
+      eeprom[EEPROM_HEADER_ADDR + 1] = ~(EEPROM_LAYOUT_VERSION + 1);
+    }
+
+    PresetStore store;
+    store.begin();
+    bool ok = eeprom[EEPROM_INIT_FLAG_ADDR] == EEPROM_HEADER_MAGIC && eeprom[EEPROM_HEADER_ADDR] == EEPROM_LAYOUT_ID;
+    for (uint8_t i = 0; i < TOTAL_PRESETS; i++) ok = ok && store.get(i) == expected[i];
+    // Whatever was where the messages are now is not taken for them
+    PresetMessages messages;
+    messages.begin();
+    ok = ok && messages.bytesUsed() == 0;
+
+    expected[HOT_PRESET] ^= 0x0F;
+    store.set(HOT_PRESET, expected[HOT_PRESET]);
+    drain(store);
+    store = PresetStore();
+    store.begin();
+    for (uint8_t i = 0; i < TOTAL_PRESETS; i++) ok = ok && store.get(i) == expected[i];
+    ok = ok && store.repairedBanks() == 0 && store.resetBanks() == 0;
+
+    printf("  upgrade from %-22s %s\n", NAMES[kind], ok ? "ok" : "FAILED");
+    if (!ok) failed++;
+  }
+  return failed;
+}
+
+/**
+ * A base table byte gone bad with the journal part full: the bank it is in
+ * keeps the presets the journal holds and resets the rest, every other
+ * bank is untouched, and the bank is rewritten.
+ * @return true if exactly that happened
+ */
+static bool checkBankFallback(Rng& rng) {
+  hostReset();
+  resetTracking();
+  PresetStore store;
+  store.begin();
+  fillJournal(store, rng, JOURNAL_SLOTS / 2);
+  drain(store);
+
+  LoopMask before[TOTAL_PRESETS];
+  for (uint8_t i = 0; i < TOTAL_PRESETS; i++) before[i] = store.get(i);
+
+  // The first preset of the bank that has a preset the journal does not hold
+  std::vector<bool> journaled(TOTAL_PRESETS, false);
+  const uint8_t* eeprom = hostEepromData();
+  for (uint16_t slot = 0; slot < JOURNAL_SLOTS; slot++) {
+    const uint16_t address = EEPROM_JOURNAL_START_ADDR + slot * RECORD_SIZE;
+    if ((eeprom[address] >> 7) != (eeprom[EEPROM_JOURNAL_START_ADDR] >> 7)) break;
+    journaled[eeprom[address] & 0x7F] = true;
+  }
+  uint8_t bank = 0;
+  while (bank < NUM_BANKS) {
+    const uint8_t first = bank * PRESETS_PER_BANK;
+    bool allJournaled = true;
+    for (uint8_t i = first; i < first + PRESETS_PER_BANK; i++) allJournaled = allJournaled && journaled[i];
+    if (!allJournaled) break;
+    bank++;
+  }
+  if (bank == NUM_BANKS) return false;
+  hostEepromData()[EEPROM_PRESETS_START_ADDR + bank * PRESETS_PER_BANK] ^= 0x0A;
+
+  store = PresetStore();
+  store.begin();
+  bool ok = store.resetBanks() == 1 && store.repairedBanks() == 0;
+  for (uint8_t i = 0; i < TOTAL_PRESETS; i++) {
+    const bool inBank = i / PRESETS_PER_BANK == bank;
+    const LoopMask expected = (inBank && !journaled[i]) ? 0 : before[i];
+    ok = ok && store.get(i) == expected;
+    before[i] = expected;
+  }
+
+  drain(store);
+  store = PresetStore();
+  store.begin();
+  ok = ok && store.resetBanks() == 0 && store.repairedBanks() == 0;
+  for (uint8_t i = 0; i < TOTAL_PRESETS; i++) ok = ok && store.get(i) == before[i];
+  return ok;
+}
+
+/*
+ * Preset messages are changed at random (added, grown, shrunk, removed)
+ * while update() writes them one byte per pass. get() has to give back
+ * what was last set at every pass, for every preset. Power is cut now and
+ * then, tearing the byte being programmed: a boot has to bring back every
+ * preset as last set, or as it was before, for the one being changed.
+ */
+static const uint32_t MESSAGE_CHANGES = 3000;
+static const uint8_t MESSAGE_PRESETS = 12;   // More than fit at times, so the halves fill up
+
+struct MessagesResult {
+  uint32_t changes;
+  uint32_t refused;       // No room
+  uint32_t powerCuts;
+  uint32_t readsWrong;    // get() disagreed with what was set
+  uint32_t bootedWrong;   // Presets a boot brought back neither as set nor as before
+  uint32_t maxPassNs;
+  uint32_t maxGetNs;
+  uint16_t mostUsed;
+};
+
+// Random Program Changes and Control Changes on three channels, each with its status byte
+static std::vector<uint8_t> randomMessages(Rng& rng) {
+  std::vector<uint8_t> bytes;
+  const uint8_t count = rng.between(0, PRESET_MAX_MESSAGES);
+  for (uint8_t m = 0; m < count; m++) {
+    const uint8_t channel = rng.between(0, 2);
+    if (rng.between(0, 1)) {
+      bytes.push_back(0xC0 | channel);
+      bytes.push_back(rng.between(0, 127));
+    } else {
+      bytes.push_back(0xB0 | channel);
+      bytes.push_back(rng.between(0, 127));
+      bytes.push_back(rng.between(0, 127));
+    }
+  }
+  return bytes;
+}
+
+// The bytes as PresetMessages keeps them: a status byte only where it changes
+static std::vector<uint8_t> runningStatus(const std::vector<uint8_t>& bytes) {
+  std::vector<uint8_t> out;
+  uint8_t status = 0;
+  for (size_t i = 0; i < bytes.size(); i++) {
+    if (bytes[i] & 0x80) {
+      if (bytes[i] == status) continue;
+      status = bytes[i];
+    }
+    out.push_back(bytes[i]);
+  }
+  return out;
+}
+
+static std::vector<uint8_t> storedMessages(const PresetMessages& messages, uint8_t index, MessagesResult& result) {
+  uint8_t bytes[PRESET_MESSAGE_BYTES];
+  const uint64_t start = hostNowNs();
+  const uint8_t length = messages.get(index, bytes);
+  result.maxGetNs = std::max(result.maxGetNs, (uint32_t)(hostNowNs() - start));
+  return std::vector<uint8_t>(bytes, bytes + length);
+}
+
+static MessagesResult checkMessages(Rng& rng) {
+  hostReset();
+  hostSetEepromWriteHook(onEepromWrite);
+  g_lastWrite.pending = false;
+  PresetStore store;
+  store.begin();
+  PresetMessages messages;
+  messages.begin();
+
+  MessagesResult result;
+  memset(&result, 0, sizeof(result));
+  std::vector<std::vector<uint8_t> > set(TOTAL_PRESETS);
+  std::vector<std::vector<uint8_t> > before(TOTAL_PRESETS);   // As they were before the change being written
+  uint32_t nextCut = rng.between(50, 600);
+
+  for (uint32_t pass = 1; result.changes < MESSAGE_CHANGES || !messages.isIdle(); pass++) {
+    hostAdvanceNs(PASS_NS);
+    if (messages.isIdle()) before = set;
+
+    // As the control task would, a pass after the last write
+    for (uint8_t i = 0; i < MESSAGE_PRESETS; i++) {
+      if (storedMessages(messages, i, result) != set[i]) result.readsWrong++;
+    }
+
+    if (result.changes < MESSAGE_CHANGES && messages.isIdle() && rng.between(0, 3) == 0) {
+      const uint8_t index = rng.between(0, MESSAGE_PRESETS - 1);
+      const std::vector<uint8_t> bytes = randomMessages(rng);
+      result.changes++;
+      if (messages.set(index, bytes.data(), bytes.size())) {
+        set[index] = runningStatus(bytes);
+      } else {
+        result.refused++;
+      }
+    }
+
+    const uint64_t start = hostNowNs();
+    messages.update();
+    result.maxPassNs = std::max(result.maxPassNs, (uint32_t)(hostNowNs() - start));
+    result.mostUsed = std::max(result.mostUsed, messages.bytesUsed());
+
+    if (pass != nextCut) continue;
+    nextCut = pass + rng.between(50, 600);
+    result.powerCuts++;
+    const uint64_t cutNs = hostNowNs() + rng.between(0, PASS_NS / 1000) * 1000ULL;
+    if (g_lastWrite.pending && cutNs < g_lastWrite.timeNs + g_hostCost.eepromWriteNs) {
+      hostEepromData()[g_lastWrite.address] = rng.next() & 0xFF;
+    }
+    g_lastWrite.pending = false;
+    hostAdvanceToNs(cutNs + PASS_NS);
+
+    messages = PresetMessages();
+    messages.begin();
+    for (uint8_t i = 0; i < TOTAL_PRESETS; i++) {
+      const std::vector<uint8_t> booted = storedMessages(messages, i, result);
+      if (booted != set[i] && booted != before[i]) result.bootedWrong++;
+      set[i] = booted;
+    }
+  }
+  return result;
+}
+
+int commandStore(int argc, char** argv) {
+  const uint32_t saves = (argc > 0) ? strtoul(argv[0], nullptr, 10) : 20000;
+  Rng rng((argc > 1) ? strtoul(argv[1], nullptr, 10) : 1);
+
+  g_hostCost = HOST_COST_ATMEGA328;
+  hostReset();
+  resetTracking();
+
+  PresetStore store;
+  store.begin();
+
+  uint32_t saved = 0;
+  uint32_t hotSaves = 0;
+  uint32_t powerCuts = 0;
+  uint32_t torn = 0;
+  BootResult boots = {0, 0, 0};
+  uint32_t maxSaveNs = 0;
+  uint32_t maxPassNs = 0;
+  uint64_t nextCut = rng.between(200, 3000);
+  std::vector<uint64_t> pendingSince(TOTAL_PRESETS, 0);   // First save not yet in a record, 0 if none
+  std::vector<uint32_t> commitDelayUs;
+
+  for (uint64_t pass = 1; saved < saves || !store.isIdle(); pass++) {
+    hostAdvanceToNs(std::max(hostNowNs(), pass * PASS_NS));
+
+    if (saved < saves && rng.between(0, 2) == 0) {
+      const uint8_t index = (rng.between(1, 100) <= HOT_PERCENT) ? HOT_PRESET : rng.between(0, TOTAL_PRESETS - 1);
+      // Saving an unchanged preset does not reach the store
+      const LoopMask loops = (LoopMask)((store.get(index) + rng.between(1, ALL_LOOPS)) & ALL_LOOPS);
+      const uint64_t start = hostNowNs();
+      store.set(index, loops);
+      maxSaveNs = std::max(maxSaveNs, (uint32_t)(hostNowNs() - start));
+      g_saved[index] = loops;
+      if (pendingSince[index] == 0) pendingSince[index] = start;
+      saved++;
+      if (index == HOT_PRESET) hotSaves++;
+    }
+
+    const uint64_t start = hostNowNs();
+    store.update();
+    maxPassNs = std::max(maxPassNs, (uint32_t)(hostNowNs() - start));
+
+    if (pass == nextCut) {
+      powerCycle(store, rng, boots, torn);
+      std::fill(pendingSince.begin(), pendingSince.end(), 0);
+      powerCuts++;
+      nextCut = pass + rng.between(200, 3000);
+      continue;
+    }
+
+    // Delay from a save to the record that holds it
+    finishWrite();
+    for (uint8_t i = 0; i < TOTAL_PRESETS; i++) {
+      if (pendingSince[i] != 0 && g_commitNs[i] >= pendingSince[i] && g_committed[i] == store.get(i)) {
+        commitDelayUs.push_back((uint32_t)((g_commitNs[i] - pendingSince[i]) / 1000));
+        pendingSince[i] = 0;
+      }
+    }
+  }
+  powerCycle(store, rng, boots, torn);
+  powerCuts++;
+
+  const uint32_t* counts = hostEepromWriteCounts();
+  uint32_t maxBase = 0;
+  uint32_t maxCrc = 0;
+  uint32_t maxJournal = 0;
+  for (uint16_t a = EEPROM_PRESETS_START_ADDR; a < EEPROM_HEADER_ADDR; a++) maxBase = std::max(maxBase, counts[a]);
+  for (uint16_t a = EEPROM_BANK_CRC_ADDR; a < EEPROM_JOURNAL_START_ADDR; a++) maxCrc = std::max(maxCrc, counts[a]);
+  for (uint16_t a = EEPROM_JOURNAL_START_ADDR; a < EEPROM_MESSAGES_START_ADDR; a++) {
+    maxJournal = std::max(maxJournal, counts[a]);
+  }
+  const uint32_t maxCell = std::max(std::max(maxBase, maxCrc), maxJournal);
+
+  std::sort(commitDelayUs.begin(), commitDelayUs.end());
+
+  printf("store: %u saves (%u to preset %u), %u records, %u power cuts (%u tore a byte)\n", saved, hotSaves,
+         HOT_PRESET + 1, g_records, powerCuts, torn);
+  printf("  most writes to one cell  %u (fixed address: %u) - %.1fx less wear\n", maxCell, hotSaves,
+         maxCell ? (double)hotSaves / maxCell : 0.0);
+  printf("    base table             %u\n", maxBase);
+  printf("    bank CRCs              %u\n", maxCrc);
+  printf("    journal                %u\n", maxJournal);
+  printf("  longest save             %u us (blocking write: %u us)\n", maxSaveNs / 1000, BLOCKING_SAVE_US);
+  printf("  longest pass in update() %u us\n", maxPassNs / 1000);
+  if (!commitDelayUs.empty()) {
+    printf("  save to record (ms)      median %u, p99 %u, max %u\n", percentile(commitDelayUs, 50) / 1000,
+           percentile(commitDelayUs, 99) / 1000, commitDelayUs.back() / 1000);
+  }
+  printf("  banks repaired / reset   %u / %u\n", boots.repairedBanks, boots.resetBanks);
+  printf("  presets booted wrong     %u\n", boots.wrong);
+
+  const uint32_t upgradesFailed = checkUpgrades(rng);
+  const bool fallback = checkBankFallback(rng);
+  printf("  bad base table byte      %s\n", fallback ? "bank reset, others kept" : "FAILED");
+
+  const MessagesResult m = checkMessages(rng);
+  printf("  preset messages          %u changes (%u refused, no room), %u power cuts\n", m.changes, m.refused,
+         m.powerCuts);
+  printf("    most bytes used        %u of %u\n", m.mostUsed, PresetMessages::LOG_SIZE);
+  printf("    longest get() / pass   %u / %u us\n", m.maxGetNs / 1000, m.maxPassNs / 1000);
+  printf("    read back wrong        %u\n", m.readsWrong);
+  printf("    booted wrong           %u\n", m.bootedWrong);
+
+  const bool ok = boots.wrong == 0 && boots.resetBanks == 0 && upgradesFailed == 0 && fallback &&
+                  maxSaveNs / 1000 < BLOCKING_SAVE_US && maxPassNs / 1000 <= PASS_LIMIT_US &&
+                  m.readsWrong == 0 && m.bootedWrong == 0 && m.maxPassNs / 1000 <= PASS_LIMIT_US;
+  printf("%s\n", ok ? "every boot recovered the committed presets without waiting on EEPROM" : "store check FAILED");
+  return ok ? 0 : 1;
+}
+
+int commandStoreBoot(int argc, char** argv) {
+  Rng rng((argc > 0) ? strtoul(argv[0], nullptr, 10) : 1);
+  g_hostCost = HOST_COST_ATMEGA328;
+
+  enum Image { ERASED, EMPTY, HALF, FULL, BAD_BANK, LEGACY_BASE, NUM_IMAGES };
+  static const char* const NAMES[NUM_IMAGES] = {
+    "erased (first boot)", "journal empty", "journal half full", "ring full, mid write-back",
+    "one bank failing CRC", "earlier base table (0x42)"
+  };
+
+  printf("storeboot: preset load and boot to ready, by EEPROM contents\n");
+  printf("  %-28s %10s %10s %12s\n", "EEPROM", "load (us)", "records", "ready (ms)");
+
+  bool ok = true;
+  std::vector<uint8_t> image(HOST_EEPROM_SIZE);
+  for (uint8_t kind = 0; kind < NUM_IMAGES; kind++) {
+    hostReset();
+    resetTracking();
+    if (kind != ERASED && kind != LEGACY_BASE) {
+      PresetStore writer;
+      writer.begin();
+      if (kind == HALF || kind == BAD_BANK) fillJournal(writer, rng, JOURNAL_SLOTS / 2);
+      if (kind == FULL) fillJournal(writer, rng, JOURNAL_SLOTS);
+      if (kind == BAD_BANK) hostEepromData()[EEPROM_PRESETS_START_ADDR + 4 * PRESETS_PER_BANK] ^= 0x0A;
+    }
+    if (kind == LEGACY_BASE) {
+      LoopMask expected[TOTAL_PRESETS];
+      randomBaseTable(rng, expected);
+      hostEepromData()[EEPROM_INIT_FLAG_ADDR] = EEPROM_INIT_MAGIC;
+    }
+    memcpy(image.data(), hostEepromData(), HOST_EEPROM_SIZE);
+    hostSetEepromWriteHook(nullptr);
+
+    // The store alone, then the whole firmware powering up on the same image
+    hostAdvanceNs(PASS_NS);
+    PresetStore store;
+    const uint64_t start = hostNowNs();
+    store.begin();
+    const uint32_t loadUs = (uint32_t)((hostNowNs() - start) / 1000);
+    const uint32_t records = (kind == FULL) ? JOURNAL_SLOTS : (kind == HALF || kind == BAD_BANK) ? JOURNAL_SLOTS / 2 : 0;
+
+    Simulator sim;
+    sim.begin(false, image.data());
+    const double readyMs = sim.bootNs() / 1e6;
+
+    printf("  %-28s %10u %10u %12.1f\n", NAMES[kind], loadUs, records, readyMs);
+    // Loading has to fit behind the channel splash
+    ok = ok && loadUs < CHANNEL_DISPLAY_MS * 1000U && readyMs < CHANNEL_DISPLAY_MS + 5;
+  }
+
+  printf("%s\n", ok ? "presets load and check behind the channel splash" : "boot check FAILED");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,33 @@
+#ifndef PRESET_STORE_CHECK_H
+#define PRESET_STORE_CHECK_H
+
+/**
+ * Journaled preset store check.
+ *
+ * Usage: store [saves] [seed]
+ * Saves presets at random, most of them to one heavily edited preset,
+ * committing through PresetStore::update() once per 10 ms pass, and cuts
+ * the power at random points, tearing the byte being programmed if there
+ * is one: each cut boots a fresh store from the EEPROM image as it stands.
+ * Also upgrades EEPROM images of earlier firmware and damages a base table
+ * byte. Reports EEPROM wear against the fixed-address layout, the longest
+ * time a save or a pass spent on EEPROM, and how long saves took to reach
+ * EEPROM. Returns non-zero if a boot loses a committed preset or brings
+ * back an older one, if a cut makes a boot reset a bank, or if a save or
+ * pass ever waits on a write.
+ */
+int commandStore(int argc, char** argv);
+
+/**
+ * Boot validation benchmark.
+ *
+ * Usage: storeboot [seed]
+ * Times PresetStore::begin() (reading the base table, checking the bank
+ * CRCs and replaying the journal) and the firmware's boot to its first
+ * main-loop pass, on an erased EEPROM, journals of several lengths, a bank
+ * failing its CRC and an image of earlier firmware. Returns non-zero if
+ * loading the presets does not fit behind the MIDI channel splash.
+ */
+int commandStoreBoot(int argc, char** argv);
+
+#endif
@@ -0,0 +1,621 @@
+#include "preset_transfer_check.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+#include "hal_host.h"
+#include <EEPROM.h>
+#include "rng.h"
+#include "simulator.h"
+#include "midi_parser.h"
+#include "preset_transfer.h"
+#include "sysex.h"
+#include <util/crc16.h>
+
+/*
+ * Like the event log decoder, this works on MIDI bytes as the other end of
+ * the cable gets them: a monitor's .syx capture, or what the simulator saw
+ * the switcher send. The restore the check sends is built from the decoded
+ * dump by the same code that writes the tool's restore file.
+ */
+
+static const uint64_t BYTE_NS = HOST_MIDI_BYTE_NS;
+static const uint64_t PASS_NS = MAIN_LOOP_INTERVAL_MS * 1000000ULL;
+static const uint64_t DUMP_WAIT_NS = 2000ULL * 1000000ULL;
+static const uint64_t REPLY_WAIT_NS = 2000ULL * 1000000ULL;
+// Chunks are answered WRITTEN once in EEPROM, loops as the journal takes them
+static const uint64_t JOURNAL_WAIT_NS = 10000ULL * 1000000ULL;
+static const uint64_t POLL_NS = 1000000ULL;
+// Fills the wire behind a chunk: a data byte with no status, which receivers ignore and thru drops
+static const uint8_t RESTORE_FILL = 0x00;
+// Bytes of a reply to a chunk: F0 7D 4C 45 kind preset status F7
+static const size_t REPLY_SIZE = 8;
+static const uint8_t CHUNK_CRC_INIT = 0xFF;
+static const uint8_t LOOP_CHUNKS = TOTAL_PRESETS / PresetTransfer::PRESETS_PER_CHUNK;
+static const uint8_t NO_REPLY = 0xFF;
+static const uint8_t NO_RECALL = 0xFF;
+static const uint64_t RECALL_GAP_MAX_MS = 5;
+
+struct PresetImage {
+  uint8_t loopCount;
+  uint16_t loops[TOTAL_PRESETS];
+  std::vector<uint8_t> messages[TOTAL_PRESETS];
+};
+
+typedef std::vector<uint8_t> Bytes;
+
+static uint8_t chunkCrc(const uint8_t* data, size_t length) {
+  uint8_t crc = CHUNK_CRC_INIT;
+  for (size_t i = 0; i < length; i++) crc = _crc8_ccitt_update(crc, data[i]);
+  return crc;
+}
+
+/**
+ * Split a MIDI byte stream into the bodies (after F0, up to F7) of the
+ * switcher's SysEx with the given command; other traffic is skipped.
+ */
+static std::vector<Bytes> switcherSysEx(const Bytes& bytes, uint8_t command) {
+  std::vector<Bytes> found;
+  Bytes message;
+  bool inSysEx = false;
+  for (size_t i = 0; i < bytes.size(); i++) {
+    const uint8_t data = bytes[i];
+    if (data >= 0xF8) continue;
+    if (data == MIDI_SYSEX_START) {
+      message.clear();
+      inSysEx = true;
+    } else if (data == MIDI_SYSEX_END) {
+      if (inSysEx && message.size() >= 3 && message[0] == MIDI_SYSEX_ID && message[1] == MIDI_SYSEX_DEVICE &&
+          message[2] == command) {
+        found.push_back(Bytes(message.begin() + 3, message.end()));
+      }
+      inSysEx = false;
+    } else if (data & 0x80) {
+      inSysEx = false;
+    } else if (inSysEx) {
+      message.push_back(data);
+    }
+  }
+  return found;
+}
+
+/**
+ * Pull the presets out of a dump, or out of the chunks of a restore.
+ * @return false if a chunk fails its CRC or is garbled, or some are
+ *         missing (reason printed)
+ */
+static bool decodePresets(const Bytes& bytes, PresetImage& image) {
+  const std::vector<Bytes> chunks = switcherSysEx(bytes, SYSEX_PRESETS_CHUNK);
+  bool headerSeen = false;
+  uint16_t withMessages = 0;
+  uint16_t messageChunks = 0;
+  uint32_t loopChunks = 0;
+  image.loopCount = 0;
+
+  for (size_t c = 0; c < chunks.size(); c++) {
+    const Bytes& chunk = chunks[c];
+    if (chunk.size() < 3) {
+      fprintf(stderr, "garbled presets chunk (%zu bytes)\n", chunk.size());
+      return false;
+    }
+    const uint8_t* crcIn = &chunk[chunk.size() - 2];
+    if (getSeptets(crcIn, 2) != chunkCrc(chunk.data(), chunk.size() - 2)) {
+      fprintf(stderr, "presets chunk %zu fails its CRC\n", c);
+      return false;
+    }
+    const uint8_t* in = chunk.data() + 1;
+    const size_t body = chunk.size() - 3;
+
+    if (chunk[0] == PRESET_CHUNK_HEADER && body == 3) {
+      headerSeen = true;
+      image.loopCount = *in++;
+      withMessages = getSeptets(in, 2);
+      for (uint8_t i = 0; i < TOTAL_PRESETS; i++) image.messages[i].clear();
+      messageChunks = 0;
+      loopChunks = 0;
+    } else if (chunk[0] == PRESET_CHUNK_LOOPS && body >= 2) {
+      const uint8_t first = *in++;
+      const uint8_t loopCount = *in++;
+      const uint8_t septets = (loopCount + 6) / 7;
+      if (!headerSeen || loopCount != image.loopCount || first % PresetTransfer::PRESETS_PER_CHUNK != 0 ||
+          first >= TOTAL_PRESETS || body != 2u + PresetTransfer::PRESETS_PER_CHUNK * septets) {
+        fprintf(stderr, "garbled loops chunk (first preset %u, %zu bytes)\n", first, body);
+        return false;
+      }
+      for (uint8_t i = 0; i < PresetTransfer::PRESETS_PER_CHUNK; i++) {
+        image.loops[first + i] = getSeptets(in, septets);
+      }
+      loopChunks |= 1UL << (first / PresetTransfer::PRESETS_PER_CHUNK);
+    } else if (chunk[0] == PRESET_CHUNK_MESSAGES && body >= 2) {
+      const uint8_t preset = *in++;
+      const uint8_t length = *in++;
+      if (!headerSeen || preset >= TOTAL_PRESETS || length == 0 || length > PRESET_MESSAGE_BYTES ||
+          body != 2u + packedSize(length)) {
+        fprintf(stderr, "garbled messages chunk (preset %u, %zu bytes)\n", preset, body);
+        return false;
+      }
+      if (image.messages[preset].empty()) messageChunks++;
+      image.messages[preset].resize(length);
+      unpackBytes(in, image.messages[preset].data(), length);
+    } else {
+      fprintf(stderr, "unknown presets chunk %u (%zu bytes)\n", chunk[0], body);
+      return false;
+    }
+  }
+
+  if (!headerSeen) {
+    fprintf(stderr, "no presets in the stream\n");
+    return false;
+  }
+  if (loopChunks != (1UL << LOOP_CHUNKS) - 1 || messageChunks != withMessages) {
+    fprintf(stderr, "presets incomplete: %u of %u chunks of loops, messages of %u of %u presets\n",
+            __builtin_popcount(loopChunks), LOOP_CHUNKS, messageChunks, withMessages);
+    return false;
+  }
+  return true;
+}
+
+static Bytes frameChunk(const Bytes& body) {
+  Bytes message(4 + body.size() + 3);
+  message[0] = MIDI_SYSEX_START;
+  message[1] = MIDI_SYSEX_ID;
+  message[2] = MIDI_SYSEX_DEVICE;
+  message[3] = SYSEX_PRESETS_CHUNK;
+  memcpy(&message[4], body.data(), body.size());
+  putSeptets(&message[4 + body.size()], chunkCrc(body.data(), body.size()), 2);
+  message.back() = MIDI_SYSEX_END;
+  return message;
+}
+
+/**
+ * The chunks that restore image, each a whole SysEx message, in the order
+ * a dump sends them: header, loops, then messages.
+ */
+static std::vector<Bytes> encodePresets(const PresetImage& image) {
+  std::vector<Bytes> chunks;
+  uint8_t withMessages = 0;
+  for (uint8_t i = 0; i < TOTAL_PRESETS; i++) {
+    if (!image.messages[i].empty()) withMessages++;
+  }
+  chunks.push_back(frameChunk({PRESET_CHUNK_HEADER, image.loopCount, (uint8_t)(withMessages & 0x7F),
+                               (uint8_t)(withMessages >> 7)}));
+
+  const uint8_t septets = (image.loopCount + 6) / 7;
+  for (uint8_t first = 0; first < TOTAL_PRESETS; first += PresetTransfer::PRESETS_PER_CHUNK) {
+    Bytes body = {PRESET_CHUNK_LOOPS, first, image.loopCount};
+    for (uint8_t i = 0; i < PresetTransfer::PRESETS_PER_CHUNK; i++) {
+      uint8_t loops[3];
+      putSeptets(loops, image.loops[first + i], septets);
+      body.insert(body.end(), loops, loops + septets);
+    }
+    chunks.push_back(frameChunk(body));
+  }
+
+  for (uint8_t i = 0; i < TOTAL_PRESETS; i++) {
+    const Bytes& messages = image.messages[i];
+    if (messages.empty()) continue;
+    Bytes body = {PRESET_CHUNK_MESSAGES, i, (uint8_t)messages.size()};
+    body.resize(3 + packedSize(messages.size()));
+    packBytes(&body[3], messages.data(), messages.size());
+    chunks.push_back(frameChunk(body));
+  }
+  return chunks;
+}
+
+/**
+ * A restore that can be sent at wire speed without waiting for replies:
+ * the chunks of image, each followed by fill bytes. They leave room on
+ * MIDI OUT, which carries the restore as it is forwarded, for the chunk's
+ * two replies, and give a chunk of messages the time it takes to be
+ * written.
+ */
+static Bytes encodeRestore(const PresetImage& image) {
+  const std::vector<Bytes> chunks = encodePresets(image);
+  Bytes restore;
+  for (size_t c = 0; c < chunks.size(); c++) {
+    const Bytes& chunk = chunks[c];
+    restore.insert(restore.end(), chunk.begin(), chunk.end());
+    size_t fill = 2 * REPLY_SIZE;
+    if (chunk[4] == PRESET_CHUNK_MESSAGES) {
+      const uint64_t writeNs = PresetTransfer::messagesWriteUs(chunk[6]) * 1000ULL;
+      fill = std::max(fill, (size_t)((writeNs + BYTE_NS - 1) / BYTE_NS));
+    }
+    restore.insert(restore.end(), fill, RESTORE_FILL);
+  }
+  return restore;
+}
+
+static void printPresets(const PresetImage& image) {
+  uint8_t withMessages = 0;
+  for (uint8_t i = 0; i < TOTAL_PRESETS; i++) {
+    if (!image.messages[i].empty()) withMessages++;
+  }
+  printf("presets: %u loops, %u with messages\n", image.loopCount, withMessages);
+  for (uint8_t i = 0; i < TOTAL_PRESETS; i++) {
+    printf("  %3u  bank %2u-%u  loops 0x%04X", i + 1, i / PRESETS_PER_BANK + 1, i % PRESETS_PER_BANK + 1,
+           image.loops[i]);
+    if (!image.messages[i].empty()) {
+      printf("  messages");
+      for (size_t b = 0; b < image.messages[i].size(); b++) printf(" %02X", image.messages[i][b]);
+    }
+    printf("\n");
+  }
+}
+
+static bool readFile(const char* path, Bytes& bytes) {
+  FILE* file = fopen(path, "rb");
+  if (!file) {
+    fprintf(stderr, "cannot open %s\n", path);
+    return false;
+  }
+  int c;
+  while ((c = fgetc(file)) != EOF) bytes.push_back(c);
+  fclose(file);
+  return true;
+}
+
+int commandSyxPresets(int argc, char** argv) {
+  if (argc < 1) {
+    fprintf(stderr, "usage: syxpresets <dump.syx> [restore.syx]\n");
+    return 2;
+  }
+  Bytes bytes;
+  if (!readFile(argv[0], bytes)) return 2;
+
+  PresetImage image;
+  if (!decodePresets(bytes, image)) return 1;
+  printPresets(image);
+  if (argc < 2) return 0;
+
+  FILE* out = fopen(argv[1], "wb");
+  if (!out) {
+    fprintf(stderr, "cannot write %s\n", argv[1]);
+    return 2;
+  }
+  const Bytes restore = encodeRestore(image);
+  const size_t written = fwrite(restore.data(), 1, restore.size(), out);
+  fclose(out);
+  printf("wrote %zu chunks, %zu bytes to %s, %.0f ms on the wire; send it as it is, fill bytes included\n",
+         encodePresets(image).size(), written, argv[1], restore.size() * BYTE_NS / 1e6);
+  return 0;
+}
+
+// Run until both stores have written everything
+static void settle(Simulator& sim) {
+  const StateManager& state = sim.firmware().state;
+  while (!state.presets.isIdle() || !state.presetMessages.isIdle()) {
+    sim.runUntilNs(hostNowNs() + PASS_NS);
+  }
+}
+
+/**
+ * Random loops for every preset and one to three Program Changes and
+ * Control Changes for the given number of presets, written to EEPROM.
+ */
+static void fillUnit(Simulator& sim, Rng& rng, uint8_t withMessages) {
+  StateManager& state = sim.firmware().state;
+  for (uint8_t i = 0; i < TOTAL_PRESETS; i++) state.presets.set(i, rng.next() & ALL_LOOPS);
+  for (uint8_t n = 0; n < withMessages; n++) {
+    Bytes messages;
+    for (uint32_t m = rng.between(1, 3); m > 0; m--) {
+      const uint8_t channel = rng.between(0, 15);
+      if (rng.between(0, 1)) {
+        messages.insert(messages.end(), {(uint8_t)(0xC0 | channel), (uint8_t)rng.between(0, 127)});
+      } else {
+        messages.insert(messages.end(),
+                        {(uint8_t)(0xB0 | channel), (uint8_t)rng.between(0, 119), (uint8_t)rng.between(0, 127)});
+      }
+    }
+    settle(sim);
+    state.presetMessages.set(rng.between(0, TOTAL_PRESETS - 1), messages.data(), messages.size());
+  }
+  settle(sim);
+}
+
+// The presets of the running firmware
+static void readUnit(Simulator& sim, PresetImage& image) {
+  const StateManager& state = sim.firmware().state;
+  image.loopCount = NUM_LOOPS;
+  for (uint8_t i = 0; i < TOTAL_PRESETS; i++) {
+    image.loops[i] = state.presets.get(i);
+    uint8_t bytes[PRESET_MESSAGE_BYTES];
+    image.messages[i].assign(bytes, bytes + state.presetMessages.get(i, bytes));
+  }
+}
+
+// Presets that differ in their loops or messages
+static uint32_t countDifferences(const PresetImage& a, const PresetImage& b) {
+  uint32_t differences = 0;
+  for (uint8_t i = 0; i < TOTAL_PRESETS; i++) {
+    if (a.loops[i] != b.loops[i] || a.messages[i] != b.messages[i]) differences++;
+  }
+  return differences;
+}
+
+// Power-cycle the unit on its EEPROM as it stands
+static void powerCycle(Simulator& sim) {
+  const Bytes image(hostEepromData(), hostEepromData() + HOST_EEPROM_SIZE);
+  sim.begin(true, image.data());
+}
+
+// Schedule a message on MIDI IN, its first byte starting at startNs; returns when its last byte is in
+static uint64_t sendMessage(Simulator& sim, const Bytes& message, uint64_t startNs) {
+  for (size_t i = 0; i < message.size(); i++) sim.scheduleMidiIn(message[i], startNs + (i + 1) * BYTE_NS);
+  return startNs + message.size() * BYTE_NS;
+}
+
+struct Reply {
+  uint8_t kind;
+  uint8_t preset;
+  uint8_t status;
+  uint64_t queuedNs;   // When the switcher queued it
+};
+
+// Replies the switcher sent since timeline entry from
+static std::vector<Reply> repliesSince(const Simulator& sim, size_t from) {
+  std::vector<Reply> replies;
+  const std::vector<TimelineEntry>& entries = sim.timeline();
+  Bytes bytes;
+  std::vector<uint64_t> times;
+  for (size_t i = from; i < entries.size(); i++) {
+    // Forwarded Active Sensing may fall between the bytes of a reply
+    if (entries[i].kind != TL_MIDI || entries[i].value >= 0xF8) continue;
+    bytes.push_back(entries[i].value);
+    times.push_back(entries[i].timeNs);
+  }
+  // Each reply is F0 7D 4C 45 kind preset status F7, forwarded traffic around it
+  for (size_t i = 0; i + 7 < bytes.size(); i++) {
+    if (bytes[i] == MIDI_SYSEX_START && bytes[i + 1] == MIDI_SYSEX_ID && bytes[i + 2] == MIDI_SYSEX_DEVICE &&
+        bytes[i + 3] == SYSEX_PRESETS_REPLY && bytes[i + 7] == MIDI_SYSEX_END) {
+      replies.push_back({bytes[i + 4], bytes[i + 5], bytes[i + 6], times[i]});
+    }
+  }
+  return replies;
+}
+
+// Chunk kind and the preset a reply to it names
+static void chunkId(const Bytes& message, uint8_t& kind, uint8_t& preset) {
+  kind = message[4];
+  preset = (kind == PRESET_CHUNK_HEADER) ? 0 : message[5];
+}
+
+// The first reply since timeline entry from to the chunk, WRITTEN or the one before; status NO_REPLY if none
+static Reply findReply(const Simulator& sim, size_t from, const Bytes& message, bool written) {
+  uint8_t kind, preset;
+  chunkId(message, kind, preset);
+  const std::vector<Reply> replies = repliesSince(sim, from);
+  for (size_t i = 0; i < replies.size(); i++) {
+    if (replies[i].kind == kind && replies[i].preset == preset &&
+        (replies[i].status == PRESET_REPLY_WRITTEN) == written) {
+      return replies[i];
+    }
+  }
+  return {kind, preset, NO_REPLY, 0};
+}
+
+/**
+ * Run until the switcher answers the chunk, or waitNs passes.
+ * @param written Wait for the WRITTEN reply rather than the one before it
+ * @return Its reply, status NO_REPLY if none came
+ */
+static Reply awaitReply(Simulator& sim, size_t from, const Bytes& message, uint64_t waitNs = REPLY_WAIT_NS,
+                        bool written = false) {
+  const uint64_t giveUpNs = hostNowNs() + waitNs;
+  Reply reply = findReply(sim, from, message, written);
+  while (reply.status == NO_REPLY && hostNowNs() < giveUpNs) {
+    sim.runUntilNs(hostNowNs() + POLL_NS);
+    reply = findReply(sim, from, message, written);
+  }
+  return reply;
+}
+
+/**
+ * Ask for a dump and collect what the switcher sends for DUMP_WAIT_NS.
+ * Unless recall is NO_RECALL, recalls that preset with a Program Change
+ * every 1 to RECALL_GAP_MAX_MS meanwhile.
+ * @return When the request's last byte was in
+ */
+static uint64_t requestDump(Simulator& sim, Rng& rng, Bytes& dumpBytes, uint64_t& dumpEndNs,
+                            uint8_t recall = NO_RECALL) {
+  const size_t from = sim.timeline().size();
+  const Bytes request = {MIDI_SYSEX_START, MIDI_SYSEX_ID, MIDI_SYSEX_DEVICE, SYSEX_PRESETS_REQUEST, MIDI_SYSEX_END};
+  const uint64_t requestedNs = sendMessage(sim, request, hostNowNs());
+  if (recall != NO_RECALL) {
+    const Bytes programChange = {(uint8_t)(0xC0 | sim.firmware().state.midiChannel), recall};
+    uint64_t atNs = requestedNs;
+    while (atNs < requestedNs + DUMP_WAIT_NS / 2) {
+      sendMessage(sim, programChange, atNs);
+      atNs += rng.between(1, RECALL_GAP_MAX_MS) * 1000000ULL;
+    }
+  }
+  sim.runUntilNs(requestedNs + DUMP_WAIT_NS);
+
+  dumpBytes.clear();
+  dumpEndNs = requestedNs;
+  for (size_t i = from; i < sim.timeline().size(); i++) {
+    const TimelineEntry& entry = sim.timeline()[i];
+    if (entry.kind != TL_MIDI) continue;
+    dumpBytes.push_back(entry.value);
+    if (entry.value == MIDI_SYSEX_END) dumpEndNs = entry.extraNs + BYTE_NS;
+  }
+  return requestedNs;
+}
+
+static double ms(uint64_t ns) {
+  return ns / 1e6;
+}
+
+// EEPROM bytes written since the HAL was reset
+static uint32_t eepromWrites() {
+  const uint32_t* counts = hostEepromWriteCounts();
+  uint32_t writes = 0;
+  for (uint16_t a = 0; a < HOST_EEPROM_SIZE; a++) writes += counts[a];
+  return writes;
+}
+
+int commandPresetDump(int argc, char** argv) {
+  Rng rng((argc > 0) ? strtoul(argv[0], nullptr, 10) : 1);
+  Simulator sim;
+
+  // The unit dumped, read back from EEPROM
+  sim.begin(false);
+  fillUnit(sim, rng, 12);
+  powerCycle(sim);
+  PresetImage source;
+  readUnit(sim, source);
+
+  Bytes dumpBytes;
+  uint64_t dumpEndNs;
+  const uint64_t requestedNs = requestDump(sim, rng, dumpBytes, dumpEndNs);
+  PresetImage dump;
+  if (!decodePresets(dumpBytes, dump)) {
+    printf("preset dump check FAILED\n");
+    return 1;
+  }
+  const uint32_t dumpDifferences = countDifferences(source, dump);
+
+  // Again with a preset recalled over and over: its messages, a Program
+  // Change and 7 Control Changes, crowd the transmit queue the dump uses
+  const uint8_t recalled = rng.between(0, TOTAL_PRESETS - 1);
+  Bytes recalledMessages = {(uint8_t)(0xC0 | rng.between(0, 15)), (uint8_t)rng.between(0, 127)};
+  for (uint8_t m = 1; m < PRESET_MAX_MESSAGES; m++) {
+    recalledMessages.insert(recalledMessages.end(), {(uint8_t)(0xB0 | rng.between(0, 15)),
+                                                     (uint8_t)rng.between(0, 119), (uint8_t)rng.between(0, 127)});
+  }
+  sim.firmware().state.presetMessages.set(recalled, recalledMessages.data(), recalledMessages.size());
+  settle(sim);
+  PresetImage recallSource;
+  readUnit(sim, recallSource);
+  Bytes recallBytes;
+  uint64_t recallEndNs;
+  const uint64_t recallRequestedNs = requestDump(sim, rng, recallBytes, recallEndNs, recalled);
+  PresetImage recallDump;
+  const bool recallDecoded = decodePresets(recallBytes, recallDump);
+  const uint32_t recallDifferences = recallDecoded ? countDifferences(recallSource, recallDump) : TOTAL_PRESETS;
+
+  // Another unit, with presets of its own
+  sim.begin(false);
+  fillUnit(sim, rng, 10);
+  powerCycle(sim);
+  PresetImage before;
+  readUnit(sim, before);
+
+  // The restore file syxpresets writes, sent at wire speed without waiting for replies
+  const std::vector<Bytes> chunks = encodePresets(dump);
+  const Bytes restore = encodeRestore(dump);
+  size_t from = sim.timeline().size();
+  const uint64_t startNs = hostNowNs();
+  const uint32_t writesBefore = eepromWrites();
+  const uint64_t restoreWireNs = sendMessage(sim, restore, startNs) - startNs;
+  uint64_t messagesWireNs = 0;
+  for (size_t c = LOOP_CHUNKS + 1; c < chunks.size(); c++) messagesWireNs += chunks[c].size() * BYTE_NS;
+  uint64_t chunksWireNs = 0;
+  for (size_t c = 0; c < chunks.size(); c++) chunksWireNs += chunks[c].size() * BYTE_NS;
+  sim.runUntilNs(startNs + restoreWireNs + PASS_NS);
+
+  // Every chunk answered OK on MIDI OUT within a pass of the restore's last byte
+  uint32_t notOk = 0;
+  uint64_t takenNs = startNs;
+  for (size_t c = 0; c < chunks.size(); c++) {
+    const Reply reply = findReply(sim, from, chunks[c], false);
+    if (reply.status != PRESET_REPLY_OK) notOk++;
+    else takenNs = std::max(takenNs, reply.queuedNs);
+  }
+  const uint64_t restoreTakenNs = takenNs - startNs;
+
+  // Then each answered again once it would survive a power loss
+  uint32_t notWritten = 0;
+  for (size_t c = 0; c < chunks.size(); c++) {
+    if (awaitReply(sim, from, chunks[c], JOURNAL_WAIT_NS, true).status != PRESET_REPLY_WRITTEN) notWritten++;
+  }
+  settle(sim);
+  const uint64_t committedNs = hostNowNs();
+  const uint32_t restoreWrites = eepromWrites() - writesBefore;
+
+  // A damaged chunk, then three chunks of messages back to back: the second is held while the first is written
+  Bytes damaged = chunks[3];
+  damaged[8] ^= 0x01;
+  from = sim.timeline().size();
+  sendMessage(sim, damaged, hostNowNs());
+  const bool damagedRefused = awaitReply(sim, from, damaged).status == PRESET_REPLY_BAD;
+  bool earlyRefused = true;
+  if (chunks.size() >= (size_t)LOOP_CHUNKS + 4) {
+    const Bytes& first = chunks[LOOP_CHUNKS + 1];
+    const Bytes& second = chunks[LOOP_CHUNKS + 2];
+    const Bytes& third = chunks[LOOP_CHUNKS + 3];
+    from = sim.timeline().size();
+    sendMessage(sim, third, sendMessage(sim, second, sendMessage(sim, first, hostNowNs())));
+    const Reply early = awaitReply(sim, from, third);
+    earlyRefused = awaitReply(sim, from, first).status == PRESET_REPLY_OK &&
+                   awaitReply(sim, from, second).status == PRESET_REPLY_OK && early.status == PRESET_REPLY_BUSY;
+    from = sim.timeline().size();
+    sendMessage(sim, third, hostNowNs());
+    if (awaitReply(sim, from, third).status != PRESET_REPLY_OK) notOk++;
+  }
+  settle(sim);
+
+  powerCycle(sim);
+  PresetImage restored;
+  readUnit(sim, restored);
+  const uint32_t restoreDifferences = countDifferences(dump, restored);
+
+  // Other loops for every preset, the power cut the moment the first chunk is answered WRITTEN
+  PresetImage inverted = dump;
+  for (uint8_t i = 0; i < TOTAL_PRESETS; i++) inverted.loops[i] ^= ALL_LOOPS;
+  const std::vector<Bytes> invertedChunks = encodePresets(inverted);
+  from = sim.timeline().size();
+  uint64_t inNs = hostNowNs();
+  for (uint8_t c = 1; c <= LOOP_CHUNKS; c++) inNs = sendMessage(sim, invertedChunks[c], inNs);
+  std::vector<Reply> answered;
+  for (sim.runUntilNs(inNs); answered.empty() && hostNowNs() < inNs + JOURNAL_WAIT_NS;) {
+    sim.runUntilNs(hostNowNs() + POLL_NS);
+    const std::vector<Reply> replies = repliesSince(sim, from);
+    for (size_t r = 0; r < replies.size(); r++) {
+      if (replies[r].status == PRESET_REPLY_WRITTEN) answered.push_back(replies[r]);
+    }
+  }
+  powerCycle(sim);
+  PresetImage cut;
+  readUnit(sim, cut);
+  uint32_t answeredLost = 0;
+  for (size_t r = 0; r < answered.size(); r++) {
+    for (uint8_t i = 0; i < PresetTransfer::PRESETS_PER_CHUNK; i++) {
+      if (cut.loops[answered[r].preset + i] != inverted.loops[answered[r].preset + i]) answeredLost++;
+    }
+  }
+
+  uint8_t withMessages = 0;
+  for (uint8_t i = 0; i < TOTAL_PRESETS; i++) {
+    if (!dump.messages[i].empty()) withMessages++;
+  }
+  const bool restoreInTime = notOk == 0 && restoreTakenNs <= restoreWireNs + PASS_NS;
+  printf("presetdump: %u presets, %u loops, %u with messages\n", TOTAL_PRESETS, NUM_LOOPS, withMessages);
+  printf("  dump            %zu bytes, %.1f ms from request to last byte (wire %.1f ms)\n", dumpBytes.size(),
+         ms(dumpEndNs - requestedNs), ms(dumpBytes.size() * BYTE_NS));
+  printf("  restore         %zu chunks, %zu bytes, taken %.1f ms after the first byte (wire %.1f ms)\n", chunks.size(),
+         restore.size(), ms(restoreTakenNs), ms(restoreWireNs));
+  printf("                  chunks %.1f ms of the wire (messages %.1f ms), fill %.1f ms\n", ms(chunksWireNs),
+         ms(messagesWireNs), ms(restoreWireNs - chunksWireNs));
+  printf("  EEPROM          caught up %.1f ms after the first byte, %u bytes written\n", ms(committedNs - startNs),
+         restoreWrites);
+  printf("  replies         %u not OK, %u not WRITTEN\n", notOk, notWritten);
+  printf("  damaged chunk   %s\n", damagedRefused ? "refused" : "NOT refused");
+  printf("  early chunk     %s\n", earlyRefused ? "refused busy" : "NOT refused");
+  printf("  dump            %u presets differ from the unit\n", dumpDifferences);
+  printf("  dump, recalling %s, %u presets differ, %.1f ms from request to last chunk\n",
+         recallDecoded ? "complete" : "INCOMPLETE", recallDifferences, ms(recallEndNs - recallRequestedNs));
+  printf("  restored unit   %u presets differ from the dump after power-up (%u differed before)\n",
+         restoreDifferences, countDifferences(dump, before));
+  printf("  power cut       at the first WRITTEN to a chunk of loops: %zu answered, %u of their presets lost\n",
+         answered.size(), answeredLost);
+
+  const bool ok = dumpDifferences == 0 && recallDifferences == 0 && restoreDifferences == 0 && notOk == 0 &&
+                  notWritten == 0 && restoreInTime && damagedRefused && earlyRefused && !answered.empty() &&
+                  answeredLost == 0;
+  if (!restoreInTime) printf("  restore took longer than its wire time and a pass\n");
+  printf("%s\n", ok ? "presets dumped and restored" : "preset dump check FAILED");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,42 @@
+#ifndef PRESET_TRANSFER_CHECK_H
+#define PRESET_TRANSFER_CHECK_H
+
+/**
+ * Preset dump and restore check.
+ *
+ * Usage: presetdump [seed]
+ * Fills a unit with random presets and messages, power-cycles it and asks
+ * for a dump over MIDI IN, then for another while a preset with 8
+ * messages is recalled every few milliseconds. Restores the dump into a
+ * unit filled with other presets and messages by sending the file
+ * syxpresets would write at wire speed, without waiting for replies. Then
+ * sends a damaged chunk and three chunks of messages back to back, and
+ * last other loops for every preset, cutting the power as the first chunk
+ * of them is answered WRITTEN.
+ * Reports the dump's and the restore's time against the time their bytes
+ * take on the wire, and how long EEPROM took to catch up.
+ * Returns non-zero if either dump disagrees with the unit, the restored
+ * unit boots with anything but the dumped presets, a chunk of the restore
+ * is not answered OK, or WRITTEN after, the last OK comes more than a pass
+ * after the restore's last byte on the wire, a damaged chunk or the third
+ * chunk of messages is not refused, or a chunk answered WRITTEN before
+ * the power cut is not kept.
+ */
+int commandPresetDump(int argc, char** argv);
+
+/**
+ * Preset dump reader and restore writer.
+ *
+ * Usage: syxpresets <dump.syx> [restore.syx]
+ * Reads raw MIDI bytes as saved by a MIDI monitor after sending the
+ * switcher F0 7D 4C 04 F7 and prints the presets they carry. Other
+ * traffic in the file is skipped; a chunk that fails its CRC is an error.
+ * With a second file, writes the chunks to send back to restore the
+ * presets, the same format, without the other traffic. Each chunk is
+ * followed by data bytes with no status for the time its replies and its
+ * messages' EEPROM writes take, so the file can go out at wire speed
+ * without waiting for replies.
+ */
+int commandSyxPresets(int argc, char** argv);
+
+#endif
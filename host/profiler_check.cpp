@@ -0,0 +1,211 @@
+#include "profiler_check.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <vector>
+
+#include "hal_host.h"
+#include "rng.h"
+#include "simulator.h"
+#include "sysex.h"
+
+#ifndef PROFILE_MODE
+
+int commandProfile(int argc, char** argv) {
+  (void)argc;
+  (void)argv;
+  fprintf(stderr, "profile: the profiler is not built in (build with -DPROFILE_MODE, env:native_profile)\n");
+  return 2;
+}
+
+#else
+
+/*
+ * The profile is read from what the switcher puts on MIDI OUT, as a host
+ * on the other end of the cable sees it: SysEx bytes are picked out of the
+ * timeline and decoded. MIDI thru echoes the request itself, which is told
+ * apart by its command.
+ */
+
+// In ProfileSection order
+static const char* const SECTION_NAMES[PROFILE_SECTIONS] = {
+  "switches", "patterns", "display", "leds", "presets", "session", "midi"
+};
+static const char* const BUCKET_NAMES[PROFILE_BUCKETS] = {
+  "<4us", "<16us", "<64us", "<256us", "<1ms", "<4ms", "<16ms", "more"
+};
+
+static const uint64_t BYTE_NS = HOST_MIDI_BYTE_NS;
+// Long enough for every section to go out behind whatever else is queued
+static const uint64_t DUMP_WAIT_NS = 500ULL * 1000000ULL;
+static const uint64_t IDLE_NS = 100ULL * 1000000ULL;
+// Bytes between the command and F7 of a section message
+static const size_t SECTION_BODY = 2 + 3 * 5 + PROFILE_BUCKETS * 3;
+
+struct SectionReport {
+  bool seen;
+  uint32_t runs;
+  uint32_t minCycles;
+  uint32_t maxCycles;
+  uint32_t buckets[PROFILE_BUCKETS];
+};
+
+/**
+ * Append one gesture starting at timeUs: a single press, or now and then
+ * a pair for a bank or mode change.
+ * @return Time the last switch is released
+ */
+static uint64_t appendGesture(std::vector<TraceEvent>& trace, Rng& rng, uint64_t timeUs) {
+  if (rng.between(0, 4) != 0) {
+    const uint8_t sw = rng.between(0, NUM_SWITCHES - 1);
+    const uint64_t pressedUs = appendBouncedEdge(trace, rng, timeUs, sw, LOW);
+    return appendBouncedEdge(trace, rng, pressedUs + rng.between(60, 400) * 1000ULL, sw, HIGH);
+  }
+  const uint8_t a = rng.between(0, 2);
+  const uint64_t aUs = appendBouncedEdge(trace, rng, timeUs, a, LOW);
+  const uint64_t bUs = appendBouncedEdge(trace, rng, timeUs + rng.between(0, 20000), a + 1, LOW);
+  const uint64_t releaseUs = std::max(aUs, bUs) + rng.between(80, 300) * 1000ULL;
+  appendBouncedEdge(trace, rng, releaseUs, a, HIGH);
+  return appendBouncedEdge(trace, rng, releaseUs + rng.between(0, 20000), a + 1, HIGH);
+}
+
+// Put F0 <id> <device> <command> F7 on MIDI IN from timeNs
+static void sendCommand(Simulator& sim, uint64_t timeNs, uint8_t command) {
+  const uint8_t bytes[] = {MIDI_SYSEX_START, MIDI_SYSEX_ID, MIDI_SYSEX_DEVICE, command, MIDI_SYSEX_END};
+  for (uint8_t i = 0; i < sizeof(bytes); i++) {
+    sim.scheduleMidiIn(bytes[i], timeNs + (i + 1) * BYTE_NS);
+  }
+}
+
+/**
+ * Decode the section messages sent from timeline entry `from` on.
+ * @return false on a message of the wrong size or for a section out of range
+ */
+static bool collectDump(const Simulator& sim, size_t from, SectionReport* reports) {
+  for (uint8_t i = 0; i < PROFILE_SECTIONS; i++) reports[i].seen = false;
+
+  const std::vector<TimelineEntry>& entries = sim.timeline();
+  std::vector<uint8_t> message;
+  bool inSysEx = false;
+  for (size_t i = from; i < entries.size(); i++) {
+    if (entries[i].kind != TL_MIDI) continue;
+    const uint8_t data = entries[i].value;
+    if (data >= 0xF8) continue;
+    if (data == MIDI_SYSEX_START) {
+      message.clear();
+      inSysEx = true;
+      continue;
+    }
+    if (!inSysEx) continue;
+    if (data != MIDI_SYSEX_END) {
+      message.push_back(data);
+      continue;
+    }
+    inSysEx = false;
+
+    if (message.size() < 3 || message[0] != MIDI_SYSEX_ID || message[1] != MIDI_SYSEX_DEVICE ||
+        message[2] != SYSEX_PROFILE_SECTION) {
+      continue;
+    }
+    if (message.size() != 3 + SECTION_BODY || message[3] >= PROFILE_SECTIONS || message[4] != PROFILE_SECTIONS) {
+      fprintf(stderr, "  garbled section message (%zu bytes)\n", message.size());
+      return false;
+    }
+
+    SectionReport& report = reports[message[3]];
+    const uint8_t* in = &message[5];
+    report.seen = true;
+    report.runs = getSeptets(in, 5);
+    report.minCycles = getSeptets(in, 5);
+    report.maxCycles = getSeptets(in, 5);
+    for (uint8_t b = 0; b < PROFILE_BUCKETS; b++) {
+      report.buckets[b] = getSeptets(in, 3);
+    }
+  }
+  return true;
+}
+
+/**
+ * Print the dump and check it holds together.
+ * @return false if a section is missing or its histogram disagrees with its run count
+ */
+static bool checkDump(const SectionReport* reports) {
+  const double cyclesPerUs = F_CPU / 1e6;
+  printf("  %-9s %8s %9s %9s", "section", "runs", "min us", "max us");
+  for (uint8_t b = 0; b < PROFILE_BUCKETS; b++) printf(" %7s", BUCKET_NAMES[b]);
+  printf("\n");
+
+  bool ok = true;
+  for (uint8_t i = 0; i < PROFILE_SECTIONS; i++) {
+    const SectionReport& r = reports[i];
+    if (!r.seen) {
+      printf("  %-9s missing\n", SECTION_NAMES[i]);
+      ok = false;
+      continue;
+    }
+    printf("  %-9s %8u %9.2f %9.2f", SECTION_NAMES[i], r.runs, r.minCycles / cyclesPerUs,
+           r.maxCycles / cyclesPerUs);
+    uint32_t total = 0;
+    bool saturated = false;
+    for (uint8_t b = 0; b < PROFILE_BUCKETS; b++) {
+      printf(" %7u", r.buckets[b]);
+      total += r.buckets[b];
+      saturated = saturated || r.buckets[b] == 0xFFFF;
+    }
+    printf("\n");
+    // A saturated bucket undercounts
+    if (saturated ? total > r.runs : total != r.runs) ok = false;
+    if (r.runs && r.minCycles > r.maxCycles) ok = false;
+  }
+  return ok;
+}
+
+int commandProfile(int argc, char** argv) {
+  const uint32_t seconds = (argc > 0) ? strtoul(argv[0], nullptr, 10) : 60;
+  Rng rng((argc > 1) ? strtoul(argv[1], nullptr, 10) : 1);
+
+  Simulator sim;
+  sim.begin(true);
+  const uint64_t startNs = hostNowNs();
+  const uint64_t endNs = startNs + seconds * 1000000000ULL;
+
+  std::vector<TraceEvent> trace;
+  uint32_t gestures = 0;
+  for (uint64_t timeUs = startNs / 1000; timeUs < endNs / 1000; gestures++) {
+    timeUs = appendGesture(trace, rng, timeUs) + rng.between(50, 800) * 1000ULL;
+  }
+  std::stable_sort(trace.begin(), trace.end(),
+                   [](const TraceEvent& a, const TraceEvent& b) { return a.timeUs < b.timeUs; });
+  sim.play(trace.data(), trace.size());
+  sim.runUntilNs(endNs);
+
+  printf("profile: %u s, %u gestures\n", seconds, gestures);
+  SectionReport loaded[PROFILE_SECTIONS];
+  size_t from = sim.timeline().size();
+  sendCommand(sim, hostNowNs(), SYSEX_PROFILE_REQUEST);
+  sim.runUntilNs(hostNowNs() + DUMP_WAIT_NS);
+  bool ok = collectDump(sim, from, loaded) && checkDump(loaded);
+
+  printf("after SYSEX_PROFILE_CLEAR and %u ms idle:\n", (unsigned)(IDLE_NS / 1000000));
+  sendCommand(sim, hostNowNs(), SYSEX_PROFILE_CLEAR);
+  sim.runUntilNs(hostNowNs() + IDLE_NS);
+  SectionReport idle[PROFILE_SECTIONS];
+  from = sim.timeline().size();
+  sendCommand(sim, hostNowNs(), SYSEX_PROFILE_REQUEST);
+  sim.runUntilNs(hostNowNs() + DUMP_WAIT_NS);
+  const bool idleOk = collectDump(sim, from, idle) && checkDump(idle);
+  ok = ok && idleOk;
+  for (uint8_t i = 0; ok && i < PROFILE_SECTIONS; i++) {
+    // Cleared: only the idle time and the second dump are in it
+    if (idle[i].runs >= loaded[i].runs) {
+      printf("  %s was not cleared\n", SECTION_NAMES[i]);
+      ok = false;
+    }
+  }
+
+  printf("%s\n", ok ? "every section read back" : "profile check FAILED");
+  return ok ? 0 : 1;
+}
+
+#endif
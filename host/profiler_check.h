@@ -0,0 +1,19 @@
+#ifndef PROFILER_CHECK_H
+#define PROFILER_CHECK_H
+
+/**
+ * Hot-path profiler readout check. Needs a PROFILE_MODE build
+ * (env:native_profile).
+ *
+ * Usage: profile [seconds] [seed]
+ * Plays random presses and bank/mode combos into the firmware, then asks
+ * for the profile over MIDI IN the way a host would and decodes the SysEx
+ * that comes back on MIDI OUT. Prints each section's runs, shortest and
+ * longest run and its histogram. Then clears the profile, lets the
+ * switcher idle and reads it again. Returns non-zero if a section is
+ * missing or garbled, or if clearing does not start the figures over;
+ * returns 2 if the profiler is not built in.
+ */
+int commandProfile(int argc, char** argv);
+
+#endif
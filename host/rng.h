@@ -0,0 +1,27 @@
+#ifndef RNG_H
+#define RNG_H
+
+#include <stdint.h>
+
+/**
+ * Rng - xorshift32 generator so host runs are repeatable from a seed.
+ */
+struct Rng {
+  uint32_t state;
+
+  explicit Rng(uint32_t seed) : state(seed ? seed : 1) {}
+
+  uint32_t next() {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+  }
+
+  // Uniform-ish integer in [lo, hi]
+  uint32_t between(uint32_t lo, uint32_t hi) {
+    return lo + next() % (hi - lo + 1);
+  }
+};
+
+#endif
@@ -0,0 +1,145 @@
+#include "scheduler_check.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <vector>
+
+#include "hal_host.h"
+#include "rng.h"
+#include "simulator.h"
+
+/*
+ * The footswitch trace and the MIDI stream are laid out for the whole run
+ * up front, then played in one go. Gestures follow each other with a random
+ * pause; a quarter of them are combos and one in ten holds SW2+SW3 for edit
+ * mode, so edit mode is entered and left (saving a preset) all through the
+ * run. MIDI messages go out between clock bytes on a wire that carries one
+ * byte per 320 us.
+ */
+
+// In Firmware's task table order
+static const char* const TASK_NAMES[Firmware::TASK_COUNT] = {"control", "output", "storage"};
+static const uint8_t TASK_DEADLINES[Firmware::TASK_COUNT] = {
+  CONTROL_DEADLINE_TICKS, OUTPUT_DEADLINE_TICKS, STORAGE_DEADLINE_TICKS
+};
+
+static const uint64_t BYTE_NS = HOST_MIDI_BYTE_NS;
+// 24 ppqn at 120 BPM
+static const uint64_t CLOCK_NS = 20833333ULL;
+static const uint32_t LONG_HOLD_MS = EDIT_MODE_LONG_PRESS_MS + 500;
+
+static void sortTrace(std::vector<TraceEvent>& trace) {
+  std::stable_sort(trace.begin(), trace.end(),
+                   [](const TraceEvent& a, const TraceEvent& b) { return a.timeUs < b.timeUs; });
+}
+
+/**
+ * Append one gesture starting at timeUs.
+ * @return Time the last switch is released
+ */
+static uint64_t appendGesture(std::vector<TraceEvent>& trace, Rng& rng, uint64_t timeUs) {
+  const uint32_t kind = rng.between(0, 19);
+  if (kind < 13) {
+    const uint8_t sw = rng.between(0, NUM_SWITCHES - 1);
+    const uint64_t pressedUs = appendBouncedEdge(trace, rng, timeUs, sw, LOW);
+    return appendBouncedEdge(trace, rng, pressedUs + rng.between(60, 400) * 1000ULL, sw, HIGH);
+  }
+
+  // Bank down, mode toggle, bank up; held long, the center pair is edit mode
+  const uint8_t first = rng.between(0, 2);
+  const uint32_t holdMs = (kind < 18) ? rng.between(80, 300) : LONG_HOLD_MS;
+  const uint8_t a = (kind < 18) ? first : 1;
+  const uint64_t aUs = appendBouncedEdge(trace, rng, timeUs, a, LOW);
+  const uint64_t bUs = appendBouncedEdge(trace, rng, timeUs + rng.between(0, 20000), a + 1, LOW);
+  const uint64_t releaseUs = std::max(aUs, bUs) + holdMs * 1000ULL;
+  appendBouncedEdge(trace, rng, releaseUs, a, HIGH);
+  return appendBouncedEdge(trace, rng, releaseUs + rng.between(0, 20000), a + 1, HIGH);
+}
+
+/**
+ * Schedule a random PC or loop CC on channel 1 at or after timeNs, clock
+ * bytes slotted in ahead of it where they fall due.
+ * @return Time the wire is free again
+ */
+static uint64_t scheduleMessage(Simulator& sim, Rng& rng, uint64_t timeNs, uint64_t& nextClockNs) {
+  uint8_t bytes[3];
+  uint8_t length = 2;
+  if (rng.between(0, 2) == 0) {
+    bytes[0] = 0xC0;
+    bytes[1] = rng.between(0, TOTAL_PRESETS - 1);
+  } else {
+    bytes[0] = 0xB0;
+    bytes[1] = MIDI_CC_LOOP_FIRST + rng.between(0, NUM_LOOPS - 1);
+    bytes[2] = rng.between(0, 127);
+    length = 3;
+  }
+
+  uint64_t wireNs = timeNs;
+  for (uint8_t i = 0; i < length; i++) {
+    while (nextClockNs <= wireNs) {
+      sim.scheduleMidiIn(0xF8, wireNs + BYTE_NS);
+      wireNs += BYTE_NS;
+      nextClockNs += CLOCK_NS;
+    }
+    sim.scheduleMidiIn(bytes[i], wireNs + BYTE_NS);
+    wireNs += BYTE_NS;
+  }
+  return wireNs;
+}
+
+int commandSched(int argc, char** argv) {
+  const uint32_t seconds = (argc > 0) ? strtoul(argv[0], nullptr, 10) : 600;
+  Rng rng((argc > 1) ? strtoul(argv[1], nullptr, 10) : 1);
+
+  Simulator sim;
+  sim.begin(false);
+  Firmware& fw = sim.firmware();
+  const uint64_t startNs = hostNowNs();
+  const uint64_t endNs = startNs + seconds * 1000000000ULL;
+
+  std::vector<TraceEvent> trace;
+  uint32_t gestures = 0;
+  for (uint64_t timeUs = startNs / 1000; timeUs < endNs / 1000; gestures++) {
+    timeUs = appendGesture(trace, rng, timeUs) + rng.between(50, 800) * 1000ULL;
+  }
+  sortTrace(trace);
+
+  uint32_t messages = 0;
+  uint64_t nextClockNs = startNs;
+  uint64_t wireNs = startNs;
+  while (wireNs < endNs) {
+    const uint64_t messageNs = wireNs + rng.between(20, 400) * 1000000ULL;
+    // Clock alone up to the message
+    for (; nextClockNs < messageNs && nextClockNs < endNs; nextClockNs += CLOCK_NS) {
+      sim.scheduleMidiIn(0xF8, nextClockNs + BYTE_NS);
+    }
+    if (messageNs >= endNs) break;
+    wireNs = scheduleMessage(sim, rng, messageNs, nextClockNs);
+    messages++;
+  }
+
+  // Only the run is measured, not the boot
+  fw.scheduler.resetStats();
+  sim.play(trace.data(), trace.size());
+  sim.runUntilNs(endNs);
+  const uint64_t elapsedUs = (hostNowNs() - startNs) / 1000;
+
+  printf("sched: %u s, %u gestures, %u MIDI messages over a running clock\n", seconds, gestures, messages);
+  printf("  %-8s %8s %9s %9s %9s %9s %9s %6s\n", "task", "runs", "worst run", "worst rsp", "deadline",
+         "overruns", "missed", "cpu %");
+  bool ok = true;
+  uint64_t busyUs = 0;
+  for (uint8_t i = 0; i < Firmware::TASK_COUNT; i++) {
+    const TaskStats& stats = fw.scheduler.stats(i);
+    busyUs += stats.busyUs;
+    printf("  %-8s %8u %9u %9u %9u %9u %9u %6.2f\n", TASK_NAMES[i], stats.runs, stats.worstRunUs,
+           stats.worstResponseUs, TASK_DEADLINES[i] * SCHEDULER_TICK_US, stats.overruns, stats.missedReleases,
+           100.0 * stats.busyUs / elapsedUs);
+    ok = ok && stats.overruns == 0 && stats.missedReleases == 0;
+  }
+  printf("  main-loop tasks use %.2f%% of the CPU; times in us\n", 100.0 * busyUs / elapsedUs);
+
+  printf("%s\n", ok ? "every task met its deadline" : "scheduler check FAILED");
+  return ok ? 0 : 1;
+}
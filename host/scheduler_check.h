@@ -0,0 +1,18 @@
+#ifndef SCHEDULER_CHECK_H
+#define SCHEDULER_CHECK_H
+
+/**
+ * Main-loop scheduler budget check.
+ *
+ * Usage: sched [seconds] [seed]
+ * Plays random footswitch gestures into the firmware (single presses, bank
+ * and mode combos, edit mode entered and left with a save) while MIDI IN
+ * carries a running clock and Program Change/Control Change messages. The
+ * run keeps preset write-back and session saves busy.
+ * Prints each task's runs, worst run and response times against its
+ * deadline, overruns, lost releases and share of the CPU. Returns non-zero
+ * on any overrun or lost release.
+ */
+int commandSched(int argc, char** argv);
+
+#endif
@@ -0,0 +1,267 @@
+#include "session_check.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+#include "hal_host.h"
+#include <EEPROM.h>
+#include "rng.h"
+#include "simulator.h"
+
+/*
+ * Each cycle powers the firmware up on the EEPROM image the previous one
+ * left, plays 1-12 actions 0.2-3 s apart (MIDI Program Changes and loop
+ * Control Changes, single footswitch taps, the mode and bank-up chords)
+ * and cuts the power 0-3 s after the last one.
+ *
+ * The EEPROM write hook follows the session ring: a record counts once its
+ * sequence number, written last, has finished programming. A cut while a byte is still
+ * programming leaves that cell torn. The next power-up has to restore the
+ * newest counted record, decoded here from the documented record format,
+ * and nothing at all before the first one.
+ */
+
+static const uint32_t CYCLES_DEFAULT = 2000;
+// Reset to relays set, on the ATmega328 cost model
+static const uint32_t RESTORE_BUDGET_US = 500;
+// Quiet time after the last action by which the live session must be saved
+static const uint64_t SETTLE_NS = (SESSION_SAVE_DELAY_MS + 500) * 1000000ULL;
+// Record bytes between the sequence number and the CRC
+static const uint8_t SESSION_BYTES = SESSION_RECORD_SIZE - 2;
+
+struct EepromWrite {
+  bool pending;
+  uint16_t address;
+  uint64_t timeNs;
+};
+
+static EepromWrite g_lastWrite;
+static bool g_hasRecord;          // A session record has completed since the first boot
+static uint8_t g_record[SESSION_BYTES];   // Session bytes of the newest completed record
+static uint32_t g_records;
+
+// CRC-8 as the firmware computes it (poly 0x07, init 0xFF), without the HAL's cycle cost
+static uint8_t crc8(const uint8_t* bytes, uint8_t length) {
+  uint8_t crc = 0xFF;
+  for (uint8_t i = 0; i < length; i++) {
+    crc ^= bytes[i];
+    for (uint8_t bit = 0; bit < 8; bit++) {
+      crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x07) : (uint8_t)(crc << 1);
+    }
+  }
+  return crc;
+}
+
+static void finishWrite() {
+  if (!g_lastWrite.pending) return;
+  g_lastWrite.pending = false;
+
+  const uint16_t address = g_lastWrite.address;
+  if (address < EEPROM_SESSION_START_ADDR || (address - EEPROM_SESSION_START_ADDR) % SESSION_RECORD_SIZE != 0) return;
+  const uint8_t* record = hostEepromData() + address;
+  if (crc8(record, SESSION_RECORD_SIZE - 1) != record[SESSION_RECORD_SIZE - 1]) return;
+  g_hasRecord = true;
+  memcpy(g_record, record + 1, SESSION_BYTES);
+  g_records++;
+}
+
+static void onEepromWrite(uint16_t address, uint8_t value, uint64_t timeNs) {
+  (void)value;
+  // The HAL waited for the previous write before starting this one
+  finishWrite();
+  g_lastWrite.pending = true;
+  g_lastWrite.address = address;
+  g_lastWrite.timeNs = timeNs;
+}
+
+// Session bytes as the record format lays them out; edit mode is saved as bank mode
+static void packSession(const StateManager& state, uint8_t* bytes) {
+  bytes[0] = (uint8_t)((state.currentBank - 1) | ((state.currentMode != MANUAL_MODE) ? 0x20 : 0) |
+                       (state.globalPresetActive ? 0x40 : 0));
+  bytes[1] = (uint8_t)(((state.activePreset + 1) << 4) | (state.loops & 0x0F));
+  for (uint8_t i = 2; i < SESSION_BYTES; i++) bytes[i] = (uint8_t)(state.loops >> (4 + 8 * (i - 2)));
+}
+
+static LoopMask sessionLoops(const uint8_t* bytes) {
+  uint32_t loops = bytes[1] & 0x0F;
+  for (uint8_t i = 2; i < SESSION_BYTES; i++) loops |= (uint32_t)bytes[i] << (4 + 8 * (i - 2));
+  return (LoopMask)loops;
+}
+
+static void printSession(const uint8_t* bytes) {
+  for (uint8_t i = 0; i < SESSION_BYTES; i++) printf(" %02X", bytes[i]);
+}
+
+/**
+ * Compare a freshly booted firmware with the session it should have come back to.
+ * @return true if the state and the relay outputs match
+ */
+static bool checkRestored(Simulator& sim, bool hasRecord, const uint8_t* record) {
+  static const uint8_t DEFAULTS[SESSION_BYTES] = {};   // Manual mode, bank 1, no preset, loops off
+  const uint8_t* expected = hasRecord ? record : DEFAULTS;
+
+  const StateManager& state = sim.firmware().state;
+  uint8_t restored[SESSION_BYTES];
+  packSession(state, restored);
+  bool ok = memcmp(restored, expected, SESSION_BYTES) == 0 && state.currentMode != EDIT_MODE &&
+            sim.relayLoops() == sessionLoops(expected);
+  for (uint8_t i = 0; i < RelayController::PIN_LOOPS; i++) {
+    ok = ok && hostGetPinMode(RELAY_PIN_MAP[i]) == OUTPUT;
+  }
+  if (!ok) {
+    printf("  restored");
+    printSession(restored);
+    printf(", expected");
+    printSession(expected);
+    printf("\n");
+  }
+  return ok;
+}
+
+static void chord(std::vector<TraceEvent>& trace, uint64_t timeUs, uint8_t first, uint8_t second) {
+  const TraceEvent events[] = {
+    {timeUs, first, LOW}, {timeUs + 3000, second, LOW}, {timeUs + 150000, first, HIGH}, {timeUs + 155000, second, HIGH}
+  };
+  trace.insert(trace.end(), events, events + 4);
+}
+
+/**
+ * Schedule one cycle's actions from startUs on.
+ * @return Time the last action is over, in microseconds
+ */
+static uint64_t scheduleActions(Simulator& sim, Rng& rng, std::vector<TraceEvent>& trace, uint64_t startUs) {
+  uint64_t timeUs = startUs;
+  const uint8_t actions = rng.between(1, 12);
+  for (uint8_t a = 0; a < actions; a++) {
+    timeUs += rng.between(200, 3000) * 1000ULL;
+    const uint32_t kind = rng.between(0, 9);
+    if (kind <= 2) {
+      sim.scheduleMidiIn(0xC0, timeUs * 1000ULL);
+      sim.scheduleMidiIn(rng.between(0, TOTAL_PRESETS - 1), timeUs * 1000ULL + HOST_MIDI_BYTE_NS);
+      timeUs += 1000;
+    } else if (kind <= 4) {
+      sim.scheduleMidiIn(0xB0, timeUs * 1000ULL);
+      sim.scheduleMidiIn(MIDI_CC_LOOP_FIRST + rng.between(0, NUM_LOOPS - 1), timeUs * 1000ULL + HOST_MIDI_BYTE_NS);
+      sim.scheduleMidiIn(rng.between(0, 1) ? 127 : 0, timeUs * 1000ULL + 2 * HOST_MIDI_BYTE_NS);
+      timeUs += 1000;
+    } else if (kind <= 7) {
+      const uint8_t sw = rng.between(0, NUM_SWITCHES - 1);
+      timeUs = appendBouncedEdge(trace, rng, timeUs, sw, LOW) + rng.between(80, 300) * 1000ULL;
+      timeUs = appendBouncedEdge(trace, rng, timeUs, sw, HIGH);
+    } else if (kind == 8) {
+      chord(trace, timeUs, 1, 2);
+      timeUs += 155000;
+    } else {
+      chord(trace, timeUs, 2, 3);
+      timeUs += 155000;
+    }
+  }
+  return timeUs;
+}
+
+/**
+ * An image of earlier firmware (layout 1) whose session area holds a
+ * record with a good CRC: the first boot must not restore it, and must
+ * clear it so the next one does not either.
+ */
+static bool checkForeignRecord() {
+  std::vector<uint8_t> image(HOST_EEPROM_SIZE, 0);
+  image[EEPROM_INIT_FLAG_ADDR] = EEPROM_HEADER_MAGIC;
+  image[EEPROM_HEADER_ADDR] = 1;
+  image[EEPROM_HEADER_ADDR + 1] = (uint8_t)~1;
+  uint8_t* record = image.data() + EEPROM_SESSION_START_ADDR + SESSION_RECORD_SIZE * 5;
+  record[0] = 9;
+  record[1] = 0x20 | 6;   // Bank mode, bank 7
+  record[2] = 0x2F;       // Preset 2 of the bank, loops 1-4 on
+  record[SESSION_RECORD_SIZE - 1] = crc8(record, SESSION_RECORD_SIZE - 1);
+
+  bool ok = true;
+  for (uint8_t boot = 0; boot < 2; boot++) {
+    Simulator sim;
+    sim.begin(false, image.data());
+    ok = ok && checkRestored(sim, false, nullptr);
+    memcpy(image.data(), hostEepromData(), HOST_EEPROM_SIZE);
+  }
+  return ok;
+}
+
+int commandRestore(int argc, char** argv) {
+  const uint32_t cycles = (argc > 0) ? strtoul(argv[0], nullptr, 10) : CYCLES_DEFAULT;
+  Rng rng((argc > 1) ? strtoul(argv[1], nullptr, 10) : 1);
+
+  g_hostCost = HOST_COST_ATMEGA328;
+  g_hasRecord = false;
+  g_records = 0;
+
+  std::vector<uint8_t> image(HOST_EEPROM_SIZE, 0xFF);
+  std::vector<uint32_t> relayUs;
+  uint32_t wrong = 0;
+  uint32_t unsaved = 0;
+  uint32_t torn = 0;
+  uint32_t settled = 0;
+  uint32_t restoredOn = 0;
+
+  for (uint32_t cycle = 0; cycle < cycles; cycle++) {
+    Simulator sim;
+    sim.begin(false, image.data());
+    if (!checkRestored(sim, g_hasRecord, g_record)) {
+      if (wrong == 0) printf("  cycle %u restored the wrong session\n", cycle);
+      wrong++;
+    }
+    if (sim.relaysRestoredNs() != 0) {
+      relayUs.push_back((uint32_t)(sim.relaysRestoredNs() / 1000));
+      restoredOn++;
+    }
+
+    g_lastWrite.pending = false;
+    hostSetEepromWriteHook(onEepromWrite);
+
+    std::vector<TraceEvent> trace;
+    const uint64_t lastActionUs = scheduleActions(sim, rng, trace, sim.bootNs() / 1000);
+    sim.play(trace.data(), trace.size());
+    const uint64_t tailNs = rng.between(0, 3000) * 1000000ULL + rng.between(0, MAIN_LOOP_INTERVAL_MS * 1000) * 1000ULL;
+    sim.runUntilNs(lastActionUs * 1000ULL + tailNs);
+
+    // Power cut
+    const uint64_t cutNs = hostNowNs();
+    if (g_lastWrite.pending && cutNs < g_lastWrite.timeNs + g_hostCost.eepromWriteNs) {
+      hostEepromData()[g_lastWrite.address] = rng.next() & 0xFF;
+      g_lastWrite.pending = false;
+      torn++;
+    }
+    finishWrite();
+    hostSetEepromWriteHook(nullptr);
+
+    if (tailNs >= SETTLE_NS) {
+      settled++;
+      uint8_t live[SESSION_BYTES];
+      packSession(sim.firmware().state, live);
+      if (!g_hasRecord || memcmp(live, g_record, SESSION_BYTES) != 0) {
+        if (unsaved == 0) printf("  cycle %u: session stood %u ms unsaved\n", cycle, (uint32_t)(tailNs / 1000000));
+        unsaved++;
+      }
+    }
+    memcpy(image.data(), hostEepromData(), HOST_EEPROM_SIZE);
+  }
+
+  const bool foreign = checkForeignRecord();
+
+  std::sort(relayUs.begin(), relayUs.end());
+  const uint32_t maxRelayUs = relayUs.empty() ? 0 : relayUs.back();
+
+  printf("restore: %u power cycles, %u session records, %u cuts tore a byte\n", cycles, g_records, torn);
+  if (!relayUs.empty()) {
+    printf("  reset to relays set (us) median %u, max %u, budget %u (%u boots with loops on)\n",
+           relayUs[relayUs.size() / 2], maxRelayUs, RESTORE_BUDGET_US, restoredOn);
+  }
+  printf("  wrong restores           %u\n", wrong);
+  printf("  settled but unsaved      %u of %u\n", unsaved, settled);
+  printf("  earlier firmware record  %s\n", foreign ? "ignored" : "RESTORED");
+
+  const bool ok = wrong == 0 && unsaved == 0 && foreign && maxRelayUs <= RESTORE_BUDGET_US;
+  printf("%s\n", ok ? "every power-up came back to the last saved session" : "restore check FAILED");
+  return ok ? 0 : 1;
+}
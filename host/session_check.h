@@ -0,0 +1,21 @@
+#ifndef SESSION_CHECK_H
+#define SESSION_CHECK_H
+
+/**
+ * Instant-on session restore check.
+ *
+ * Usage: restore [cycles] [seed]
+ * Plays a few seconds of footswitch presses and MIDI recalls and loop
+ * changes into the firmware, cuts the power at a random point (tearing the
+ * EEPROM byte being programmed, if there is one) and powers the firmware
+ * up again on the EEPROM image it left, over and over. Each power-up has
+ * to come back to the newest session record completed before the cut,
+ * and to the live session if it had stood for long enough to be saved.
+ * Also boots an image of earlier firmware whose session area happens to
+ * hold a valid-looking record. Reports the time from reset to the relays
+ * being set. Returns non-zero on a wrong restore, or if the relays take
+ * longer than RESTORE_BUDGET_US.
+ */
+int commandRestore(int argc, char** argv);
+
+#endif
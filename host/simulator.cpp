@@ -0,0 +1,277 @@
+#include "simulator.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+#include "hal_host.h"
+#include <EEPROM.h>
+
+static const uint8_t SIM_SWITCH_PINS[NUM_SWITCHES] = {SW1_PIN, SW2_PIN, SW3_PIN, SW4_PIN};
+static const uint8_t RELAY_SHIFT_REGISTERS = RelayController::SHIFT_REGISTERS;
+
+// HAL hooks are plain function pointers, so route them to the active instance
+static Simulator* g_activeSimulator = nullptr;
+
+static const char* const KIND_NAMES[] = {"SWITCH", "RELAY", "MIDI", "DISPLAY", "LEDS", "MIDI_IN"};
+
+Simulator::Simulator()
+  : fw(nullptr),
+    display(MAX_DIN_PIN, MAX_CLK_PIN, MAX_CS_PIN),
+    leds(SR_DATA_PIN, SR_CLOCK_PIN, SR_LATCH_PIN, LED_SHIFT_REGISTERS),
+    relayChain(SR_DATA_PIN, SR_CLOCK_PIN, RELAY_SR_LATCH_PIN, RELAY_SHIFT_REGISTERS),
+    recording(false),
+    inSetup(false),
+    bootDoneNs(0),
+    relaysRestoredAtNs(0),
+    lastDisplayWriteNs(0) {
+}
+
+Simulator::~Simulator() {
+  if (g_activeSimulator == this) {
+    hostSetPinWriteHook(nullptr);
+    hostSetSerialTxHook(nullptr);
+    g_activeSimulator = nullptr;
+  }
+  delete fw;
+}
+
+void Simulator::begin(bool record, const uint8_t* eeprom) {
+  delete fw;
+  fw = nullptr;
+
+  hostReset();
+  if (eeprom) memcpy(hostEepromData(), eeprom, HOST_EEPROM_SIZE);
+  display.reset();
+  leds.reset();
+  relayChain.reset();
+  entries.clear();
+  recording = record;
+  lastDisplayWriteNs = 0;
+  relaysRestoredAtNs = 0;
+  memset(lastFrame, 0, sizeof(lastFrame));
+
+  g_activeSimulator = this;
+  hostSetPinWriteHook(onPinWrite);
+  hostSetSerialTxHook(onSerialTx);
+
+  // Constructed after the reset so the firmware starts from power-up pin state
+  fw = new Firmware();
+  inSetup = true;
+  fw->setup();
+  inSetup = false;
+  captureDisplayFrame();
+  bootDoneNs = hostNowNs();
+}
+
+void Simulator::runUntilNs(uint64_t untilNs) {
+  while (hostNowNs() < untilNs) {
+    if (fw->loop()) {
+      captureDisplayFrame();
+    } else {
+      // Skip the idle spin: jump straight to the next 100 Hz pass
+      const uint64_t nextPassNs = nextReleaseNs();
+      hostAdvanceToNs(nextPassNs < untilNs ? nextPassNs : untilNs);
+    }
+  }
+}
+
+uint64_t Simulator::nextReleaseNs() const {
+  const uint16_t ticks = fw->scheduler.ticksUntilRelease();
+  if (ticks == 0) return hostNowNs();
+  return hostTimer2NextMatchNs() + (ticks - 1) * (uint64_t)SCHEDULER_TICK_US * 1000ULL;
+}
+
+void Simulator::play(const TraceEvent* events, size_t count) {
+  // The HAL applies each edge at its exact time, interrupting the firmware mid-pass
+  for (size_t i = 0; i < count; i++) {
+    const uint64_t timeNs = events[i].timeUs * 1000ULL;
+    hostScheduleInputLevel(SIM_SWITCH_PINS[events[i].switchIndex], events[i].level, timeNs);
+    record(timeNs, TL_SWITCH, events[i].switchIndex, events[i].level);
+  }
+  if (count > 0) runUntilNs(events[count - 1].timeUs * 1000ULL);
+}
+
+void Simulator::scheduleMidiIn(uint8_t data, uint64_t timeNs) {
+  hostScheduleSerialRx(data, timeNs);
+  record(timeNs, TL_MIDI_IN, 0, data);
+}
+
+void Simulator::record(uint64_t timeNs, uint8_t kind, uint8_t index, uint32_t value, uint64_t extraNs) {
+  if (!recording) return;
+  TimelineEntry entry;
+  entry.timeNs = timeNs;
+  entry.kind = kind;
+  entry.index = index;
+  entry.value = value;
+  entry.extraNs = extraNs;
+  memset(entry.frame, 0, sizeof(entry.frame));
+  entries.push_back(entry);
+}
+
+void Simulator::captureDisplayFrame() {
+  // A pass may blank and redraw digits; only the frame it leaves behind counts
+  if (!display.takeDirty() || memcmp(lastFrame, display.digits, sizeof(lastFrame)) == 0) return;
+  memcpy(lastFrame, display.digits, sizeof(lastFrame));
+  record(lastDisplayWriteNs, TL_DISPLAY, 0, display.registerWrites);
+  if (recording) memcpy(entries.back().frame, display.digits, sizeof(display.digits));
+}
+
+LoopMask Simulator::relayLoops() const {
+  LoopMask loops = (LoopMask)(relayChain.outputs << RelayController::PIN_LOOPS);
+  for (uint8_t i = 0; i < RelayController::PIN_LOOPS; i++) {
+    if (hostGetOutputLevel(RELAY_PIN_MAP[i]) == HIGH) loops |= loopBit(i);
+  }
+  return loops & ALL_LOOPS;
+}
+
+void Simulator::relayChanged(uint8_t loop, uint8_t level, uint64_t timeNs) {
+  record(timeNs, TL_RELAY, loop, level);
+  if (inSetup) relaysRestoredAtNs = timeNs;
+}
+
+void Simulator::onPinWrite(uint8_t pin, uint8_t level, uint64_t timeNs) {
+  Simulator* sim = g_activeSimulator;
+  if (!sim) return;
+
+  for (uint8_t i = 0; i < RelayController::PIN_LOOPS; i++) {
+    if (pin == RELAY_PIN_MAP[i]) {
+      sim->relayChanged(i, level, timeNs);
+      return;
+    }
+  }
+
+  if (RELAY_SHIFT_REGISTERS) {
+    const uint32_t relayOutputs = sim->relayChain.outputs;
+    sim->relayChain.onPinWrite(pin, level);
+    const uint32_t changed = sim->relayChain.outputs ^ relayOutputs;
+    for (uint8_t bit = 0; RelayController::PIN_LOOPS + bit < NUM_LOOPS; bit++) {
+      if (changed & (1UL << bit)) {
+        sim->relayChanged(RelayController::PIN_LOOPS + bit, (sim->relayChain.outputs >> bit) & 1, timeNs);
+      }
+    }
+  }
+
+  if (pin == MAX_CS_PIN && level == HIGH) sim->lastDisplayWriteNs = timeNs;
+  sim->display.onPinWrite(pin, level);
+
+  const uint32_t ledLatches = sim->leds.latches;
+  const uint32_t ledOutputs = sim->leds.outputs;
+  sim->leds.onPinWrite(pin, level);
+  if (sim->leds.latches != ledLatches && sim->leds.outputs != ledOutputs) {
+    sim->record(timeNs, TL_LEDS, 0, sim->leds.outputs);
+  }
+}
+
+void Simulator::onSerialTx(uint8_t data, uint64_t queuedNs, uint64_t wireStartNs) {
+  if (g_activeSimulator) g_activeSimulator->record(queuedNs, TL_MIDI, 0, data, wireStartNs);
+}
+
+uint64_t appendBouncedEdge(std::vector<TraceEvent>& trace, Rng& rng, uint64_t timeUs, uint8_t sw, uint8_t level) {
+  const uint8_t bounces = rng.between(0, 4);
+  for (uint8_t i = 0; i < bounces; i++) {
+    const TraceEvent ev = {timeUs, sw, (uint8_t)((i % 2 == 0) ? level : !level)};
+    trace.push_back(ev);
+    timeUs += rng.between(50, 1500);
+  }
+  const TraceEvent settled = {timeUs, sw, level};
+  trace.push_back(settled);
+  return timeUs;
+}
+
+static void printMicros(FILE* out, uint64_t ns) {
+  fprintf(out, "%10llu.%03llu", (unsigned long long)(ns / 1000), (unsigned long long)(ns % 1000));
+}
+
+static bool entryBefore(const TimelineEntry& a, const TimelineEntry& b) {
+  return a.timeNs < b.timeNs;
+}
+
+void Simulator::writeTimeline(FILE* out) const {
+  // Display frames are recorded when the pass ends but stamped with their last register write
+  std::vector<TimelineEntry> sorted(entries);
+  std::stable_sort(sorted.begin(), sorted.end(), entryBefore);
+
+  for (size_t i = 0; i < sorted.size(); i++) {
+    const TimelineEntry& e = sorted[i];
+    printMicros(out, e.timeNs);
+    fprintf(out, " %-7s ", KIND_NAMES[e.kind]);
+
+    switch (e.kind) {
+      case TL_SWITCH:
+        fprintf(out, "SW%u %c\n", e.index + 1, e.value ? 'H' : 'L');
+        break;
+
+      case TL_RELAY:
+        fprintf(out, "LOOP%u %s\n", e.index + 1, e.value ? "ON" : "OFF");
+        break;
+
+      case TL_MIDI:
+        fprintf(out, "%02X wire ", (unsigned)e.value);
+        printMicros(out, e.extraNs);
+        fputc('\n', out);
+        break;
+
+      case TL_DISPLAY: {
+        // Digit 7 is the leftmost position
+        char text[17];
+        uint8_t n = 0;
+        for (int8_t d = 7; d >= 0; d--) {
+          text[n++] = segmentToChar(e.frame[d]);
+          if (e.frame[d] & 0x80) text[n++] = '.';
+        }
+        text[n] = '\0';
+        fprintf(out, "[%s]", text);
+        for (int8_t d = 7; d >= 0; d--) fprintf(out, " %02X", e.frame[d]);
+        fputc('\n', out);
+        break;
+      }
+
+      case TL_LEDS:
+      case TL_MIDI_IN:
+        fprintf(out, "%0*X\n", (e.kind == TL_LEDS) ? LED_SHIFT_REGISTERS * 2 : 2, (unsigned)e.value);
+        break;
+    }
+  }
+}
+
+bool Simulator::loadTrace(const char* path, std::vector<TraceEvent>& events) {
+  FILE* in = fopen(path, "r");
+  if (!in) {
+    fprintf(stderr, "cannot open trace %s\n", path);
+    return false;
+  }
+
+  char line[128];
+  unsigned lineNumber = 0;
+  uint64_t lastTimeUs = 0;
+  bool ok = true;
+
+  while (fgets(line, sizeof(line), in)) {
+    lineNumber++;
+    char* hash = strchr(line, '#');
+    if (hash) *hash = '\0';
+
+    unsigned long long timeUs;
+    unsigned sw;
+    char level;
+    const int fields = sscanf(line, "%llu %u %c", &timeUs, &sw, &level);
+    if (fields <= 0) continue;  // Blank or comment line
+
+    if (fields != 3 || sw < 1 || sw > NUM_SWITCHES || (level != 'L' && level != 'H') || timeUs < lastTimeUs) {
+      fprintf(stderr, "%s:%u: expected '<time_us> <1-%u> <L|H>' in time order\n", path, lineNumber, NUM_SWITCHES);
+      ok = false;
+      break;
+    }
+
+    TraceEvent ev;
+    ev.timeUs = timeUs;
+    ev.switchIndex = (uint8_t)(sw - 1);
+    ev.level = (level == 'L') ? LOW : HIGH;
+    events.push_back(ev);
+    lastTimeUs = timeUs;
+  }
+
+  fclose(in);
+  return ok;
+}
@@ -0,0 +1,133 @@
+#ifndef SIMULATOR_H
+#define SIMULATOR_H
+
+#include <stdio.h>
+#include <vector>
+
+#include "firmware.h"
+#include "peripherals.h"
+#include "rng.h"
+
+/**
+ * One switch-level change in an input trace.
+ * Trace files hold one event per line: `<time_us> <switch 1-4> <L|H>`
+ * where L means the contact is closed (pin pulled LOW). Bounce is written
+ * out as explicit alternating lines. '#' starts a comment.
+ */
+struct TraceEvent {
+  uint64_t timeUs;
+  uint8_t switchIndex;   // 0-3
+  uint8_t level;         // Pin level, LOW = pressed
+};
+
+/**
+ * Append one contact transition with 0-4 bounces (50-1500 us apart) before it settles.
+ * @return Time of the settled edge in microseconds
+ */
+uint64_t appendBouncedEdge(std::vector<TraceEvent>& trace, Rng& rng, uint64_t timeUs, uint8_t sw, uint8_t level);
+
+enum TimelineKind {
+  TL_SWITCH,    // Input edge applied from the trace
+  TL_RELAY,     // Relay pin or relay shift register output changed (index = loop, value = level)
+  TL_MIDI,      // Byte handed to Serial (value = byte, extraNs = wire start)
+  TL_DISPLAY,   // 7-segment frame after a main-loop pass (frame = digit registers)
+  TL_LEDS,      // 74HC595 outputs latched with a new value
+  TL_MIDI_IN    // Byte received on MIDI IN (value = byte, time = stop bit)
+};
+
+struct TimelineEntry {
+  uint64_t timeNs;
+  uint8_t kind;
+  uint8_t index;
+  uint32_t value;
+  uint64_t extraNs;
+  uint8_t frame[8];
+};
+
+/**
+ * Simulator - Replays an input trace through the firmware on the virtual
+ * clock and records what the outside world would see.
+ *
+ * Runs are deterministic: the same trace and cost model always give the same
+ * timeline, so timelines can be stored and diffed as golden files.
+ */
+class Simulator {
+public:
+  Simulator();
+  ~Simulator();
+
+  /**
+   * Reset the HAL, power up a fresh firmware instance and run setup().
+   * @param record Record a timeline (disable for throughput runs)
+   * @param eeprom EEPROM contents at power-up (HOST_EEPROM_SIZE bytes),
+   *        or nullptr for an erased chip
+   */
+  void begin(bool record = true, const uint8_t* eeprom = nullptr);
+
+  /**
+   * Schedule trace events on the HAL and run the main loop until the last
+   * one has been applied. Edges reach the firmware through its pin-change
+   * interrupts at their exact times.
+   * @param events Events sorted by time; times are relative to begin()
+   * @param count Number of events
+   */
+  void play(const TraceEvent* events, size_t count);
+
+  /**
+   * Schedule a byte arriving on MIDI IN. It reaches the firmware's receive
+   * interrupt when the clock gets to timeNs; run the loop to deliver it.
+   */
+  void scheduleMidiIn(uint8_t data, uint64_t timeNs);
+
+  /**
+   * Keep running the main loop until virtual time reaches untilNs.
+   */
+  void runUntilNs(uint64_t untilNs);
+
+  /**
+   * @return Virtual time at which the firmware's next task is released
+   */
+  uint64_t nextReleaseNs() const;
+
+  Firmware& firmware() { return *fw; }
+  // Entries in recording order; display frames may trail the edges around them
+  const std::vector<TimelineEntry>& timeline() const { return entries; }
+  uint64_t bootNs() const { return bootDoneNs; }
+  // Last relay change made by setup(), from power-up; 0 if it left every relay off
+  uint64_t relaysRestoredNs() const { return relaysRestoredAtNs; }
+  // Relays as the hardware has them, from the pins and the relay shift registers (bit 0 = loop 1)
+  LoopMask relayLoops() const;
+
+  /**
+   * Write the timeline as text, one entry per line.
+   */
+  void writeTimeline(FILE* out) const;
+
+  /**
+   * Parse a trace file.
+   * @return false on I/O or syntax error (message printed to stderr)
+   */
+  static bool loadTrace(const char* path, std::vector<TraceEvent>& events);
+
+private:
+  Firmware* fw;
+  Max7219Model display;
+  ShiftRegisterModel leds;
+  ShiftRegisterModel relayChain;   // Relays past the relay pins, if the unit has any
+  std::vector<TimelineEntry> entries;
+  bool recording;
+  bool inSetup;
+  uint64_t bootDoneNs;
+  uint64_t relaysRestoredAtNs;
+  uint64_t lastDisplayWriteNs;
+  uint8_t lastFrame[8];
+
+  void record(uint64_t timeNs, uint8_t kind, uint8_t index, uint32_t value, uint64_t extraNs = 0);
+  void captureDisplayFrame();
+  void relayChanged(uint8_t loop, uint8_t level, uint64_t timeNs);
+
+  static void onPinWrite(uint8_t pin, uint8_t level, uint64_t timeNs);
+  static void onSerialTx(uint8_t data, uint64_t queuedNs, uint64_t wireStartNs);
+};
+
+#endif
@@ -0,0 +1,15 @@
+#ifndef UTIL_CRC16_H
+#define UTIL_CRC16_H
+
+#include <stdint.h>
+
+/**
+ * Host stand-in for avr-libc's <util/crc16.h>.
+ *
+ * Only the CRC-8 the firmware uses is provided. It computes the same value
+ * as the avr-libc inline assembly (polynomial x^8 + x^2 + x + 1, MSB first)
+ * and is charged that loop's cycles on the virtual clock.
+ */
+uint8_t _crc8_ccitt_update(uint8_t crc, uint8_t data);
+
+#endif
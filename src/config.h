@@ -17,6 +17,12 @@
 #define DEBUG_PRINTLN(...)
 #endif
 
+// ===== PROFILING =====
+// Uncomment (or build with the uno_profile environment) to time the hot paths
+// with Timer1. Results are read back over MIDI SysEx, so MIDI keeps working.
+// Without it the probes compile to nothing.
+// #define PROFILE_MODE
+
 // ===== PIN DEFINITIONS =====
 // Footswitches (active LOW, internal pullup)
 const uint8_t SW1_PIN = 2;
@@ -30,7 +36,7 @@ const uint8_t RELAY2_PIN = 8;
 const uint8_t RELAY3_PIN = 9;
 const uint8_t RELAY4_PIN = 10;
 
-// MAX7219 SPI (using LedControl library)
+// MAX7219 (hardware SPI when DIN/CLK are MOSI/SCK and CS is not MISO, see max7219.h)
 const uint8_t MAX_DIN_PIN = 11;
 const uint8_t MAX_CLK_PIN = 13;
 const uint8_t MAX_CS_PIN = 12;
@@ -40,12 +46,73 @@ const uint8_t SR_DATA_PIN = A0;   // SER / DS - Serial data input
 const uint8_t SR_CLOCK_PIN = A1;  // SHCP / SRCLK - Shift register clock
 const uint8_t SR_LATCH_PIN = A2;  // STCP / RCLK - Storage register clock (latch)
 const bool LED_ACTIVE_LOW = false; // Set true if LEDs wired: +5V -> resistor -> LED -> 74HC595 output
+// Relays past RELAY4_PIN (units with more than 4 loops) sit on their own 74HC595
+// chain: same data and clock lines as the LED chain, latched on this pin
+const uint8_t RELAY_SR_LATCH_PIN = A3;
+
+// MIDI uses the hardware UART: TX on pin 1, RX on pin 0 (Uno/Nano)
+
+// ===== MIDI =====
+// Outgoing messages wait in a queue drained by the UART's data-register-empty
+// interrupt, so sending never blocks the main loop
+const uint8_t MIDI_TX_QUEUE_SIZE = 64;          // Bytes, power of two (one slot kept free)
+const uint8_t MIDI_TX_REALTIME_QUEUE_SIZE = 8;  // Realtime bytes, sent ahead of the queue
+
+enum MidiTxOverflowPolicy {
+  MIDI_TX_DROP_NEWEST,  // A message that does not fit is dropped
+  MIDI_TX_DROP_OLDEST   // Queued channel messages ahead of any SysEx make room for the latest
+};
+const MidiTxOverflowPolicy MIDI_TX_OVERFLOW_POLICY = MIDI_TX_DROP_OLDEST;
+
+// Incoming Program Change/Control Change on the switcher's channel, parsed in
+// the UART receive interrupt and handled on the next main-loop pass
+const uint8_t MIDI_RX_EVENT_QUEUE_SIZE = 8;  // Events, power of two
+// Control Changes that switch loops: loop n on CC MIDI_CC_LOOP_FIRST + n - 1
+// (loops 1-4 on General Purpose 5-8); value >= 64 = on
+const uint8_t MIDI_CC_LOOP_FIRST = 80;
 
-// MIDI uses hardware UART TX (pin 1 on Uno/Nano)
+// Everything received on MIDI IN is forwarded to MIDI OUT, merged with the
+// switcher's own messages between whole messages
+const bool MIDI_THRU_ENABLED = true;
+const uint8_t MIDI_THRU_QUEUE_SIZE = 32;  // Bytes, power of two
+// A forwarded message left unfinished this many passes with nothing received is given up on
+const uint8_t MIDI_THRU_STALL_PASSES = 2;
+
+// SysEx to and from the switcher: F0 MIDI_SYSEX_ID MIDI_SYSEX_DEVICE <command> [data] F7
+const uint8_t MIDI_SYSEX_ID = 0x7D;       // Non-commercial manufacturer ID
+const uint8_t MIDI_SYSEX_DEVICE = 0x4C;
+// Received SysEx body bytes kept: a preset restore chunk from a 16-loop unit.
+// Longer messages are ignored.
+const uint8_t MIDI_RX_SYSEX_SIZE = 56;
+// Data bytes of received SysEx waiting for the main loop, power of two
+const uint8_t MIDI_RX_SYSEX_QUEUE_SIZE = 128;
+
+enum SysExCommand {
+  SYSEX_PROFILE_REQUEST = 0x01,   // In: send the profile (PROFILE_MODE builds)
+  SYSEX_PROFILE_CLEAR = 0x02,     // In: start the profile over
+  SYSEX_LOG_REQUEST = 0x03,       // In: send the event log
+  SYSEX_PRESETS_REQUEST = 0x04,   // In: send the presets and their messages
+  SYSEX_PROFILE_SECTION = 0x41,   // Out: one profiled section's figures
+  SYSEX_LOG_HEADER = 0x42,        // Out: event log size and timing, ahead of its records
+  SYSEX_LOG_RECORDS = 0x43,       // Out: a run of event log records
+  SYSEX_PRESETS_CHUNK = 0x44,     // Out: a chunk of the presets; in: the same, restoring it
+  SYSEX_PRESETS_REPLY = 0x45      // Out: a restore chunk taken or refused
+};
+
+// Recent events (mode, gestures, presets, relays, MIDI sent) kept in RAM,
+// oldest overwritten, and read back over SysEx. 6 bytes each.
+const uint8_t EVENT_LOG_SIZE = 32;
 
 // ===== CONSTANTS =====
 // System configuration
-const uint8_t NUM_LOOPS = 4;
+// Loops the unit switches, 4-16: build with -DLOOP_COUNT=8 or -DLOOP_COUNT=16
+// for the larger units. There are always 4 footswitches; loops past 4 are
+// switched over MIDI and recalled with presets.
+#ifndef LOOP_COUNT
+#define LOOP_COUNT 4
+#endif
+const uint8_t NUM_LOOPS = LOOP_COUNT;
+const uint8_t NUM_SWITCHES = 4;
 const uint8_t NUM_BANKS = 32;
 const uint8_t PRESETS_PER_BANK = 4;
 const uint8_t TOTAL_PRESETS = NUM_BANKS * PRESETS_PER_BANK;  // 128
@@ -53,7 +120,11 @@ const uint8_t MAIN_LOOP_INTERVAL_MS = 10;  // For 100Hz update rate
 
 // Timing
 const uint8_t DEBOUNCE_MS = 30;
+const uint8_t SWITCH_EDGE_QUEUE_SIZE = 16;  // Captured switch edges, power of two
 const uint16_t SIMULTANEOUS_WINDOW_MS = 400;  // Increased from 100ms for easier combo detection
+// Apply single presses that could start a combo immediately and roll them back
+// if the partner switch arrives within SIMULTANEOUS_WINDOW_MS
+const bool SPECULATIVE_SINGLE_PRESS = true;
 const uint16_t LONG_PRESS_MS = 1000;
 const uint16_t EDIT_MODE_LONG_PRESS_MS = 2000;
 const uint16_t PC_FLASH_MS = 1000;
@@ -61,12 +132,54 @@ const uint16_t EDIT_ANIM_INTERVAL_MS = 150;
 const uint16_t SAVED_ANIM_INTERVAL_MS = 200;
 const uint16_t SAVED_DISPLAY_MS = 1200;  // 3 flashes * 2 states * 200ms
 const uint16_t CHANNEL_DISPLAY_MS = 1000;
+const uint16_t SESSION_SAVE_DELAY_MS = 500;  // A session change is saved once it has stood this long
+
+// Scheduler: Timer2 ticks release the main-loop tasks every MAIN_LOOP_INTERVAL_MS.
+// Deadlines count from a task's release; a later finish is an overrun.
+const uint16_t SCHEDULER_TICK_US = 1000;
+const uint8_t MAIN_LOOP_INTERVAL_TICKS = MAIN_LOOP_INTERVAL_MS * 1000UL / SCHEDULER_TICK_US;
+const uint8_t CONTROL_DEADLINE_TICKS = 2;   // Switches and MIDI in to relays and MIDI out
+const uint8_t OUTPUT_DEADLINE_TICKS = 5;    // Display and LEDs
+// Storage runs every tick so each EEPROM byte starts as soon as the one before is written
+const uint8_t STORAGE_INTERVAL_TICKS = 1;
+const uint8_t STORAGE_DEADLINE_TICKS = STORAGE_INTERVAL_TICKS;  // One EEPROM step, before the next release
+// An EEPROM byte's erase and write, 3.3 ms (ATmega328P datasheet table 8-2), in whole ticks
+const uint8_t EEPROM_WRITE_TICKS = 4;
+// Bytes written per pass: each must finish before the control task's next release
+const uint8_t EEPROM_WRITES_PER_PASS = MAIN_LOOP_INTERVAL_TICKS / EEPROM_WRITE_TICKS;
 
 // EEPROM layout
 // Address 0: Reserved (previously used for MIDI channel)
+const uint16_t EEPROM_SIZE = 1024;             // ATmega328
 const uint8_t EEPROM_INIT_FLAG_ADDR = 1;
-const uint8_t EEPROM_PRESETS_START_ADDR = 2;  // Presets 1-128 stored at addresses 2-129
-const uint8_t EEPROM_INIT_MAGIC = 0x42;        // Magic byte to detect first boot
+const uint8_t EEPROM_PRESETS_START_ADDR = 2;  // Base table: presets 1-128 at addresses 2-129 (loops 1-8)
+const uint8_t EEPROM_INIT_MAGIC = 0x42;        // Base table only (earlier firmware)
+const uint8_t EEPROM_JOURNAL_MAGIC = 0x43;     // Base table + 2-byte journal at 130 (earlier firmware)
+const uint8_t EEPROM_HEADER_MAGIC = 0x44;      // Base table + versioned header
+// Header after the base table: layout version and its complement
+const uint16_t EEPROM_HEADER_ADDR = EEPROM_PRESETS_START_ADDR + TOTAL_PRESETS;
+const uint8_t EEPROM_LAYOUT_VERSION = 3;        // 1: journal ran to the end of EEPROM, no session ring
+                                                // 2: journal ran to the session ring, no preset messages
+// Header value: the version, with the loop count in bits 3-6 on units with more than 4 loops
+const uint8_t EEPROM_LAYOUT_ID = (NUM_LOOPS <= 4) ? EEPROM_LAYOUT_VERSION
+                                                  : (uint8_t)(((NUM_LOOPS - 1) << 3) | EEPROM_LAYOUT_VERSION);
+const uint16_t EEPROM_BANK_CRC_ADDR = EEPROM_HEADER_ADDR + 2;  // CRC-8 of each bank's base table bytes
+// Loops 9-16 of presets 1-128, inverted, on units with more than 8 loops
+const uint16_t EEPROM_PRESETS_HIGH_ADDR = EEPROM_BANK_CRC_ADDR + NUM_BANKS;
+// Preset journal: records from the end of the tables to the preset messages
+const uint16_t EEPROM_JOURNAL_START_ADDR = EEPROM_PRESETS_HIGH_ADDR + ((NUM_LOOPS > 8) ? TOTAL_PRESETS : 0);
+// Session ring at the end of EEPROM: mode, bank, preset and loops restored at power-up.
+// Records grow by a byte for every 8 loops past the first 4.
+const uint8_t SESSION_SLOTS = 16;
+const uint8_t SESSION_RECORD_SIZE = 4 + ((NUM_LOOPS > 4) ? (NUM_LOOPS - 4 + 7) / 8 : 0);
+const uint16_t EEPROM_SESSION_START_ADDR = EEPROM_SIZE - SESSION_SLOTS * SESSION_RECORD_SIZE;
+// MIDI messages presets send when recalled (Program Changes and Control Changes
+// for the rest of the rig), variable-length records in two halves ahead of the
+// session ring. Every byte given to them is taken from the journal.
+const uint8_t PRESET_MAX_MESSAGES = 8;
+const uint8_t PRESET_MESSAGE_BYTES = PRESET_MAX_MESSAGES * 3;  // Most a preset's messages take, running status aside
+const uint16_t PRESET_MESSAGES_SIZE = 320;
+const uint16_t EEPROM_MESSAGES_START_ADDR = EEPROM_SESSION_START_ADDR - PRESET_MESSAGES_SIZE;
 
 // Default MIDI channel 0-15 (used in constructor before hardware read in initialize())
 const uint8_t DEFAULT_MIDI_CHANNEL = 0;
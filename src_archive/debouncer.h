@@ -0,0 +1,82 @@
+#ifndef DEBOUNCER_H
+#define DEBOUNCER_H
+
+#include <Arduino.h>
+
+/**
+ * VerticalDebouncer - Debounces a whole port's worth of inputs at once
+ *
+ * Each input has a 2-bit counter stored "vertically": bit 0 of every
+ * counter lives in count0, bit 1 in count1. One update() is a fixed handful
+ * of bitwise operations whether Mask holds 4, 8 (uint8_t) or 16 (uint16_t)
+ * inputs, and the whole state is four Mask words.
+ *
+ * An input's debounced level changes once its raw level has disagreed with
+ * it for `samples` consecutive updates with no edge in between. Any edge
+ * (reported through `bounced`) restarts the count, like the time-based
+ * debounce restarting its timer.
+ *
+ * Levels are raw pin levels: with pullups, a press is a falling edge.
+ */
+template <typename Mask>
+class VerticalDebouncer {
+public:
+  /**
+   * @param samples Quiet samples needed to accept a change (1-3)
+   * @param initial Starting debounced levels
+   */
+  explicit VerticalDebouncer(uint8_t samples, Mask initial = (Mask)~(Mask)0)
+    : match0((samples & 1) ? (Mask)~(Mask)0 : 0),
+      match1((samples & 2) ? (Mask)~(Mask)0 : 0) {
+    reset(initial);
+  }
+
+  void reset(Mask levels) {
+    state = levels;
+    count0 = 0;
+    count1 = 0;
+    fell = 0;
+    rose = 0;
+  }
+
+  /**
+   * Take one sample.
+   * @param levels Raw input levels, bit per input
+   * @param bounced Inputs that had an edge since the previous sample, even
+   *                if they read back the same level
+   * @return Inputs whose debounced level changed on this sample
+   */
+  Mask update(Mask levels, Mask bounced) {
+    // Only inputs that disagree and stayed quiet keep counting; the rest restart
+    const Mask counting = (Mask)((levels ^ state) & ~bounced);
+    count1 = (Mask)((count1 ^ count0) & counting);
+    count0 = (Mask)(~count0 & counting);
+
+    const Mask toggled = (Mask)(counting & ~(count0 ^ match0) & ~(count1 ^ match1));
+    count0 &= (Mask)~toggled;
+    count1 &= (Mask)~toggled;
+    state ^= toggled;
+
+    fell = (Mask)(toggled & ~state);
+    rose = (Mask)(toggled & state);
+    return toggled;
+  }
+
+  // Debounced levels
+  Mask levels() const { return state; }
+
+  // Inputs that went LOW / HIGH on the last update()
+  Mask fallingEdges() const { return fell; }
+  Mask risingEdges() const { return rose; }
+
+private:
+  Mask match0;    // Count value that accepts a change, spread across all inputs
+  Mask match1;
+  Mask state;
+  Mask count0;
+  Mask count1;
+  Mask fell;
+  Mask rose;
+};
+
+#endif
@@ -1,211 +1,162 @@
 #include "display.h"
-
-// Sentinel values for display buffer management
-#define BLANK_VALUE 0xFE   // Represents a blank/cleared display position
-#define INIT_VALUE 0xFF    // Initial invalid value to force first update
-
-const byte n = 0b00010101;
-const byte t = 0b00001111;
-
-/*
- * These are the printable characters:
- *  0 1 2 3 4 5 6 7 8 9
-    A a (prints upper case)
-    B b (prints lower case)
-    C c (prints lower case)
-    D d (prints lower case)
-    E e (prints upper case)
-    F f (prints upper case)
-    H h (prints upper case)
-    L l (prints upper case)
-    P p (prints upper case)
-    - (the minus sign)
-    . , (lights up the decimal-point)
-    _ (the underscore)
-    <SPACE> (the blank or space char)
+#include "glyphs.h"
+#include "profiler.h"
+
+enum FrameImage {
+  FRAME_BLANK,
+  FRAME_BANK,
+  FRAME_BANK_GLOBAL,
+  FRAME_CHANNEL,
+  FRAME_EDIT_FIRST,
+  FRAME_SAVED_ON = FRAME_EDIT_FIRST + EDIT_ANIMATION_FRAMES,
+  NUM_FRAME_IMAGES
+};
+
+constexpr uint8_t FRAME_IMAGES[NUM_FRAME_IMAGES][DISPLAY_DIGITS] PROGMEM = {
+  DISPLAY_FRAME("        "),          // Blank; PC flash digits and saved "off" frames
+  DISPLAY_FRAME("bAn     "),          // "bAn  12"
+  DISPLAY_FRAME("bAn  -  "),          // "bAn -12" for the global preset
+  DISPLAY_FRAME("cHAn    "),          // "cHAn  01"
+  // "Ed1t" with a decimal point walking positions 5..0 (frame 3 would land on 't' and shows none)
+  DISPLAY_FRAME("  E.d1t  "),
+  DISPLAY_FRAME("  Ed.1t  "),
+  DISPLAY_FRAME("  Ed1.t  "),
+  DISPLAY_FRAME("  Ed1t  "),
+  DISPLAY_FRAME("  Ed1t . "),
+  DISPLAY_FRAME("  Ed1t  ."),
+  DISPLAY_FRAME(" . . . . . . . ."),  // Saved: every decimal point
+};
+
+constexpr uint8_t DIGIT_IMAGES[10] PROGMEM = {
+  glyph('0'), glyph('1'), glyph('2'), glyph('3'), glyph('4'),
+  glyph('5'), glyph('6'), glyph('7'), glyph('8'), glyph('9')
+};
+
+/**
+ * Manual mode "4 3 2 1" on a 4-loop unit: loop N shows N at position
+ * 2 * (N - 1) when on and '_' when off. One image per combination of loop
+ * states.
  */
-Display::Display(uint8_t dinPin, uint8_t clkPin, uint8_t csPin)
-  : lc(dinPin, clkPin, csPin, 1), bufferInitialized(false) {
-  // Initialize buffers to force initial update
-  for (uint8_t i = 0; i < DISPLAY_DIGITS; i++) {
-    digitBuffer[i] = INIT_VALUE;  // Force update on first use
-    isDigitBuffer[i] = false;
-    decimalBuffer[i] = false;
-  }
+constexpr uint8_t manualFrameDigit(uint8_t loops, uint8_t position) {
+  return (position % 2 != 0 || position > 6) ? glyph(' ')
+       : ((loops >> (position / 2)) & 1) ? glyph((char)('1' + position / 2))
+       : glyph('_');
+}
+
+#define MANUAL_FRAME(loops) {                                   \
+    manualFrameDigit(loops, 0), manualFrameDigit(loops, 1),     \
+    manualFrameDigit(loops, 2), manualFrameDigit(loops, 3),     \
+    manualFrameDigit(loops, 4), manualFrameDigit(loops, 5),     \
+    manualFrameDigit(loops, 6), manualFrameDigit(loops, 7) }
+
+constexpr uint8_t MANUAL_IMAGES[16][DISPLAY_DIGITS] PROGMEM = {
+  MANUAL_FRAME(0),  MANUAL_FRAME(1),  MANUAL_FRAME(2),  MANUAL_FRAME(3),
+  MANUAL_FRAME(4),  MANUAL_FRAME(5),  MANUAL_FRAME(6),  MANUAL_FRAME(7),
+  MANUAL_FRAME(8),  MANUAL_FRAME(9),  MANUAL_FRAME(10), MANUAL_FRAME(11),
+  MANUAL_FRAME(12), MANUAL_FRAME(13), MANUAL_FRAME(14), MANUAL_FRAME(15)
+};
+
+Display::Display() {
+  loadFrame(FRAME_BLANK);
 }
 
 void Display::begin() {
-  lc.shutdown(0, false);  // Wake up display
-  lc.setIntensity(0, 8);  // Medium brightness (0-15)
-  lc.clearDisplay(0);
-  bufferInitialized = true;
-}
-
-// Buffered setChar - only updates if value changed
-void Display::setCharAtBuffered(uint8_t position, char c, bool dp) {
-  const uint8_t charValue = (uint8_t)c;
-  
-  // Update only if the character, type, or decimal point changed (or buffer not initialized)
-  if (!bufferInitialized || digitBuffer[position] != charValue || isDigitBuffer[position] || decimalBuffer[position] != dp) {
-    lc.setChar(0, position, c, dp);
-    digitBuffer[position] = charValue;
-    isDigitBuffer[position] = false;  // Mark as character, not digit
-    decimalBuffer[position] = dp;
-  }
+  driver.begin(8);  // Medium brightness (0-15)
 }
 
-// Buffered setDigit - only updates if value changed
-void Display::setDigitAtBuffered(uint8_t position, uint8_t digit, bool dp) {
-  // Update only if the digit, type, or decimal point changed (or buffer not initialized)
-  if (!bufferInitialized || digitBuffer[position] != digit || !isDigitBuffer[position] || decimalBuffer[position] != dp) {
-    lc.setDigit(0, position, digit, dp);
-    digitBuffer[position] = digit;
-    isDigitBuffer[position] = true;  // Mark as digit, not character
-    decimalBuffer[position] = dp;
-  }
+void Display::loadFrame(uint8_t image) {
+  memcpy_P(frame, FRAME_IMAGES[image], DISPLAY_DIGITS);
 }
 
-// Buffered clear - only clears positions that aren't already blank
-void Display::clearBuffered() {
-  if (!bufferInitialized) {
-    lc.clearDisplay(0);
-    // Mark all positions as blank in buffer
-    for (uint8_t i = 0; i < DISPLAY_DIGITS; i++) {
-      digitBuffer[i] = BLANK_VALUE;
-      isDigitBuffer[i] = false;
-      decimalBuffer[i] = false;
-    }
-    return;
+void Display::patchNumber(uint8_t num, uint8_t digits) {
+  // Right-aligned, zero-padded
+  for (uint8_t i = 0; i < digits; i++) {
+    frame[i] = pgm_read_byte(&DIGIT_IMAGES[num % 10]);
+    num /= 10;
   }
-  
+}
+
+void Display::patchLoops(LoopMask loops) {
+  // Loop N at position N - 1, loop N + 8 on that digit's decimal point
   for (uint8_t i = 0; i < DISPLAY_DIGITS; i++) {
-    if (digitBuffer[i] != BLANK_VALUE) {
-      lc.setChar(0, i, ' ', false);
-      digitBuffer[i] = BLANK_VALUE;
-      isDigitBuffer[i] = false;
-      decimalBuffer[i] = false;
+    if (i >= NUM_LOOPS) {
+      frame[i] = glyph(' ');
+    } else {
+      frame[i] = ((loops >> i) & 1) ? pgm_read_byte(&DIGIT_IMAGES[i + 1]) : glyph('_');
+      if (i + DISPLAY_DIGITS < NUM_LOOPS && ((loops >> (i + DISPLAY_DIGITS)) & 1)) frame[i] |= SEGMENT_DP;
     }
   }
 }
 
-void Display::update(DisplayState state, uint8_t value, const bool loopStates[4], bool globalPreset, uint8_t animFrame) {
+void Display::showFrame() {
+  driver.setFrame(frame);
+  driver.flush();
+}
+
+void Display::render(DisplayState state, uint8_t value, LoopMask loops, bool globalPreset, uint8_t animFrame) {
   switch (state) {
     case SHOWING_MANUAL:
-      displayManualStatus(loopStates);
+      if (NUM_LOOPS <= 4) {
+        memcpy_P(frame, MANUAL_IMAGES[loops & 0x0F], DISPLAY_DIGITS);
+      } else {
+        patchLoops(loops);
+      }
       break;
 
     case SHOWING_BANK:
-      displayBankNumber(value, globalPreset);
+      loadFrame(globalPreset ? FRAME_BANK_GLOBAL : FRAME_BANK);
+      patchNumber(value, 2);
       break;
 
     case FLASHING_PC:
-      displayProgramChange(value);
+      loadFrame(FRAME_BLANK);
+      patchNumber(value, 3);
       break;
 
     case SHOWING_SAVED:
-      displaySaved(animFrame);
+      // Even frames on, odd frames off: 3 flashes
+      loadFrame((animFrame % 2 == 0) ? FRAME_SAVED_ON : FRAME_BLANK);
       break;
 
     case EDIT_MODE_ANIMATED:
-      displayEdit(animFrame);
+      loadFrame(FRAME_EDIT_FIRST + animFrame % EDIT_ANIMATION_FRAMES);
       break;
   }
 }
 
-void Display::displayBankNumber(uint8_t num, bool globalPreset) {
-  clearBuffered();
-
-  setCharAtBuffered(7, 'b', false);
-  setCharAtBuffered(6, 'A', false);
-  setCharAtBuffered(4, ' ', false);
-
-  const uint8_t tens = num / 10;
-  const uint8_t ones = num % 10;
-
-  setDigitAtBuffered(1, tens, false);
-  setDigitAtBuffered(0, ones, false);
-
-  if (globalPreset) {
-    setCharAtBuffered(2, '-', false);
-  }
+void Display::update(DisplayState state, uint8_t value, LoopMask loops, bool globalPreset, uint8_t animFrame) {
+  PROFILE_SCOPE(PROFILE_DISPLAY_UPDATE);
+  render(state, value, loops, globalPreset, animFrame);
+  showFrame();
+}
 
-  // Custom bit pattern for lowercase 'n' - set this LAST
-  lc.setRow(0, 5, n);
+void Display::displayBankNumber(uint8_t num, bool globalPreset) {
+  update(SHOWING_BANK, num, 0, globalPreset);
 }
 
 void Display::displayProgramChange(uint8_t num) {
-  clearBuffered();
-
-  const uint8_t hundreds = num / 100;
-  const uint8_t tens = (num / 10) % 10;
-  const uint8_t ones = num % 10;
-
-  setDigitAtBuffered(2, hundreds, false);
-  setDigitAtBuffered(1, tens, false);
-  setDigitAtBuffered(0, ones, false);
+  update(FLASHING_PC, num, 0);
 }
 
 void Display::displayChannel(uint8_t ch) {
-  // Directly write to hardware without buffering
-  lc.clearDisplay(0);
-
-  lc.setChar(0, 7, 'C', false);
-  lc.setChar(0, 6, 'H', false);
-  lc.setChar(0, 5, 'A', false);
-
-  const uint8_t tens = ch / 10;
-  const uint8_t ones = ch % 10;
-
-  lc.setDigit(0, 1, tens, false);
-  lc.setDigit(0, 0, ones, false);
-
-  // Custom bit pattern for lowercase 'n' - set this LAST
-  lc.setRow(0, 4, n);
+  loadFrame(FRAME_CHANNEL);
+  patchNumber(ch, 2);
+  showFrame();
 }
 
 void Display::displayEdit(uint8_t animFrame) {
-  // Display "Edit" with scrolling decimal animation (E->d->i->t)
-  clearBuffered();
-
-  // Show "Edit" text with scrolling decimal from left to right (Ed17)
-  setCharAtBuffered(5, 'E', animFrame == 0);
-  setCharAtBuffered(4, 'd', animFrame == 1);
-  setDigitAtBuffered(3, 1, animFrame == 2);
-
-  // Add trailing decimals for scroll effect
-  if (animFrame == 4) setCharAtBuffered(1, ' ', true);
-  if (animFrame == 5) setCharAtBuffered(0, ' ', true);
-
-  lc.setRow(0, 2, t);
+  update(EDIT_MODE_ANIMATED, 0, 0, false, animFrame);
 }
 
 void Display::displaySaved(uint8_t animFrame) {
-  // Flash all decimals 3 times: 200ms on, 200ms off
-  // animFrame 0,2,4 = decimals on; animFrame 1,3,5 = decimals off
-  clearBuffered();
-
-  const bool decimalsOn = (animFrame % 2 == 0);
-
-  // Set all positions to blank with decimal point controlled by animFrame
-  for (uint8_t i = 0; i < DISPLAY_DIGITS; i++) {
-    setCharAtBuffered(i, ' ', decimalsOn);
-  }
+  update(SHOWING_SAVED, 0, 0, false, animFrame);
 }
 
-void Display::displayManualStatus(const bool loopStates[4]) {
-  clearBuffered();
-
-  setCharAtBuffered(6, loopStates[3] ? '4' : '_', false);
-  setCharAtBuffered(5, ' ', false);  // Explicitly clear position 5 (where 'n' from bank appears)
-  setCharAtBuffered(4, loopStates[2] ? '3' : '_', false);
-  setCharAtBuffered(2, loopStates[1] ? '2' : '_', false);
-  setCharAtBuffered(0, loopStates[0] ? '1' : '_', false);
+void Display::displayManualStatus(LoopMask loops) {
+  update(SHOWING_MANUAL, 0, loops);
 }
 
 void Display::clear() {
-  clearBuffered();
-}
-
-void Display::setCharAt(uint8_t position, char c) {
-  setCharAtBuffered(position, c, false);
+  loadFrame(FRAME_BLANK);
+  showFrame();
 }
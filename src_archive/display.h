@@ -2,10 +2,11 @@
 #define DISPLAY_H
 
 #include <Arduino.h>
-#include <LedControl.h>
+#include "max7219.h"
+#include "loop_mask.h"
 
 // Number of digits in the display
-#define DISPLAY_DIGITS 8
+#define DISPLAY_DIGITS MAX7219_DIGITS
 
 enum DisplayState {
   SHOWING_MANUAL,
@@ -15,34 +16,57 @@ enum DisplayState {
   EDIT_MODE_ANIMATED
 };
 
+// Frames in the edit-mode point sweep and the saved flash (3 on/off pairs)
+const uint8_t EDIT_ANIMATION_FRAMES = 6;
+const uint8_t SAVED_ANIMATION_FRAMES = 6;
+
+/**
+ * Display - Draws the switcher's screens on the 8-digit 7-segment display
+ *
+ * Every screen, including each frame of the edit and saved animations, is a
+ * segment image built at compile time and kept in flash (see glyphs.h).
+ * Drawing copies the image and patches in the variable digits (numbers,
+ * manual-mode loops), then hands the frame to the Max7219 framebuffer; only
+ * digits that differ from what is shown get sent.
+ *
+ * Manual mode shows "4 3 2 1" on a 4-loop unit, one image per combination
+ * of loops. Larger units show loops 1-8 as "87654321" and light the decimal
+ * point of loop n's digit for loop n + 8.
+ */
 class Display {
 public:
-  Display(uint8_t dinPin, uint8_t clkPin, uint8_t csPin);
+  Display();
 
   void begin();
-  void update(DisplayState state, uint8_t value, const bool loopStates[4], bool globalPreset = false, uint8_t animFrame = 0);
+  void update(DisplayState state, uint8_t value, LoopMask loops, bool globalPreset = false, uint8_t animFrame = 0);
+
+  /**
+   * Compose a state's frame without sending it; update() is render() plus a
+   * flush. loops is only read for SHOWING_MANUAL.
+   */
+  void render(DisplayState state, uint8_t value, LoopMask loops, bool globalPreset = false, uint8_t animFrame = 0);
+
   void displayBankNumber(uint8_t num, bool globalPreset = false);
   void displayProgramChange(uint8_t num);
   void displayChannel(uint8_t ch);
-  void displayManualStatus(const bool loopStates[4]);
+  void displayManualStatus(LoopMask loops);
   void displayEdit(uint8_t animFrame);
   void displaySaved(uint8_t animFrame);
   void clear();
 
+  // Segment byte of the frame last composed, index 0 = rightmost digit
+  uint8_t getFrameDigit(uint8_t digit) const { return frame[digit]; }
+
 private:
-  LedControl lc;
-  
-  // Display buffers to track current state
-  // Store both the character value and a type flag to distinguish between chars and digits
-  uint8_t digitBuffer[DISPLAY_DIGITS];      // Current values on display (char ASCII or digit 0-15)
-  bool isDigitBuffer[DISPLAY_DIGITS];       // True if position contains a digit, false if char
-  bool decimalBuffer[DISPLAY_DIGITS];       // Current decimal point states
-  bool bufferInitialized;                   // Track if buffer has been initialized
-  
-  void setCharAt(uint8_t position, char c);
-  void setCharAtBuffered(uint8_t position, char c, bool dp);
-  void setDigitAtBuffered(uint8_t position, uint8_t digit, bool dp);
-  void clearBuffered();
+  Max7219 driver;
+
+  // Frame under construction, index 0 = rightmost digit
+  uint8_t frame[DISPLAY_DIGITS];
+
+  void loadFrame(uint8_t image);
+  void patchNumber(uint8_t num, uint8_t digits);
+  void patchLoops(LoopMask loops);
+  void showFrame();
 };
 
 #endif
@@ -0,0 +1,88 @@
+#include "event_log.h"
+#include "midi_handler.h"
+#include "sysex.h"
+
+static_assert(EVENT_LOG_SIZE >= 1 && EVENT_LOG_SIZE <= 127, "Record indexes go out as one data byte");
+
+static const uint8_t RECORDS_PER_MESSAGE = 4;
+static const uint8_t RECORD_BYTES = 3 + 1 + 2 + 3;
+// Index of the first record, then the records
+static const uint8_t RECORDS_MESSAGE_SIZE = 1 + RECORDS_PER_MESSAGE * RECORD_BYTES;
+static const int16_t DUMP_HEADER = -1;
+
+static LogRecord records[EVENT_LOG_SIZE];
+static uint8_t newest = EVENT_LOG_SIZE - 1;
+static uint8_t count = 0;
+static uint16_t lost = 0;
+static unsigned long lastMs = 0;   // When the newest record was made
+
+static bool dumping = false;
+static int16_t dumpNext = DUMP_HEADER;   // Header, or the index of the next record to send
+
+static void countLost() {
+  if (lost < 0xFFFF) lost++;
+}
+
+void logEvent(LogEvent event, uint8_t a, uint16_t b) {
+  // The readout is of the log as it was asked for
+  if (dumping) {
+    countLost();
+    return;
+  }
+
+  const unsigned long now = millis();
+  const unsigned long deltaMs = now - lastMs;
+  lastMs = now;
+  if (count < EVENT_LOG_SIZE) count++;
+  else countLost();
+  newest = (newest + 1) % EVENT_LOG_SIZE;
+
+  LogRecord& record = records[newest];
+  record.deltaMs = (deltaMs > 0xFFFF) ? 0xFFFF : deltaMs;
+  record.event = event;
+  record.a = a;
+  record.b = b;
+}
+
+void requestLogDump() {
+  dumping = true;
+  dumpNext = DUMP_HEADER;
+}
+
+void clearEventLog() {
+  newest = EVENT_LOG_SIZE - 1;
+  count = 0;
+  lost = 0;
+  lastMs = 0;
+  dumping = false;
+}
+
+void updateEventLog() {
+  if (!dumping) return;
+
+  uint8_t message[RECORDS_MESSAGE_SIZE];
+  uint8_t* out = message;
+  if (dumpNext == DUMP_HEADER) {
+    const unsigned long now = millis();
+    *out++ = count;
+    *out++ = EVENT_LOG_SIZE;
+    out = putSeptets(out, lost, 3);
+    out = putSeptets(out, count ? now - lastMs : 0, 5);
+    out = putSeptets(out, now, 5);
+    // No room yet: the same message goes next pass
+    if (sendMIDISysEx(SYSEX_LOG_HEADER, message, out - message)) dumpNext = 0;
+  } else {
+    const uint8_t oldest = (newest + 1 + EVENT_LOG_SIZE - count) % EVENT_LOG_SIZE;
+    *out++ = dumpNext;
+    for (uint8_t i = dumpNext; i < count && i < dumpNext + RECORDS_PER_MESSAGE; i++) {
+      const LogRecord& record = records[(oldest + i) % EVENT_LOG_SIZE];
+      out = putSeptets(out, record.deltaMs, 3);
+      *out++ = record.event;
+      out = putSeptets(out, record.a, 2);
+      out = putSeptets(out, record.b, 3);
+    }
+    if (sendMIDISysEx(SYSEX_LOG_RECORDS, message, out - message)) dumpNext += RECORDS_PER_MESSAGE;
+  }
+
+  if (dumpNext >= count) dumping = false;
+}
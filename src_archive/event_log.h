@@ -0,0 +1,74 @@
+#ifndef EVENT_LOG_H
+#define EVENT_LOG_H
+
+#include <Arduino.h>
+#include "config.h"
+
+/**
+ * What a log record says happened; meaning of its a and b fields
+ */
+enum LogEvent {
+  LOG_MODE,          // a = new Mode
+  LOG_BANK,          // a = new bank, 1-NUM_BANKS
+  LOG_GESTURE,       // a = LogGesture, b = switch 0-3 for a single press
+  LOG_PRESET_LOAD,   // a = preset 1-TOTAL_PRESETS, b = its loops
+  LOG_PRESET_SAVE,   // a = preset 1-TOTAL_PRESETS, b = the loops saved
+  LOG_RELAYS,        // b = loops now switched in, bit 0 = loop 1
+  LOG_MIDI_SEND      // a = status, b = data1 | data2 << 8
+};
+
+/**
+ * Footswitch gestures, as the mode controller recognized them
+ */
+enum LogGesture {
+  PRESS_SINGLE,      // Single press
+  PRESS_MODE_PAIR,   // SW2+SW3
+  PRESS_BANK_DOWN,   // SW1+SW2
+  PRESS_BANK_UP,     // SW3+SW4
+  PRESS_EDIT_HOLD    // SW2+SW3 held to enter or leave edit mode
+};
+
+/**
+ * One event, 6 bytes
+ */
+struct LogRecord {
+  uint16_t deltaMs;   // Since the record before, saturating at 65535
+  uint8_t event;      // LogEvent
+  uint8_t a;
+  uint16_t b;
+};
+
+/**
+ * EventLog - Post-mortem trace of what the switcher did, kept in RAM
+ *
+ * The last EVENT_LOG_SIZE events are kept in a ring, the oldest
+ * overwritten. Recording one is a few stores, so the log runs in release
+ * builds and leaves the UART to MIDI, unlike DEBUG_MODE.
+ *
+ * SysEx command SYSEX_LOG_REQUEST reads it back over MIDI, one message per
+ * main-loop pass as room in the transmit queue allows:
+ *
+ *   F0 7D 4C 42 <records> <EVENT_LOG_SIZE> <lost: 3 bytes>
+ *      <newest record's age, ms: 5 bytes> <uptime, ms: 5 bytes> F7
+ *   F0 7D 4C 43 <index of first> then up to 4 records of
+ *      <delta ms: 3 bytes> <event> <a: 2 bytes> <b: 3 bytes> F7
+ *
+ * Multi-byte values are 7 bits a byte, low first; records go oldest first.
+ * Lost counts records overwritten, and those made while a readout was
+ * going out (the log holds still for it), saturating at 65535. The host
+ * `syxlog` command turns a dump into a timeline.
+ */
+
+// Record an event at millis()
+void logEvent(LogEvent event, uint8_t a = 0, uint16_t b = 0);
+
+// Send the log, starting with the next updateEventLog()
+void requestLogDump();
+
+// Send the next message of a requested dump. Call once per main-loop pass.
+void updateEventLog();
+
+// Empty the log (power-up)
+void clearEventLog();
+
+#endif
@@ -0,0 +1,83 @@
+#include "firmware.h"
+
+static const uint8_t SWITCH_PINS[NUM_SWITCHES] = {SW1_PIN, SW2_PIN, SW3_PIN, SW4_PIN};
+
+// Control and output released together every pass, storage every tick; the table order is also the run order
+const Task<Firmware> Firmware::TASKS[TASK_COUNT] = {
+  {&Firmware::controlTask, 0, MAIN_LOOP_INTERVAL_TICKS, CONTROL_DEADLINE_TICKS},
+  {&Firmware::outputTask, 1, MAIN_LOOP_INTERVAL_TICKS, OUTPUT_DEADLINE_TICKS},
+  {&Firmware::storageTask, 2, STORAGE_INTERVAL_TICKS, STORAGE_DEADLINE_TICKS},
+};
+
+Firmware::Firmware()
+  : switches(SWITCH_PINS, DEBOUNCE_MS, SIMULTANEOUS_WINDOW_MS, LONG_PRESS_MS),
+    modes(state, switches, relays),
+    scheduler(TASKS) {
+}
+
+void Firmware::setup() {
+  clearEventLog();
+  // Instant-on: the relays go back to the last session before anything else starts
+  state.restoreSession();
+  relays.begin();
+  relays.update(state.loops);
+
+  initMIDI();
+  switches.begin();
+  display.begin();
+  leds.begin();
+
+  // Reads the DIP switches, so it must run after the pullups are enabled
+  state.initialize();
+
+  // Presets are read and checked while the channel is on show
+  display.displayChannel(state.midiChannel + 1);
+  const unsigned long channelShownAt = millis();
+  state.loadPresets();
+  const unsigned long presetsLoadedIn = millis() - channelShownAt;
+  if (presetsLoadedIn < CHANNEL_DISPLAY_MS) delay(CHANNEL_DISPLAY_MS - presetsLoadedIn);
+
+  initSchedulerTick();
+  scheduler.begin();
+  initProfiler();
+}
+
+bool Firmware::loop() {
+  return scheduler.run(*this);
+}
+
+void Firmware::controlTask() {
+  switches.readAndDebounce();
+  modes.detectSwitchPatterns();
+  updateMIDI();
+  modes.handleMidiInput();
+  updateProfiler();
+  updateEventLog();
+
+  // Edit mode drives the relays from the edit buffer so changes are heard live
+  relays.update(state.getDisplayLoops());
+}
+
+void Firmware::outputTask() {
+  modes.updateStateMachine();
+
+  const LoopMask appliedLoops = state.getDisplayLoops();
+  const uint8_t animFrame = (state.displayState == SHOWING_SAVED) ? state.savedDisplayAnimFrame
+                                                                   : state.editModeAnimFrame;
+  display.update(state.displayState, state.getDisplayValue(), appliedLoops, state.globalPresetActive, animFrame);
+  leds.update(appliedLoops, state.currentMode, state.activePreset, state.globalPresetActive);
+}
+
+void Firmware::storageTask() {
+  // At most one EEPROM byte, once the one before is written, and only if
+  // it will be written before the control task runs again: a recall reads
+  // its messages from EEPROM, and that read would wait for the write.
+  // That is EEPROM_WRITES_PER_PASS bytes a pass, the first started after
+  // the pass's outputs. Preset messages go first: only a restore changes
+  // them, and it holds the next change in RAM until this one is written,
+  // while presets wait in RAM. The session goes last.
+  if (scheduler.ticksUntilRelease(CONTROL_TASK) < EEPROM_WRITE_TICKS) return;
+  state.presetMessages.update();
+  state.presets.update();
+  state.updateSession();
+}
@@ -0,0 +1,65 @@
+#ifndef FIRMWARE_H
+#define FIRMWARE_H
+
+#include <Arduino.h>
+#include "config.h"
+#include "state_manager.h"
+#include "switches.h"
+#include "relays.h"
+#include "display.h"
+#include "led_controller.h"
+#include "mode_controller.h"
+#include "midi_handler.h"
+#include "scheduler.h"
+#include "profiler.h"
+#include "event_log.h"
+
+/**
+ * Firmware - The switcher application: its modules wired together and the
+ * task table the scheduler runs them from. The sketch (main.cpp) calls
+ * setup() and loop() on the board; host tools own an instance, reset it
+ * between runs and drive it on the virtual clock.
+ */
+class Firmware {
+public:
+  Firmware();
+
+  static const uint8_t TASK_COUNT = 3;
+  static const uint8_t CONTROL_TASK = 0;   // Row of the control task in the table
+
+  /**
+   * Power-up sequence: the last session and the relays it had on, then
+   * MIDI, switches, display, LEDs and the MIDI channel splash, with the
+   * presets loaded from EEPROM behind it. The scheduler tick starts last.
+   */
+  void setup();
+
+  /**
+   * One pass of the main loop: runs the tasks the scheduler tick has
+   * released, control first, then outputs (100 Hz each), then storage
+   * (every tick).
+   * @return true if any task ran, false if none was due
+   */
+  bool loop();
+
+  StateManager state;
+  SwitchHandler switches;
+  RelayController relays;
+  Display display;
+  LedController leds;
+  ModeController modes;
+  Scheduler<Firmware, TASK_COUNT> scheduler;
+
+private:
+  static const Task<Firmware> TASKS[TASK_COUNT];
+
+  // Switches and MIDI in, acted on: relays and MIDI out
+  void controlTask();
+  // Display state timers, 7-segment display and status LEDs
+  void outputTask();
+  // At most one EEPROM byte, if it will be written before control runs:
+  // preset messages, presets, then the session
+  void storageTask();
+};
+
+#endif
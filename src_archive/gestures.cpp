@@ -0,0 +1,109 @@
+#include "gestures.h"
+
+GestureRecognizer::GestureRecognizer(const GestureRule* rules, uint8_t count)
+  : rules(rules), count(count) {
+  reset();
+}
+
+void GestureRecognizer::reset() {
+  span = 0;
+  tapped = 0;
+  for (uint8_t i = 0; i < NUM_SWITCHES; i++) lastTapMs[i] = 0;
+}
+
+GestureRule GestureRecognizer::rule(uint8_t index) const {
+  GestureRule entry;
+  memcpy_P(&entry, &rules[index], sizeof(entry));
+  return entry;
+}
+
+bool GestureRecognizer::recognize(SwitchHandler& switches, uint8_t context, uint8_t pending, GestureMatch& gesture) {
+  const uint8_t recent = switches.getRecentPresses();
+  const uint8_t held = switches.getPressedSwitches();
+
+  // A span of presses ends on the pass the last switch comes up
+  span |= held;
+  const uint8_t released = held ? 0 : span;
+  if (!held) span = 0;
+
+  for (uint8_t i = 0; i < count; i++) {
+    const GestureRule entry = rule(i);
+    if (!(entry.contexts & context)) continue;
+
+    bool matched;
+    switch (entry.trigger) {
+      case TRIGGER_CHORD:
+        matched = (recent & entry.switches) == entry.switches;
+        break;
+      case TRIGGER_HOLD:
+        matched = switches.isLongPress(entry.switches, entry.ms);
+        break;
+      case TRIGGER_RELEASE:
+        matched = released == entry.switches;
+        break;
+      default:
+        matched = false;
+        break;
+    }
+    if (!matched) continue;
+
+    // Presses that made up a chord are not the first half of a double tap
+    tapped &= ~entry.switches;
+    gesture.action = entry.action;
+    gesture.trigger = entry.trigger;
+    gesture.switchIndex = 0;
+    return true;
+  }
+
+  const uint8_t taps = recent & ~pending;
+  for (uint8_t i = 0; i < NUM_SWITCHES; i++) {
+    if (taps & (1 << i)) return recognizeTap(switches, context, i, gesture);
+  }
+  return false;
+}
+
+bool GestureRecognizer::recognizeTap(SwitchHandler& switches, uint8_t context, uint8_t switchIndex,
+                                     GestureMatch& gesture) {
+  const uint8_t bit = 1 << switchIndex;
+  const unsigned long pressMs = switches.getPressStartTime(switchIndex);
+  const bool secondTap = tapped & bit;
+
+  gesture.action = 0;
+  gesture.trigger = TRIGGER_TAP;
+  gesture.switchIndex = switchIndex;
+
+  for (uint8_t i = 0; i < count; i++) {
+    const GestureRule entry = rule(i);
+    if (!(entry.contexts & context) || !(entry.switches & bit)) continue;
+
+    if (entry.trigger == TRIGGER_DOUBLE_TAP && secondTap && pressMs - lastTapMs[switchIndex] < entry.ms) {
+      gesture.action = entry.action;
+      gesture.trigger = TRIGGER_DOUBLE_TAP;
+      break;
+    }
+    if (entry.trigger == TRIGGER_TAP) {
+      gesture.action = entry.action;
+      break;
+    }
+  }
+
+  // A double tap is a pair; the next press starts over
+  if (gesture.trigger == TRIGGER_DOUBLE_TAP) {
+    tapped &= ~bit;
+  } else {
+    tapped |= bit;
+    lastTapMs[switchIndex] = pressMs;
+  }
+  return true;
+}
+
+bool GestureRecognizer::canStartChord(uint8_t pressed, uint8_t context) const {
+  for (uint8_t i = 0; i < count; i++) {
+    const GestureRule entry = rule(i);
+    if (entry.trigger == TRIGGER_CHORD && (entry.contexts & context) && (entry.switches & pressed) == pressed &&
+        entry.switches != pressed) {
+      return true;
+    }
+  }
+  return false;
+}
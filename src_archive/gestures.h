@@ -0,0 +1,114 @@
+#ifndef GESTURES_H
+#define GESTURES_H
+
+#include <Arduino.h>
+#include "config.h"
+#include "switches.h"
+
+// Footswitch bits, as a gesture names its switches
+const uint8_t SW1 = 1 << 0;
+const uint8_t SW2 = 1 << 1;
+const uint8_t SW3 = 1 << 2;
+const uint8_t SW4 = 1 << 3;
+
+/**
+ * How a gesture's switches have to be worked
+ */
+enum GestureTrigger {
+  TRIGGER_TAP,          // One of the switches pressed on its own
+  TRIGGER_DOUBLE_TAP,   // The one switch tapped again within ms of the last tap
+  TRIGGER_CHORD,        // All of the switches pressed within SIMULTANEOUS_WINDOW_MS
+  TRIGGER_HOLD,         // All of the switches held down for ms, counted from the last; once per hold
+  TRIGGER_RELEASE       // The last switch up, exactly these having been pressed since all were up
+};
+
+/**
+ * Where a gesture applies, bit per state; a gesture lists every one it is live in
+ */
+enum GestureContext {
+  IN_MANUAL = 1 << 0,   // Manual mode
+  IN_BANK = 1 << 1,     // Bank mode, no preset active
+  IN_PRESET = 1 << 2,   // Bank mode with a preset active
+  IN_EDIT = 1 << 3,     // Edit mode
+  IN_ANY = IN_MANUAL | IN_BANK | IN_PRESET | IN_EDIT
+};
+
+/**
+ * One gesture: when its switches are worked as the trigger says, in one of
+ * its contexts, the mode controller runs the action. Actions are the mode
+ * controller's, so the recognizer only carries the number.
+ */
+struct GestureRule {
+  uint8_t switches;   // SW1-SW4 bits
+  uint8_t trigger;    // GestureTrigger
+  uint8_t contexts;   // GestureContext bits
+  uint8_t action;
+  uint16_t ms;        // Hold time, or the longest gap between double taps
+};
+
+/**
+ * What a pass of the recognizer found
+ */
+struct GestureMatch {
+  uint8_t action;
+  uint8_t trigger;
+  uint8_t switchIndex;   // The switch tapped, for taps and double taps
+};
+
+/**
+ * GestureRecognizer - Matches the footswitches against a table of gestures
+ *
+ * Each pass takes the switches' recent presses, held switches and
+ * releases as bitmasks once, then walks the table in order: a chord, hold
+ * or release is a mask compare, so the cost of a pass depends on the
+ * length of the table, not on what the player is doing. The first match
+ * wins, so a table lists the gestures that must take priority first. A
+ * press that no chord, hold or release took is a tap, matched against the
+ * tap and double-tap entries for its switch; a double tap is the second
+ * press of the pair, the first having gone out as a tap.
+ *
+ * The table lives in flash (PROGMEM) and adding a gesture is adding an
+ * entry. A press no entry takes comes back with action 0, for the caller
+ * to discard.
+ */
+class GestureRecognizer {
+public:
+  /**
+   * @param rules Table in PROGMEM
+   * @param count Entries in it
+   */
+  GestureRecognizer(const GestureRule* rules, uint8_t count);
+
+  // Forget taps and releases in progress (power-up)
+  void reset();
+
+  /**
+   * Classify this pass. Call once per pass, after readAndDebounce().
+   * @param context GestureContext bit the switcher was in before the pending
+   *                presses were acted on, so that a pending press cannot
+   *                change which chord its partner completes
+   * @param pending Switches whose recent press is already being acted on,
+   *                left out of taps so a partner can still complete a chord
+   * @return true if a gesture was recognized
+   */
+  bool recognize(SwitchHandler& switches, uint8_t context, uint8_t pending, GestureMatch& gesture);
+
+  /**
+   * @param pressed Switches pressed so far, bit per switch
+   * @return true if more presses could still make them a chord in this
+   *         context
+   */
+  bool canStartChord(uint8_t pressed, uint8_t context) const;
+
+private:
+  const GestureRule* rules;
+  uint8_t count;
+  uint8_t span;        // Switches pressed since all were last up
+  uint8_t tapped;      // Switches whose last tap can start a double tap
+  unsigned long lastTapMs[NUM_SWITCHES];
+
+  GestureRule rule(uint8_t index) const;
+  bool recognizeTap(SwitchHandler& switches, uint8_t context, uint8_t switchIndex, GestureMatch& gesture);
+};
+
+#endif
@@ -0,0 +1,83 @@
+#ifndef GLYPHS_H
+#define GLYPHS_H
+
+#include <Arduino.h>
+#include "max7219.h"
+
+/**
+ * Compile-time 7-segment glyphs and frame images
+ *
+ * glyph() maps a character to its segment byte (DP A B C D E F G, as the
+ * MAX7219 takes them in no-decode mode). DISPLAY_FRAME() turns an 8-digit
+ * string into a frame, index 0 = rightmost digit, so screens can be written
+ * the way they read:
+ *
+ *   constexpr uint8_t BANK[DISPLAY_DIGITS] PROGMEM = DISPLAY_FRAME("bAn     ");
+ *
+ * A '.' lights the decimal point of the digit before it and takes no digit
+ * of its own. Everything is evaluated by the compiler: a character missing
+ * from the table, or a string that is not 8 digits long, fails the build
+ * when used to initialize a constexpr frame.
+ */
+
+// Deliberately not constexpr and never defined: reaching one of these while
+// building a constexpr frame is a compile error naming the problem
+uint8_t glyphNotInTable(char c);
+uint8_t frameTextNotEightDigits();
+
+constexpr uint8_t glyph(char c) {
+  return (c == '0') ? 0b01111110 :
+         (c == '1') ? 0b00110000 :
+         (c == '2') ? 0b01101101 :
+         (c == '3') ? 0b01111001 :
+         (c == '4') ? 0b00110011 :
+         (c == '5') ? 0b01011011 :
+         (c == '6') ? 0b01011111 :
+         (c == '7') ? 0b01110000 :
+         (c == '8') ? 0b01111111 :
+         (c == '9') ? 0b01111011 :
+         (c == 'A') ? 0b01110111 :
+         (c == 'b') ? 0b00011111 :
+         (c == 'c') ? 0b00001101 :
+         (c == 'd') ? 0b00111101 :
+         (c == 'E') ? 0b01001111 :
+         (c == 'H') ? 0b00110111 :
+         (c == 'n') ? 0b00010101 :
+         (c == 't') ? 0b00001111 :
+         (c == '-') ? 0b00000001 :
+         (c == '_') ? 0b00001000 :
+         (c == ' ') ? 0b00000000 :
+         glyphNotInTable(c);
+}
+
+// Number of digits a frame string takes ('.' rides on the digit before it)
+constexpr uint8_t frameTextDigits(const char* text) {
+  return (*text == '\0') ? 0 : (uint8_t)((*text == '.' ? 0 : 1) + frameTextDigits(text + 1));
+}
+
+// Pointer to the n-th digit character of a frame string, counted from the left
+constexpr const char* frameTextAt(const char* text, uint8_t n) {
+  return (*text == '.') ? frameTextAt(text + 1, n) : (n == 0) ? text : frameTextAt(text + 1, n - 1);
+}
+
+constexpr uint8_t frameTextSegments(const char* digit) {
+  return (uint8_t)(glyph(digit[0]) | ((digit[1] == '.') ? SEGMENT_DP : 0));
+}
+
+/**
+ * Segment byte of one digit of a frame string.
+ * @param position Digit position, 0 = rightmost
+ */
+constexpr uint8_t frameTextDigit(const char* text, uint8_t position) {
+  return (frameTextDigits(text) != MAX7219_DIGITS)
+    ? frameTextNotEightDigits()
+    : frameTextSegments(frameTextAt(text, MAX7219_DIGITS - 1 - position));
+}
+
+#define DISPLAY_FRAME(text) {                                   \
+    frameTextDigit(text, 0), frameTextDigit(text, 1),           \
+    frameTextDigit(text, 2), frameTextDigit(text, 3),           \
+    frameTextDigit(text, 4), frameTextDigit(text, 5),           \
+    frameTextDigit(text, 6), frameTextDigit(text, 7) }
+
+#endif
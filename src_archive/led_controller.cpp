@@ -1,59 +1,61 @@
 #include "led_controller.h"
+#include "pin_map.h"
+#include "profiler.h"
 
-LedController::LedController(uint8_t dataPin, uint8_t clockPin, uint8_t latchPin, bool activeLow)
-  : _dataPin(dataPin), _clockPin(clockPin), _latchPin(latchPin), _activeLow(activeLow) {
+LedController::LedController() : _latched(0) {
 }
 
 void LedController::begin() {
-  pinMode(_dataPin, OUTPUT);
-  pinMode(_clockPin, OUTPUT);
-  pinMode(_latchPin, OUTPUT);
+  pinMode(SR_DATA_PIN, OUTPUT);
+  pinMode(SR_CLOCK_PIN, OUTPUT);
+  pinMode(SR_LATCH_PIN, OUTPUT);
 
-  digitalWrite(_dataPin, LOW);
-  digitalWrite(_clockPin, LOW);
-  digitalWrite(_latchPin, LOW);
+  digitalWrite(SR_DATA_PIN, LOW);
+  digitalWrite(SR_CLOCK_PIN, LOW);
+  digitalWrite(SR_LATCH_PIN, LOW);
 
   // Initialize all LEDs to off
-  shiftOut(0x00);
+  _latched = LED_ACTIVE_LOW ? ~(uint32_t)0 : 0;
+  shiftOut(_latched);
 }
 
-void LedController::update(const bool* appliedLoopStates, Mode currentMode, int8_t activePreset, bool globalPresetActive) {
-  uint8_t outputByte = 0;
+void LedController::update(LoopMask appliedLoops, Mode currentMode, int8_t activePreset, bool globalPresetActive) {
+  PROFILE_SCOPE(PROFILE_LED_UPDATE);
+  // Low bits: Relay LEDs (show currently applied loop states)
+  uint32_t outputs = appliedLoops;
 
-  // Bits 0-3: Relay LEDs (show currently applied loop states)
-  for (uint8_t i = 0; i < 4; i++) {
-    if (appliedLoopStates[i]) {
-      outputByte |= (1 << i);
-    }
-  }
-
-  // Bits 4-7: Preset LEDs
+  // Next 4 bits: Preset LEDs
   // - In MANUAL_MODE: all preset LEDs OFF
   // - When global preset is active: all preset LEDs OFF
   // - In other modes: light the LED for activePreset (if valid 0-3)
   if (currentMode != MANUAL_MODE && !globalPresetActive && activePreset >= 0 && activePreset <= 3) {
-    outputByte |= (1 << (4 + activePreset));
+    outputs |= (uint32_t)1 << (NUM_LOOPS + activePreset);
   }
 
   // Apply polarity inversion if LEDs are wired active-low
-  if (_activeLow) {
-    outputByte = ~outputByte;
+  if (LED_ACTIVE_LOW) {
+    outputs = ~outputs;
   }
 
-  shiftOut(outputByte);
+  // The chain still shows it
+  if (outputs == _latched) return;
+  _latched = outputs;
+  shiftOut(outputs);
 }
 
-void LedController::shiftOut(uint8_t data) {
-  // Set latch low to begin data transfer
-  digitalWrite(_latchPin, LOW);
-
-  // Shift out 8 bits, MSB first
-  for (int8_t i = 7; i >= 0; i--) {
-    digitalWrite(_clockPin, LOW);
-    digitalWrite(_dataPin, (data >> i) & 0x01);
-    digitalWrite(_clockPin, HIGH);
+void LedController::shiftOut(uint32_t data) {
+  // Shift out 8 bits per chip, MSB of the last chip first
+  for (int8_t chip = LED_SHIFT_REGISTERS - 1; chip >= 0; chip--) {
+    const uint8_t bits = (uint8_t)(data >> (8 * chip));
+    for (uint8_t mask = 0x80; mask; mask >>= 1) {
+      fastPinLow<SR_CLOCK_PIN>();
+      if (bits & mask) fastPinHigh<SR_DATA_PIN>();
+      else fastPinLow<SR_DATA_PIN>();
+      fastPinHigh<SR_CLOCK_PIN>();
+    }
   }
 
-  // Set latch high to update outputs
-  digitalWrite(_latchPin, HIGH);
+  // A rising latch edge moves the whole chain to the outputs at once
+  fastPinHigh<SR_LATCH_PIN>();
+  fastPinLow<SR_LATCH_PIN>();
 }
@@ -3,45 +3,53 @@
 
 #include <Arduino.h>
 #include "config.h"
+#include "loop_mask.h"
+
+// One relay LED per loop, then one preset LED per footswitch
+const uint8_t LED_COUNT = NUM_LOOPS + PRESETS_PER_BANK;
+const uint8_t LED_SHIFT_REGISTERS = (LED_COUNT + 7) / 8;
+static_assert(LED_SHIFT_REGISTERS <= 4, "The LED image is kept in 32 bits");
 
 /**
- * LedController - Drives 8 status LEDs via 74HC595 shift register
+ * LedController - Drives the status LEDs via a chain of 74HC595 shift registers
  *
- * LED Assignment (Q0-Q7):
- * - Q0: Relay LED for Loop 1 (switch 0)
- * - Q1: Relay LED for Loop 2 (switch 1)
- * - Q2: Relay LED for Loop 3 (switch 2)
- * - Q3: Relay LED for Loop 4 (switch 3)
- * - Q4: Preset LED for Switch 1 / Preset 0
- * - Q5: Preset LED for Switch 2 / Preset 1
- * - Q6: Preset LED for Switch 3 / Preset 2
- * - Q7: Preset LED for Switch 4 / Preset 3
+ * LED Assignment, counting outputs from Q0 of the chip nearest the MCU
+ * (a 4-loop unit has one chip, Q0-Q7):
+ * - Outputs 0 to NUM_LOOPS - 1: Relay LEDs for Loops 1 to NUM_LOOPS
+ * - The next 4 outputs: Preset LEDs for Switches 1-4 / Presets 0-3
  *
  * Relay LEDs: Show currently applied loop states (what's driving the relays right now)
  * Preset LEDs: Show which preset is loaded (OFF in manual mode, ON for active preset otherwise)
+ *
+ * The chain is clocked on SR_DATA_PIN/SR_CLOCK_PIN and latched on
+ * SR_LATCH_PIN with direct port writes, as the relay chain that shares the
+ * data and clock lines is. Those are not the SPI pins: MOSI and SCK go to
+ * the display, and the USART carries MIDI. On the stock wiring the display
+ * is clocked with port writes too, since its CS on MISO keeps the SPI
+ * peripheral out of use (MAX7219_HARDWARE_SPI). The image last latched is
+ * kept, and update() only shifts and latches a new one, so a pass with
+ * nothing new costs a compare. Another chip on the end of the chain adds
+ * 8 LEDs; LED_COUNT sets the length shifted.
  */
 class LedController {
 public:
-  LedController(uint8_t dataPin, uint8_t clockPin, uint8_t latchPin, bool activeLow);
+  LedController();
 
   void begin();
 
   /**
    * Update LED states based on current system state
-   * @param appliedLoopStates The loop states currently applied to relays (4 bool array)
+   * @param appliedLoops The loops currently applied to relays (bit 0 = loop 1)
    * @param currentMode Current operating mode
    * @param activePreset Currently selected preset index (0-3, or -1 if none)
    * @param globalPresetActive True if global preset is active
    */
-  void update(const bool* appliedLoopStates, Mode currentMode, int8_t activePreset, bool globalPresetActive);
+  void update(LoopMask appliedLoops, Mode currentMode, int8_t activePreset, bool globalPresetActive);
 
 private:
-  uint8_t _dataPin;
-  uint8_t _clockPin;
-  uint8_t _latchPin;
-  bool _activeLow;
+  uint32_t _latched;   // Outputs as last latched, polarity applied
 
-  void shiftOut(uint8_t data);
+  void shiftOut(uint32_t data);
 };
 
 #endif
@@ -0,0 +1,37 @@
+#ifndef LOOP_MASK_H
+#define LOOP_MASK_H
+
+#include <Arduino.h>
+#include "config.h"
+
+/**
+ * Smallest unsigned type with a bit per loop: uint8_t up to 8 loops,
+ * uint16_t up to 16
+ */
+template <uint8_t LOOPS, bool WIDE = (LOOPS > 8)>
+struct LoopMaskOf {
+  typedef uint8_t Type;
+};
+
+template <uint8_t LOOPS>
+struct LoopMaskOf<LOOPS, true> {
+  static_assert(LOOPS <= 16, "A loop mask holds at most 16 loops");
+  typedef uint16_t Type;
+};
+
+static_assert(NUM_LOOPS >= NUM_SWITCHES && NUM_LOOPS <= 16, "LOOP_COUNT must be 4-16");
+
+/**
+ * Loop states of the unit, bit 0 = loop 1. State is carried as one mask
+ * from the switches through presets to relays, LEDs and display, so a copy
+ * or a comparison is a single register operation.
+ */
+typedef LoopMaskOf<NUM_LOOPS>::Type LoopMask;
+
+const LoopMask ALL_LOOPS = (LoopMask)((1UL << NUM_LOOPS) - 1);
+
+constexpr LoopMask loopBit(uint8_t loop) {
+  return (LoopMask)(1U << loop);
+}
+
+#endif
@@ -0,0 +1,23 @@
+/**
+ * MIDI Loop Switcher
+ * ATmega328 (Arduino Uno/Nano)
+ *
+ * The sketch: the switcher application (firmware.h) powered up by setup()
+ * and run from the Arduino main loop. The host tools drive the same
+ * Firmware class on a virtual clock instead, so this file is left out of
+ * the native build.
+ */
+
+#include <Arduino.h>
+#include "firmware.h"
+
+// The one instance for the life of the sketch; setup() brings up the hardware
+static Firmware firmware;
+
+void setup() {
+  firmware.setup();
+}
+
+void loop() {
+  firmware.loop();
+}
@@ -0,0 +1,99 @@
+#include "max7219.h"
+#include "pin_map.h"
+
+// MAX7219 register addresses (digit 0-7 = 1-8)
+#define MAX7219_REG_DIGIT0      0x01
+#define MAX7219_REG_DECODEMODE  0x09
+#define MAX7219_REG_INTENSITY   0x0A
+#define MAX7219_REG_SCANLIMIT   0x0B
+#define MAX7219_REG_SHUTDOWN    0x0C
+#define MAX7219_REG_DISPLAYTEST 0x0F
+
+Max7219::Max7219()
+  : dirtyDigits(0) {
+  for (uint8_t i = 0; i < MAX7219_DIGITS; i++) {
+    framebuffer[i] = 0;
+  }
+}
+
+void Max7219::begin(uint8_t intensity) {
+  fastPinHigh<MAX_CS_PIN>();
+  pinMode(MAX_CS_PIN, OUTPUT);
+  pinMode(MAX_DIN_PIN, OUTPUT);
+  pinMode(MAX_CLK_PIN, OUTPUT);
+
+  if (MAX7219_HARDWARE_SPI) {
+    // SS must be an output in master mode, or a LOW on it drops the SPI to slave
+    pinMode(SS, OUTPUT);
+    // Master, mode 0, MSB first, fosc/2 = 8 MHz (MAX7219 takes up to 10 MHz)
+    SPCR = _BV(SPE) | _BV(MSTR);
+    SPSR = _BV(SPI2X);
+  }
+
+  writeRegister(MAX7219_REG_DISPLAYTEST, 0);
+  writeRegister(MAX7219_REG_SCANLIMIT, MAX7219_DIGITS - 1);
+  writeRegister(MAX7219_REG_DECODEMODE, 0);
+  writeRegister(MAX7219_REG_INTENSITY, intensity);
+
+  // Digit registers power up undefined: send the whole (blank) framebuffer
+  dirtyDigits = 0xFF;
+  flush();
+  writeRegister(MAX7219_REG_SHUTDOWN, 1);
+}
+
+void Max7219::setIntensity(uint8_t intensity) {
+  writeRegister(MAX7219_REG_INTENSITY, intensity & 0x0F);
+}
+
+void Max7219::setDigit(uint8_t position, uint8_t segments) {
+  if (framebuffer[position] == segments) return;
+  framebuffer[position] = segments;
+  dirtyDigits |= (1 << position);
+}
+
+void Max7219::setFrame(const uint8_t segments[MAX7219_DIGITS]) {
+  for (uint8_t i = 0; i < MAX7219_DIGITS; i++) {
+    setDigit(i, segments[i]);
+  }
+}
+
+void Max7219::clear() {
+  for (uint8_t i = 0; i < MAX7219_DIGITS; i++) {
+    setDigit(i, 0);
+  }
+}
+
+uint8_t Max7219::flush() {
+  uint8_t written = 0;
+  for (uint8_t i = 0; dirtyDigits; i++) {
+    if (!(dirtyDigits & (1 << i))) continue;
+    writeRegister(MAX7219_REG_DIGIT0 + i, framebuffer[i]);
+    dirtyDigits &= ~(1 << i);
+    written++;
+  }
+  return written;
+}
+
+void Max7219::writeRegister(uint8_t address, uint8_t data) {
+  fastPinLow<MAX_CS_PIN>();
+  transfer(address);
+  transfer(data);
+  // Rising CS latches the 16 bits
+  fastPinHigh<MAX_CS_PIN>();
+}
+
+void Max7219::transfer(uint8_t data) {
+  if (MAX7219_HARDWARE_SPI) {
+    SPDR = data;
+    while (!(SPSR & _BV(SPIF))) {
+    }
+    return;
+  }
+
+  for (uint8_t bit = 0x80; bit; bit >>= 1) {
+    if (data & bit) fastPinHigh<MAX_DIN_PIN>();
+    else fastPinLow<MAX_DIN_PIN>();
+    fastPinHigh<MAX_CLK_PIN>();
+    fastPinLow<MAX_CLK_PIN>();
+  }
+}
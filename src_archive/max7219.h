@@ -0,0 +1,67 @@
+#ifndef MAX7219_H
+#define MAX7219_H
+
+#include <Arduino.h>
+#include "config.h"
+
+// Number of digits in the display
+#define MAX7219_DIGITS 8
+
+// Segment byte layout in no-decode mode: DP A B C D E F G
+#define SEGMENT_DP 0x80
+
+// DIN/CLK on MOSI/SCK can use the SPI peripheral, but only if CS is not on
+// MISO: the SPI master forces MISO to an input
+const bool MAX7219_HARDWARE_SPI =
+  MAX_DIN_PIN == MOSI && MAX_CLK_PIN == SCK && MAX_CS_PIN != MISO && MAX_CS_PIN != MOSI && MAX_CS_PIN != SCK;
+
+/**
+ * Max7219 - Single MAX7219 driving an 8-digit 7-segment display
+ *
+ * Keeps an 8-byte segment framebuffer (index 0 = rightmost digit). Drawing
+ * only touches RAM; flush() sends the digits that changed since the last
+ * flush in one burst.
+ *
+ * Pins come from MAX_DIN_PIN, MAX_CLK_PIN and MAX_CS_PIN in config.h. When
+ * the pins allow (see MAX7219_HARDWARE_SPI) the SPI peripheral clocks data
+ * out at 8 MHz, otherwise the bits are clocked with direct port writes.
+ */
+class Max7219 {
+public:
+  Max7219();
+
+  /**
+   * Configure the chip (no decode, 8 digits), blank it and wake it up.
+   * @param intensity Brightness 0-15
+   */
+  void begin(uint8_t intensity);
+  void setIntensity(uint8_t intensity);
+
+  /**
+   * @param position Digit 0-7, 0 = rightmost
+   * @param segments Segment byte, bit 7 = decimal point
+   */
+  void setDigit(uint8_t position, uint8_t segments);
+  uint8_t getDigit(uint8_t position) const { return framebuffer[position]; }
+
+  /**
+   * Replace the whole framebuffer, index 0 = rightmost digit.
+   */
+  void setFrame(const uint8_t segments[MAX7219_DIGITS]);
+  void clear();
+
+  /**
+   * Send every digit changed since the last flush.
+   * @return Number of digit registers written
+   */
+  uint8_t flush();
+
+private:
+  uint8_t framebuffer[MAX7219_DIGITS];
+  uint8_t dirtyDigits;    // Bit per digit not yet sent
+
+  void writeRegister(uint8_t address, uint8_t data);
+  void transfer(uint8_t data);
+};
+
+#endif
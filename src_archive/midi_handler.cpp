@@ -1,14 +1,346 @@
 #include "midi_handler.h"
-#include "config.h"
+#include "ring_buffer.h"
+#include "profiler.h"
+#include "event_log.h"
 
 const uint32_t MIDI_BAUD = 31250;
 
-void initMIDI() {
+static MidiTxOverflowPolicy overflowPolicy = MIDI_TX_OVERFLOW_POLICY;
+static MidiTxStats txStats;
+static MidiParser rxParser;
+static MidiRxStats rxStats;
+// Body of the SysEx being received; only read back when it ends
+static uint8_t rxSysEx[MIDI_RX_SYSEX_SIZE];
+// Data bytes of the SysEx event taken last, and those of them not read yet
+static uint8_t rxDataLength = 0;
+static uint8_t rxDataUnread = 0;
+
+/**
+ * Only Program Change, Control Change and SysEx addressed to the switcher
+ * drive it. A SysEx event is rewritten to carry its command in data1, its
+ * first data byte in data2 and the count of its data bytes in length.
+ */
+static bool takeSwitcherEvent(MidiEvent& event) {
+  const uint8_t type = event.status & 0xF0;
+  if (type == 0xB0 || type == 0xC0) return true;
+  if (event.status != MIDI_SYSEX_START || event.length < 3 || rxParser.sysExOverflowed()) return false;
+  if (rxSysEx[0] != MIDI_SYSEX_ID || rxSysEx[1] != MIDI_SYSEX_DEVICE) return false;
+  event.data1 = rxSysEx[2];
+  event.data2 = (event.length > 3) ? rxSysEx[3] : 0;
+  event.length -= 3;
+  return true;
+}
+
+#ifndef DEBUG_MODE
+static RingBuffer<uint8_t, MIDI_TX_QUEUE_SIZE> txQueue;
+// Written by the main loop and the receive interrupt; the main loop masks interrupts to push
+static RingBuffer<uint8_t, MIDI_TX_REALTIME_QUEUE_SIZE> txRealtime;
+static RingBuffer<MidiEvent, MIDI_RX_EVENT_QUEUE_SIZE> rxEvents;
+// Data bytes of the SysEx events in rxEvents, in the same order
+static RingBuffer<uint8_t, MIDI_RX_SYSEX_QUEUE_SIZE> rxSysExData;
+static RingBuffer<uint8_t, MIDI_THRU_QUEUE_SIZE> thruQueue;
+
+// Message the interrupt is sending; only the ISR touches these
+static uint8_t txMessage[3];
+static uint8_t txMessageLength = 0;
+static uint8_t txMessageSent = 0;
+// A SysEx of the switcher's own is on the wire; the rest of it is at the front of the queue
+static bool txInSysEx = false;
+
+// Status in force on the wire for running status, 0 = none
+static uint8_t txRunningStatus = 0;
+// Nothing has been sent since the interrupt last found nothing to send
+static bool txLineIdle = true;
+
+// The thru stream as the transmit interrupt sends it
+static bool thruEnabled = false;
+static uint8_t thruStatus = 0;      // Running status of the thru stream, 0 = none
+static uint8_t thruRemaining = 0;   // Data bytes still to send of the current thru message
+static bool thruInSysEx = false;
+static bool thruWentLast = false;   // Whose turn it is at the next message boundary
+// Set by the receive interrupt, cleared by updateMIDI()
+static volatile bool thruActivity = false;
+static uint8_t thruStalledPasses = 0;
+
+static bool thruInMessage() {
+  return thruRemaining > 0 || thruInSysEx;
+}
+
+// Data bytes with no status to belong to would only confuse the receiver
+static void skipStrayThruBytes() {
+  uint8_t data;
+  while (!thruQueue.isEmpty() && !thruInMessage() && thruStatus == 0 && !(thruQueue.peek() & 0x80)) {
+    thruQueue.pop(data);
+  }
+}
+
+// Send the next byte of the thru stream; the queue must not be empty
+static void sendThruByte() {
+  uint8_t data = thruQueue.peek();
+
+  if (data & 0x80) {
+    thruQueue.pop(data);
+    // Any status ends a SysEx, F7 or not
+    thruInSysEx = (data == MIDI_SYSEX_START);
+    if (thruInSysEx || data == MIDI_SYSEX_END) {
+      thruRemaining = 0;
+      thruStatus = 0;
+    } else {
+      thruRemaining = midiMessageLength(data) - 1;
+      // Only channel messages leave a running status behind
+      thruStatus = (data < 0xF0) ? data : 0;
+    }
+    txRunningStatus = thruStatus;
+    UDR0 = data;
+    return;
+  }
+
+  if (!thruInMessage()) {
+    // A message in running status. If the switcher's own traffic changed the
+    // status on the wire since, send the status byte again first.
+    thruRemaining = midiMessageLength(thruStatus) - 1;
+    if (txRunningStatus != thruStatus) {
+      txRunningStatus = thruStatus;
+      UDR0 = thruStatus;
+      return;
+    }
+  }
+
+  thruQueue.pop(data);
+  if (!thruInSysEx) thruRemaining--;
+  UDR0 = data;
+}
+
+// Start the next of the switcher's own messages; the queue must not be empty
+static void sendOwnMessage() {
+  if (txQueue.peek() == MIDI_SYSEX_START) {
+    // Queued whole like any message; the interrupt sends it on up to its F7
+    uint8_t data = 0;
+    txQueue.pop(data);
+    txInSysEx = true;
+    txRunningStatus = 0;
+    UDR0 = data;
+    return;
+  }
+
+  // Messages are queued whole, so all of this one's bytes are there
+  txMessageLength = midiMessageLength(txQueue.peek());
+  for (uint8_t i = 0; i < txMessageLength; i++) {
+    txQueue.pop(txMessage[i]);
+  }
+  // Running status only while the line stays busy
+  const uint8_t first = (!txLineIdle && txMessage[0] == txRunningStatus) ? 1 : 0;
+  txLineIdle = false;
+  txRunningStatus = (txMessage[0] < 0xF0) ? txMessage[0] : 0;
+  txMessageSent = first + 1;
+  UDR0 = txMessage[first];
+}
+
+ISR(USART_UDRE_vect) {
+  uint8_t data = 0;
+  if (txRealtime.pop(data)) {
+    UDR0 = data;
+    return;
+  }
+
+  // Whichever message is on the wire finishes first
+  if (txInSysEx) {
+    txQueue.pop(data);
+    txInSysEx = (data != MIDI_SYSEX_END);
+    UDR0 = data;
+    return;
+  }
+  if (txMessageSent < txMessageLength) {
+    UDR0 = txMessage[txMessageSent++];
+    return;
+  }
+  if (thruInMessage()) {
+    if (thruQueue.isEmpty()) {
+      // The rest has not arrived yet; the receive interrupt wakes us again
+      UCSR0B &= ~_BV(UDRIE0);
+      return;
+    }
+    sendThruByte();
+    return;
+  }
+
+  // Message boundary: take turns, but let a thru backlog past half the
+  // queue catch up before the switcher adds to it again
+  skipStrayThruBytes();
+  const bool thruWaiting = !thruQueue.isEmpty();
+  const bool ownWaiting = !txQueue.isEmpty();
+  if (ownWaiting && (!thruWaiting || (thruWentLast && thruQueue.count() <= MIDI_THRU_QUEUE_SIZE / 2))) {
+    thruWentLast = false;
+    sendOwnMessage();
+  } else if (thruWaiting) {
+    thruWentLast = true;
+    sendThruByte();
+  } else {
+    txLineIdle = true;
+    UCSR0B &= ~_BV(UDRIE0);
+  }
+}
+
+// Queue a received byte for MIDI OUT; called from the receive interrupt
+static void forwardThruByte(uint8_t data) {
+  thruActivity = true;
+  const bool queued = (data >= 0xF8) ? txRealtime.push(data) : thruQueue.push(data);
+  if (!queued) rxStats.thruDropped++;
+  UCSR0B |= _BV(UDRIE0);
+}
+
+ISR(USART_RX_vect) {
+  // Flags first: reading UDR0 clears them
+  const uint8_t flags = UCSR0A;
+  const uint8_t data = UDR0;
+
+  if (flags & (_BV(FE0) | _BV(DOR0))) {
+    // A garbled or lost byte: the message in progress cannot be trusted
+    rxStats.lineErrors++;
+    rxParser.reset();
+    if (flags & _BV(FE0)) return;
+  }
+
+  if (thruEnabled) forwardThruByte(data);
+
+  MidiEvent event;
+  if (!rxParser.parse(data, event) || !takeSwitcherEvent(event)) return;
+  // A SysEx's data bytes are queued with it or it is dropped
+  const uint8_t dataBytes = (event.status == MIDI_SYSEX_START) ? event.length : 0;
+  if (rxEvents.space() == 0 || rxSysExData.space() < dataBytes) {
+    rxStats.eventsDropped++;
+    return;
+  }
+  rxSysExData.push(rxSysEx + 3, dataBytes);
+  rxEvents.push(event);
+}
+
+// Drop the channel message at the front of the queue
+static void dropOldestMessage() {
+  uint8_t data = 0;
+  txQueue.pop(data);
+  for (uint8_t n = midiMessageLength(data); n > 1; n--) {
+    txQueue.pop(data);
+  }
+}
+
+// Tell the interrupt there is something to send
+static void queuedMessage() {
+  const uint8_t pending = txQueue.count();
+  if (pending > txStats.queueHighWater) txStats.queueHighWater = pending;
+  UCSR0B |= _BV(UDRIE0);
+}
+#endif
+
+void initMIDI(MidiTxOverflowPolicy policy, bool thru) {
+  overflowPolicy = policy;
+  txStats.messagesDropped = 0;
+  txStats.realtimeDropped = 0;
+  txStats.queueHighWater = 0;
+  rxStats.eventsDropped = 0;
+  rxStats.lineErrors = 0;
+  rxStats.thruDropped = 0;
+  rxStats.thruAbandoned = 0;
+  rxParser.reset();
+  rxParser.setSysExBuffer(rxSysEx, sizeof(rxSysEx));
+  rxDataLength = 0;
+  rxDataUnread = 0;
+
+#ifdef DEBUG_MODE
+  (void)thru;
   Serial.begin(MIDI_BAUD);
+#else
+  UCSR0B = 0;
+  txQueue.clear();
+  txRealtime.clear();
+  txMessageLength = 0;
+  txMessageSent = 0;
+  txInSysEx = false;
+  txRunningStatus = 0;
+  txLineIdle = true;
+  rxEvents.clear();
+  rxSysExData.clear();
+  thruQueue.clear();
+  thruEnabled = thru;
+  thruStatus = 0;
+  thruRemaining = 0;
+  thruInSysEx = false;
+  thruWentLast = false;
+  thruActivity = false;
+  thruStalledPasses = 0;
+
+  // 8N1 at 31250 baud; the bootloader may have left double speed on
+  UBRR0 = F_CPU / 16 / MIDI_BAUD - 1;
+  UCSR0A &= ~_BV(U2X0);
+  UCSR0C = _BV(UCSZ01) | _BV(UCSZ00);
+  UCSR0B = _BV(TXEN0) | _BV(RXEN0) | _BV(RXCIE0);
+#endif
   DEBUG_PRINTLN("MIDI initialized at 31250 baud");
 }
 
-void sendMIDIProgramChange(uint8_t program, uint8_t channel) {
+bool sendMIDIMessage(uint8_t status, uint8_t data1, uint8_t data2) {
+  PROFILE_SCOPE(PROFILE_MIDI_SEND);
+  const uint8_t length = midiMessageLength(status);
+  if (length == 0) return false;
+  const uint8_t message[3] = {status, (uint8_t)(data1 & 0x7F), (uint8_t)(data2 & 0x7F)};
+  logEvent(LOG_MIDI_SEND, status, message[1] | (message[2] << 8));
+
+#ifdef DEBUG_MODE
+  Serial.write(message, length);
+  return true;
+#else
+  bool queued = txQueue.push(message, length);
+
+  if (!queued && overflowPolicy == MIDI_TX_DROP_OLDEST) {
+    // Act as the consumer for a moment: drop whole messages from the front.
+    // A short message on the wire already left the queue. A SysEx, sent or
+    // waiting, was promised to go whole, so dropping stops at one and this
+    // message is dropped instead.
+    noInterrupts();
+    while (txQueue.space() < length && !txQueue.isEmpty() && !txInSysEx &&
+           txQueue.peek() != MIDI_SYSEX_START) {
+      dropOldestMessage();
+      txStats.messagesDropped++;
+    }
+    interrupts();
+    queued = txQueue.push(message, length);
+  }
+
+  if (!queued) {
+    txStats.messagesDropped++;
+    return false;
+  }
+
+  queuedMessage();
+  return true;
+#endif
+}
+
+bool sendMIDISysEx(uint8_t command, const uint8_t* data, uint8_t length) {
+  PROFILE_SCOPE(PROFILE_MIDI_SEND);
+  uint8_t message[MIDI_TX_QUEUE_SIZE - 1];
+  if (length > sizeof(message) - 5) return false;
+  message[0] = MIDI_SYSEX_START;
+  message[1] = MIDI_SYSEX_ID;
+  message[2] = MIDI_SYSEX_DEVICE;
+  message[3] = command & 0x7F;
+  for (uint8_t i = 0; i < length; i++) {
+    message[4 + i] = data[i] & 0x7F;
+  }
+  message[4 + length] = MIDI_SYSEX_END;
+
+#ifdef DEBUG_MODE
+  Serial.write(message, length + 5);
+  return true;
+#else
+  // Never makes room by dropping others; the sender tries again later
+  if (!txQueue.push(message, length + 5)) return false;
+  queuedMessage();
+  return true;
+#endif
+}
+
+bool sendMIDIProgramChange(uint8_t program, uint8_t channel) {
   // Program Change: 0xC0 + channel (0-15), then program number (0-127)
   // channel: MIDI channel 0-15
   // program: Program number 1-128 (displayed), maps to MIDI 0-127
@@ -20,6 +352,112 @@ void sendMIDIProgramChange(uint8_t program, uint8_t channel) {
   DEBUG_PRINT(" on channel ");
   DEBUG_PRINTLN(channel + 1);
 
-  Serial.write(statusByte);
-  Serial.write(programByte);
+  return sendMIDIMessage(statusByte, programByte);
+}
+
+uint8_t sendMIDIMessages(const uint8_t* bytes, uint8_t length) {
+  uint8_t queued = 0;
+  uint8_t status = 0;
+  uint8_t i = 0;
+  while (i < length) {
+    if (bytes[i] & 0x80) status = bytes[i++];
+    if (status == 0 || status >= 0xF0) break;
+    const uint8_t dataBytes = midiMessageLength(status) - 1;
+    if (i + dataBytes > length || (bytes[i] & 0x80) || (dataBytes > 1 && (bytes[i + 1] & 0x80))) break;
+    if (sendMIDIMessage(status, bytes[i], (dataBytes > 1) ? bytes[i + 1] : 0)) queued++;
+    i += dataBytes;
+  }
+  return queued;
+}
+
+bool sendMIDIRealtime(uint8_t status) {
+  if (status < 0xF8) return false;
+
+#ifdef DEBUG_MODE
+  Serial.write(status);
+  return true;
+#else
+  // The receive interrupt pushes forwarded realtime bytes into the same lane
+  noInterrupts();
+  const bool queued = txRealtime.push(status);
+  interrupts();
+  if (!queued) {
+    txStats.realtimeDropped++;
+    return false;
+  }
+  UCSR0B |= _BV(UDRIE0);
+  return true;
+#endif
+}
+
+void updateMIDI() {
+#ifndef DEBUG_MODE
+  noInterrupts();
+  if (thruActivity || !thruInMessage()) {
+    thruActivity = false;
+    thruStalledPasses = 0;
+  } else if (++thruStalledPasses >= MIDI_THRU_STALL_PASSES) {
+    // The receiver downstream sees an unfinished message, then the next status byte
+    thruRemaining = 0;
+    thruInSysEx = false;
+    thruStatus = 0;
+    txRunningStatus = 0;
+    thruStalledPasses = 0;
+    rxStats.thruAbandoned++;
+    UCSR0B |= _BV(UDRIE0);
+  }
+  interrupts();
+#endif
+}
+
+uint8_t midiTxPending() {
+#ifdef DEBUG_MODE
+  return 0;
+#else
+  return txQueue.count();
+#endif
+}
+
+MidiTxStats getMIDITxStats() {
+  return txStats;
+}
+
+bool readMIDIEvent(MidiEvent& event) {
+#ifdef DEBUG_MODE
+  rxDataUnread = 0;
+  bool taken = false;
+  while (!taken && Serial.available() > 0) {
+    taken = rxParser.parse((uint8_t)Serial.read(), event) && takeSwitcherEvent(event);
+  }
+  if (!taken) return false;
+#else
+  uint8_t skipped;
+  while (rxDataUnread > 0 && rxSysExData.pop(skipped)) rxDataUnread--;
+  if (!rxEvents.pop(event)) return false;
+#endif
+  rxDataLength = (event.status == MIDI_SYSEX_START) ? event.length : 0;
+  rxDataUnread = rxDataLength;
+  return true;
+}
+
+uint8_t readMIDISysExData(uint8_t* data, uint8_t size) {
+  uint8_t n = 0;
+  while (n < size && rxDataUnread > 0) {
+#ifdef DEBUG_MODE
+    // Parsed just now: the capture buffer still holds it
+    data[n] = rxSysEx[3 + rxDataLength - rxDataUnread];
+#else
+    rxSysExData.pop(data[n]);
+#endif
+    n++;
+    rxDataUnread--;
+  }
+  return n;
+}
+
+MidiRxStats getMIDIRxStats() {
+  noInterrupts();
+  const MidiRxStats stats = rxStats;
+  interrupts();
+  return stats;
 }
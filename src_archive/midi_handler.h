@@ -2,8 +2,123 @@
 #define MIDI_HANDLER_H
 
 #include <Arduino.h>
+#include "config.h"
+#include "midi_parser.h"
 
-void initMIDI();
-void sendMIDIProgramChange(uint8_t program, uint8_t channel);
+/**
+ * MIDI input and output
+ *
+ * Sends never block. Messages go into a queue that the UART's
+ * data-register-empty interrupt drains at 31250 baud (320 us per byte).
+ * A message is queued whole or not at all, and the interrupt takes all of
+ * its bytes at once, so the wire never carries half a message and a
+ * message that has started is never dropped.
+ *
+ * Realtime bytes (0xF8-0xFF) have their own lane that goes out ahead of
+ * the queue, between the bytes of a message if need be, as MIDI allows.
+ *
+ * When the queue is full, MIDI_TX_OVERFLOW_POLICY picks the message that
+ * loses.
+ *
+ * A message that follows one with the same status back to back, the line
+ * busy in between, goes out in running status, without its status byte.
+ * Once the line has gone quiet the status byte is always sent, for a
+ * receiver that was plugged in since.
+ *
+ * Input is parsed byte by byte in the UART receive interrupt (MidiParser).
+ * Program Change and Control Change events wait in a small queue for the
+ * main loop; everything else is parsed and dropped.
+ *
+ * SysEx addressed to the switcher (F0 MIDI_SYSEX_ID MIDI_SYSEX_DEVICE
+ * <command> ... F7) also reaches the event queue, its data bytes queued
+ * beside it, so the next SysEx can arrive before the main loop gets to
+ * the last. The switcher's own SysEx is queued whole like any other
+ * message and goes out in one piece.
+ *
+ * With thru on, the receive interrupt also forwards every byte as it
+ * arrives: realtime bytes into the realtime lane, the rest into a thru
+ * queue. The transmit interrupt follows the thru stream's message
+ * boundaries and only switches between it and the switcher's own queue
+ * there, taking turns, so neither stream's messages get split. A thru
+ * message sent with running status gets its status byte back when one of
+ * the switcher's messages went out in between. SysEx is forwarded whole;
+ * the switcher's messages wait for its F7.
+ *
+ * Debug builds leave the UART to the core's Serial (debug text shares it):
+ * output is written through it, blocking as before, input is parsed when
+ * the main loop asks for events, and there is no thru.
+ */
+
+struct MidiTxStats {
+  uint16_t messagesDropped;   // Lost to the overflow policy
+  uint16_t realtimeDropped;   // Realtime lane was full
+  uint8_t queueHighWater;     // Most bytes ever waiting in the queue
+};
+
+struct MidiRxStats {
+  uint16_t eventsDropped;     // Event queue was full
+  uint16_t lineErrors;        // Framing errors and receiver overruns
+  uint16_t thruDropped;       // Bytes the thru queue or realtime lane had no room for
+  uint16_t thruAbandoned;     // Forwarded messages cut off because input stopped mid-message
+};
+
+/**
+ * @param thru Forward MIDI IN to MIDI OUT
+ */
+void initMIDI(MidiTxOverflowPolicy policy = MIDI_TX_OVERFLOW_POLICY, bool thru = MIDI_THRU_ENABLED);
+
+/**
+ * Main-loop housekeeping, once per pass: gives up on a forwarded message
+ * whose sender went quiet halfway through, which would otherwise hold the
+ * switcher's own output back for good.
+ */
+void updateMIDI();
+
+/**
+ * Queue a channel or system common message; its length comes from the
+ * status byte. SysEx is not supported here.
+ * @return false if the overflow policy dropped it
+ */
+bool sendMIDIMessage(uint8_t status, uint8_t data1 = 0, uint8_t data2 = 0);
+bool sendMIDIProgramChange(uint8_t program, uint8_t channel);
+
+/**
+ * Queue channel messages given as wire bytes, running status allowed, one
+ * after the other in the same call so they leave as one burst.
+ * @return Messages queued; anything after a byte that does not fit a
+ *         channel message is left out
+ */
+uint8_t sendMIDIMessages(const uint8_t* bytes, uint8_t length);
+
+/**
+ * Queue F0 MIDI_SYSEX_ID MIDI_SYSEX_DEVICE command data... F7. Data bytes
+ * are sent as 7-bit values. Queued messages are never dropped to make room,
+ * and once queued it goes out whole: a channel message that would need it
+ * dropped is dropped instead.
+ * @return false if it does not fit in the queue now (try again later)
+ */
+bool sendMIDISysEx(uint8_t command, const uint8_t* data, uint8_t length);
+bool sendMIDIRealtime(uint8_t status);
+
+// Bytes queued and not yet taken by the interrupt
+uint8_t midiTxPending();
+MidiTxStats getMIDITxStats();
+
+/**
+ * Take the oldest received Program Change or Control Change (any channel),
+ * or SysEx addressed to the switcher: status MIDI_SYSEX_START, data1 the
+ * command, data2 its first data byte (0 if none), length its data bytes
+ * after the command.
+ * @return false if none is waiting
+ */
+bool readMIDIEvent(MidiEvent& event);
+
+/**
+ * Data bytes after the command of the SysEx readMIDIEvent() took last.
+ * Those not read are dropped by the next readMIDIEvent().
+ * @return Bytes copied, at most size
+ */
+uint8_t readMIDISysExData(uint8_t* data, uint8_t size);
+MidiRxStats getMIDIRxStats();
 
 #endif
@@ -0,0 +1,104 @@
+#include "midi_parser.h"
+
+uint8_t midiMessageLength(uint8_t status) {
+  if (status < 0x80) return 0;
+  // Program Change and Channel Pressure carry one data byte, other channel messages two
+  if (status < 0xF0) return ((status & 0xE0) == 0xC0) ? 2 : 3;
+  switch (status) {
+    case 0xF0:  // SysEx start
+    case 0xF7:  // SysEx end
+      return 0;
+    case 0xF1:  // MTC quarter frame
+    case 0xF3:  // Song select
+      return 2;
+    case 0xF2:  // Song position
+      return 3;
+    default:    // Tune request, realtime
+      return 1;
+  }
+}
+
+MidiParser::MidiParser() : sysExBuffer(nullptr), sysExSize(0) {
+  reset();
+}
+
+void MidiParser::reset() {
+  status = 0;
+  received = 0;
+  expected = 0;
+  inSysEx = false;
+  sysExCount = 0;
+  sysExOverflow = false;
+}
+
+void MidiParser::setSysExBuffer(uint8_t* buffer, uint8_t size) {
+  sysExBuffer = buffer;
+  sysExSize = buffer ? size : 0;
+}
+
+bool MidiParser::parse(uint8_t data, MidiEvent& event) {
+  if (data >= 0xF8) {
+    // Realtime: never disturbs the message in progress
+    event.status = data;
+    event.data1 = 0;
+    event.data2 = 0;
+    event.length = 1;
+    return true;
+  }
+
+  if (data & 0x80) {
+    if (data == MIDI_SYSEX_END) {
+      status = 0;
+      if (!inSysEx) return false;
+      inSysEx = false;
+      event.status = MIDI_SYSEX_START;
+      event.data1 = 0;
+      event.data2 = 0;
+      event.length = sysExCount;
+      return true;
+    }
+
+    // Any other status ends a SysEx in progress without reporting it
+    inSysEx = (data == MIDI_SYSEX_START);
+    sysExCount = 0;
+    sysExOverflow = false;
+    received = 0;
+    if (inSysEx) {
+      status = 0;
+      return false;
+    }
+
+    status = data;
+    expected = midiMessageLength(data) - 1;
+    if (expected > 0) return false;
+
+    // Tune request and undefined system common bytes stand alone
+    status = 0;
+    event.status = data;
+    event.data1 = 0;
+    event.data2 = 0;
+    event.length = 1;
+    return true;
+  }
+
+  if (inSysEx) {
+    if (sysExCount < sysExSize) sysExBuffer[sysExCount] = data;
+    else sysExOverflow = true;
+    if (sysExCount < 0xFF) sysExCount++;
+    return false;
+  }
+
+  if (status == 0) return false;  // Stray data byte
+
+  bytes[received++] = data;
+  if (received < expected) return false;
+
+  event.status = status;
+  event.data1 = bytes[0];
+  event.data2 = (expected > 1) ? bytes[1] : 0;
+  event.length = expected + 1;
+  received = 0;
+  // Only channel messages leave a running status behind
+  if (status >= 0xF0) status = 0;
+  return true;
+}
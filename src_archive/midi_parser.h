@@ -0,0 +1,75 @@
+#ifndef MIDI_PARSER_H
+#define MIDI_PARSER_H
+
+#include <Arduino.h>
+
+// Status byte of the event reported when a SysEx message ends
+#define MIDI_SYSEX_START 0xF0
+#define MIDI_SYSEX_END 0xF7
+
+/**
+ * @return Bytes in a message starting with status, 0 for data bytes and SysEx
+ */
+uint8_t midiMessageLength(uint8_t status);
+
+struct MidiEvent {
+  uint8_t status;   // Full status byte, channel in the low nibble for channel messages
+  uint8_t data1;
+  uint8_t data2;
+  uint8_t length;   // Bytes in the message including status; SysEx: body bytes seen
+};
+
+/**
+ * MidiParser - Incremental MIDI byte stream parser
+ *
+ * Takes one byte at a time, keeps only the current message's status and
+ * data bytes, and never allocates, so it can run inside the UART receive
+ * interrupt.
+ *
+ * - Running status: data bytes after a complete channel message reuse its
+ *   status. System common messages and SysEx cancel running status.
+ * - Realtime bytes (0xF8-0xFF) are reported the moment they arrive, even in
+ *   the middle of another message or a SysEx, which carries on unharmed.
+ * - SysEx bodies are skipped unless a capture buffer is set. A SysEx event
+ *   is reported on F7; one cut short by another status byte is dropped.
+ *   Bytes past the end of the capture buffer are counted (up to 255) but
+ *   not stored.
+ * - Stray data bytes with no status to attach to are ignored.
+ */
+class MidiParser {
+public:
+  MidiParser();
+
+  void reset();
+
+  /**
+   * Capture SysEx bodies (without F0/F7) into buffer.
+   * @param buffer Caller-owned storage, nullptr to skip SysEx
+   */
+  void setSysExBuffer(uint8_t* buffer, uint8_t size);
+
+  /**
+   * Feed one received byte.
+   * @return true if the byte completed an event, stored in event
+   */
+  bool parse(uint8_t data, MidiEvent& event);
+
+  // True between messages: the next byte cannot be part of a message in progress
+  bool atMessageBoundary() const { return received == 0 && !inSysEx; }
+
+  // Last SysEx did not fit in the capture buffer
+  bool sysExOverflowed() const { return sysExOverflow; }
+
+private:
+  uint8_t status;        // Status of the message being received, 0 = none
+  uint8_t bytes[2];      // Data bytes of the current message
+  uint8_t received;      // Data bytes received for the current message
+  uint8_t expected;      // Data bytes the current status takes
+  bool inSysEx;
+  uint8_t* sysExBuffer;
+  uint8_t sysExSize;
+  uint8_t sysExCount;
+  bool sysExOverflow;
+};
+
+#endif
@@ -1,194 +1,289 @@
 #include "mode_controller.h"
 #include "config.h"
+#include "profiler.h"
+#include "event_log.h"
+
+static_assert(IN_MANUAL == 1 << ROW_MANUAL && IN_BANK == 1 << ROW_BANK && IN_PRESET == 1 << ROW_PRESET &&
+              IN_EDIT == 1 << ROW_EDIT, "Gesture contexts are the mode rows as bits");
+
+// Footswitch gestures and the ModeEvent each sends, first match wins: a hold
+// goes ahead of the chord that starts it. Chords are matched in the context
+// from before the presses applied speculatively, see gestureContext()
+constexpr GestureRule GESTURES[] PROGMEM = {
+  {SW2 | SW3, TRIGGER_HOLD, IN_PRESET | IN_EDIT, EV_EDIT_HOLD, EDIT_MODE_LONG_PRESS_MS},
+  {SW2 | SW3, TRIGGER_CHORD, IN_MANUAL | IN_BANK, EV_MODE_PAIR, 0},
+  // On a preset or in edit mode the pair only starts the hold
+  {SW2 | SW3, TRIGGER_CHORD, IN_PRESET | IN_EDIT, EV_NONE, 0},
+  {SW3 | SW4, TRIGGER_CHORD, IN_BANK | IN_PRESET, EV_BANK_UP, 0},
+  {SW1 | SW2, TRIGGER_CHORD, IN_BANK | IN_PRESET, EV_BANK_DOWN, 0},
+  {SW1 | SW2 | SW3 | SW4, TRIGGER_TAP, IN_ANY, EV_SWITCH, 0}
+};
 
 ModeController::ModeController(StateManager& state, SwitchHandler& switches, RelayController& relays)
-  : state(state), switches(switches), relays(relays) {
+  : state(state), switches(switches), relays(relays),
+    gestures(GESTURES, sizeof(GESTURES) / sizeof(GESTURES[0])),
+    transfer(state.presets, state.presetMessages) {
+  speculation.switches = 0;
 }
 
 void ModeController::detectSwitchPatterns() {
-  // In edit mode, check for exit
-  if (state.currentMode == EDIT_MODE) {
-    if (switches.isLongPress(1, 2, EDIT_MODE_LONG_PRESS_MS)) {
-      exitEditMode();
-      return;
+  PROFILE_SCOPE(PROFILE_SWITCH_PATTERNS);
+  const uint8_t context = gestureContext();
+
+  // Speculative presses stay "recent" so partners can still complete a chord
+  uint8_t pending = 0;
+  for (uint8_t i = 0; i < NUM_SWITCHES; i++) {
+    if ((speculation.switches & (1 << i)) && speculation.pressTime[i] == switches.getPressStartTime(i)) {
+      pending |= 1 << i;
     }
-    // Note: We no longer return early when buttons are held
-    // This allows simultaneous press detection to work properly
   }
 
-  // Check for 2-second long press of center switches (edit mode)
-  // Only allow in BANK_MODE when a preset is active
-  // This must be checked BEFORE the short press toggle
-  if (state.currentMode == BANK_MODE && state.activePreset != -1) {
-    if (switches.isLongPress(1, 2, EDIT_MODE_LONG_PRESS_MS)) {
-      enterEditMode();
+  GestureMatch gesture;
+  if (gestures.recognize(switches, context, pending, gesture)) {
+    if (gesture.trigger == TRIGGER_CHORD) {
+      // Whichever of the chord landed first were applied speculatively; undo them
+      rollbackSpeculation();
+      runGesture(gesture);
+      switches.clearRecentPresses();
       return;
     }
-    // Note: We no longer return early when buttons are held
-    // This allows simultaneous press detection to work properly
-  }
-
-  // Check for simultaneous presses (within window)
-  const bool sw1Pressed = switches.isRecentPress(0);
-  const bool sw2Pressed = switches.isRecentPress(1);
-  const bool sw3Pressed = switches.isRecentPress(2);
-  const bool sw4Pressed = switches.isRecentPress(3);
-
-  // Center switches: toggle Manual/Bank mode
-  // Skip this check if we're holding for long press (edit mode entry/exit)
-  const bool waitingForLongPress = switches.isPressed(1) && switches.isPressed(2) &&
-                                    ((state.currentMode == EDIT_MODE) ||
-                                     (state.currentMode == BANK_MODE && state.activePreset != -1));
-
-  if (sw2Pressed && sw3Pressed && !waitingForLongPress) {
-    if (state.currentMode == MANUAL_MODE) {
-      DEBUG_PRINTLN("Mode change: MANUAL -> BANK");
-      state.currentMode = BANK_MODE;
-      state.displayState = SHOWING_BANK;
-    } else if (state.currentMode == BANK_MODE && state.activePreset == -1) {
-      // Only toggle to MANUAL if no preset is active (prevents conflict with edit mode entry)
-      DEBUG_PRINTLN("Mode change: BANK -> MANUAL");
-      state.currentMode = MANUAL_MODE;
-      state.displayState = SHOWING_MANUAL;
-      // Clear global preset state when leaving bank mode
-      state.globalPresetActive = false;
+    if (gesture.trigger != TRIGGER_TAP && gesture.trigger != TRIGGER_DOUBLE_TAP) {
+      runGesture(gesture);
+      return;
     }
 
-    switches.clearRecentPresses();
+    // A switch pressed again, or one that does not form a chord with them:
+    // the earlier presses stand
+    const uint8_t bit = 1 << gesture.switchIndex;
+    if ((speculation.switches & bit) || !gestures.canStartChord(speculation.switches | bit, context)) {
+      commitSpeculation();
+    }
 
-    return;
+    // Once the earlier presses stand, their state is the one a new chord starts from
+    if (SPECULATIVE_SINGLE_PRESS && gesture.action == EV_SWITCH &&
+        gestures.canStartChord(speculation.switches | bit, gestureContext())) {
+      beginSpeculation(gesture.switchIndex);
+      runGesture(gesture);
+    } else {
+      commitSpeculation();
+      runGesture(gesture);
+      switches.clearRecentPresses();
+    }
   }
 
-  // Right switches: Bank up (only in bank mode)
-  if (state.currentMode == BANK_MODE && sw3Pressed && sw4Pressed) {
-    state.currentBank++;
-    if (state.currentBank > NUM_BANKS) state.currentBank = 1;
-    DEBUG_PRINT("Bank change: ");
-    DEBUG_PRINTLN(state.currentBank);
-    state.displayState = SHOWING_BANK;
+  // The chord can no longer complete within the window: the speculative presses are final
+  if (speculation.switches & ~switches.getRecentPresses()) {
+    commitSpeculation();
+  }
+}
 
-    // Clear global preset when changing banks
-    state.globalPresetActive = false;
-    state.activePreset = -1;
-    switches.clearRecentPresses();
+uint8_t ModeController::gestureContext() const {
+  // A press waiting for a partner has not happened yet as far as chords go:
+  // SW2 selecting a preset must not turn SW2+SW3 from the mode pair into the hold
+  return 1 << modeRow(speculation.switches ? speculation.mode : modeState());
+}
 
-    return;
+void ModeController::runGesture(const GestureMatch& gesture) {
+  switch (gesture.action) {
+    case EV_SWITCH:
+      logEvent(LOG_GESTURE, PRESS_SINGLE, gesture.switchIndex);
+      break;
+    case EV_MODE_PAIR:
+      logEvent(LOG_GESTURE, PRESS_MODE_PAIR);
+      break;
+    case EV_BANK_UP:
+      logEvent(LOG_GESTURE, PRESS_BANK_UP);
+      break;
+    case EV_BANK_DOWN:
+      logEvent(LOG_GESTURE, PRESS_BANK_DOWN);
+      break;
+    case EV_EDIT_HOLD:
+      logEvent(LOG_GESTURE, PRESS_EDIT_HOLD);
+      break;
+    default:
+      return;
   }
+  dispatch(gesture.action, gesture.switchIndex);
+}
 
-  // Left switches: Bank down (only in bank mode)
-  if (state.currentMode == BANK_MODE && sw1Pressed && sw2Pressed) {
-    if (state.currentBank == 1) state.currentBank = NUM_BANKS;
-    else state.currentBank--;
-    DEBUG_PRINT("Bank change: ");
-    DEBUG_PRINTLN(state.currentBank);
-    state.displayState = SHOWING_BANK;
+ModeState ModeController::modeState() const {
+  ModeState mode;
+  mode.mode = state.currentMode;
+  mode.display = state.displayState;
+  mode.bank = state.currentBank;
+  mode.activePreset = state.activePreset;
+  mode.globalPreset = state.globalPresetActive;
+  mode.flashingPC = state.flashingPC;
+  return mode;
+}
 
-    // Clear global preset when changing banks
-    state.globalPresetActive = false;
-    state.activePreset = -1;
-    switches.clearRecentPresses();
+void ModeController::dispatch(uint8_t event, uint8_t arg) {
+  const ModeState before = modeState();
+  uint16_t effects;
+  const ModeState after = reduceMode(before, event, arg, effects);
 
-    return;
+  state.currentMode = (Mode)after.mode;
+  state.displayState = (DisplayState)after.display;
+  state.currentBank = after.bank;
+  state.activePreset = after.activePreset;
+  state.globalPresetActive = after.globalPreset;
+  state.flashingPC = after.flashingPC;
+  if (after.mode != before.mode) {
+    DEBUG_PRINT("Mode change: ");
+    DEBUG_PRINTLN(after.mode);
+    logEvent(LOG_MODE, after.mode);
+  }
+  if (after.bank != before.bank) {
+    DEBUG_PRINT("Bank change: ");
+    DEBUG_PRINTLN(after.bank);
+    logEvent(LOG_BANK, after.bank);
   }
 
-  // Individual switch presses
-  for (int i = 0; i < NUM_LOOPS; i++) {
-    if (switches.isRecentPress(i)) {
-      handleSingleSwitchPress(i);
-      switches.clearRecentPresses();
-      break;  // Only handle one at a time
-    }
+  if (effects & FX_RESTORE_LOOPS) {
+    state.loops = speculation.loops;
+    state.editModeLoops = speculation.editModeLoops;
+    relays.update(state.getDisplayLoops());
   }
+  if (effects & FX_TOGGLE_LOOP) state.loops ^= loopBit(arg);
+  if (effects & FX_TOGGLE_EDIT_LOOP) state.editModeLoops ^= loopBit(arg);
+  if (effects & (FX_SET_LOOP | FX_SET_EDIT_LOOP)) {
+    LoopMask& loops = (effects & FX_SET_LOOP) ? state.loops : state.editModeLoops;
+    const LoopMask loop = loopBit(arg & ~LOOP_SET_ON);
+    loops = (arg & LOOP_SET_ON) ? (LoopMask)(loops | loop) : (LoopMask)(loops & ~loop);
+  }
+  if (effects & FX_BEGIN_EDIT) {
+    state.editModeLoops = state.loops;
+    state.editModeAnimTime = millis();
+    state.editModeAnimFrame = 0;
+  }
+  if (effects & FX_SAVE_EDIT) {
+    state.loops = state.editModeLoops;
+    relays.update(state.loops);
+    state.savePreset(((after.bank - 1) * PRESETS_PER_BANK) + after.activePreset + 1);
+    state.savedDisplayStartTime = millis();
+    state.savedDisplayAnimTime = state.savedDisplayStartTime;
+    state.savedDisplayAnimFrame = 0;
+  }
+  if (effects & FX_SEND_PC) sendMIDIProgramChange(after.flashingPC, state.midiChannel);
+  if (effects & FX_SEND_MESSAGES) sendPresetMessages(after.flashingPC);
+  if (effects & FX_LOAD_PRESET) {
+    state.loadPreset(after.flashingPC);
+    relays.update(state.loops);
+    sendPresetMessages(after.flashingPC);
+  }
+  if (effects & FX_START_FLASH) state.pcFlashStartTime = millis();
 }
 
-void ModeController::enterEditMode() {
-  DEBUG_PRINTLN("Mode change: BANK -> EDIT");
-  state.currentMode = EDIT_MODE;
+void ModeController::sendPresetMessages(uint8_t presetNumber) {
+  uint8_t bytes[PRESET_MESSAGE_BYTES];
+  sendMIDIMessages(bytes, state.getPresetMessages(presetNumber, bytes));
+}
 
-  // Copy current loop states to edit buffer
-  for (int i = 0; i < NUM_LOOPS; i++) {
-    state.editModeLoopStates[i] = state.loopStates[i];
-  }
+void ModeController::beginSpeculation(uint8_t switchIndex) {
+  const bool snapshotTaken = speculation.switches;
+  speculation.switches |= 1 << switchIndex;
+  speculation.pressTime[switchIndex] = switches.getPressStartTime(switchIndex);
+  // Rolling back goes to before the first of the presses
+  if (snapshotTaken) return;
 
-  state.displayState = EDIT_MODE_ANIMATED;
-  state.editModeAnimTime = millis();
-  state.editModeAnimFrame = 0;
+  speculation.mode = modeState();
+  speculation.loops = state.loops;
+  speculation.editModeLoops = state.editModeLoops;
 }
 
-void ModeController::exitEditMode() {
-  DEBUG_PRINTLN("Mode change: EDIT -> BANK (saving)");
-  // Copy edited states back to main loop states
-  for (int i = 0; i < NUM_LOOPS; i++) {
-    state.loopStates[i] = state.editModeLoopStates[i];
-  }
-
-  // Update relays immediately with new states
-  relays.update(state.loopStates);
-  // Calculate preset number and save to EEPROM
-  const uint8_t presetNumber = ((state.currentBank - 1) * PRESETS_PER_BANK) + state.activePreset + 1;
-  state.savePreset(presetNumber);
-  // Show flashing decimals animation
-  state.displayState = SHOWING_SAVED;
-  state.savedDisplayStartTime = millis();
-  state.savedDisplayAnimTime = millis();
-  state.savedDisplayAnimFrame = 0;
-  state.currentMode = BANK_MODE;
+void ModeController::commitSpeculation() {
+  for (uint8_t i = 0; i < NUM_SWITCHES; i++) {
+    if (speculation.switches & (1 << i)) switches.clearRecentPress(i);
+  }
+  speculation.switches = 0;
+}
+
+void ModeController::rollbackSpeculation() {
+  if (!speculation.switches) return;
+
+  DEBUG_PRINT("Rolling back presses on switches ");
+  DEBUG_PRINTLN(speculation.switches, BIN);
+  speculation.switches = 0;
+
+  // A single press never changes the mode or bank, only what EV_ROLLBACK puts back
+  dispatch(EV_ROLLBACK, rollbackArg(speculation.mode));
 }
 
-void ModeController::handleSingleSwitchPress(uint8_t switchIndex) {
-  if (state.currentMode == MANUAL_MODE) {
-    // Toggle loop state
-    state.loopStates[switchIndex] = !state.loopStates[switchIndex];
-  }
-  else if (state.currentMode == EDIT_MODE) {
-    // Toggle loop state in edit buffer
-    state.editModeLoopStates[switchIndex] = !state.editModeLoopStates[switchIndex];
-  }
-  else if (state.currentMode == BANK_MODE) {
-    // Check if pressing the same switch as the active preset
-    if (state.activePreset == switchIndex && !state.globalPresetActive) {
-      // Activate global preset - send PC TOTAL_PRESETS (calculated as NUM_BANKS * PRESETS_PER_BANK)
-      state.globalPresetActive = true;
-      sendMIDIProgramChange(TOTAL_PRESETS, state.midiChannel);
-
-      // Flash PC number on display
-      state.flashingPC = TOTAL_PRESETS;
-      state.pcFlashStartTime = millis();
-      state.displayState = FLASHING_PC;
+void ModeController::handleMidiInput() {
+  MidiEvent event;
+  while (readMIDIEvent(event)) {
+    // SysEx is addressed to the switcher by its ID, not the channel
+    if (event.status == MIDI_SYSEX_START) {
+      handleSysEx(event);
+      continue;
     }
-    else {
-      // Exit global preset if active, or just send normal PC
-      state.globalPresetActive = false;
-      state.activePreset = switchIndex;
-
-      // Send MIDI Program Change
-      const uint8_t pc = ((state.currentBank - 1) * PRESETS_PER_BANK) + switchIndex + 1;
-      sendMIDIProgramChange(pc, state.midiChannel);
-      // Load preset from EEPROM and apply to relays
-      state.loadPreset(pc);
-      relays.update(state.loopStates);
-      // Flash PC number on display
-      state.flashingPC = pc;
-      state.pcFlashStartTime = millis();
-      state.displayState = FLASHING_PC;
+    if ((event.status & 0x0F) != state.midiChannel) continue;
+
+    if ((event.status & 0xF0) == 0xC0) {
+      recallPresetFromMidi(event.data1);
+    } else if (event.data1 >= MIDI_CC_LOOP_FIRST && event.data1 < MIDI_CC_LOOP_FIRST + NUM_LOOPS) {
+      setLoopFromMidi(event.data1 - MIDI_CC_LOOP_FIRST, event.data2 >= 64);
+    }
+  }
+  transfer.update();
+}
+
+void ModeController::handleSysEx(const MidiEvent& event) {
+  switch (event.data1) {
+    case SYSEX_PROFILE_REQUEST:
+      requestProfileDump();
+      break;
+    case SYSEX_PROFILE_CLEAR:
+      clearProfile();
+      break;
+    case SYSEX_LOG_REQUEST:
+      requestLogDump();
+      break;
+    case SYSEX_PRESETS_REQUEST:
+      transfer.requestDump();
+      break;
+    case SYSEX_PRESETS_CHUNK: {
+      uint8_t chunk[PresetTransfer::CHUNK_MAX_SIZE];
+      transfer.restore(chunk, readMIDISysExData(chunk, sizeof(chunk)));
+      break;
     }
+    default:
+      break;
   }
 }
 
+void ModeController::recallPresetFromMidi(uint8_t program) {
+  if (!modeAccepts(modeState(), EV_PROGRAM)) return;
+
+  // The controller has the last word over a footswitch press still waiting for a partner
+  commitSpeculation();
+
+  // PC 0-127 = presets 1-128; the controller sent the PC itself, so none is echoed
+  DEBUG_PRINT("MIDI recall: preset ");
+  DEBUG_PRINTLN(program + 1);
+  dispatch(EV_PROGRAM, program);
+}
+
+void ModeController::setLoopFromMidi(uint8_t loop, bool on) {
+  commitSpeculation();
+  // Edit mode edits the buffer being saved; elsewhere the live loops change
+  dispatch(EV_LOOP_SET, on ? (uint8_t)(loop | LOOP_SET_ON) : loop);
+}
+
 void ModeController::updateStateMachine() {
   const unsigned long now = millis();
 
   // Handle PC flash timeout
   if (state.displayState == FLASHING_PC) {
     if ((now - state.pcFlashStartTime) > PC_FLASH_MS) {
-      state.displayState = SHOWING_BANK;
+      dispatch(EV_FLASH_DONE, 0);
     }
   }
 
   // Handle edit mode animation
   if (state.currentMode == EDIT_MODE) {
     if ((now - state.editModeAnimTime) > EDIT_ANIM_INTERVAL_MS) {
-      state.editModeAnimFrame = (state.editModeAnimFrame + 1) % 6;
+      state.editModeAnimFrame = (state.editModeAnimFrame + 1) % EDIT_ANIMATION_FRAMES;
       state.editModeAnimTime = now;
     }
   }
@@ -200,9 +295,9 @@ void ModeController::updateStateMachine() {
       state.savedDisplayAnimTime = now;
     }
 
-    // After 6 frames (3 flashes), return to bank display
-    if (state.savedDisplayAnimFrame >= 6) {
-      state.displayState = SHOWING_BANK;
+    // After the last frame (3 flashes), return to bank display
+    if (state.savedDisplayAnimFrame >= SAVED_ANIMATION_FRAMES) {
+      dispatch(EV_SAVED_DONE, 0);
     }
   }
 }
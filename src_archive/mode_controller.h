@@ -7,6 +7,18 @@
 #include "switches.h"
 #include "relays.h"
 #include "midi_handler.h"
+#include "gestures.h"
+#include "mode_machine.h"
+#include "preset_transfer.h"
+
+// State changed by a single press, kept so speculative presses can be undone
+struct PressSnapshot {
+  uint8_t switches;   // Presses applied speculatively since the snapshot, bit per switch
+  unsigned long pressTime[NUM_SWITCHES];
+  ModeState mode;     // Undone through EV_ROLLBACK
+  LoopMask loops;
+  LoopMask editModeLoops;
+};
 
 class ModeController {
 public:
@@ -14,15 +26,41 @@ public:
   
   void detectSwitchPatterns();
   void updateStateMachine();
-  void handleSingleSwitchPress(uint8_t switchIndex);
+
+  /**
+   * Act on Program Change/Control Change received on the switcher's channel:
+   * PC n recalls preset n + 1 as if its footswitch had been pressed in its
+   * bank, CC MIDI_CC_LOOP_FIRST + i switches loop i. Edit mode ignores PCs.
+   * SysEx commands addressed to the switcher are taken on any channel.
+   * Also sends what a preset dump or restore has to send this pass.
+   */
+  void handleMidiInput();
   
 private:
   StateManager& state;
   SwitchHandler& switches;
   RelayController& relays;
-  
-  void enterEditMode();
-  void exitEditMode();
+  GestureRecognizer gestures;
+  PressSnapshot speculation;
+  PresetTransfer transfer;
+
+  void recallPresetFromMidi(uint8_t program);
+  void setLoopFromMidi(uint8_t loop, bool on);
+  void handleSysEx(const MidiEvent& event);
+
+  // GestureContext bit for the mode from before any speculative press
+  uint8_t gestureContext() const;
+  void runGesture(const GestureMatch& gesture);
+
+  ModeState modeState() const;
+  // Take the state through reduceMode() and carry out the effects
+  void dispatch(uint8_t event, uint8_t arg);
+  // Queue a preset's stored messages behind whatever this pass already sent
+  void sendPresetMessages(uint8_t presetNumber);
+
+  void beginSpeculation(uint8_t switchIndex);
+  void commitSpeculation();
+  void rollbackSpeculation();
 };
 
 #endif
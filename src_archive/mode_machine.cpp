@@ -0,0 +1,203 @@
+#include "mode_machine.h"
+
+// What a transition does to the bank and preset
+enum ModeOp {
+  OP_IGNORE,        // The row ignores the event: nothing changes
+  OP_KEEP,
+  OP_LEAVE_BANK,    // Global preset off
+  OP_BANK_UP,       // Next bank, no preset active
+  OP_BANK_DOWN,
+  OP_SELECT,        // Preset arg of the bank; the active one again is the global preset
+  OP_PROGRAM,       // Preset arg + 1 of all of them
+  OP_END_FLASH,     // Back to the bank if the PC is still showing
+  OP_END_SAVED,     // Back to the bank if the saved animation is still showing
+  OP_ROLLBACK       // Preset selection from arg; the bank if there was none
+};
+
+// rollbackArg(): the active preset + 1, with this bit for the global preset
+const uint8_t ROLLBACK_GLOBAL = 0x80;
+
+const uint8_t DISPLAY_KEEP = 0xFF;
+
+/**
+ * One cell of the table: the mode and display after the event, what
+ * happens to the bank and preset, and the effects
+ */
+struct ModeTransition {
+  uint8_t mode;
+  uint8_t display;    // DisplayState, or DISPLAY_KEEP
+  uint8_t op;         // ModeOp
+  uint16_t effects;   // ModeEffect bits
+};
+
+#define IGNORED {0, DISPLAY_KEEP, OP_IGNORE, 0}
+#define TIMEOUTS(mode) {mode, DISPLAY_KEEP, OP_END_FLASH, 0}, {mode, DISPLAY_KEEP, OP_END_SAVED, 0}
+#define BANK_ROLLBACK \
+  {BANK_MODE, FLASHING_PC, OP_ROLLBACK, FX_RESTORE_LOOPS | FX_SEND_PC | FX_SEND_MESSAGES | FX_START_FLASH}
+
+constexpr ModeTransition TRANSITIONS[MODE_ROWS][MODE_EVENTS] PROGMEM = {
+  // ROW_MANUAL
+  {
+    IGNORED,
+    {MANUAL_MODE, DISPLAY_KEEP, OP_KEEP, FX_TOGGLE_LOOP},
+    {BANK_MODE, SHOWING_BANK, OP_KEEP, 0},
+    IGNORED,
+    IGNORED,
+    IGNORED,
+    {BANK_MODE, FLASHING_PC, OP_PROGRAM, FX_LOAD_PRESET | FX_START_FLASH},
+    TIMEOUTS(MANUAL_MODE),
+    {MANUAL_MODE, DISPLAY_KEEP, OP_KEEP, FX_SET_LOOP},
+    {MANUAL_MODE, DISPLAY_KEEP, OP_KEEP, FX_RESTORE_LOOPS}
+  },
+  // ROW_BANK
+  {
+    IGNORED,
+    {BANK_MODE, FLASHING_PC, OP_SELECT, FX_SEND_PC | FX_LOAD_PRESET | FX_START_FLASH},
+    {MANUAL_MODE, SHOWING_MANUAL, OP_LEAVE_BANK, 0},
+    {BANK_MODE, SHOWING_BANK, OP_BANK_UP, 0},
+    {BANK_MODE, SHOWING_BANK, OP_BANK_DOWN, 0},
+    IGNORED,
+    {BANK_MODE, FLASHING_PC, OP_PROGRAM, FX_LOAD_PRESET | FX_START_FLASH},
+    TIMEOUTS(BANK_MODE),
+    {BANK_MODE, DISPLAY_KEEP, OP_KEEP, FX_SET_LOOP},
+    BANK_ROLLBACK
+  },
+  // ROW_PRESET: SW2+SW3 only starts the hold into edit mode
+  {
+    IGNORED,
+    {BANK_MODE, FLASHING_PC, OP_SELECT, FX_SEND_PC | FX_LOAD_PRESET | FX_START_FLASH},
+    IGNORED,
+    {BANK_MODE, SHOWING_BANK, OP_BANK_UP, 0},
+    {BANK_MODE, SHOWING_BANK, OP_BANK_DOWN, 0},
+    {EDIT_MODE, EDIT_MODE_ANIMATED, OP_KEEP, FX_BEGIN_EDIT},
+    {BANK_MODE, FLASHING_PC, OP_PROGRAM, FX_LOAD_PRESET | FX_START_FLASH},
+    TIMEOUTS(BANK_MODE),
+    {BANK_MODE, DISPLAY_KEEP, OP_KEEP, FX_SET_LOOP},
+    BANK_ROLLBACK
+  },
+  // ROW_EDIT: Program Changes wait until the edit is saved
+  {
+    IGNORED,
+    {EDIT_MODE, DISPLAY_KEEP, OP_KEEP, FX_TOGGLE_EDIT_LOOP},
+    IGNORED,
+    IGNORED,
+    IGNORED,
+    {BANK_MODE, SHOWING_SAVED, OP_KEEP, FX_SAVE_EDIT},
+    IGNORED,
+    TIMEOUTS(EDIT_MODE),
+    {EDIT_MODE, DISPLAY_KEEP, OP_KEEP, FX_SET_EDIT_LOOP},
+    {EDIT_MODE, DISPLAY_KEEP, OP_KEEP, FX_RESTORE_LOOPS}
+  }
+};
+
+#undef IGNORED
+#undef TIMEOUTS
+#undef BANK_ROLLBACK
+
+static ModeTransition transition(const ModeState& state, uint8_t event) {
+  ModeTransition cell;
+  memcpy_P(&cell, &TRANSITIONS[modeRow(state)][(event < MODE_EVENTS) ? event : (uint8_t)EV_NONE], sizeof(cell));
+  return cell;
+}
+
+ModeRow modeRow(const ModeState& state) {
+  switch (state.mode) {
+    case MANUAL_MODE:
+      return ROW_MANUAL;
+    case EDIT_MODE:
+      return ROW_EDIT;
+    default:
+      return (state.activePreset != -1) ? ROW_PRESET : ROW_BANK;
+  }
+}
+
+bool modeAccepts(const ModeState& state, uint8_t event) {
+  return transition(state, event).op != OP_IGNORE;
+}
+
+ModeState reduceMode(const ModeState& state, uint8_t event, uint8_t arg, uint16_t& effects) {
+  const ModeTransition cell = transition(state, event);
+  effects = 0;
+  if (cell.op == OP_IGNORE) return state;
+
+  ModeState next = state;
+  next.mode = cell.mode;
+  if (cell.display != DISPLAY_KEEP) next.display = cell.display;
+  effects = cell.effects;
+
+  switch (cell.op) {
+    case OP_LEAVE_BANK:
+      next.globalPreset = false;
+      break;
+    case OP_BANK_UP:
+    case OP_BANK_DOWN:
+      if (cell.op == OP_BANK_UP) next.bank = (state.bank >= NUM_BANKS) ? 1 : state.bank + 1;
+      else next.bank = (state.bank <= 1) ? NUM_BANKS : state.bank - 1;
+      next.activePreset = -1;
+      next.globalPreset = false;
+      break;
+    case OP_SELECT:
+      if (state.activePreset == arg && !state.globalPreset) {
+        // Nothing to load: the global preset is the rig's own
+        next.globalPreset = true;
+        next.flashingPC = TOTAL_PRESETS;
+        effects &= ~FX_LOAD_PRESET;
+      } else {
+        next.activePreset = arg;
+        next.globalPreset = false;
+        next.flashingPC = (state.bank - 1) * PRESETS_PER_BANK + arg + 1;
+      }
+      break;
+    case OP_PROGRAM:
+      next.bank = arg / PRESETS_PER_BANK + 1;
+      next.activePreset = arg % PRESETS_PER_BANK;
+      next.globalPreset = false;
+      next.flashingPC = arg + 1;
+      break;
+    case OP_END_FLASH:
+      if (state.display == FLASHING_PC) next.display = SHOWING_BANK;
+      break;
+    case OP_END_SAVED:
+      if (state.display == SHOWING_SAVED) next.display = SHOWING_BANK;
+      break;
+    case OP_ROLLBACK:
+      next.activePreset = (int8_t)(arg & ~ROLLBACK_GLOBAL) - 1;
+      next.globalPreset = arg & ROLLBACK_GLOBAL;
+      if (next.activePreset == -1) {
+        // The PC already sent has no earlier one to take back to
+        next.display = SHOWING_BANK;
+        effects = FX_RESTORE_LOOPS;
+      } else {
+        next.flashingPC = next.globalPreset ? TOTAL_PRESETS
+                                            : (state.bank - 1) * PRESETS_PER_BANK + next.activePreset + 1;
+      }
+      break;
+    default:
+      break;
+  }
+  return next;
+}
+
+uint8_t rollbackArg(const ModeState& state) {
+  return (uint8_t)(state.activePreset + 1) | (state.globalPreset ? ROLLBACK_GLOBAL : 0);
+}
+
+bool modeStateValid(const ModeState& state) {
+  if (state.bank < 1 || state.bank > NUM_BANKS) return false;
+  if (state.activePreset < -1 || state.activePreset >= PRESETS_PER_BANK) return false;
+  // The global preset is reached from an active one, and left with bank mode
+  if (state.globalPreset && (state.activePreset == -1 || state.mode == MANUAL_MODE)) return false;
+  if (state.display == FLASHING_PC && (state.flashingPC < 1 || state.flashingPC > TOTAL_PRESETS)) return false;
+
+  switch (state.mode) {
+    case MANUAL_MODE:
+      return state.display == SHOWING_MANUAL;
+    case BANK_MODE:
+      return state.display == SHOWING_BANK || state.display == FLASHING_PC || state.display == SHOWING_SAVED;
+    case EDIT_MODE:
+      // Edit mode saves into the active preset
+      return state.activePreset != -1 && state.display == EDIT_MODE_ANIMATED;
+    default:
+      return false;
+  }
+}
@@ -0,0 +1,111 @@
+#ifndef MODE_MACHINE_H
+#define MODE_MACHINE_H
+
+#include <Arduino.h>
+#include "config.h"
+#include "display.h"
+
+/**
+ * What can happen to the mode; the argument each one takes
+ */
+enum ModeEvent {
+  EV_NONE,          // Nothing (a press a gesture swallowed)
+  EV_SWITCH,        // Single press, arg = switch 0-3
+  EV_MODE_PAIR,     // SW2+SW3 tapped
+  EV_BANK_UP,       // SW3+SW4
+  EV_BANK_DOWN,     // SW1+SW2
+  EV_EDIT_HOLD,     // SW2+SW3 held
+  EV_PROGRAM,       // MIDI Program Change, arg = program 0-127
+  EV_FLASH_DONE,    // The PC number has been shown PC_FLASH_MS
+  EV_SAVED_DONE,    // The saved animation has run its frames
+  EV_LOOP_SET,      // MIDI Control Change for a loop, arg = loop, LOOP_SET_ON added to switch it on
+  EV_ROLLBACK,      // Speculative presses undone, arg = rollbackArg() of the state before them
+  MODE_EVENTS
+};
+
+// EV_LOOP_SET's argument bit for on
+const uint8_t LOOP_SET_ON = 0x80;
+
+/**
+ * Rows of the transition table: the mode, with bank mode split by whether
+ * a preset is active, since that decides what SW2+SW3 does
+ */
+enum ModeRow {
+  ROW_MANUAL,
+  ROW_BANK,         // No preset active
+  ROW_PRESET,       // A preset active
+  ROW_EDIT,
+  MODE_ROWS
+};
+
+/**
+ * What the mode controller has to do after a transition, bit per effect
+ */
+enum ModeEffect {
+  FX_TOGGLE_LOOP = 1 << 0,        // Live loop arg
+  FX_TOGGLE_EDIT_LOOP = 1 << 1,   // Loop arg in the edit buffer
+  FX_SEND_PC = 1 << 2,            // Program Change flashingPC on the switcher's channel
+  FX_LOAD_PRESET = 1 << 3,        // Preset flashingPC onto the loops and relays
+  FX_START_FLASH = 1 << 4,        // Time the PC flash from now
+  FX_BEGIN_EDIT = 1 << 5,         // Copy the loops to the edit buffer, start the animation
+  FX_SAVE_EDIT = 1 << 6,          // Apply the edit buffer, save it to the active preset, start the animation
+  FX_RESTORE_LOOPS = 1 << 7,      // Live loops and edit buffer back to before the speculative presses
+  FX_SEND_MESSAGES = 1 << 8,      // Preset flashingPC's stored messages, without loading its loops
+  FX_SET_LOOP = 1 << 9,           // Live loop arg on or off
+  FX_SET_EDIT_LOOP = 1 << 10      // Loop arg on or off in the edit buffer
+};
+
+/**
+ * The part of the switcher's state the mode logic owns
+ */
+struct ModeState {
+  uint8_t mode;           // Mode
+  uint8_t display;        // DisplayState
+  uint8_t bank;           // 1-NUM_BANKS
+  int8_t activePreset;    // Switch 0-3 of the bank, -1 if none
+  bool globalPreset;
+  uint8_t flashingPC;     // PC shown while FLASHING_PC, 1-TOTAL_PRESETS
+};
+
+/**
+ * ModeMachine - The switcher's modes as a table over (row, event)
+ *
+ * reduceMode() looks the cell up in a constexpr table in flash and applies
+ * it: a fixed handful of field updates whatever the state or event, with
+ * no side effects. Anything that touches hardware, MIDI or EEPROM comes
+ * back as effect bits for the mode controller to carry out. A cell can
+ * ignore its event, which leaves the state alone; edit mode ignores
+ * Program Changes, manual mode bank changes.
+ *
+ * Undoing speculative presses is an event too: a single press changes no
+ * more than the preset selection, the display and the loops, so going
+ * back needs only the selection from before, and the loops as the mode
+ * controller kept them. In bank mode the old preset's PC and messages go
+ * out again and its number flashes; with no preset before there is
+ * nothing to send, and the bank is shown.
+ *
+ * Every state reduceMode() can reach from power-up passes
+ * modeStateValid(); the host `modes` command checks that exhaustively.
+ */
+ModeRow modeRow(const ModeState& state);
+
+// True if the state's row takes the event rather than ignoring it
+bool modeAccepts(const ModeState& state, uint8_t event);
+
+/**
+ * @param effects Set to the ModeEffect bits to carry out
+ * @return The state after the event
+ */
+ModeState reduceMode(const ModeState& state, uint8_t event, uint8_t arg, uint16_t& effects);
+
+// EV_ROLLBACK's argument to go back to state: its preset selection
+uint8_t rollbackArg(const ModeState& state);
+
+/**
+ * @return false for a state the switcher must never be in, such as edit
+ *         mode with no preset to save into or a display that belongs to
+ *         another mode
+ */
+bool modeStateValid(const ModeState& state);
+
+#endif
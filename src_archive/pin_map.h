@@ -0,0 +1,61 @@
+#ifndef PIN_MAP_H
+#define PIN_MAP_H
+
+#include <Arduino.h>
+
+/**
+ * Compile-time Arduino pin -> AVR port mapping (Uno/Nano)
+ *
+ * D0-D7 are PORTD, D8-D13 PORTB, A0-A5 (14-19) PORTC. With a constant pin
+ * the helpers below fold to a single sbi/cbi or masked port write, against
+ * ~50 cycles for digitalWrite().
+ */
+enum PortIndex {
+  PORT_INDEX_B,
+  PORT_INDEX_C,
+  PORT_INDEX_D
+};
+
+constexpr uint8_t pinPortIndex(uint8_t pin) {
+  return (pin <= 7) ? PORT_INDEX_D : ((pin <= 13) ? PORT_INDEX_B : PORT_INDEX_C);
+}
+
+constexpr uint8_t pinPortBit(uint8_t pin) {
+  return (pin <= 7) ? pin : ((pin <= 13) ? pin - 8 : pin - 14);
+}
+
+constexpr uint8_t pinPortMask(uint8_t pin) {
+  return (uint8_t)(1 << pinPortBit(pin));
+}
+
+/**
+ * Replace the `mask` bits of a port with `bits`. PORT should be a constant
+ * so the switch drops out.
+ */
+inline void writePortMasked(uint8_t port, uint8_t mask, uint8_t bits) {
+  switch (port) {
+    case PORT_INDEX_B: PORTB = (PORTB & ~mask) | bits; break;
+    case PORT_INDEX_C: PORTC = (PORTC & ~mask) | bits; break;
+    case PORT_INDEX_D: PORTD = (PORTD & ~mask) | bits; break;
+  }
+}
+
+template <uint8_t PIN>
+inline void fastPinHigh() {
+  switch (pinPortIndex(PIN)) {
+    case PORT_INDEX_B: PORTB |= pinPortMask(PIN); break;
+    case PORT_INDEX_C: PORTC |= pinPortMask(PIN); break;
+    case PORT_INDEX_D: PORTD |= pinPortMask(PIN); break;
+  }
+}
+
+template <uint8_t PIN>
+inline void fastPinLow() {
+  switch (pinPortIndex(PIN)) {
+    case PORT_INDEX_B: PORTB &= (uint8_t)~pinPortMask(PIN); break;
+    case PORT_INDEX_C: PORTC &= (uint8_t)~pinPortMask(PIN); break;
+    case PORT_INDEX_D: PORTD &= (uint8_t)~pinPortMask(PIN); break;
+  }
+}
+
+#endif
@@ -0,0 +1,257 @@
+#include "preset_messages.h"
+#include <EEPROM.h>
+#include <util/crc16.h>
+#include "midi_parser.h"
+
+// Not zero, so that zeroed cells never pass for a record
+static const uint8_t CRC_INIT = 0xFF;
+
+PresetMessages::PresetMessages()
+  : present{},
+    half(0),
+    used(0),
+    live(0),
+    step(STEP_IDLE),
+    source(0),
+    target(0),
+    copied(0),
+    record{} {
+}
+
+void PresetMessages::format() {
+  // Generations equal: the first half is the one in use
+  EEPROM.update(EEPROM_MESSAGES_START_ADDR, EEPROM.read(EEPROM_MESSAGES_START_ADDR + HALF_SIZE));
+  EEPROM.update(logAddress(0, 0), END_OF_LIST);
+}
+
+void PresetMessages::begin() {
+  memset(present, 0, sizeof(present));
+  step = STEP_IDLE;
+
+  // The second half is in use once its generation is one past the first's
+  const uint8_t firstGeneration = EEPROM.read(EEPROM_MESSAGES_START_ADDR);
+  half = (EEPROM.read(EEPROM_MESSAGES_START_ADDR + HALF_SIZE) == (uint8_t)(firstGeneration + 1)) ? 1 : 0;
+
+  uint16_t offset = 0;
+  while (offset < LOG_SIZE) {
+    const uint16_t address = logAddress(half, offset);
+    const uint8_t index = EEPROM.read(address);
+    if (index == END_OF_LIST) break;
+
+    const uint8_t length = EEPROM.read(address + 1);
+    bool valid = index < TOTAL_PRESETS && length <= PRESET_MESSAGE_BYTES &&
+                 offset + length + RECORD_OVERHEAD <= LOG_SIZE;
+    if (valid) {
+      uint8_t crc = _crc8_ccitt_update(_crc8_ccitt_update(CRC_INIT, index), length);
+      for (uint8_t i = 0; i < length; i++) crc = _crc8_ccitt_update(crc, EEPROM.read(address + 2 + i));
+      valid = crc == EEPROM.read(address + 2 + length);
+    }
+    if (!valid) {
+      // Cut short by a power loss; it was the last record written
+      DEBUG_PRINT("Preset messages end at bad record, offset ");
+      DEBUG_PRINTLN(offset);
+      EEPROM.write(address, END_OF_LIST);
+      break;
+    }
+
+    if (length > 0) {
+      present[index >> 3] |= 1 << (index & 7);
+    } else {
+      present[index >> 3] &= ~(1 << (index & 7));
+    }
+    offset += length + RECORD_OVERHEAD;
+  }
+  used = offset;
+
+  live = 0;
+  for (uint8_t i = 0; i < TOTAL_PRESETS; i++) {
+    if (has(i)) live += recordSize(find(i));
+  }
+}
+
+bool PresetMessages::has(uint8_t index) const {
+  return index < TOTAL_PRESETS && (present[index >> 3] & (1 << (index & 7)));
+}
+
+uint8_t PresetMessages::readByte(uint16_t offset) const {
+  return EEPROM.read(logAddress(half, offset));
+}
+
+bool PresetMessages::writeByte(uint16_t address, uint8_t value) {
+  if (EEPROM.read(address) == value) return false;
+  EEPROM.write(address, value);
+  return true;
+}
+
+uint16_t PresetMessages::find(uint8_t index) const {
+  uint16_t found = used;
+  for (uint16_t offset = 0; offset < used; offset += recordSize(offset)) {
+    if (readByte(offset) == index) found = offset;
+  }
+  return found;
+}
+
+uint8_t PresetMessages::get(uint8_t index, uint8_t* bytes) const {
+  if (!has(index)) return 0;
+  if (step != STEP_IDLE && index == record[0]) {
+    memcpy(bytes, record + 2, record[1]);
+    return record[1];
+  }
+  const uint16_t offset = find(index);
+  const uint8_t length = readByte(offset + 1);
+  for (uint8_t i = 0; i < length; i++) bytes[i] = readByte(offset + 2 + i);
+  return length;
+}
+
+bool PresetMessages::set(uint8_t index, const uint8_t* bytes, uint8_t length) {
+  if (index >= TOTAL_PRESETS || step != STEP_IDLE) return false;
+
+  // Whole channel messages only, each status byte kept only where it changes
+  uint8_t* out = record + 2;
+  uint8_t status = 0;
+  uint8_t dataLeft = 0;
+  uint8_t messages = 0;
+  for (uint8_t i = 0; i < length; i++) {
+    const uint8_t data = bytes[i];
+    if (data & 0x80) {
+      if (dataLeft > 0 || data >= 0xF0 || ++messages > PRESET_MAX_MESSAGES) return false;
+      if (data != status) *out++ = data;
+      status = data;
+      dataLeft = midiMessageLength(status) - 1;
+      continue;
+    }
+    if (dataLeft == 0) {
+      if (status == 0 || ++messages > PRESET_MAX_MESSAGES) return false;
+      dataLeft = midiMessageLength(status) - 1;
+    }
+    *out++ = data;
+    dataLeft--;
+  }
+  if (dataLeft > 0) return false;
+
+  const uint8_t messageBytes = out - (record + 2);
+  const bool had = has(index);
+  if (!had && messageBytes == 0) return true;
+  const uint8_t replaced = had ? recordSize(find(index)) : 0;
+  const uint8_t size = messageBytes + RECORD_OVERHEAD;
+  const uint16_t liveAfter = live - replaced + (messageBytes ? size : 0);
+  if (liveAfter > LOG_SIZE) return false;
+
+  record[0] = index;
+  record[1] = messageBytes;
+  uint8_t crc = CRC_INIT;
+  for (uint8_t i = 0; i < messageBytes + 2; i++) crc = _crc8_ccitt_update(crc, record[i]);
+  record[messageBytes + 2] = crc;
+
+  live = liveAfter;
+  if (messageBytes > 0) {
+    present[index >> 3] |= 1 << (index & 7);
+  } else {
+    present[index >> 3] &= ~(1 << (index & 7));
+  }
+  source = 0;
+  target = 0;
+  copied = 0;
+  step = (used + size <= LOG_SIZE) ? STEP_APPEND : STEP_COMPACT;
+  return true;
+}
+
+bool PresetMessages::clear() {
+  if (step != STEP_IDLE) return false;
+  memset(present, 0, sizeof(present));
+  live = 0;
+  record[0] = END_OF_LIST;
+  record[1] = 0;
+  // Nothing left to copy: compact() goes straight to the end of the list and the switch
+  source = used;
+  target = 0;
+  copied = 0;
+  step = STEP_COMPACT;
+  return true;
+}
+
+bool PresetMessages::inForce() const {
+  // The preset being changed gets a new record; a removal has done its work
+  const uint8_t index = readByte(source);
+  if (index == record[0] || readByte(source + 1) == 0) return false;
+  for (uint16_t offset = source + recordSize(source); offset < used; offset += recordSize(offset)) {
+    if (readByte(offset) == index) return false;
+  }
+  return true;
+}
+
+void PresetMessages::compact() {
+  const uint8_t other = half ^ 1;
+
+  if (source == used) {
+    // Every record in force copied: the change behind them, the end of the list, then switch halves
+    const uint8_t size = (record[1] > 0) ? record[1] + RECORD_OVERHEAD : 0;
+    while (copied <= size) {
+      const uint8_t phase = copied++;
+      if (phase < size) {
+        if (writeByte(logAddress(other, target + phase), record[phase])) return;
+      } else if (target + size < LOG_SIZE && writeByte(logAddress(other, target + size), END_OF_LIST)) {
+        return;
+      }
+    }
+    const uint8_t generation = EEPROM.read(EEPROM_MESSAGES_START_ADDR + half * HALF_SIZE) + 1;
+    half = other;
+    used = target + size;
+    step = STEP_IDLE;
+    writeByte(EEPROM_MESSAGES_START_ADDR + half * HALF_SIZE, generation);
+    return;
+  }
+
+  // One record looked at per update; one passed over takes no write
+  if (copied == 0 && !inForce()) {
+    source += recordSize(source);
+    return;
+  }
+
+  const uint8_t size = recordSize(source);
+  while (copied < size) {
+    const uint8_t value = readByte(source + copied);
+    const uint16_t address = logAddress(other, target + copied);
+    copied++;
+    if (writeByte(address, value)) break;
+  }
+  if (copied == size) {
+    source += size;
+    target += size;
+    copied = 0;
+  }
+}
+
+void PresetMessages::append() {
+  // Bytes 1 on, then the end of the list behind them, then byte 0, which makes the record count
+  const uint8_t size = record[1] + RECORD_OVERHEAD;
+  while (step == STEP_APPEND) {
+    const uint8_t phase = copied++;
+    uint16_t offset;
+    uint8_t value;
+    if (phase < size - 1) {
+      offset = used + 1 + phase;
+      value = record[1 + phase];
+    } else if (phase == size - 1) {
+      if (used + size == LOG_SIZE) continue;
+      offset = used + size;
+      value = END_OF_LIST;
+    } else {
+      offset = used;
+      value = record[0];
+      used += size;
+      step = STEP_IDLE;
+    }
+    if (writeByte(logAddress(half, offset), value)) return;
+  }
+}
+
+void PresetMessages::update() {
+  // A write in progress would make the next access wait for it
+  if (step == STEP_IDLE || !eeprom_is_ready()) return;
+  if (step == STEP_COMPACT) {
+    compact();
+  } else {
+    append();
+  }
+}
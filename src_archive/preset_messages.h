@@ -0,0 +1,133 @@
+#ifndef PRESET_MESSAGES_H
+#define PRESET_MESSAGES_H
+
+#include <Arduino.h>
+#include "config.h"
+
+/**
+ * PresetMessages - MIDI messages a preset sends when it is recalled
+ *
+ * Up to PRESET_MAX_MESSAGES channel messages per preset: Program Changes
+ * for the other units on their own channels, Control Changes for an amp
+ * channel or a delay on/off. They sit in EEPROM apart from the loops
+ * (PresetStore), from EEPROM_MESSAGES_START_ADDR, in two halves. Each half
+ * is a generation byte and a log of variable-length records:
+ *
+ *   byte 0:        preset index 0-127, END_OF_LIST after the last record
+ *   byte 1:        n, bytes of messages (0-PRESET_MESSAGE_BYTES)
+ *   bytes 2..n+1:  the messages as they go on the wire, in running status
+ *   byte n+2:      CRC-8 of bytes 0..n+1
+ *
+ * The newest record of a preset is the one that counts; n = 0 records
+ * that its messages were removed. A preset without messages takes no room.
+ * Two Program Changes on different channels and two Control Changes on a
+ * third take 2 + 2 + 3 + 2 + 3 = 12 bytes.
+ *
+ * A change is appended behind the last record, bytes 1 on and the end of
+ * list first, byte 0 last, so a record cut short by a power loss never
+ * counts and the one before it still does. When the half has no room left,
+ * the records still in force are copied to the other half, a byte at a
+ * time, and the change behind them; its generation byte, one more than
+ * this half's, is written last and switches to it. The half in use is not
+ * written to meanwhile, so a power loss loses at most the change.
+ *
+ * RAM holds a bit per preset, so recalling a preset without messages never
+ * touches EEPROM. get() walks the log, two reads for each record passed.
+ * The storage task starts no EEPROM write that would still be running
+ * when the control task runs, so those reads never wait for one.
+ *
+ * A change shows in get() at once; update(), from the storage task,
+ * writes at most one EEPROM byte of it. One change is written at a time.
+ */
+class PresetMessages {
+public:
+  static const uint8_t END_OF_LIST = 0xFF;
+  static const uint8_t RECORD_OVERHEAD = 3;   // Index, length and CRC
+  static const uint16_t HALF_SIZE = PRESET_MESSAGES_SIZE / 2;
+  static const uint16_t LOG_SIZE = HALF_SIZE - 1;   // Behind the generation byte
+
+  PresetMessages();
+
+  /**
+   * Power-up, once PresetStore::begin() has EEPROM in the current layout:
+   * check the records of the half in use in order. The log ends before
+   * the first that fails.
+   */
+  void begin();
+
+  // Fresh layout: no preset has messages, the first half in use
+  static void format();
+
+  /**
+   * Messages of preset index 0-127 as wire bytes, running status included.
+   * @param bytes Room for PRESET_MESSAGE_BYTES
+   * @return Bytes of them, 0 if the preset has none
+   */
+  uint8_t get(uint8_t index, uint8_t* bytes) const;
+  bool has(uint8_t index) const;
+
+  /**
+   * Replace the messages of preset index 0-127; length 0 removes them. A
+   * status byte that repeats the one before is dropped. Returns at once;
+   * the write happens in update().
+   * @return false, with the messages left as they were, if bytes are not
+   *         whole channel messages, there are more than
+   *         PRESET_MAX_MESSAGES, the presets' messages would not fit
+   *         together, or the change before is still being written
+   */
+  bool set(uint8_t index, const uint8_t* bytes, uint8_t length);
+
+  /**
+   * Remove the messages of every preset: the other half gets an empty log
+   * and is switched to, like a compaction with no record in force. Returns
+   * at once; the writes happen in update().
+   * @return false if the change before is still being written
+   */
+  bool clear();
+
+  /**
+   * Commit at most one EEPROM byte, if the EEPROM is ready.
+   * Call from the storage task.
+   */
+  void update();
+
+  // Nothing waiting to be written
+  bool isIdle() const { return step == STEP_IDLE; }
+
+  // Bytes of the log in use, and of the records in force in it
+  uint16_t bytesUsed() const { return used; }
+  uint16_t bytesLive() const { return live; }
+
+private:
+  enum Step {
+    STEP_IDLE,
+    STEP_COMPACT,   // Copy the records in force and the change to the other half
+    STEP_APPEND     // Write the new record behind the last one
+  };
+
+  uint8_t present[TOTAL_PRESETS / 8];   // Presets with messages
+  uint8_t half;            // Half in use, 0 or 1
+  uint16_t used;           // Bytes of its log; END_OF_LIST follows unless it is full
+  uint16_t live;           // Bytes of the newest record of each preset with messages
+  Step step;
+  uint16_t source;         // Compacting: record being looked at or copied
+  uint16_t target;         // Compacting: where it goes in the other half
+  uint8_t copied;          // Compacting: bytes of it copied; appending: bytes written
+  uint8_t record[PRESET_MESSAGE_BYTES + RECORD_OVERHEAD];   // The change being written
+
+  static uint16_t logAddress(uint8_t which, uint16_t offset) {
+    return EEPROM_MESSAGES_START_ADDR + which * HALF_SIZE + 1 + offset;
+  }
+  uint8_t readByte(uint16_t offset) const;
+  uint8_t recordSize(uint16_t offset) const { return readByte(offset + 1) + RECORD_OVERHEAD; }
+  // Offset of the newest record of the preset, used if none
+  uint16_t find(uint8_t index) const;
+  // Compacting: the record at source is the newest of a preset that keeps messages
+  bool inForce() const;
+  // Write value unless the cell holds it already; true if it wrote
+  static bool writeByte(uint16_t address, uint8_t value);
+  void compact();
+  void append();
+};
+
+#endif
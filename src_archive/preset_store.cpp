@@ -0,0 +1,422 @@
+#include "preset_store.h"
+#include <EEPROM.h>
+#include <util/crc16.h>
+#include "profiler.h"
+#include "preset_messages.h"
+
+// Not zero, so that zeroed cells never pass for a record
+static const uint8_t CRC_INIT = 0xFF;
+
+// Layout 0x43: 2-byte records right after the base table
+static const uint16_t LEGACY_JOURNAL_START_ADDR = EEPROM_PRESETS_START_ADDR + TOTAL_PRESETS;
+static const uint16_t LEGACY_JOURNAL_SLOTS = (EEPROM_SIZE - LEGACY_JOURNAL_START_ADDR) / 2;
+// Layout version 1: the 4-loop records, running to the end of EEPROM
+static const uint16_t LAYOUT_1_JOURNAL_SLOTS = (EEPROM_SIZE - EEPROM_JOURNAL_START_ADDR) / 3;
+// Layout version 2: this unit's records, running to the session ring
+static const uint8_t LAYOUT_2_ID = (uint8_t)((EEPROM_LAYOUT_ID & ~0x07) | 2);
+static const uint16_t LAYOUT_2_JOURNAL_SLOTS =
+    (EEPROM_SESSION_START_ADDR - EEPROM_JOURNAL_START_ADDR) / PresetStore::RECORD_SIZE;
+// The loop bytes carry the lap in their top bit if the loops leave it free
+static const LoopMask LOOPS_LAP_BIT =
+    (NUM_LOOPS < PresetStore::LOOP_BYTES * 8) ? (LoopMask)(1U << (PresetStore::LOOP_BYTES * 8 - 1)) : 0;
+
+static uint16_t slotAddress(uint16_t slot) {
+  return EEPROM_JOURNAL_START_ADDR + slot * PresetStore::RECORD_SIZE;
+}
+
+// Record loop bytes as one value
+static LoopMask lapLoops(uint8_t lap, LoopMask loops) {
+  return (LoopMask)(loops | (lap ? LOOPS_LAP_BIT : 0));
+}
+
+static uint8_t recordCrc(uint8_t indexByte, LoopMask loopBytes) {
+  uint8_t crc = _crc8_ccitt_update(CRC_INIT, indexByte);
+  for (uint8_t i = 0; i < PresetStore::LOOP_BYTES; i++) {
+    crc = _crc8_ccitt_update(crc, (uint8_t)(loopBytes >> (8 * i)));
+  }
+  return crc;
+}
+
+// Loops 9-16 are kept inverted, so an erased table needs no writes to read as all loops off
+static uint16_t presetByteAddress(uint8_t index, uint8_t byte) {
+  return (byte == 0) ? EEPROM_PRESETS_START_ADDR + index : EEPROM_PRESETS_HIGH_ADDR + index;
+}
+
+static uint8_t storedPresetByte(LoopMask loops, uint8_t byte) {
+  const uint8_t value = (uint8_t)(loops >> (8 * byte));
+  return (byte == 0) ? value : (uint8_t)~value;
+}
+
+// A preset as the tables in EEPROM hold it
+static LoopMask readPreset(uint8_t index) {
+  LoopMask loops = EEPROM.read(EEPROM_PRESETS_START_ADDR + index);
+  if (PresetStore::LOOP_BYTES > 1) loops |= (LoopMask)((uint8_t)~EEPROM.read(EEPROM_PRESETS_HIGH_ADDR + index) << 8);
+  return loops;
+}
+
+static uint8_t legacyRecordCheck(uint8_t index, uint8_t loops) {
+  return (uint8_t)(~(index ^ (index >> 3) ^ (index >> 6) ^ loops) & 0x07);
+}
+
+PresetStore::PresetStore()
+  : cache{},
+    committed{},
+    dirty{},
+    dirtyCount(0),
+    nextDirty(0),
+    head(0),
+    lap(0),
+    step(STEP_IDLE),
+    recordIndex(0),
+    recordLoops(0),
+    recordByte(0),
+    writeBackBank(0),
+    staleBanks(0),
+    repaired(0),
+    reset(0) {
+}
+
+static bool layoutIs(uint8_t id) {
+  return EEPROM.read(EEPROM_INIT_FLAG_ADDR) == EEPROM_HEADER_MAGIC && EEPROM.read(EEPROM_HEADER_ADDR) == id &&
+         EEPROM.read(EEPROM_HEADER_ADDR + 1) == (uint8_t)~id;
+}
+
+bool PresetStore::layoutCurrent() {
+  return layoutIs(EEPROM_LAYOUT_ID);
+}
+
+bool PresetStore::sessionRingCurrent() {
+  return layoutIs(EEPROM_LAYOUT_ID) || layoutIs(LAYOUT_2_ID);
+}
+
+void PresetStore::begin() {
+  if (layoutCurrent()) {
+    DEBUG_PRINTLN("EEPROM already initialized");
+    load();
+    return;
+  }
+
+  const uint8_t initFlag = EEPROM.read(EEPROM_INIT_FLAG_ADDR);
+  const uint8_t version = EEPROM.read(EEPROM_HEADER_ADDR);
+  bool highTableKept = false;
+  if (layoutIs(LAYOUT_2_ID)) {
+    // Same tables and records; the messages take the end of the ring
+    DEBUG_PRINTLN("Folding layout 2 journal into preset tables");
+    foldJournal(LAYOUT_2_JOURNAL_SLOTS);
+    highTableKept = true;
+  } else if (initFlag == EEPROM_JOURNAL_MAGIC) {
+    DEBUG_PRINTLN("Folding preset journal into base table");
+    foldLegacyJournal();
+  } else if (NUM_LOOPS <= 4 && initFlag == EEPROM_HEADER_MAGIC && version == 1 &&
+             EEPROM.read(EEPROM_HEADER_ADDR + 1) == (uint8_t)~version) {
+    // Only 4-loop units ran layout 1, with the records this build reads
+    DEBUG_PRINTLN("Folding layout 1 journal into base table");
+    foldJournal(LAYOUT_1_JOURNAL_SLOTS);
+  } else if (initFlag == EEPROM_HEADER_MAGIC) {
+    // Written by other firmware, or for another loop count; every layout keeps the base table
+    DEBUG_PRINTLN("Unknown EEPROM layout - keeping base table");
+  } else if (initFlag != EEPROM_INIT_MAGIC) {
+    DEBUG_PRINTLN("First boot - initializing EEPROM");
+    // First boot - initialize all presets to 0 (all loops off)
+    for (uint8_t i = 0; i < TOTAL_PRESETS; i++) {
+      EEPROM.write(EEPROM_PRESETS_START_ADDR + i, 0);
+    }
+  }
+  // From here on the base table alone holds the presets, wherever power is lost
+  EEPROM.update(EEPROM_INIT_FLAG_ADDR, EEPROM_INIT_MAGIC);
+  format(highTableKept);
+  load();
+}
+
+void PresetStore::foldLegacyJournal() {
+  for (uint8_t i = 0; i < TOTAL_PRESETS; i++) {
+    cache.set(i, EEPROM.read(EEPROM_PRESETS_START_ADDR + i));
+  }
+  const uint8_t legacyLap = EEPROM.read(LEGACY_JOURNAL_START_ADDR) >> 7;
+  for (uint16_t slot = 0; slot < LEGACY_JOURNAL_SLOTS; slot++) {
+    const uint8_t indexByte = EEPROM.read(LEGACY_JOURNAL_START_ADDR + slot * 2);
+    const uint8_t loopsByte = EEPROM.read(LEGACY_JOURNAL_START_ADDR + slot * 2 + 1);
+    if ((indexByte >> 7) != legacyLap || (loopsByte >> 7) != legacyLap ||
+        ((loopsByte >> 4) & 0x07) != legacyRecordCheck(indexByte & 0x7F, loopsByte & 0x0F)) {
+      break;
+    }
+    cache.set(indexByte & 0x7F, loopsByte & 0x0F);
+  }
+  for (uint8_t i = 0; i < TOTAL_PRESETS; i++) {
+    EEPROM.update(EEPROM_PRESETS_START_ADDR + i, (uint8_t)cache.get(i));
+  }
+}
+
+void PresetStore::foldJournal(uint16_t slots) {
+  for (uint8_t i = 0; i < TOTAL_PRESETS; i++) {
+    cache.set(i, readPreset(i));
+  }
+  lap = EEPROM.read(slotAddress(0)) >> 7;
+  uint8_t index;
+  LoopMask loops;
+  for (uint16_t slot = 0; slot < slots && readRecord(slot, index, loops); slot++) {
+    cache.set(index, loops);
+  }
+  for (uint8_t i = 0; i < TOTAL_PRESETS; i++) {
+    for (uint8_t b = 0; b < LOOP_BYTES; b++) {
+      EEPROM.update(presetByteAddress(i, b), storedPresetByte(cache.get(i), b));
+    }
+  }
+}
+
+void PresetStore::format(bool highTableKept) {
+  // Bank CRCs over the preset tables as they stand, cut down to this unit's
+  // loops; only layout 2 had loops 9-16 where they are now
+  for (uint8_t i = 0; i < TOTAL_PRESETS; i++) {
+    cache.set(i, highTableKept ? readPreset(i) : EEPROM.read(EEPROM_PRESETS_START_ADDR + i));
+    EEPROM.update(EEPROM_PRESETS_START_ADDR + i, (uint8_t)cache.get(i));
+    if (LOOP_BYTES > 1) EEPROM.update(EEPROM_PRESETS_HIGH_ADDR + i, storedPresetByte(cache.get(i), 1));
+  }
+  for (uint8_t bank = 0; bank < NUM_BANKS; bank++) {
+    EEPROM.update(EEPROM_BANK_CRC_ADDR + bank, bankCrc(cache, bank));
+  }
+
+  // Whatever the journal area held before must not replay
+  const uint8_t firstIndex = EEPROM.read(slotAddress(0));
+  uint8_t index;
+  LoopMask loops;
+  lap = firstIndex >> 7;
+  if (readRecord(0, index, loops)) {
+    EEPROM.write(slotAddress(0), firstIndex ^ 0x80);
+  }
+  PresetMessages::format();
+
+  EEPROM.update(EEPROM_HEADER_ADDR, EEPROM_LAYOUT_ID);
+  EEPROM.update(EEPROM_HEADER_ADDR + 1, (uint8_t)~EEPROM_LAYOUT_ID);
+  EEPROM.write(EEPROM_INIT_FLAG_ADDR, EEPROM_HEADER_MAGIC);
+}
+
+void PresetStore::load() {
+  // Preset tables, each bank checked against its CRC
+  uint32_t badBanks = 0;
+  for (uint8_t bank = 0; bank < NUM_BANKS; bank++) {
+    uint8_t crc = CRC_INIT;
+    for (uint8_t i = bank * PRESETS_PER_BANK; i < (bank + 1) * PRESETS_PER_BANK; i++) {
+      const LoopMask loops = readPreset(i);
+      for (uint8_t b = 0; b < LOOP_BYTES; b++) crc = _crc8_ccitt_update(crc, (uint8_t)(loops >> (8 * b)));
+      cache.set(i, loops);
+    }
+    if (crc != EEPROM.read(EEPROM_BANK_CRC_ADDR + bank)) {
+      badBanks |= (uint32_t)1 << bank;
+    }
+  }
+
+  // The journal's lap is the one slot 0 was written in. While it replays,
+  // dirty[] marks the presets it holds.
+  memset(dirty, 0, sizeof(dirty));
+  lap = EEPROM.read(slotAddress(0)) >> 7;
+  uint8_t index;
+  LoopMask loops;
+  for (head = 0; head < JOURNAL_SLOTS && readRecord(head, index, loops); head++) {
+    cache.set(index, loops);
+    dirty[index >> 3] |= 1 << (index & 7);
+  }
+  if (head == 0) {
+    // Empty journal. Starting on the lap the next slot is not in spares a fence write.
+    lap = (EEPROM.read(slotAddress(1)) >> 7) ^ 1;
+  }
+
+  // With the ring full, power was lost while a bank was written back and
+  // every byte that changed is in the ring. Otherwise presets of a failed
+  // bank that the journal does not hold are lost.
+  repaired = 0;
+  reset = 0;
+  for (uint8_t bank = 0; bank < NUM_BANKS; bank++) {
+    if (!(badBanks & ((uint32_t)1 << bank))) continue;
+    bool lost = false;
+    for (uint8_t i = bank * PRESETS_PER_BANK; head < JOURNAL_SLOTS && i < (bank + 1) * PRESETS_PER_BANK; i++) {
+      if (!(dirty[i >> 3] & (1 << (i & 7)))) {
+        cache.set(i, 0);
+        lost = true;
+      }
+    }
+    if (lost) {
+      reset++;
+    } else {
+      repaired++;
+    }
+  }
+
+  committed = cache;
+  memset(dirty, 0, sizeof(dirty));
+  dirtyCount = 0;
+  nextDirty = 0;
+  staleBanks = badBanks;
+  writeBackBank = 0;
+  step = (head == JOURNAL_SLOTS || badBanks) ? STEP_WRITE_BACK : STEP_IDLE;
+
+  DEBUG_PRINT("Preset journal: ");
+  DEBUG_PRINT(head);
+  DEBUG_PRINTLN(" records");
+  if (badBanks) {
+    DEBUG_PRINT("Banks repaired: ");
+    DEBUG_PRINT(repaired);
+    DEBUG_PRINT(", reset: ");
+    DEBUG_PRINTLN(reset);
+  }
+}
+
+bool PresetStore::readRecord(uint16_t slot, uint8_t& index, LoopMask& loops) {
+  const uint16_t address = slotAddress(slot);
+  const uint8_t indexByte = EEPROM.read(address);
+  if ((indexByte >> 7) != lap) return false;
+  LoopMask loopBytes = 0;
+  for (uint8_t i = 0; i < LOOP_BYTES; i++) {
+    loopBytes |= (LoopMask)(EEPROM.read(address + 1 + i) << (8 * i));
+  }
+  // Bits past the loops are zero but for the lap
+  if ((LoopMask)(loopBytes & ~ALL_LOOPS) != lapLoops(lap, 0)) return false;
+  if (EEPROM.read(address + 1 + LOOP_BYTES) != recordCrc(indexByte, loopBytes)) return false;
+  index = indexByte & 0x7F;
+  loops = loopBytes & ALL_LOOPS;
+  return true;
+}
+
+// CRC-8 of a bank's preset table bytes, base table byte first
+uint8_t PresetStore::bankCrc(const PresetTable<>& table, uint8_t bank) {
+  uint8_t crc = CRC_INIT;
+  for (uint8_t i = bank * PRESETS_PER_BANK; i < (bank + 1) * PRESETS_PER_BANK; i++) {
+    const LoopMask loops = table.get(i);
+    for (uint8_t b = 0; b < LOOP_BYTES; b++) crc = _crc8_ccitt_update(crc, (uint8_t)(loops >> (8 * b)));
+  }
+  return crc;
+}
+
+LoopMask PresetStore::get(uint8_t index) const {
+  if (index >= TOTAL_PRESETS) return 0;
+  return cache.get(index);
+}
+
+void PresetStore::set(uint8_t index, LoopMask loops) {
+  if (index >= TOTAL_PRESETS) return;
+  cache.set(index, loops);
+
+  const uint8_t bit = 1 << (index & 7);
+  if (!(dirty[index >> 3] & bit)) {
+    dirty[index >> 3] |= bit;
+    dirtyCount++;
+  }
+}
+
+bool PresetStore::isIdle() const {
+  return step == STEP_IDLE && dirtyCount == 0;
+}
+
+bool PresetStore::isCommitted(uint8_t index) const {
+  if (index >= TOTAL_PRESETS) return true;
+  return committed.get(index) == cache.get(index);
+}
+
+bool PresetStore::startRecord() {
+  if (dirtyCount == 0) return false;
+
+  // Round robin, so a preset saved over and over cannot hold the others back
+  uint8_t index = nextDirty;
+  while (!(dirty[index >> 3] & (1 << (index & 7)))) {
+    index = (index + 1) % TOTAL_PRESETS;
+  }
+  dirty[index >> 3] &= ~(1 << (index & 7));
+  dirtyCount--;
+  nextDirty = (index + 1) % TOTAL_PRESETS;
+
+  // Saved again while this record is written: dirty again, written again
+  recordIndex = index;
+  recordLoops = get(index);
+  recordByte = 0;
+
+  uint8_t nextIndex;
+  LoopMask nextLoops;
+  const bool nextLooksCurrent = head + 1 < JOURNAL_SLOTS && readRecord(head + 1, nextIndex, nextLoops);
+  step = nextLooksCurrent ? STEP_FENCE : STEP_LOOPS;
+  return true;
+}
+
+void PresetStore::writeBack() {
+  // Past a full ring every bank is brought up to date, otherwise only those that failed their CRC
+  const bool wrapping = head == JOURNAL_SLOTS;
+  for (; writeBackBank < NUM_BANKS; writeBackBank++) {
+    const uint32_t bankBit = (uint32_t)1 << writeBackBank;
+    if (!wrapping && !(staleBanks & bankBit)) continue;
+
+    // Committed values only: each byte written is one the ring can replay
+    const uint8_t first = writeBackBank * PRESETS_PER_BANK;
+    for (uint8_t i = first; i < first + PRESETS_PER_BANK; i++) {
+      const LoopMask loops = committed.get(i);
+      for (uint8_t b = 0; b < LOOP_BYTES; b++) {
+        const uint16_t address = presetByteAddress(i, b);
+        const uint8_t value = storedPresetByte(loops, b);
+        if (EEPROM.read(address) != value) {
+          EEPROM.write(address, value);
+          staleBanks |= bankBit;
+          return;
+        }
+      }
+    }
+    if (staleBanks & bankBit) {
+      EEPROM.write(EEPROM_BANK_CRC_ADDR + writeBackBank, bankCrc(committed, writeBackBank));
+      staleBanks &= ~bankBit;
+    }
+    // The next bank waits for the next update, so an update reads one bank's bytes at most
+    writeBackBank++;
+    return;
+  }
+
+  // The base table now holds everything the ring did: start the next lap
+  if (wrapping) {
+    head = 0;
+    lap ^= 1;
+  }
+  step = STEP_IDLE;
+}
+
+void PresetStore::update() {
+  PROFILE_SCOPE(PROFILE_PRESET_STORE);
+  // A write in progress would make the next access wait for it
+  if (!eeprom_is_ready()) return;
+  if (step == STEP_IDLE && !startRecord()) return;
+
+  const uint16_t address = slotAddress(head);
+  switch (step) {
+    case STEP_FENCE: {
+      const uint16_t nextAddress = slotAddress(head + 1);
+      EEPROM.write(nextAddress, EEPROM.read(nextAddress) ^ 0x80);
+      step = STEP_LOOPS;
+      break;
+    }
+
+    case STEP_LOOPS:
+      EEPROM.write(address + 1 + recordByte, (uint8_t)(lapLoops(lap, recordLoops) >> (8 * recordByte)));
+      recordByte++;
+      if (recordByte == LOOP_BYTES) step = STEP_CHECK;
+      break;
+
+    case STEP_CHECK:
+      EEPROM.write(address + 1 + LOOP_BYTES, recordCrc((uint8_t)((lap << 7) | recordIndex), lapLoops(lap, recordLoops)));
+      step = STEP_INDEX;
+      break;
+
+    case STEP_INDEX:
+      EEPROM.write(address, (uint8_t)((lap << 7) | recordIndex));
+      committed.set(recordIndex, recordLoops);
+      head++;
+      if (head == JOURNAL_SLOTS) {
+        step = STEP_WRITE_BACK;
+        writeBackBank = 0;
+      } else {
+        step = STEP_IDLE;
+      }
+      break;
+
+    case STEP_WRITE_BACK:
+      writeBack();
+      break;
+
+    default:
+      break;
+  }
+}
@@ -0,0 +1,182 @@
+#ifndef PRESET_STORE_H
+#define PRESET_STORE_H
+
+#include <Arduino.h>
+#include "config.h"
+#include "loop_mask.h"
+
+/**
+ * PresetTable - Loops of all 128 presets: a LoopMask each, or two presets
+ * to a byte when the loops fit in a nibble
+ */
+template <bool NIBBLES = (NUM_LOOPS <= 4)>
+class PresetTable {
+public:
+  PresetTable() : masks{} {}
+
+  LoopMask get(uint8_t index) const { return masks[index]; }
+  void set(uint8_t index, LoopMask loops) { masks[index] = loops & ALL_LOOPS; }
+
+private:
+  LoopMask masks[TOTAL_PRESETS];
+};
+
+template <>
+class PresetTable<true> {
+public:
+  PresetTable() : pairs{} {}
+
+  LoopMask get(uint8_t index) const {
+    return (pairs[index >> 1] >> ((index & 1) ? 4 : 0)) & 0x0F;
+  }
+
+  void set(uint8_t index, LoopMask loops) {
+    const uint8_t shift = (index & 1) ? 4 : 0;
+    uint8_t& pair = pairs[index >> 1];
+    pair = (uint8_t)((pair & ~(0x0F << shift)) | ((loops & ALL_LOOPS) << shift));
+  }
+
+private:
+  // Odd indexes in the high nibble
+  uint8_t pairs[TOTAL_PRESETS / 2];
+};
+
+/**
+ * PresetStore - Presets in RAM, journaled to EEPROM in the background
+ *
+ * All 128 presets live in a RAM cache (a PresetTable: one nibble each on a
+ * 4-loop unit, a LoopMask each on larger ones), so reads never touch
+ * EEPROM. A change only updates the cache and marks the preset dirty;
+ * update(), called from the storage task, commits at most one EEPROM
+ * byte and only when the previous write has finished, so no caller ever
+ * waits the ~3.3 ms an EEPROM write takes.
+ *
+ * EEPROM holds a base table (one byte per preset with loops 1-8, the
+ * layout earlier firmware used), a header with the layout version, a
+ * CRC-8 per bank of the preset tables, on units with more than 8 loops a
+ * second table with loops 9-16 (inverted, so an erased one reads as
+ * all loops off), and a journal ring up to the session ring.
+ * A change is appended to the ring as a record rather than rewriting the
+ * preset's own bytes, which spreads the wear of a preset edited over and
+ * over across the whole ring. On a 4-loop unit a record is 3 bytes:
+ *
+ *   byte 0: lap bit 7 | preset index 0-127
+ *   byte 1: lap bit 7 | loops bits 0-3 (bits 4-6 zero)
+ *   byte 2: CRC-8 of bytes 0 and 1
+ *
+ * Larger units have LOOP_BYTES loop bytes, low byte first, with the lap in
+ * the top bit only if the loops leave it free, then the CRC.
+ *
+ * The lap bit flips each time the ring wraps, so the newest record is the
+ * last one carrying the same lap as slot 0. Byte 0 is written last: a
+ * record cut short by a power loss, even one whose last byte was left
+ * half-programmed, fails its lap bits or CRC and ends the journal. Before
+ * a record goes in, the slot after it is invalidated if it could be
+ * mistaken for part of the current lap. The ring ends where the preset
+ * messages (PresetMessages) start.
+ *
+ * When the ring is full, the base table is written back bank by bank: the
+ * presets that differ from their newest record, then the bank's CRC. Then
+ * the lap flips and the ring starts again at slot 0. Only values already
+ * in the ring are written back, so a power loss at any point, including
+ * one that leaves a base byte or CRC torn, replays the full ring over the
+ * base table and recovers every preset whose record was complete.
+ *
+ * load() checks every bank of the preset tables against its CRC. A bank that
+ * fails while the ring is full was being written back and the journal has
+ * repaired it. Any other failing bank keeps the presets the journal holds
+ * and resets the rest of that bank to all loops off; the other banks are
+ * untouched. Either way the bank is rewritten in the background.
+ */
+class PresetStore {
+public:
+  PresetStore();
+
+  /**
+   * Power-up: bring EEPROM to the current layout if it is not (first
+   * boot, or the layout of earlier firmware, keeping its presets), then
+   * load().
+   */
+  void begin();
+
+  // EEPROM holds the current layout (header and version check out)
+  static bool layoutCurrent();
+  // The session ring is where this firmware keeps it: the current layout, or layout 2
+  static bool sessionRingCurrent();
+
+  /**
+   * Rebuild the cache from EEPROM: the base table, checked bank by bank,
+   * then the journal replayed over it. Changes not yet committed are
+   * forgotten.
+   */
+  void load();
+
+  // Loops of preset index 0-127 as bits (loop 1 = bit 0)
+  LoopMask get(uint8_t index) const;
+
+  /**
+   * Change a preset. Returns at once; the write happens in update().
+   */
+  void set(uint8_t index, LoopMask loops);
+
+  /**
+   * Commit at most one EEPROM byte, if the EEPROM is ready.
+   * Call from the storage task.
+   */
+  void update();
+
+  // Nothing waiting to be written
+  bool isIdle() const;
+
+  // A power loss now would keep what get() returns for this preset
+  bool isCommitted(uint8_t index) const;
+
+  // Banks that failed their CRC at the last load(), repaired from the journal
+  uint8_t repairedBanks() const { return repaired; }
+  // Banks that failed their CRC at the last load() and were partly reset
+  uint8_t resetBanks() const { return reset; }
+
+  // Journal layout
+  static const uint8_t LOOP_BYTES = sizeof(LoopMask);
+  static const uint8_t RECORD_SIZE = LOOP_BYTES + 2;
+  static const uint16_t JOURNAL_SLOTS = (EEPROM_MESSAGES_START_ADDR - EEPROM_JOURNAL_START_ADDR) / RECORD_SIZE;
+
+private:
+  enum Step {
+    STEP_IDLE,
+    STEP_FENCE,       // Invalidate the slot after the one being written
+    STEP_LOOPS,       // Record loop bytes, one per update
+    STEP_CHECK,       // Record CRC
+    STEP_INDEX,       // Record byte 0, which completes the record
+    STEP_WRITE_BACK   // Bring base table banks up to date from the journal
+  };
+
+  PresetTable<> cache;       // Newest values, as saved
+  PresetTable<> committed;   // Values a boot would load
+  uint8_t dirty[TOTAL_PRESETS / 8];
+  uint8_t dirtyCount;
+  uint8_t nextDirty;       // Where the search for a dirty preset resumes
+  uint16_t head;           // Slot the next record goes in
+  uint8_t lap;             // Lap bit of records in the current pass over the ring
+  Step step;
+  uint8_t recordIndex;     // Record being written
+  LoopMask recordLoops;
+  uint8_t recordByte;      // Loop bytes of it written
+  uint8_t writeBackBank;   // Next bank to write back
+  uint32_t staleBanks;     // Banks whose CRC must be rewritten
+  uint8_t repaired;
+  uint8_t reset;
+
+  static uint8_t bankCrc(const PresetTable<>& table, uint8_t bank);
+  void foldLegacyJournal();
+  // Replay the first slots of the journal into the preset tables
+  void foldJournal(uint16_t slots);
+  // Set up the current layout over the base table, and loops 9-16 if the layout before had them
+  void format(bool highTableKept);
+  bool startRecord();
+  // Read a slot; true if it holds a complete record of the current lap
+  bool readRecord(uint16_t slot, uint8_t& index, LoopMask& loops);
+  void writeBack();
+};
+
+#endif
@@ -0,0 +1,196 @@
+#include "preset_transfer.h"
+#include <util/crc16.h>
+#include "midi_handler.h"
+#include "sysex.h"
+
+static const uint8_t CRC_INIT = 0xFF;
+// Not a PresetReply: the chunk is held and answered once it is taken
+static const uint8_t REPLY_LATER = 0xFF;
+// Bytes of a preset's loops in a chunk from this unit
+static const uint8_t LOOP_SEPTETS = (NUM_LOOPS + 6) / 7;
+
+// Chunks of loops in a dump or restore
+static const uint8_t LOOP_CHUNKS = TOTAL_PRESETS / PresetTransfer::PRESETS_PER_CHUNK;
+
+static_assert(TOTAL_PRESETS % PresetTransfer::PRESETS_PER_CHUNK == 0, "Chunks of loops cover the presets evenly");
+static_assert(LOOP_CHUNKS <= 8, "A bit of loopsWaiting for each chunk of loops");
+static_assert(3 + packedSize(PRESET_MESSAGE_BYTES) + 2 <= PresetTransfer::CHUNK_MAX_SIZE,
+              "A preset's messages fit in a chunk");
+static_assert(3 + PresetTransfer::CHUNK_MAX_SIZE <= MIDI_RX_SYSEX_SIZE, "A chunk fits in the SysEx receive buffer");
+
+static uint8_t chunkCrc(const uint8_t* data, uint8_t length) {
+  uint8_t crc = CRC_INIT;
+  for (uint8_t i = 0; i < length; i++) crc = _crc8_ccitt_update(crc, data[i]);
+  return crc;
+}
+
+PresetTransfer::PresetTransfer(PresetStore& presets, PresetMessages& messages)
+  : presets(presets),
+    messages(messages),
+    dumpStep(DUMP_IDLE),
+    dumpPreset(0),
+    writing(false),
+    writingKind(0),
+    writingPreset(0),
+    held(false),
+    heldKind(0),
+    heldPreset(0),
+    heldCount(0),
+    heldBytes{},
+    loopsWaiting(0) {
+}
+
+void PresetTransfer::requestDump() {
+  dumpStep = DUMP_HEADER;
+  dumpPreset = 0;
+}
+
+uint8_t PresetTransfer::buildChunk(uint8_t* chunk) {
+  uint8_t* out = chunk;
+  if (dumpStep == DUMP_HEADER) {
+    uint8_t withMessages = 0;
+    for (uint8_t i = 0; i < TOTAL_PRESETS; i++) {
+      if (messages.has(i)) withMessages++;
+    }
+    *out++ = PRESET_CHUNK_HEADER;
+    *out++ = NUM_LOOPS;
+    out = putSeptets(out, withMessages, 2);
+  } else if (dumpStep == DUMP_LOOPS) {
+    *out++ = PRESET_CHUNK_LOOPS;
+    *out++ = dumpPreset;
+    *out++ = NUM_LOOPS;
+    for (uint8_t i = 0; i < PRESETS_PER_CHUNK; i++) {
+      out = putSeptets(out, presets.get(dumpPreset + i), LOOP_SEPTETS);
+    }
+  } else {
+    uint8_t bytes[PRESET_MESSAGE_BYTES];
+    const uint8_t length = messages.get(dumpPreset, bytes);
+    *out++ = PRESET_CHUNK_MESSAGES;
+    *out++ = dumpPreset;
+    *out++ = length;
+    out = packBytes(out, bytes, length);
+  }
+  out = putSeptets(out, chunkCrc(chunk, out - chunk), 2);
+  return out - chunk;
+}
+
+void PresetTransfer::update() {
+  if (writing && messages.isIdle()) {
+    writing = !sendReply(writingKind, writingPreset, PRESET_REPLY_WRITTEN);
+  }
+  // Its OK gets the room in the transmit queue it finds; without it, the chunk is sent again
+  if (held && !writing && messages.isIdle()) {
+    sendReply(heldKind, heldPreset, takeHeld());
+  }
+  for (uint8_t chunk = 0; chunk < LOOP_CHUNKS; chunk++) {
+    const uint8_t first = chunk * PRESETS_PER_CHUNK;
+    if (!(loopsWaiting & (1 << chunk)) || !loopsCommitted(first)) continue;
+    if (!sendReply(PRESET_CHUNK_LOOPS, first, PRESET_REPLY_WRITTEN)) break;
+    loopsWaiting &= ~(1 << chunk);
+  }
+
+  if (dumpStep == DUMP_MESSAGES) {
+    while (dumpPreset < TOTAL_PRESETS && !messages.has(dumpPreset)) dumpPreset++;
+    if (dumpPreset == TOTAL_PRESETS) dumpStep = DUMP_IDLE;
+  }
+  if (dumpStep == DUMP_IDLE) return;
+
+  uint8_t chunk[CHUNK_MAX_SIZE];
+  const uint8_t length = buildChunk(chunk);
+  // No room yet: the same chunk goes next pass
+  if (!sendMIDISysEx(SYSEX_PRESETS_CHUNK, chunk, length)) return;
+
+  if (dumpStep == DUMP_HEADER) {
+    dumpStep = DUMP_LOOPS;
+  } else if (dumpStep == DUMP_LOOPS) {
+    dumpPreset += PRESETS_PER_CHUNK;
+    if (dumpPreset == TOTAL_PRESETS) {
+      dumpStep = DUMP_MESSAGES;
+      dumpPreset = 0;
+    }
+  } else {
+    dumpPreset++;
+  }
+}
+
+bool PresetTransfer::restoreLoops(const uint8_t* data, uint8_t length) {
+  const uint8_t first = data[1];
+  const uint8_t loopCount = data[2];
+  if (first >= TOTAL_PRESETS || first % PRESETS_PER_CHUNK != 0 || loopCount < 1 || loopCount > 16) return false;
+  const uint8_t septets = (loopCount + 6) / 7;
+  if (length != 3 + PRESETS_PER_CHUNK * septets + 2) return false;
+
+  const uint8_t* in = data + 3;
+  for (uint8_t i = 0; i < PRESETS_PER_CHUNK; i++) {
+    const LoopMask loops = getSeptets(in, septets) & ALL_LOOPS;
+    // A preset restored to what it holds takes no journal record
+    if (presets.get(first + i) != loops) presets.set(first + i, loops);
+  }
+  return true;
+}
+
+uint8_t PresetTransfer::restoreMessages(const uint8_t* data, uint8_t length) {
+  const uint8_t preset = data[1];
+  const uint8_t count = data[2];
+  if (preset >= TOTAL_PRESETS || count > PRESET_MESSAGE_BYTES || length != 3 + packedSize(count) + 2) {
+    return PRESET_REPLY_BAD;
+  }
+  if (held) return PRESET_REPLY_BUSY;
+
+  const uint8_t* in = data + 3;
+  unpackBytes(in, heldBytes, count);
+  heldCount = count;
+  return hold(PRESET_CHUNK_MESSAGES, preset);
+}
+
+uint8_t PresetTransfer::hold(uint8_t kind, uint8_t preset) {
+  held = true;
+  heldKind = kind;
+  heldPreset = preset;
+  return (writing || !messages.isIdle()) ? REPLY_LATER : takeHeld();
+}
+
+uint8_t PresetTransfer::takeHeld() {
+  held = false;
+  const bool taken = (heldKind == PRESET_CHUNK_HEADER) ? messages.clear()
+                                                       : messages.set(heldPreset, heldBytes, heldCount);
+  if (!taken) return PRESET_REPLY_BAD;
+  writing = true;
+  writingKind = heldKind;
+  writingPreset = heldPreset;
+  return PRESET_REPLY_OK;
+}
+
+void PresetTransfer::restore(const uint8_t* data, uint8_t length) {
+  const uint8_t kind = (length > 0) ? data[0] : 0;
+  const uint8_t preset = (length > 1) ? data[1] : 0;
+
+  uint8_t status = PRESET_REPLY_BAD;
+  if (length >= 3) {
+    const uint8_t* in = data + length - 2;
+    if (getSeptets(in, 2) == chunkCrc(data, length - 2)) {
+      if (kind == PRESET_CHUNK_HEADER && length == 6) {
+        status = held ? PRESET_REPLY_BUSY : hold(PRESET_CHUNK_HEADER, 0);
+      } else if (kind == PRESET_CHUNK_LOOPS) {
+        status = restoreLoops(data, length) ? PRESET_REPLY_OK : PRESET_REPLY_BAD;
+      } else if (kind == PRESET_CHUNK_MESSAGES) {
+        status = restoreMessages(data, length);
+      }
+    }
+  }
+
+  if (status == PRESET_REPLY_OK && kind == PRESET_CHUNK_LOOPS) loopsWaiting |= 1 << (preset / PRESETS_PER_CHUNK);
+  if (status != REPLY_LATER) sendReply(kind, (kind == PRESET_CHUNK_HEADER) ? 0 : preset, status);
+}
+
+bool PresetTransfer::loopsCommitted(uint8_t first) const {
+  for (uint8_t i = 0; i < PRESETS_PER_CHUNK; i++) {
+    if (!presets.isCommitted(first + i)) return false;
+  }
+  return true;
+}
+
+bool PresetTransfer::sendReply(uint8_t kind, uint8_t preset, uint8_t status) {
+  const uint8_t message[3] = {kind, preset, status};
+  return sendMIDISysEx(SYSEX_PRESETS_REPLY, message, sizeof(message));
+}
@@ -0,0 +1,152 @@
+#ifndef PRESET_TRANSFER_H
+#define PRESET_TRANSFER_H
+
+#include <Arduino.h>
+#include "config.h"
+#include "preset_store.h"
+#include "preset_messages.h"
+
+/**
+ * PresetTransfer - Presets and their messages in and out over SysEx
+ *
+ * SysEx command SYSEX_PRESETS_REQUEST sends every preset as a stream of
+ * chunks, one per main-loop pass as room in the transmit queue allows.
+ * Chunks sent back with the same command restore them, so a dump saved by
+ * a MIDI monitor or librarian restores the unit it came from or clones it
+ * onto another one:
+ *
+ *   F0 7D 4C 44 00 <loop count> <presets with messages: 2 bytes> <crc: 2 bytes> F7
+ *   F0 7D 4C 44 01 <first preset 0-127> <loop count>
+ *      <loops of 16 presets: (loop count + 6) / 7 bytes each> <crc: 2 bytes> F7
+ *   F0 7D 4C 44 02 <preset 0-127> <n> <n bytes of messages, packed> <crc: 2 bytes> F7
+ *
+ * The header goes first, then 8 chunks of loops, then a chunk for each
+ * preset with messages. A chunk waits for room in the transmit queue, and
+ * once queued it goes out whole, whatever else is sent meanwhile.
+ * Multi-byte values are 7 bits a byte, low first; the messages, which keep
+ * their status bytes, go 8 bits in 7 (sysex.h). The CRC is the CRC-8 of
+ * the chunk from its kind byte on.
+ *
+ * Each chunk received is checked and answered:
+ *
+ *   F0 7D 4C 45 <kind> <preset or first preset, 0 for the header> <PresetReply> F7
+ *
+ * Restoring a header removes the messages of every preset, so those the
+ * restore does not bring back are gone; a chunk of loops sets 16 presets,
+ * loops past this unit's dropped and its loops past the sender's off.
+ * A chunk is answered OK when it is taken, and answered again WRITTEN once
+ * what it took would survive a power loss:
+ *
+ * - Loops go into the preset store's RAM cache the pass they arrive, so a
+ *   stream of loops is taken as fast as the wire brings it. The store
+ *   journals them to EEPROM in the background, as it does a save, and a
+ *   chunk is answered WRITTEN once its 16 presets are in the journal.
+ * - Messages have no copy in RAM and go to EEPROM one change at a time,
+ *   ahead of the loops, at EEPROM_WRITES_PER_PASS bytes a pass. The header
+ *   or chunk of messages that arrives while one is being written is held
+ *   until it is done, then taken and answered; one that arrives while
+ *   another is held is answered PRESET_REPLY_BUSY. Send a chunk of
+ *   messages after the OK to the header or chunk of messages before it;
+ *   the loops need not be answered first.
+ *
+ * A restore sent without waiting for replies is taken as fast as the wire
+ * brings it if each chunk of messages is followed by messagesWriteUs() of
+ * silence or of data bytes with no status, which MIDI receivers ignore
+ * and thru does not forward. The host `syxpresets` command writes such a
+ * restore from a dump, so any tool that sends a .syx file byte for byte
+ * can send it. MIDI OUT carries the forwarded restore as well as the
+ * replies, so it also leaves room for those behind every chunk.
+ *
+ * Chunks say what the presets hold rather than what changed, so sending
+ * one again is harmless. A reply the transmit queue has no room for is not
+ * sent; send the chunk again. A power loss before a chunk is answered
+ * WRITTEN may keep any part of it, so send again every chunk not answered
+ * WRITTEN.
+ */
+
+enum PresetChunk {
+  PRESET_CHUNK_HEADER,
+  PRESET_CHUNK_LOOPS,
+  PRESET_CHUNK_MESSAGES
+};
+
+enum PresetReply {
+  PRESET_REPLY_OK,        // Taken; WRITTEN follows
+  PRESET_REPLY_BAD,       // Wrong length, CRC or values, or no room for the messages; nothing changed
+  PRESET_REPLY_BUSY,      // Messages already held; send it again after the OK to the one before
+  PRESET_REPLY_WRITTEN    // What the chunk's OK took is in EEPROM
+};
+
+class PresetTransfer {
+public:
+  static const uint8_t PRESETS_PER_CHUNK = 16;
+  // Bytes of a chunk of loops from a unit with 16 loops, the longest there is
+  static const uint8_t CHUNK_MAX_SIZE = 3 + PRESETS_PER_CHUNK * 3 + 2;
+
+  PresetTransfer(PresetStore& presets, PresetMessages& messages);
+
+  /**
+   * Time the chunk of messages with the given bytes of messages takes to
+   * be written, from its OK: its record and the end of the log, and the
+   * pass that takes the next one.
+   */
+  static uint32_t messagesWriteUs(uint8_t count) {
+    const uint8_t bytes = count + PresetMessages::RECORD_OVERHEAD + 1;
+    return ((bytes + EEPROM_WRITES_PER_PASS - 1) / EEPROM_WRITES_PER_PASS + 1) * MAIN_LOOP_INTERVAL_MS * 1000UL;
+  }
+
+  // Send every preset, starting with the next update()
+  void requestDump();
+
+  /**
+   * Take a chunk received with SYSEX_PRESETS_CHUNK and queue its reply.
+   * @param data Its bytes after the command
+   */
+  void restore(const uint8_t* data, uint8_t length);
+
+  /**
+   * Send the next chunk of a requested dump, take a held chunk once the
+   * messages before it are written, and send the WRITTEN replies due.
+   * Call once per main-loop pass.
+   */
+  void update();
+
+  bool isDumping() const { return dumpStep != DUMP_IDLE; }
+
+private:
+  enum DumpStep {
+    DUMP_IDLE,
+    DUMP_HEADER,
+    DUMP_LOOPS,
+    DUMP_MESSAGES
+  };
+
+  PresetStore& presets;
+  PresetMessages& messages;
+  DumpStep dumpStep;
+  uint8_t dumpPreset;       // First preset of the next chunk of loops, or the next preset with messages
+  // The header or chunk of messages being written, answered WRITTEN once it is
+  bool writing;
+  uint8_t writingKind;
+  uint8_t writingPreset;
+  // The one taken next, held until that is done
+  bool held;
+  uint8_t heldKind;
+  uint8_t heldPreset;
+  uint8_t heldCount;
+  uint8_t heldBytes[PRESET_MESSAGE_BYTES];
+  uint8_t loopsWaiting;     // Chunks of loops taken, a bit each, answered WRITTEN once in the journal
+
+  // The dump's next chunk, from its kind byte to its CRC; returns its size
+  uint8_t buildChunk(uint8_t* chunk);
+  // A chunk of loops or messages after its CRC checked out
+  bool restoreLoops(const uint8_t* data, uint8_t length);
+  uint8_t restoreMessages(const uint8_t* data, uint8_t length);   // PresetReply, or none yet
+  // Hold a header or chunk of messages, taking it at once if nothing is being written
+  uint8_t hold(uint8_t kind, uint8_t preset);                      // PresetReply, or none yet
+  uint8_t takeHeld();                                              // PresetReply
+  bool loopsCommitted(uint8_t first) const;
+  bool sendReply(uint8_t kind, uint8_t preset, uint8_t status);
+};
+
+#endif
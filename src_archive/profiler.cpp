@@ -0,0 +1,98 @@
+#include "profiler.h"
+
+#ifdef PROFILE_MODE
+#include "midi_handler.h"
+#include "sysex.h"
+
+// Bytes after the command: section, section count, three 32-bit figures, the buckets
+static const uint8_t SECTION_MESSAGE_SIZE = 2 + 3 * 5 + PROFILE_BUCKETS * 3;
+
+static volatile uint16_t overflows = 0;
+static uint32_t probeCycles = 0;   // Cost of a probe with nothing inside it
+static ProfileStats stats[PROFILE_SECTIONS];
+static uint8_t dumpNext = PROFILE_SECTIONS;   // Section to send next; PROFILE_SECTIONS = no dump
+
+ISR(TIMER1_OVF_vect) {
+  overflows++;
+}
+
+void initProfiler() {
+  noInterrupts();
+  // The core runs Timer1 as PWM for pins 9 and 10; normal mode at the CPU clock
+  TCCR1A = 0;
+  TCNT1 = 0;
+  TIFR1 = _BV(TOV1);
+  TIMSK1 = _BV(TOIE1);
+  TCCR1B = _BV(CS10);
+  overflows = 0;
+  interrupts();
+
+  // The smallest of a few tries, so an interrupt in the middle does not count
+  probeCycles = 0xFFFFFFFF;
+  for (uint8_t i = 0; i < 8; i++) {
+    const uint32_t start = profileCycles();
+    const uint32_t cycles = profileCycles() - start;
+    if (cycles < probeCycles) probeCycles = cycles;
+  }
+  clearProfile();
+}
+
+uint32_t profileCycles() {
+  noInterrupts();
+  uint16_t high = overflows;
+  const uint16_t low = TCNT1;
+  // Wrapped while interrupts were off: the count has started over, the overflow is not in yet
+  if ((TIFR1 & _BV(TOV1)) && low < 0x8000) high++;
+  interrupts();
+  return ((uint32_t)high << 16) | low;
+}
+
+void recordProfile(ProfileSection section, uint32_t cycles) {
+  cycles = (cycles > probeCycles) ? cycles - probeCycles : 0;
+  ProfileStats& s = stats[section];
+  s.runs++;
+  if (cycles < s.minCycles) s.minCycles = cycles;
+  if (cycles > s.maxCycles) s.maxCycles = cycles;
+
+  uint8_t bucket = 0;
+  for (uint32_t limit = 64; bucket < PROFILE_BUCKETS - 1 && cycles >= limit; limit <<= 2) {
+    bucket++;
+  }
+  if (s.buckets[bucket] < 0xFFFF) s.buckets[bucket]++;
+}
+
+void requestProfileDump() {
+  dumpNext = 0;
+}
+
+void clearProfile() {
+  memset(stats, 0, sizeof(stats));
+  for (uint8_t i = 0; i < PROFILE_SECTIONS; i++) {
+    stats[i].minCycles = 0xFFFFFFFF;
+  }
+}
+
+void updateProfiler() {
+  if (dumpNext >= PROFILE_SECTIONS) return;
+
+  const ProfileStats& s = stats[dumpNext];
+  uint8_t message[SECTION_MESSAGE_SIZE];
+  uint8_t* out = message;
+  *out++ = dumpNext;
+  *out++ = PROFILE_SECTIONS;
+  out = putSeptets(out, s.runs, 5);
+  out = putSeptets(out, s.runs ? s.minCycles : 0, 5);
+  out = putSeptets(out, s.maxCycles, 5);
+  for (uint8_t i = 0; i < PROFILE_BUCKETS; i++) {
+    out = putSeptets(out, s.buckets[i], 3);
+  }
+
+  // No room yet: the same section goes next pass
+  if (sendMIDISysEx(SYSEX_PROFILE_SECTION, message, sizeof(message))) dumpNext++;
+}
+
+const ProfileStats& profileStats(ProfileSection section) {
+  return stats[section];
+}
+
+#endif
@@ -0,0 +1,103 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <Arduino.h>
+#include "config.h"
+
+/**
+ * Hot paths timed by the profiler
+ */
+enum ProfileSection {
+  PROFILE_READ_SWITCHES,     // SwitchHandler::readAndDebounce()
+  PROFILE_SWITCH_PATTERNS,   // ModeController::detectSwitchPatterns()
+  PROFILE_DISPLAY_UPDATE,    // Display::update()
+  PROFILE_LED_UPDATE,        // LedController::update()
+  PROFILE_PRESET_STORE,      // PresetStore::update(), journal and write-back
+  PROFILE_SESSION_STORE,     // SessionStore::update()
+  PROFILE_MIDI_SEND,         // sendMIDIMessage() and sendMIDISysEx()
+  PROFILE_SECTIONS
+};
+
+// Histogram buckets: bucket b counts runs under 64 << 2b cycles (4 us << 2b
+// at 16 MHz), the last one everything longer
+const uint8_t PROFILE_BUCKETS = 8;
+
+/**
+ * Profiler - Cycle counts of the hot paths, built in with PROFILE_MODE
+ *
+ * Timer1 runs free at the CPU clock, its overflow interrupt extending the
+ * count to 32 bits, so a probe reads the cycles to the clock. PROFILE_SCOPE
+ * times the rest of the enclosing block; the cost of the probe itself,
+ * measured at start-up, is taken off. Sections nest: an outer one includes
+ * the time of any inside it, interrupts included.
+ *
+ * Each section keeps its run count, shortest and longest run and a
+ * histogram of run times in powers of four. The figures are read back over
+ * MIDI, so no debug build is needed: SysEx command SYSEX_PROFILE_REQUEST
+ * sends one SYSEX_PROFILE_SECTION message per section, as room in the
+ * transmit queue allows:
+ *
+ *   F0 7D 4C 41 <section> <PROFILE_SECTIONS>
+ *      <runs> <min cycles> <max cycles>   5 bytes each, 7 bits a byte, low first
+ *      <bucket 0> ... <bucket 7>          3 bytes each, saturating at 65535
+ *   F7
+ *
+ * Min cycles is 0 for a section that has not run. SYSEX_PROFILE_CLEAR
+ * starts every section over. Timer1 is the profiler's, so PWM on pins 9
+ * and 10 is lost in PROFILE_MODE builds.
+ *
+ * Without PROFILE_MODE the probes and calls below compile to nothing.
+ */
+#ifdef PROFILE_MODE
+
+struct ProfileStats {
+  uint32_t runs;
+  uint32_t minCycles;
+  uint32_t maxCycles;
+  uint16_t buckets[PROFILE_BUCKETS];
+};
+
+// Start Timer1 and measure the probe's own cost. Call once, late in setup.
+void initProfiler();
+
+// CPU cycles since initProfiler(), wrapping every 2^32 (about 4.5 minutes)
+uint32_t profileCycles();
+
+// Count one run of a section
+void recordProfile(ProfileSection section, uint32_t cycles);
+
+// Send the figures, starting with the next updateProfiler()
+void requestProfileDump();
+
+// Start every section over
+void clearProfile();
+
+// Send the next section of a requested dump. Call once per main-loop pass.
+void updateProfiler();
+
+const ProfileStats& profileStats(ProfileSection section);
+
+class ProfileScope {
+public:
+  explicit ProfileScope(ProfileSection section) : section(section), start(profileCycles()) {}
+  ~ProfileScope() { recordProfile(section, profileCycles() - start); }
+
+private:
+  const ProfileSection section;
+  const uint32_t start;
+};
+
+#define PROFILE_SCOPE(section) ProfileScope profileScope_(section)
+
+#else
+
+#define PROFILE_SCOPE(section) do {} while (0)
+
+inline void initProfiler() {}
+inline void requestProfileDump() {}
+inline void clearProfile() {}
+inline void updateProfiler() {}
+
+#endif
+
+#endif
@@ -2,17 +2,128 @@
 #define RELAYS_H
 
 #include <Arduino.h>
+#include "config.h"
+#include "loop_mask.h"
+#include "pin_map.h"
+#include "event_log.h"
 
-class RelayController {
+// ===== Compile-time relay pin mapping =====
+// Loops 1-4 have a pin each; any further loops are on the relay shift registers
+const uint8_t RELAY_PIN_COUNT = 4;
+constexpr uint8_t RELAY_PIN_MAP[RELAY_PIN_COUNT] = {RELAY1_PIN, RELAY2_PIN, RELAY3_PIN, RELAY4_PIN};
+
+/**
+ * Bits of a port driven by the first `pinLoops` relays, from loop `loop` onwards
+ */
+constexpr uint8_t relayPortMask(uint8_t port, uint8_t pinLoops, uint8_t loop = 0) {
+  return (loop >= pinLoops) ? 0
+         : (uint8_t)(((pinPortIndex(RELAY_PIN_MAP[loop]) == port) ? (1 << pinPortBit(RELAY_PIN_MAP[loop])) : 0) |
+                     relayPortMask(port, pinLoops, loop + 1));
+}
+
+/**
+ * Spreads a loop mask onto one port's bits. Unrolled at compile time so each
+ * loop costs one bit test on the AVR.
+ */
+template <uint8_t PORT, uint8_t PIN_LOOPS, uint8_t LOOP = 0>
+struct RelayPortBits {
+  static inline uint8_t fromLoops(uint8_t loopMask) {
+    return (uint8_t)(((pinPortIndex(RELAY_PIN_MAP[LOOP]) == PORT && (loopMask & (1 << LOOP)))
+                        ? (1 << pinPortBit(RELAY_PIN_MAP[LOOP])) : 0) |
+                     RelayPortBits<PORT, PIN_LOOPS, LOOP + 1>::fromLoops(loopMask));
+  }
+};
+
+template <uint8_t PORT, uint8_t PIN_LOOPS>
+struct RelayPortBits<PORT, PIN_LOOPS, PIN_LOOPS> {
+  static inline uint8_t fromLoops(uint8_t) { return 0; }
+};
+
+/**
+ * RelayDriver - Drives the relays of a unit with LOOPS loops
+ *
+ * Loops 1-4 are on RELAY1_PIN..RELAY4_PIN in config.h and are written with
+ * one masked write per port instead of one digitalWrite per relay. Loops 5
+ * and up are on a chain of 74HC595s (loop 5 on Q0 of the chip nearest the
+ * MCU) sharing the LED chain's data and clock lines. Their bits are shifted
+ * in first and latched right after the port writes, so every loop changes
+ * within a few CPU cycles and a preset change switches all relays together.
+ * Each change of the loops switched in goes in the event log.
+ */
+template <uint8_t LOOPS>
+class RelayDriver {
 public:
-  RelayController(const uint8_t pins[4]);
+  typedef typename LoopMaskOf<LOOPS>::Type Mask;
+
+  static const uint8_t PIN_LOOPS = (LOOPS < RELAY_PIN_COUNT) ? LOOPS : RELAY_PIN_COUNT;
+  static const uint8_t SHIFT_REGISTERS = (LOOPS - PIN_LOOPS + 7) / 8;
+
+  RelayDriver() : applied(0) {}
 
-  void begin();
-  void update(const bool loopStates[4]);
-  void allOff();
+  void begin() {
+    if (SHIFT_REGISTERS) {
+      digitalWrite(RELAY_SR_LATCH_PIN, LOW);
+      pinMode(SR_DATA_PIN, OUTPUT);
+      pinMode(SR_CLOCK_PIN, OUTPUT);
+      pinMode(RELAY_SR_LATCH_PIN, OUTPUT);
+    }
+    // Latch LOW first so the pins come up with the relays off
+    update(0);
+    for (uint8_t i = 0; i < PIN_LOOPS; i++) {
+      pinMode(RELAY_PIN_MAP[i], OUTPUT);
+    }
+  }
+
+  /**
+   * Set every relay from a loop mask (bit 0 = loop 1).
+   */
+  void update(Mask loopMask) {
+    const uint8_t maskB = relayPortMask(PORT_INDEX_B, PIN_LOOPS);
+    const uint8_t maskC = relayPortMask(PORT_INDEX_C, PIN_LOOPS);
+    const uint8_t maskD = relayPortMask(PORT_INDEX_D, PIN_LOOPS);
+
+    // Work out every port value first so the writes run back to back
+    const uint8_t bitsB = RelayPortBits<PORT_INDEX_B, PIN_LOOPS>::fromLoops((uint8_t)loopMask);
+    const uint8_t bitsC = RelayPortBits<PORT_INDEX_C, PIN_LOOPS>::fromLoops((uint8_t)loopMask);
+    const uint8_t bitsD = RelayPortBits<PORT_INDEX_D, PIN_LOOPS>::fromLoops((uint8_t)loopMask);
+    if (SHIFT_REGISTERS) shiftLoops(loopMask);
+
+    // Ports without relays drop out at compile time. No ISR may split the
+    // writes (or touch the same port between read and write).
+    noInterrupts();
+    if (maskD) writePortMasked(PORT_INDEX_D, maskD, bitsD);
+    if (maskB) writePortMasked(PORT_INDEX_B, maskB, bitsB);
+    if (maskC) writePortMasked(PORT_INDEX_C, maskC, bitsC);
+    if (SHIFT_REGISTERS) {
+      fastPinHigh<RELAY_SR_LATCH_PIN>();
+      fastPinLow<RELAY_SR_LATCH_PIN>();
+    }
+    interrupts();
+
+    if (loopMask != applied) {
+      applied = loopMask;
+      logEvent(LOG_RELAYS, 0, loopMask);
+    }
+  }
+
+  void allOff() { update(0); }
 
 private:
-  const uint8_t* relayPins;
+  Mask applied;
+
+  // Shift the loops past the pins into the chain, last output first. The
+  // clock is left where the LED chain leaves it, so each bit starts low.
+  static void shiftLoops(Mask loopMask) {
+    for (int8_t bit = SHIFT_REGISTERS * 8 - 1; bit >= 0; bit--) {
+      fastPinLow<SR_CLOCK_PIN>();
+      if (PIN_LOOPS + bit < LOOPS && ((loopMask >> (PIN_LOOPS + bit)) & 1)) fastPinHigh<SR_DATA_PIN>();
+      else fastPinLow<SR_DATA_PIN>();
+      fastPinHigh<SR_CLOCK_PIN>();
+    }
+  }
 };
 
+// The unit's relays
+typedef RelayDriver<NUM_LOOPS> RelayController;
+
 #endif
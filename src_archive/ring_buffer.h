@@ -0,0 +1,83 @@
+#ifndef RING_BUFFER_H
+#define RING_BUFFER_H
+
+#include <Arduino.h>
+
+/**
+ * RingBuffer - Lock-free single-producer/single-consumer queue
+ *
+ * Used to hand data from an ISR to the main loop (or back). One side only
+ * ever calls push(), the other only pop(). Each index is a single byte
+ * written by one side only, so no interrupt masking is needed on AVR.
+ *
+ * SIZE must be a power of two, at most 128. One slot is kept free to tell
+ * a full buffer from an empty one, so SIZE - 1 items fit.
+ */
+template <typename T, uint8_t SIZE>
+class RingBuffer {
+public:
+  RingBuffer() : head(0), tail(0) {}
+
+  /**
+   * Producer side.
+   * @return false if the buffer is full (item dropped)
+   */
+  bool push(const T& item) {
+    const uint8_t next = (head + 1) & MASK;
+    if (next == tail) return false;
+    items[head] = item;
+    // Item must be stored before the consumer can see the new head
+    asm volatile("" ::: "memory");
+    head = next;
+    return true;
+  }
+
+  /**
+   * Producer side: queue several items at once. The consumer sees all of
+   * them or none, so a multi-byte message is never half visible.
+   * @return false if they do not all fit (nothing queued)
+   */
+  bool push(const T* src, uint8_t n) {
+    if (n > space()) return false;
+    uint8_t index = head;
+    for (uint8_t i = 0; i < n; i++) {
+      items[index] = src[i];
+      index = (index + 1) & MASK;
+    }
+    asm volatile("" ::: "memory");
+    head = index;
+    return true;
+  }
+
+  /**
+   * Consumer side.
+   * @return false if the buffer is empty
+   */
+  bool pop(T& item) {
+    if (tail == head) return false;
+    item = items[tail];
+    asm volatile("" ::: "memory");
+    tail = (tail + 1) & MASK;
+    return true;
+  }
+
+  bool isEmpty() const { return head == tail; }
+  uint8_t count() const { return (uint8_t)(head - tail) & MASK; }
+  uint8_t space() const { return (uint8_t)(MASK - count()); }
+
+  // Consumer side: oldest item without removing it; buffer must not be empty
+  const T& peek() const { return items[tail]; }
+
+  // Consumer side: drop everything queued so far
+  void clear() { tail = head; }
+
+private:
+  static_assert(SIZE >= 2 && SIZE <= 128 && (SIZE & (SIZE - 1)) == 0, "RingBuffer SIZE must be a power of two");
+  static const uint8_t MASK = SIZE - 1;
+
+  T items[SIZE];
+  volatile uint8_t head;
+  volatile uint8_t tail;
+};
+
+#endif
@@ -0,0 +1,42 @@
+#include "scheduler.h"
+
+// Timer2 counts F_CPU / 64: 4 us steps at 16 MHz
+static const uint8_t TICK_PRESCALER = 64;
+static const uint32_t TICK_COUNTS = (F_CPU / 1000000UL) * SCHEDULER_TICK_US / TICK_PRESCALER;
+static_assert(TICK_COUNTS >= 2 && TICK_COUNTS <= 256, "SCHEDULER_TICK_US must fit Timer2 at /64");
+
+static volatile uint16_t ticks = 0;
+
+ISR(TIMER2_COMPA_vect) {
+  ticks++;
+}
+
+void initSchedulerTick() {
+  noInterrupts();
+  // The core runs Timer2 as PWM for pins 3 and 11; CTC with the outputs disconnected
+  TCCR2A = _BV(WGM21);
+  OCR2A = TICK_COUNTS - 1;
+  TCNT2 = 0;
+  TIFR2 = _BV(OCF2A);
+  TIMSK2 = _BV(OCIE2A);
+  TCCR2B = _BV(CS22);   // /64, and the count starts
+  ticks = 0;
+  interrupts();
+}
+
+uint16_t schedulerTicks() {
+  noInterrupts();
+  const uint16_t now = ticks;
+  interrupts();
+  return now;
+}
+
+uint32_t schedulerMicrosSince(uint16_t tick) {
+  noInterrupts();
+  uint16_t now = ticks;
+  const uint8_t count = TCNT2;
+  // Matched while interrupts were off: the count has started over, the tick is not in yet
+  if ((TIFR2 & _BV(OCF2A)) && count < TICK_COUNTS / 2) now++;
+  interrupts();
+  return (uint16_t)(now - tick) * (uint32_t)SCHEDULER_TICK_US + (uint32_t)count * TICK_PRESCALER / (F_CPU / 1000000UL);
+}
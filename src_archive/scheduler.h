@@ -0,0 +1,165 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <Arduino.h>
+#include "config.h"
+
+/**
+ * Start the scheduler tick: Timer2 in CTC mode interrupts every
+ * SCHEDULER_TICK_US. Timer0 stays with millis().
+ */
+void initSchedulerTick();
+
+// Ticks since initSchedulerTick(), wrapping every 65536 ticks
+uint16_t schedulerTicks();
+
+// Microseconds from the start of the given tick to now, to Timer2's 4 us step
+uint32_t schedulerMicrosSince(uint16_t tick);
+
+/**
+ * One row of a task table
+ */
+template <typename Owner>
+struct Task {
+  void (Owner::*run)();
+  uint8_t priority;        // Lower runs first when several are ready
+  uint8_t periodTicks;
+  uint8_t deadlineTicks;   // Release to finish
+};
+
+/**
+ * What a task has done since the scheduler began
+ */
+struct TaskStats {
+  uint32_t runs;
+  uint32_t busyUs;           // Time spent running
+  uint16_t worstRunUs;       // Start to finish, saturating
+  uint16_t worstResponseUs;  // Release to finish, saturating
+  uint16_t overruns;         // Finished past the deadline
+  uint16_t missedReleases;   // Released again before it had run; the earlier release is lost
+};
+
+/**
+ * Scheduler - Cooperative scheduler over a fixed task table
+ *
+ * The tick releases each task every periodTicks, keeping its phase however
+ * late it runs. run() is called from the main loop: it runs the ready task
+ * with the lowest priority value, then looks again, so work released in the
+ * meantime goes ahead of anything less urgent. A task is never preempted,
+ * so each must return well within the deadlines of the tasks above it.
+ *
+ * Every finish is checked against the task's deadline. Overruns and lost
+ * releases are counted, with the worst run and response times, so the
+ * main-loop budget can be shown to hold rather than assumed.
+ */
+template <typename Owner, uint8_t TASKS>
+class Scheduler {
+public:
+  typedef Task<Owner> Table[TASKS];
+
+  explicit Scheduler(const Table& tasks) : tasks(tasks), waiting(0) {
+    resetStats();
+  }
+
+  /**
+   * Release every task one period from now. Call once the tick is running.
+   */
+  void begin() {
+    const uint16_t now = schedulerTicks();
+    for (uint8_t i = 0; i < TASKS; i++) {
+      nextRelease[i] = now + tasks[i].periodTicks;
+    }
+    waiting = 0;
+    resetStats();
+  }
+
+  /**
+   * Run every task that is due, most urgent first.
+   * @return true if any task ran
+   */
+  bool run(Owner& owner) {
+    bool ran = false;
+    for (;;) {
+      release(schedulerTicks());
+      const int8_t next = nextReady();
+      if (next < 0) return ran;
+      runTask(owner, next);
+      ran = true;
+    }
+  }
+
+  // Ticks until the next release, 0 if a task is waiting to run
+  uint16_t ticksUntilRelease() const {
+    if (waiting) return 0;
+    const uint16_t now = schedulerTicks();
+    uint16_t soonest = 0xFFFF;
+    for (uint8_t i = 0; i < TASKS; i++) {
+      const int16_t until = (int16_t)(nextRelease[i] - now);
+      if (until <= 0) return 0;
+      if ((uint16_t)until < soonest) soonest = until;
+    }
+    return soonest;
+  }
+
+  // Ticks until the given task's next release, 0 if it is waiting to run
+  uint16_t ticksUntilRelease(uint8_t task) const {
+    if (waiting & (1 << task)) return 0;
+    const int16_t until = (int16_t)(nextRelease[task] - schedulerTicks());
+    return (until > 0) ? until : 0;
+  }
+
+  const TaskStats& stats(uint8_t task) const { return taskStats[task]; }
+  void resetStats() { memset(taskStats, 0, sizeof(taskStats)); }
+
+private:
+  static_assert(TASKS >= 1 && TASKS <= 8, "Waiting tasks are kept in a byte");
+
+  const Table& tasks;
+  uint16_t nextRelease[TASKS];
+  uint16_t releasedAt[TASKS];
+  uint8_t waiting;           // Bit per released task that has not run yet
+  TaskStats taskStats[TASKS];
+
+  void release(uint16_t now) {
+    for (uint8_t i = 0; i < TASKS; i++) {
+      if ((int16_t)(now - nextRelease[i]) < 0) continue;
+      if (waiting & (1 << i)) taskStats[i].missedReleases++;
+      waiting |= 1 << i;
+      releasedAt[i] = nextRelease[i];
+      nextRelease[i] += tasks[i].periodTicks;
+      // A whole period or more behind: those releases are lost, the phase is kept
+      while ((int16_t)(now - nextRelease[i]) >= 0) {
+        taskStats[i].missedReleases++;
+        releasedAt[i] = nextRelease[i];
+        nextRelease[i] += tasks[i].periodTicks;
+      }
+    }
+  }
+
+  // Most urgent waiting task, table order breaking ties; -1 if none
+  int8_t nextReady() const {
+    int8_t next = -1;
+    for (uint8_t i = 0; i < TASKS; i++) {
+      if (!(waiting & (1 << i))) continue;
+      if (next < 0 || tasks[i].priority < tasks[next].priority) next = i;
+    }
+    return next;
+  }
+
+  void runTask(Owner& owner, uint8_t i) {
+    waiting &= ~(1 << i);
+    const uint32_t startUs = schedulerMicrosSince(releasedAt[i]);
+    (owner.*tasks[i].run)();
+    const uint32_t responseUs = schedulerMicrosSince(releasedAt[i]);
+    const uint32_t runUs = responseUs - startUs;
+
+    TaskStats& stats = taskStats[i];
+    stats.runs++;
+    stats.busyUs += runUs;
+    if (runUs > stats.worstRunUs) stats.worstRunUs = (runUs > 0xFFFF) ? 0xFFFF : runUs;
+    if (responseUs > stats.worstResponseUs) stats.worstResponseUs = (responseUs > 0xFFFF) ? 0xFFFF : responseUs;
+    if (responseUs > (uint32_t)tasks[i].deadlineTicks * SCHEDULER_TICK_US) stats.overruns++;
+  }
+};
+
+#endif
@@ -0,0 +1,152 @@
+#include "session_store.h"
+#include <EEPROM.h>
+#include <util/crc16.h>
+#include "preset_store.h"
+#include "profiler.h"
+
+static const uint8_t RECORD_SIZE = SESSION_RECORD_SIZE;
+// Not zero, so that zeroed cells never pass for a record
+static const uint8_t CRC_INIT = 0xFF;
+static const uint8_t BANK_MODE_BIT = 0x20;
+static const uint8_t GLOBAL_PRESET_BIT = 0x40;
+// The sequence number goes last: until it lands the slot keeps the number
+// of the oldest record in the ring, so a torn record never passes for the
+// newest, and a torn sequence number alone always fails the CRC
+static uint8_t writeOrder(uint8_t written) {
+  return (written + 1) % RECORD_SIZE;
+}
+
+static uint16_t slotAddress(uint8_t slot) {
+  return EEPROM_SESSION_START_ADDR + slot * RECORD_SIZE;
+}
+
+SessionStore::SessionStore()
+  : stored{},     // Power-up defaults: manual mode, bank 1, all loops off
+    pending{},
+    changedAt(0),
+    slot(0),
+    sequence(0),
+    record{},
+    written(RECORD_SIZE),
+    layoutChecked(false) {
+}
+
+void SessionStore::pack(const Session& session, uint8_t* bytes) {
+  bytes[0] = (uint8_t)((session.bank - 1) & 0x1F);
+  if (session.mode == BANK_MODE) bytes[0] |= BANK_MODE_BIT;
+  if (session.globalPresetActive) bytes[0] |= GLOBAL_PRESET_BIT;
+  bytes[1] = (uint8_t)(((session.activePreset + 1) << 4) | (session.loops & 0x0F));
+  for (uint8_t i = 2; i < SESSION_BYTES; i++) {
+    bytes[i] = (uint8_t)(session.loops >> (4 + 8 * (i - 2)));
+  }
+}
+
+// Loops as the session bytes hold them, bits past the unit's loops included
+static uint32_t unpackLoops(const uint8_t* bytes, uint8_t count) {
+  uint32_t loops = bytes[1] & 0x0F;
+  for (uint8_t i = 2; i < count; i++) {
+    loops |= (uint32_t)bytes[i] << (4 + 8 * (i - 2));
+  }
+  return loops;
+}
+
+uint8_t SessionStore::recordCrc(const uint8_t* bytes) {
+  uint8_t crc = CRC_INIT;
+  for (uint8_t i = 0; i < RECORD_SIZE - 1; i++) {
+    crc = _crc8_ccitt_update(crc, bytes[i]);
+  }
+  return crc;
+}
+
+bool SessionStore::readSlot(uint8_t slot, uint8_t* bytes) {
+  const uint16_t address = slotAddress(slot);
+  for (uint8_t i = 0; i < RECORD_SIZE; i++) {
+    bytes[i] = EEPROM.read(address + i);
+  }
+  if (bytes[RECORD_SIZE - 1] != recordCrc(bytes)) return false;
+  // A good CRC over fields out of range is not a record this firmware wrote
+  return !(bytes[1] & 0x80) && (bytes[1] & 0x1F) < NUM_BANKS && !(bytes[2] & 0x80) &&
+         (bytes[2] >> 4) <= PRESETS_PER_BANK && !(unpackLoops(bytes + 1, SESSION_BYTES) & ~(uint32_t)ALL_LOOPS);
+}
+
+bool SessionStore::restore(Session& session) {
+  layoutChecked = PresetStore::sessionRingCurrent();
+  if (!layoutChecked) return false;
+
+  // Sequence numbers of live records lie within SESSION_SLOTS of each other
+  bool found = false;
+  uint8_t bytes[RECORD_SIZE];
+  for (uint8_t i = 0; i < SESSION_SLOTS; i++) {
+    if (!readSlot(i, bytes)) continue;
+    if (found && (int8_t)(bytes[0] - sequence) <= 0) continue;
+    found = true;
+    sequence = bytes[0];
+    memcpy(stored, bytes + 1, SESSION_BYTES);
+    slot = (i + 1) % SESSION_SLOTS;
+  }
+  if (!found) return false;
+
+  memcpy(pending, stored, SESSION_BYTES);
+  session.mode = (stored[0] & BANK_MODE_BIT) ? BANK_MODE : MANUAL_MODE;
+  session.bank = (stored[0] & 0x1F) + 1;
+  session.globalPresetActive = (stored[0] & GLOBAL_PRESET_BIT) != 0;
+  session.activePreset = (int8_t)(stored[1] >> 4) - 1;
+  session.loops = (LoopMask)unpackLoops(stored, SESSION_BYTES);
+
+  DEBUG_PRINT("Session restored from slot ");
+  DEBUG_PRINTLN((slot + SESSION_SLOTS - 1) % SESSION_SLOTS);
+  return true;
+}
+
+void SessionStore::begin() {
+  if (layoutChecked) return;
+  layoutChecked = true;
+
+  // Whatever another layout kept here must not pass for a session. Sequence
+  // number 0 is older than the first records to come.
+  uint8_t bytes[RECORD_SIZE];
+  for (uint8_t i = 0; i < SESSION_SLOTS; i++) {
+    EEPROM.update(slotAddress(i), 0);
+    if (readSlot(i, bytes)) {
+      EEPROM.write(slotAddress(i) + RECORD_SIZE - 1, bytes[RECORD_SIZE - 1] ^ 0xFF);
+    }
+  }
+  slot = 0;
+  sequence = 0;
+}
+
+bool SessionStore::isIdle() const {
+  return written == RECORD_SIZE && memcmp(pending, stored, SESSION_BYTES) == 0;
+}
+
+void SessionStore::update(const Session& session, unsigned long now) {
+  PROFILE_SCOPE(PROFILE_SESSION_STORE);
+  uint8_t bytes[SESSION_BYTES];
+  pack(session, bytes);
+  if (memcmp(bytes, pending, SESSION_BYTES) != 0) {
+    memcpy(pending, bytes, SESSION_BYTES);
+    changedAt = now;
+  }
+
+  if (!layoutChecked) return;
+  // A write in progress would make the next access wait for it
+  if (!eeprom_is_ready()) return;
+
+  if (written == RECORD_SIZE) {
+    if (memcmp(pending, stored, SESSION_BYTES) == 0) return;
+    // Loops flicked on and off in a hurry are saved once they settle
+    if (now - changedAt < SESSION_SAVE_DELAY_MS) return;
+
+    // Changed again while this record is written: written again
+    memcpy(stored, pending, SESSION_BYTES);
+    sequence++;
+    record[0] = sequence;
+    memcpy(record + 1, stored, SESSION_BYTES);
+    record[RECORD_SIZE - 1] = recordCrc(record);
+    written = 0;
+  }
+
+  EEPROM.write(slotAddress(slot) + writeOrder(written), record[writeOrder(written)]);
+  written++;
+  if (written == RECORD_SIZE) slot = (slot + 1) % SESSION_SLOTS;
+}
@@ -0,0 +1,88 @@
+#ifndef SESSION_STORE_H
+#define SESSION_STORE_H
+
+#include <Arduino.h>
+#include "config.h"
+#include "loop_mask.h"
+
+/**
+ * What the switcher was doing, as restored at power-up
+ */
+struct Session {
+  Mode mode;                 // MANUAL_MODE or BANK_MODE
+  uint8_t bank;              // 1-NUM_BANKS
+  int8_t activePreset;       // Switch 0-3 of the bank, -1 if none
+  bool globalPresetActive;
+  LoopMask loops;            // Bit 0 = loop 1
+};
+
+/**
+ * SessionStore - The live session, kept in EEPROM so a power cycle in
+ * the middle of a set comes back to the same sound
+ *
+ * A session that has stood for SESSION_SAVE_DELAY_MS is written to the
+ * next slot of a ring of SESSION_SLOTS records, one byte per update() and
+ * only when the EEPROM is ready, like the preset journal. On a 4-loop
+ * unit a record is 4 bytes:
+ *
+ *   byte 0: sequence number, one more than the previous record's
+ *   byte 1: bit 6 global preset | bit 5 bank mode | bits 0-4 bank - 1
+ *   byte 2: bits 4-6 active preset + 1 (0 = none) | bits 0-3 loops 1-4
+ *   byte 3: CRC-8 of bytes 0-2
+ *
+ * Larger units add loops 5-12 and 13-16 after byte 2, as far as they have
+ * them (SESSION_RECORD_SIZE), and the CRC follows.
+ *
+ * The sequence number is written last. The newest record with a good CRC
+ * wins, so a record cut short by a power loss leaves the one before it in
+ * charge. Writing the slots in turn spreads the wear of a session that
+ * changes with every song.
+ */
+class SessionStore {
+public:
+  SessionStore();
+
+  /**
+   * Power-up, before anything else: read the newest session.
+   * @return false if there is none or EEPROM has no ring where this
+   *         firmware keeps it (PresetStore::sessionRingCurrent())
+   */
+  bool restore(Session& session);
+
+  /**
+   * Once EEPROM is in the current layout (after PresetStore::begin()):
+   * clear the ring unless restore() found it where it is kept now.
+   */
+  void begin();
+
+  /**
+   * Note the session as it stands and commit at most one EEPROM byte of
+   * it, if the EEPROM is ready. Call from the storage task.
+   */
+  void update(const Session& session, unsigned long now);
+
+  // Nothing waiting to be written
+  bool isIdle() const;
+
+private:
+  static_assert(NUM_BANKS <= 32, "Session record packs the bank into 5 bits");
+
+  // Record bytes between the sequence number and the CRC
+  static const uint8_t SESSION_BYTES = SESSION_RECORD_SIZE - 2;
+
+  uint8_t stored[SESSION_BYTES];    // Session bytes of the newest record
+  uint8_t pending[SESSION_BYTES];   // Session bytes as they stand
+  unsigned long changedAt;
+  uint8_t slot;            // Slot the next record goes in
+  uint8_t sequence;        // Sequence number of the newest record
+  uint8_t record[SESSION_RECORD_SIZE];  // Record being written
+  uint8_t written;         // Bytes of it written, SESSION_RECORD_SIZE when none is in progress
+  bool layoutChecked;      // restore() found the ring where it is kept now
+
+  static void pack(const Session& session, uint8_t* bytes);
+  static uint8_t recordCrc(const uint8_t* bytes);
+  // Read a slot; true if it holds a complete record
+  static bool readSlot(uint8_t slot, uint8_t* bytes);
+};
+
+#endif
@@ -1,16 +1,16 @@
 #include "state_manager.h"
 #include "config.h"
-#include <EEPROM.h>
+#include "event_log.h"
 
 StateManager::StateManager()
   : currentMode(MANUAL_MODE),
     displayState(SHOWING_MANUAL),
     currentBank(1),
     midiChannel(DEFAULT_MIDI_CHANNEL),
-    loopStates{false, false, false, false},
+    loops(0),
     activePreset(-1),
     globalPresetActive(false),
-    editModeLoopStates{false, false, false, false},
+    editModeLoops(0),
     editModeAnimFrame(0),
     savedDisplayAnimFrame(0),
     pcFlashStartTime(0),
@@ -39,24 +39,58 @@ uint8_t StateManager::readMidiChannelFromHardware() const {
   return binaryValue;
 }
 
+bool StateManager::restoreSession() {
+  Session restored;
+  if (!session.restore(restored)) return false;
+
+  currentMode = restored.mode;
+  currentBank = restored.bank;
+  activePreset = restored.activePreset;
+  globalPresetActive = restored.globalPresetActive;
+  loops = restored.loops;
+  displayState = (currentMode == BANK_MODE) ? SHOWING_BANK : SHOWING_MANUAL;
+  logEvent(LOG_MODE, currentMode);
+  logEvent(LOG_BANK, currentBank);
+  return true;
+}
+
 void StateManager::initialize() {
   // Read MIDI channel from DIP switches on footswitch pins
   midiChannel = readMidiChannelFromHardware();
   DEBUG_PRINT("MIDI channel set to: ");
   DEBUG_PRINTLN(midiChannel + 1);
+}
 
-  // Check if EEPROM has been initialized
-  const uint8_t initFlag = EEPROM.read(EEPROM_INIT_FLAG_ADDR);
-  if (initFlag != EEPROM_INIT_MAGIC) {
-    DEBUG_PRINTLN("First boot - initializing EEPROM");
-    // First boot - initialize all presets to 0 (all loops off)
-    for (uint8_t i = 0; i < TOTAL_PRESETS; i++) {
-      EEPROM.write(EEPROM_PRESETS_START_ADDR + i, 0);
-    }
-    EEPROM.write(EEPROM_INIT_FLAG_ADDR, EEPROM_INIT_MAGIC);
-  } else {
-    DEBUG_PRINTLN("EEPROM already initialized");
-  }
+void StateManager::loadPresets() {
+  presets.begin();
+  presetMessages.begin();
+  session.begin();
+}
+
+void StateManager::updateSession() {
+  // Edit mode is not restored: power-up goes back to bank mode with the
+  // preset as it was before editing
+  Session current;
+  current.mode = (currentMode == MANUAL_MODE) ? MANUAL_MODE : BANK_MODE;
+  current.bank = currentBank;
+  current.activePreset = activePreset;
+  current.globalPresetActive = globalPresetActive;
+  current.loops = loops;
+  session.update(current, millis());
+}
+
+LoopMask StateManager::getPresetLoops(uint8_t presetNumber) const {
+  if (presetNumber < 1 || presetNumber > TOTAL_PRESETS) return 0;
+  return presets.get(presetNumber - 1);
+}
+
+uint8_t StateManager::getPresetMessages(uint8_t presetNumber, uint8_t* bytes) const {
+  if (presetNumber < 1 || presetNumber > TOTAL_PRESETS) return 0;
+  return presetMessages.get(presetNumber - 1, bytes);
+}
+
+bool StateManager::presetMatches(uint8_t presetNumber, LoopMask presetLoops) const {
+  return getPresetLoops(presetNumber) == presetLoops;
 }
 
 uint8_t StateManager::getDisplayValue() const {
@@ -66,45 +100,33 @@ uint8_t StateManager::getDisplayValue() const {
   return midiChannel;
 }
 
-bool* StateManager::getDisplayLoops() {
-  return (currentMode == EDIT_MODE) ? editModeLoopStates : loopStates;
+LoopMask& StateManager::getDisplayLoops() {
+  return (currentMode == EDIT_MODE) ? editModeLoops : loops;
 }
 
 void StateManager::savePreset(uint8_t presetNumber) {
   if (presetNumber < 1 || presetNumber > TOTAL_PRESETS) return;
 
-  // Pack loop states into a single byte (bits 0-(NUM_LOOPS-1))
-  uint8_t packedState = 0;
-  for (int i = 0; i < NUM_LOOPS; i++) {
-    if (loopStates[i]) {
-      packedState |= (1 << i);
-    }
-  }
+  // An unchanged preset is never journaled (reduces wear)
+  if (presetMatches(presetNumber, loops)) return;
 
-  // Only write to EEPROM if the value has changed (reduces wear)
-  const uint8_t currentValue = EEPROM.read(EEPROM_PRESETS_START_ADDR + presetNumber - 1);
-  if (currentValue != packedState) {
-    DEBUG_PRINT("Saving preset ");
-    DEBUG_PRINT(presetNumber);
-    DEBUG_PRINT(" with state: 0x");
-    DEBUG_PRINTLN(packedState, HEX);
-    EEPROM.write(EEPROM_PRESETS_START_ADDR + presetNumber - 1, packedState);
-  }
+  logEvent(LOG_PRESET_SAVE, presetNumber, loops);
+  DEBUG_PRINT("Saving preset ");
+  DEBUG_PRINT(presetNumber);
+  DEBUG_PRINT(" with state: 0x");
+  DEBUG_PRINTLN(loops, HEX);
+  // Written to EEPROM in the background by presets.update()
+  presets.set(presetNumber - 1, loops);
 }
 
 void StateManager::loadPreset(uint8_t presetNumber) {
   if (presetNumber < 1 || presetNumber > TOTAL_PRESETS) return;
 
-  // Read packed state from EEPROM
-  const uint8_t packedState = EEPROM.read(EEPROM_PRESETS_START_ADDR + presetNumber - 1);
+  loops = getPresetLoops(presetNumber);
+  logEvent(LOG_PRESET_LOAD, presetNumber, loops);
 
   DEBUG_PRINT("Loading preset ");
   DEBUG_PRINT(presetNumber);
   DEBUG_PRINT(" with state: 0x");
-  DEBUG_PRINTLN(packedState, HEX);
-
-  // Unpack into loop states
-  for (int i = 0; i < NUM_LOOPS; i++) {
-    loopStates[i] = (packedState & (1 << i)) != 0;
-  }
+  DEBUG_PRINTLN(loops, HEX);
 }
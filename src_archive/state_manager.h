@@ -3,7 +3,11 @@
 
 #include <Arduino.h>
 #include "config.h"
+#include "loop_mask.h"
 #include "display.h"
+#include "preset_store.h"
+#include "preset_messages.h"
+#include "session_store.h"
 
 class StateManager {
 public:
@@ -15,15 +19,15 @@ public:
   uint8_t currentBank;
   uint8_t midiChannel;  // MIDI channel 0-15 (displayed as 1-16)
   
-  // Loop states
-  bool loopStates[4];
+  // Loop states, bit 0 = loop 1
+  LoopMask loops;
   
   // Preset tracking
   int8_t activePreset;
   bool globalPresetActive;
   
   // Edit mode
-  bool editModeLoopStates[4];
+  LoopMask editModeLoops;
   uint8_t editModeAnimFrame;
 
   // Saved display animation
@@ -38,14 +42,29 @@ public:
   // Display state
   uint8_t flashingPC;
   
+  // Presets: cached in RAM, journaled to EEPROM a byte at a time
+  PresetStore presets;
+  // MIDI messages presets send when recalled, read from EEPROM as they are needed
+  PresetMessages presetMessages;
+  // Mode, bank, preset and loops, restored at power-up
+  SessionStore session;
+
   StateManager();
+  bool restoreSession();  // Take up the last session saved in EEPROM, before anything else runs
   void initialize();
   uint8_t getDisplayValue() const;
-  bool* getDisplayLoops();
+  // Loops being shown and applied: the edit buffer in edit mode, else the live loops
+  LoopMask& getDisplayLoops();
 
-  // EEPROM preset storage
+  void loadPresets();  // Read and check the presets in EEPROM (set it up on first boot)
+  void updateSession();  // Save the session in the background once it settles; from the storage task
   void savePreset(uint8_t presetNumber);
   void loadPreset(uint8_t presetNumber);
+  // Stored loops of a preset as bits (loop 1 = bit 0), 0 if out of range
+  LoopMask getPresetLoops(uint8_t presetNumber) const;
+  // MIDI messages of a preset as wire bytes into room for PRESET_MESSAGE_BYTES; their length, 0 if none
+  uint8_t getPresetMessages(uint8_t presetNumber, uint8_t* bytes) const;
+  bool presetMatches(uint8_t presetNumber, LoopMask presetLoops) const;
 
   // Read MIDI channel from DIP switches on footswitch pins
   uint8_t readMidiChannelFromHardware() const;
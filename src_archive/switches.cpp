@@ -1,89 +1,150 @@
 #include "switches.h"
+#include "profiler.h"
 
-SwitchHandler::SwitchHandler(const uint8_t pins[4], uint8_t debounceMs, uint16_t simultaneousWindowMs,
+SwitchHandler* SwitchHandler::activeHandler = nullptr;
+
+// Footswitches may sit on any port, so every pin-change vector feeds the capture
+ISR(PCINT0_vect) { SwitchHandler::onPinChange(); }
+ISR(PCINT1_vect) { SwitchHandler::onPinChange(); }
+ISR(PCINT2_vect) { SwitchHandler::onPinChange(); }
+
+SwitchHandler::SwitchHandler(const uint8_t pins[NUM_SWITCHES], uint8_t debounceMs, uint16_t simultaneousWindowMs,
                              uint16_t longPressMs)
-  : switchPins(pins), debounceMs(debounceMs), simultaneousWindowMs(simultaneousWindowMs), longPressMs(longPressMs) {
+  : switchPins(pins),
+    simultaneousWindowMs(simultaneousWindowMs),
+    longPressMs(longPressMs),
+    // Passes run every MAIN_LOOP_INTERVAL_MS; the 2-bit counters hold at most 3
+    debouncer(min((debounceMs + MAIN_LOOP_INTERVAL_MS - 1) / MAIN_LOOP_INTERVAL_MS, 3)) {
 }
 
 void SwitchHandler::begin() {
-  for (int i = 0; i < 4; i++) {
+  for (int i = 0; i < NUM_SWITCHES; i++) {
     pinMode(switchPins[i], INPUT_PULLUP);
-    switches[i].currentState = true; // Pullup = HIGH when not pressed
-    switches[i].lastState = true;
-    switches[i].lastDebounceTime = 0;
-    switches[i].pressStartTime = 0;
-    switches[i].longPressTriggered = false;
+    inputRegisters[i] = portInputRegister(digitalPinToPort(switchPins[i]));
+    bitMasks[i] = digitalPinToBitMask(switchPins[i]);
+  }
+
+  noInterrupts();
+  activeHandler = this;
+  edges.clear();
+  edgesOverflowed = false;
+  capturedLevels = readLevels();
+
+  // A switch held at power-up debounces into a press, as with polling
+  rawLevels = capturedLevels;
+  debouncer.reset(ALL_SWITCHES);  // Pullup = HIGH when not pressed
+  longPressTriggered = 0;
+  pressHandled = ALL_SWITCHES;
+
+  const uint16_t now = millis();
+  for (int i = 0; i < NUM_SWITCHES; i++) {
+    pressStartTime[i] = 0;
+    closeTimeMs[i] = now;
+
+    *digitalPinToPCMSK(switchPins[i]) |= _BV(digitalPinToPCMSKbit(switchPins[i]));
+    *digitalPinToPCICR(switchPins[i]) |= _BV(digitalPinToPCICRbit(switchPins[i]));
   }
+  interrupts();
 }
 
 void SwitchHandler::readAndDebounce() {
-  unsigned long now = millis();
+  PROFILE_SCOPE(PROFILE_READ_SWITCHES);
+  const unsigned long nowMs = millis();
+  const unsigned long nowUs = micros();
+
+  uint8_t bounced = 0;
+  SwitchEdge edge;
+  while (edges.pop(edge)) {
+    const uint8_t bit = 1 << edge.switchIndex;
+    bounced |= bit;
+    if (edge.level) {
+      rawLevels |= bit;
+    } else {
+      rawLevels &= ~bit;
+      // An edge captured after the clock was read counts as now
+      const long ageUs = (long)(nowUs - edge.timeUs);
+      closeTimeMs[edge.switchIndex] = nowMs - ((ageUs > 0) ? ageUs / 1000 : 0);
+    }
+  }
 
-  for (int i = 0; i < 4; i++) {
-    bool reading = digitalRead(switchPins[i]);
+  if (edgesOverflowed) {
+    // Edges were lost; fall back to the pin levels and restart the debounce
+    edgesOverflowed = false;
+    const uint8_t levels = readLevels();
+    bounced |= levels ^ rawLevels;
+    rawLevels = levels;
+  }
 
-    // If the switch state changed (noise or actual press)
-    if (reading != switches[i].lastState) {
-      switches[i].lastDebounceTime = now;
-    }
+  debouncer.update(rawLevels, bounced);
 
-    // If enough time has passed, accept the reading
-    if ((now - switches[i].lastDebounceTime) > debounceMs) {
-      // If state actually changed
-      if (reading != switches[i].currentState) {
-        switches[i].currentState = reading;
-
-        // On press (HIGH to LOW due to pullup)
-        if (!reading) {
-          switches[i].pressStartTime = now;
-          switches[i].longPressTriggered = false;
-        }
-      }
+  const uint8_t pressed = debouncer.fallingEdges();
+  if (pressed) {
+    for (uint8_t i = 0; i < NUM_SWITCHES; i++) {
+      if (!(pressed & (1 << i))) continue;
+      // Rebuild the full timestamp; the closing edge is only a few passes old
+      pressStartTime[i] = nowMs - (uint16_t)((uint16_t)nowMs - closeTimeMs[i]);
     }
-
-    switches[i].lastState = reading;
+    longPressTriggered &= ~pressed;
+    pressHandled &= ~pressed;
   }
 }
 
 bool SwitchHandler::isRecentPress(uint8_t switchIndex) const {
   // Check if button was pressed recently (within simultaneousWindowMs)
   // This includes both currently pressed AND recently released buttons
-  if (switches[switchIndex].pressStartTime > 0) {
-    const unsigned long timeSincePress = millis() - switches[switchIndex].pressStartTime;
+  if (!(pressHandled & (1 << switchIndex)) && pressStartTime[switchIndex] > 0) {
+    const unsigned long timeSincePress = millis() - pressStartTime[switchIndex];
     return timeSincePress < simultaneousWindowMs;
   }
 
   return false;
 }
 
-void SwitchHandler::clearRecentPresses() {
-  for (int i = 0; i < 4; i++) {
-    switches[i].pressStartTime = 0;
+uint8_t SwitchHandler::getRecentPresses() const {
+  const unsigned long now = millis();
+  uint8_t recent = 0;
+  for (uint8_t i = 0; i < NUM_SWITCHES; i++) {
+    const uint8_t bit = 1 << i;
+    if (!(pressHandled & bit) && pressStartTime[i] > 0 && now - pressStartTime[i] < simultaneousWindowMs) {
+      recent |= bit;
+    }
   }
+  return recent;
+}
+
+void SwitchHandler::clearRecentPresses() {
+  // Mark presses as handled instead of zeroing pressStartTime, so a pair that
+  // is still held keeps its real start time for isLongPress()
+  pressHandled = ALL_SWITCHES;
+}
+
+void SwitchHandler::clearRecentPress(uint8_t switchIndex) {
+  pressHandled |= (1 << switchIndex);
 }
 
 bool SwitchHandler::isPressed(uint8_t switchIndex) const {
-  return !switches[switchIndex].currentState;
+  return !(debouncer.levels() & (1 << switchIndex));
 }
 
-bool SwitchHandler::isLongPress(uint8_t sw1Index, uint8_t sw2Index) {
-  return isLongPress(sw1Index, sw2Index, longPressMs);
+bool SwitchHandler::isLongPress(uint8_t switchMask) {
+  return isLongPress(switchMask, longPressMs);
 }
 
-bool SwitchHandler::isLongPress(uint8_t sw1Index, uint8_t sw2Index, uint16_t customLongPressMs) {
+bool SwitchHandler::isLongPress(uint8_t switchMask, uint16_t customLongPressMs) {
   const unsigned long now = millis();
 
-  const bool switchesAreOn = !switches[sw1Index].currentState && !switches[sw2Index].currentState;
-  const bool notTriggered = !switches[sw1Index].longPressTriggered && !switches[sw2Index].longPressTriggered;
+  const bool switchesAreOn = (debouncer.levels() & switchMask) == 0;
+  const bool notTriggered = (longPressTriggered & switchMask) == 0;
+  if (!switchesAreOn || !notTriggered) return false;
 
-  // Use the LATER of the two press times to determine hold duration
+  // Use the LATER of the press times to determine hold duration
   // This allows for a more natural press sequence
-  const unsigned long laterPressTime = max(switches[sw1Index].pressStartTime, switches[sw2Index].pressStartTime);
-  const bool haveBeenHeldLongEnough = now - laterPressTime > customLongPressMs;
-
-  if (switchesAreOn && notTriggered && haveBeenHeldLongEnough) {
-    switches[sw1Index].longPressTriggered = true;
-    switches[sw2Index].longPressTriggered = true;
+  unsigned long laterPressTime = 0;
+  for (uint8_t i = 0; i < NUM_SWITCHES; i++) {
+    if (switchMask & (1 << i)) laterPressTime = max(laterPressTime, pressStartTime[i]);
+  }
+  if (now - laterPressTime > customLongPressMs) {
+    longPressTriggered |= switchMask;
 
     return true;
   }
@@ -91,6 +152,34 @@ bool SwitchHandler::isLongPress(uint8_t sw1Index, uint8_t sw2Index, uint16_t cus
   return false;
 }
 
-const SwitchState *SwitchHandler::getStates() const {
-  return switches;
+unsigned long SwitchHandler::getPressStartTime(uint8_t switchIndex) const {
+  return pressStartTime[switchIndex];
+}
+
+void SwitchHandler::onPinChange() {
+  if (activeHandler) activeHandler->captureEdges();
+}
+
+uint8_t SwitchHandler::readLevels() const {
+  uint8_t levels = 0;
+  for (uint8_t i = 0; i < NUM_SWITCHES; i++) {
+    if (*inputRegisters[i] & bitMasks[i]) levels |= (1 << i);
+  }
+  return levels;
+}
+
+void SwitchHandler::captureEdges() {
+  const unsigned long now = micros();
+  const uint8_t levels = readLevels();
+  const uint8_t changed = levels ^ capturedLevels;
+  capturedLevels = levels;
+
+  for (uint8_t i = 0; i < NUM_SWITCHES; i++) {
+    if (!(changed & (1 << i))) continue;
+    SwitchEdge edge;
+    edge.timeUs = now;
+    edge.switchIndex = i;
+    edge.level = (levels >> i) & 1;
+    if (!edges.push(edge)) edgesOverflowed = true;
+  }
 }
@@ -2,34 +2,90 @@
 #define SWITCHES_H
 
 #include <Arduino.h>
+#include "config.h"
+#include "ring_buffer.h"
+#include "debouncer.h"
 
-struct SwitchState {
-  bool currentState;
-  bool lastState;
-  unsigned long lastDebounceTime;
-  unsigned long pressStartTime;
-  bool longPressTriggered;
+// Bit per footswitch, as the debouncer and press flags hold them
+const uint8_t ALL_SWITCHES = (1 << NUM_SWITCHES) - 1;
+
+/**
+ * One pin level change, captured in the pin-change ISR
+ */
+struct SwitchEdge {
+  unsigned long timeUs;
+  uint8_t switchIndex;
+  uint8_t level;
 };
 
 class SwitchHandler {
 public:
-  SwitchHandler(const uint8_t pins[4], uint8_t debounceMs, uint16_t simultaneousWindowMs, uint16_t longPressMs);
+  SwitchHandler(const uint8_t pins[NUM_SWITCHES], uint8_t debounceMs, uint16_t simultaneousWindowMs, uint16_t longPressMs);
 
+  /**
+   * Enable pullups and pin-change interrupts on the switch pins.
+   * Only one SwitchHandler can own the interrupts at a time.
+   */
   void begin();
+
+  /**
+   * Debounce from the edges captured since the last call. A change is
+   * accepted after DEBOUNCE_MS worth of quiet passes. Press times are the
+   * moment the contact settled, not when this pass noticed it.
+   */
   void readAndDebounce();
   bool isRecentPress(uint8_t switchIndex) const;
   void clearRecentPresses();
+  void clearRecentPress(uint8_t switchIndex);
   bool isPressed(uint8_t switchIndex) const;
-  bool isLongPress(uint8_t sw1Index, uint8_t sw2Index);
-  bool isLongPress(uint8_t sw1Index, uint8_t sw2Index, uint16_t customLongPressMs);
-  const SwitchState* getStates() const;
+
+  /**
+   * True once per hold when every switch in the mask has been down for the
+   * long press time, counted from the last of them to go down
+   */
+  bool isLongPress(uint8_t switchMask);
+  bool isLongPress(uint8_t switchMask, uint16_t customLongPressMs);
+  unsigned long getPressStartTime(uint8_t switchIndex) const;
+
+  // Switches pressed within the simultaneous window and not yet acted on, bit per switch
+  uint8_t getRecentPresses() const;
+  // Switches held down, bit per switch
+  uint8_t getPressedSwitches() const { return ~debouncer.levels() & ALL_SWITCHES; }
+
+  // Switches that were pressed / released on the last readAndDebounce(), bit per switch
+  uint8_t getPressEdges() const { return debouncer.fallingEdges(); }
+  uint8_t getReleaseEdges() const { return debouncer.risingEdges(); }
+
+  /**
+   * Called from the pin-change ISRs. Queues an edge for every switch whose
+   * level differs from the last one captured.
+   */
+  static void onPinChange();
 
 private:
   const uint8_t* switchPins;
-  uint8_t debounceMs;
   uint16_t simultaneousWindowMs;
   uint16_t longPressMs;
-  SwitchState switches[4];
+
+  // Per-switch state is packed one bit per switch
+  VerticalDebouncer<uint8_t> debouncer;  // Debounced levels, HIGH = released
+  uint8_t rawLevels;            // Level after the most recent captured edge
+  uint8_t longPressTriggered;
+  uint8_t pressHandled;         // Press already acted on; pressStartTime is kept for hold timing
+  unsigned long pressStartTime[NUM_SWITCHES];
+  uint16_t closeTimeMs[NUM_SWITCHES];  // Low 16 bits of millis() at the last closing edge
+
+  // Direct port reads keep the ISR short
+  volatile uint8_t* inputRegisters[NUM_SWITCHES];
+  uint8_t bitMasks[NUM_SWITCHES];
+  uint8_t capturedLevels;       // Bit per switch, owned by the ISR
+  RingBuffer<SwitchEdge, SWITCH_EDGE_QUEUE_SIZE> edges;
+  volatile bool edgesOverflowed;
+
+  static SwitchHandler* activeHandler;
+
+  uint8_t readLevels() const;
+  void captureEdges();
 };
 
 #endif
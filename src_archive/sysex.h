@@ -0,0 +1,60 @@
+#ifndef SYSEX_H
+#define SYSEX_H
+
+#include <Arduino.h>
+
+/*
+ * SysEx data bytes carry 7 bits. Wider values go out as a fixed number of
+ * bytes of 7 bits each, low bits first. Runs of 8-bit bytes go out in
+ * groups of up to 7, each led by a byte holding their top bits (bit 0 for
+ * the first of the group).
+ */
+
+// Write value as count bytes; returns the byte after them
+inline uint8_t* putSeptets(uint8_t* out, uint32_t value, uint8_t count) {
+  for (uint8_t i = 0; i < count; i++) {
+    *out++ = value & 0x7F;
+    value >>= 7;
+  }
+  return out;
+}
+
+// Read a value of count bytes, moving in past them
+inline uint32_t getSeptets(const uint8_t*& in, uint8_t count) {
+  uint32_t value = 0;
+  for (uint8_t i = 0; i < count; i++) {
+    value |= (uint32_t)(*in++ & 0x7F) << (7 * i);
+  }
+  return value;
+}
+
+// Bytes count 8-bit bytes take packed
+constexpr uint8_t packedSize(uint8_t count) {
+  return count + (count + 6) / 7;
+}
+
+// Write count 8-bit bytes packed; returns the byte after them
+inline uint8_t* packBytes(uint8_t* out, const uint8_t* in, uint8_t count) {
+  for (uint8_t group = 0; group < count; group += 7) {
+    uint8_t* high = out++;
+    *high = 0;
+    for (uint8_t i = 0; i < 7 && group + i < count; i++) {
+      const uint8_t data = in[group + i];
+      if (data & 0x80) *high |= 1 << i;
+      *out++ = data & 0x7F;
+    }
+  }
+  return out;
+}
+
+// Read count 8-bit bytes packed, moving in past them
+inline void unpackBytes(const uint8_t*& in, uint8_t* out, uint8_t count) {
+  for (uint8_t group = 0; group < count; group += 7) {
+    const uint8_t high = *in++;
+    for (uint8_t i = 0; i < 7 && group + i < count; i++) {
+      *out++ = (*in++ & 0x7F) | ((high >> i & 1) << 7);
+    }
+  }
+}
+
+#endif